@@ -43,6 +43,10 @@
 	gameProtocolPort = 7172
 	adminProtocolPort = 7171
 	statusProtocolPort = 7171
+	networkThreads = 1 -- 0 runs one network thread per core
+	loginThreads = 2 -- decrypt and check logins, 0 runs one per core
+	maxFreeOutputMessages = 512
+	networkStatsDumpEachMinutes = 0 -- appends per opcode traffic to data/logs/networkstats.log
 	loginTries = 10
 	retryTimeout = 5 * 1000
 	loginTimeout = 60 * 1000
@@ -90,6 +94,7 @@
 	mapAuthor = "Komic"
 	randomizeTiles = "no"
 	mapStorageType = "relational"
+	pathfindingMaxNodes = 2048
 
 	-- Market
 	marketEnabled = "yes"
@@ -136,6 +141,13 @@
 	-- Server saving
 	autoSaveEachMinutes = 15
 	saveGlobalStorage = "no"
+	-- saveJournal appends storage, experience, bank balance, item and house
+	-- changes to saveJournalFile, which is replayed at startup after a crash.
+	-- What changed is journaled every saveJournalInterval seconds, each
+	-- player's changes together with its item lists.
+	saveJournal = "yes"
+	saveJournalFile = "data/save.journal"
+	saveJournalInterval = 10
 
 	-- Spawns
 	deSpawnRange = 2
@@ -147,6 +159,11 @@
 	-- SQL
 	sqlType = "sqlite"
 	passwordType = "plain"
+	-- MySQL only: connections for saves and what players wait for, and for
+	-- highscores, market statistics, cleanup and script queries. Login threads
+	-- get one connection each as well. SQLite shares one connection.
+	databasePriorityConnections = 1
+	databaseBackgroundConnections = 1
 
 	-- Startup
 	defaultPriority = "high"
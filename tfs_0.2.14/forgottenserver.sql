@@ -240,6 +240,7 @@ CREATE TABLE `player_storage`
 	`player_id` INT NOT NULL DEFAULT 0,
 	`key` INT UNSIGNED NOT NULL DEFAULT 0,
 	`value` INT NOT NULL DEFAULT 0,
+	PRIMARY KEY (`player_id`, `key`),
 	FOREIGN KEY (`player_id`) REFERENCES `players`(`id`) ON DELETE CASCADE
 ) ENGINE = InnoDB;
 
@@ -321,7 +322,7 @@ CREATE TABLE `server_config`
 	UNIQUE KEY `config` (`config`)
 ) ENGINE=InnoDB;
 
-INSERT INTO `server_config` VALUES ('db_version','7'),('encryption','0');
+INSERT INTO `server_config` VALUES ('db_version','8'),('encryption','0');
 
 CREATE TABLE `market_history`
 (
@@ -32,6 +32,7 @@
 #include "rsa.h"
 
 #include "logger.h"
+#include "networkprofiler.h"
 
 static void addLogLine(ProtocolAdmin* conn, eLogType type, int level, std::string message);
 
@@ -398,6 +399,12 @@ void ProtocolAdmin::parsePacket(NetworkMessage& msg)
 						break;
 					}
 
+					case CMD_NETWORK_STATS:
+					{
+						g_dispatcher.addTask(createTask(boost::bind(&ProtocolAdmin::adminCommandNetworkStats, this)));
+						break;
+					}
+
 					default:
 					{
 						output->AddByte(AP_MSG_COMMAND_FAILED);
@@ -562,6 +569,18 @@ void ProtocolAdmin::adminCommandSetOwner(const std::string& param)
 	}
 }
 
+void ProtocolAdmin::adminCommandNetworkStats()
+{
+	OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, false);
+	if(output)
+	{
+		TRACK_MESSAGE(output);
+		output->AddByte(AP_MSG_COMMAND_OK);
+		output->AddString(NetworkProfiler::getInstance()->getReport());
+		OutputMessagePool::getInstance()->send(output);
+	}
+}
+
 /////////////////////////////////////////////
 
 AdminProtocolConfig::AdminProtocolConfig()
@@ -120,7 +120,8 @@ enum
 	//CMD_BAN_MANAGER = 10,
 	//CMD_SERVER_INFO = 11,
 	//CMD_GETHOUSE = 12,
-	CMD_SETOWNER = 13
+	CMD_SETOWNER = 13,
+	CMD_NETWORK_STATS = 14
 };
 
 
@@ -205,6 +206,7 @@ class ProtocolAdmin : public Protocol
 		void adminCommandShutdownServer();
 		void adminCommandKickPlayer(const std::string& name);
 		void adminCommandSetOwner(const std::string& param);
+		void adminCommandNetworkStats();
 
 		enum ConnectionState_t
 		{
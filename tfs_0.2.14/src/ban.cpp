@@ -148,21 +148,25 @@ bool IOBan::isIpBanished(uint32_t clientip)
 
 	Database* db = Database::getInstance();
 
-	DBQuery query;
-	query << "SELECT `ip`, `mask`, `time` FROM `bans` WHERE `type` = " << BAN_IPADDRESS << ";";
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBStatement* stmt = db->prepareStatement("SELECT `ip`, `mask`, `time` FROM `bans` WHERE `type` = ?;");
+	if(!stmt)
+		return false;
+
+	stmt->bindInt(1, BAN_IPADDRESS);
 
 	DBResult* result;
-	if(!(result = db->storeQuery(query.str())))
+	if(!(result = stmt->storeQuery()))
 		return false;
 
 	uint32_t currentTime = time(NULL);
 	do
 	{
-		uint32_t ip = result->getDataInt("ip");
-		uint32_t mask = result->getDataInt("mask");
+		uint32_t ip = result->getDataInt(0);
+		uint32_t mask = result->getDataInt(1);
 		if((ip & mask) == (clientip & mask))
 		{
-			uint32_t time = result->getDataInt("time");
+			uint32_t time = result->getDataInt(2);
 			if(time == 0 || currentTime < time)
 			{
 				db->freeResult(result);
@@ -184,14 +188,19 @@ bool IOBan::isPlayerNamelocked(const std::string& name)
 
 	Database* db = Database::getInstance();
 
-	DBQuery query;
-	query << "SELECT COUNT(*) AS `count` FROM `bans` WHERE `type` = " << NAMELOCK_PLAYER << " AND `player` = " << playerId << " LIMIT 1;";
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBStatement* stmt = db->prepareStatement("SELECT COUNT(*) AS `count` FROM `bans` WHERE `type` = ? AND `player` = ? LIMIT 1;");
+	if(!stmt)
+		return false;
+
+	stmt->bindInt(1, NAMELOCK_PLAYER);
+	stmt->bindInt(2, playerId);
 
 	DBResult* result;
-	if(!(result = db->storeQuery(query.str())))
+	if(!(result = stmt->storeQuery()))
 		return false;
 
-	int32_t numRows = result->getDataInt("count");
+	int32_t numRows = result->getDataInt(0);
 	db->freeResult(result);
 	return numRows > 0;
 }
@@ -200,13 +209,20 @@ bool IOBan::isAccountBanned(uint32_t account)
 {
 	Database* db = Database::getInstance();
 
-	DBQuery query;
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBStatement* stmt = db->prepareStatement("SELECT COUNT(*) as `count` FROM `bans` WHERE `type` = ? AND `account` = ? AND `time` > ? LIMIT 1;");
+	if(!stmt)
+		return false;
+
+	stmt->bindInt(1, BAN_ACCOUNT);
+	stmt->bindInt(2, account);
+	stmt->bindInt(3, time(NULL));
+
 	DBResult* result;
-	query << "SELECT COUNT(*) as `count` FROM `bans` WHERE `type` = " << BAN_ACCOUNT << " AND `account` = " << account << " AND `time` > " << time(NULL) << " LIMIT 1;";
-	if(!(result = db->storeQuery(query.str())))
+	if(!(result = stmt->storeQuery()))
 		return false;
 
-	int32_t numRows = result->getDataInt("count");
+	int32_t numRows = result->getDataInt(0);
 	db->freeResult(result);
 	return numRows > 0;
 }
@@ -215,138 +231,170 @@ bool IOBan::getBanInformation(uint32_t account, uint32_t& bannedBy, uint32_t& ba
 {
 	Database* db = Database::getInstance();
 
-	DBQuery query;
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBStatement* stmt = db->prepareStatement("SELECT `banned_by`, `time`, `reason_id`, `action_id`, `comment` FROM `bans` WHERE `type` = ? AND `account` = ? AND `time` > ? LIMIT 1;");
+	if(!stmt)
+		return false;
+
+	stmt->bindInt(1, BAN_ACCOUNT);
+	stmt->bindInt(2, account);
+	stmt->bindInt(3, time(NULL));
+
 	DBResult* result;
-	query << "SELECT `banned_by`, `time`, `reason_id`, `action_id`, `comment` FROM `bans` WHERE `type` = " << BAN_ACCOUNT << " AND `account` = " << account << " AND `time` > " << time(NULL) << " LIMIT 1;";
-	if((result = db->storeQuery(query.str())))
+	if(!(result = stmt->storeQuery()))
 	{
-		bannedBy = result->getDataInt("banned_by");
-		banTime = result->getDataInt("time");
-		reason = result->getDataInt("reason_id");
-		action = result->getDataInt("action_id");
-		comment = result->getDataString("comment");
-		db->freeResult(result);
-		deletion = false;
-		return true;
-	}
+		// a deletion does not expire, -1 matches any time
+		stmt->bindInt(1, DELETE_ACCOUNT);
+		stmt->bindInt(3, -1);
+		if(!(result = stmt->storeQuery()))
+			return false;
 
-	query.str("");
-	query << "SELECT `banned_by`, `time`, `reason_id`, `action_id`, `comment` FROM `bans` WHERE `type` = " << DELETE_ACCOUNT << " AND `account` = " << account << " LIMIT 1;";
-	if((result = db->storeQuery(query.str())))
-	{
-		bannedBy = result->getDataInt("banned_by");
-		banTime = result->getDataInt("time");
-		reason = result->getDataInt("reason_id");
-		action = result->getDataInt("action_id");
-		comment = result->getDataString("comment");
-		db->freeResult(result);
 		deletion = true;
-		return true;
 	}
-	return false;
+	else
+		deletion = false;
+
+	bannedBy = result->getDataInt(0);
+	banTime = result->getDataInt(1);
+	reason = result->getDataInt(2);
+	action = result->getDataInt(3);
+	comment = result->getDataString(4);
+	db->freeResult(result);
+	return true;
 }
 
 int32_t IOBan::getNotationsCount(uint32_t account)
 {
 	Database* db = Database::getInstance();
 
-	DBQuery query;
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBStatement* stmt = db->prepareStatement("SELECT COUNT(*) AS `count` FROM `bans` WHERE `type` = ? AND `account` = ?;");
+	if(!stmt)
+		return 0;
+
+	stmt->bindInt(1, NOTATION_ACCOUNT);
+	stmt->bindInt(2, account);
+
 	DBResult* result;
-	query << "SELECT COUNT(*) AS `count` FROM `bans` WHERE `type` = " << NOTATION_ACCOUNT << " AND `account` = " << account << ";";
-	if(!(result = db->storeQuery(query.str())))
+	if(!(result = stmt->storeQuery()))
 		return 0;
 
-	int32_t numRows = result->getDataInt("count");
+	int32_t numRows = result->getDataInt(0);
 	db->freeResult(result);
 	return numRows > 0;
 }
 
 void IOBan::addIpBan(uint32_t ip, uint32_t mask, uint64_t time)
 {
-	DBQuery query;
-	query << "INSERT INTO `bans` (`type`, `ip`, `mask`, `time`) VALUES (" << BAN_IPADDRESS << ", " << ip << ", " << mask << ", " << time << ");";
-	Database::getInstance()->executeQuery(query.str());
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBStatement* stmt = Database::getInstance()->prepareStatement("INSERT INTO `bans` (`type`, `ip`, `mask`, `time`) VALUES (?, ?, ?, ?);");
+	if(!stmt)
+		return;
+
+	stmt->bindInt(1, BAN_IPADDRESS);
+	stmt->bindInt(2, ip);
+	stmt->bindInt(3, mask);
+	stmt->bindInt(4, time);
+	stmt->execute();
 }
 
-void IOBan::addPlayerNamelock(uint32_t playerId, uint32_t time, uint32_t reasonId, uint32_t actionId, std::string comment, uint32_t bannedBy)
+bool IOBan::addBan(BanType_t type, uint32_t id, uint64_t time, int32_t reasonId, int32_t actionId, const std::string& comment, uint32_t bannedBy)
 {
 	Database* db = Database::getInstance();
 
-	DBQuery query;
-	query << "INSERT INTO `bans` (`type`, `player`, `time`, `reason_id`, `action_id`, `comment`, `banned_by`)"
-		" VALUES (" << NAMELOCK_PLAYER << ", " << playerId << ", " << time << ", " << reasonId << ", " << actionId << ", " << db->escapeString(comment) << ", " << bannedBy << ");";
-	db->executeQuery(query.str());
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBStatement* stmt;
+	if(type == NAMELOCK_PLAYER)
+		stmt = db->prepareStatement("INSERT INTO `bans` (`type`, `player`, `time`, `reason_id`, `action_id`, `comment`, `banned_by`) VALUES (?, ?, ?, ?, ?, ?, ?);");
+	else
+		stmt = db->prepareStatement("INSERT INTO `bans` (`type`, `account`, `time`, `reason_id`, `action_id`, `comment`, `banned_by`) VALUES (?, ?, ?, ?, ?, ?, ?);");
+
+	if(!stmt)
+		return false;
+
+	stmt->bindInt(1, type);
+	stmt->bindInt(2, id);
+	stmt->bindInt(3, time);
+	stmt->bindInt(4, reasonId);
+	stmt->bindInt(5, actionId);
+	stmt->bindString(6, comment);
+	stmt->bindInt(7, bannedBy);
+	return stmt->execute();
 }
 
-void IOBan::addAccountNotation(uint32_t account, uint64_t time, uint32_t reasonId, uint32_t actionId, std::string comment, uint32_t bannedBy)
+void IOBan::addPlayerNamelock(uint32_t playerId, uint32_t time, uint32_t reasonId, uint32_t actionId, std::string comment, uint32_t bannedBy)
 {
-	Database* db = Database::getInstance();
+	addBan(NAMELOCK_PLAYER, playerId, time, reasonId, actionId, comment, bannedBy);
+}
 
-	DBQuery query;
-	query << "INSERT INTO `bans` (`type`, `account`, `time`, `reason_id`, `action_id`, `comment`, `banned_by`)"
-		" VALUES (" << NOTATION_ACCOUNT << ", " << account << ", " << time << ", " << reasonId << ", " << actionId << ", " << db->escapeString(comment) << ", " << bannedBy << ");";
-	db->executeQuery(query.str());
+void IOBan::addAccountNotation(uint32_t account, uint64_t time, uint32_t reasonId, uint32_t actionId, std::string comment, uint32_t bannedBy)
+{
+	addBan(NOTATION_ACCOUNT, account, time, reasonId, actionId, comment, bannedBy);
 }
 
 void IOBan::addAccountDeletion(uint32_t account, uint64_t time, int32_t reasonId, int32_t actionId, std::string comment, uint32_t bannedBy)
 {
-	Database* db = Database::getInstance();
-
-	DBQuery query;
-	query << "INSERT INTO `bans` (`type`, `account`, `time`, `reason_id`, `action_id`, `comment`, `banned_by`)"
-		" VALUES (" << DELETE_ACCOUNT << ", " << account << ", " << time << ", " << reasonId << ", " << actionId << ", " << db->escapeString(comment) << ", " << bannedBy << ");";
-	db->executeQuery(query.str());
+	addBan(DELETE_ACCOUNT, account, time, reasonId, actionId, comment, bannedBy);
 }
 
 void IOBan::addAccountBan(uint32_t account, uint64_t time, int32_t reasonId, int32_t actionId, std::string comment, uint32_t bannedBy)
+{
+	addBan(BAN_ACCOUNT, account, time, reasonId, actionId, comment, bannedBy);
+}
+
+bool IOBan::removeBans(BanType_t type, uint32_t id)
 {
 	Database* db = Database::getInstance();
 
-	DBQuery query;
-	query << "INSERT INTO `bans` (`type`, `account`, `time`, `reason_id`, `action_id`, `comment`, `banned_by`)"
-		" VALUES (" << BAN_ACCOUNT << ", " << account << ", " << time << ", " << reasonId << ", " << actionId << ", " << db->escapeString(comment) << ", " << bannedBy << ");";
-	db->executeQuery(query.str());
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBStatement* stmt;
+	if(type == NAMELOCK_PLAYER)
+		stmt = db->prepareStatement("DELETE FROM `bans` WHERE `type` = ? AND `player` = ?" + db->getUpdateLimiter());
+	else if(type == BAN_IPADDRESS)
+		stmt = db->prepareStatement("DELETE FROM `bans` WHERE `type` = ? AND `ip` = ?;");
+	else
+		stmt = db->prepareStatement("DELETE FROM `bans` WHERE `type` = ? AND `account` = ?" + db->getUpdateLimiter());
+
+	if(!stmt)
+		return false;
+
+	stmt->bindInt(1, type);
+	stmt->bindInt(2, id);
+	return stmt->execute();
 }
 
 bool IOBan::removePlayerNamelock(uint32_t guid)
 {
-	Database* db = Database::getInstance();
-
-	DBQuery query;
-	query << "DELETE FROM `bans` WHERE `type` = " << NAMELOCK_PLAYER << " AND `player` = " << guid << db->getUpdateLimiter();
-	return db->executeQuery(query.str());
+	return removeBans(NAMELOCK_PLAYER, guid);
 }
 
 bool IOBan::removeAccountNotations(uint32_t account)
 {
-	Database* db = Database::getInstance();
-
-	DBQuery query;
-	query << "DELETE FROM `bans` WHERE `type` = " << NOTATION_ACCOUNT << " AND `account` = " << account << db->getUpdateLimiter();
-	return db->executeQuery(query.str());
+	return removeBans(NOTATION_ACCOUNT, account);
 }
 
 bool IOBan::removeIPBan(uint32_t ip)
 {
-	DBQuery query;
-	query << "DELETE FROM `bans` WHERE `type` = " << BAN_IPADDRESS << " AND `ip` = " << ip << ";";
-	return Database::getInstance()->executeQuery(query.str());
+	return removeBans(BAN_IPADDRESS, ip);
 }
 
 bool IOBan::removeAccountBan(uint32_t account)
 {
 	Database* db = Database::getInstance();
 
-	DBQuery query;
-	query << "UPDATE `bans` SET `time` = " << time(NULL) << " WHERE `type` = " << BAN_ACCOUNT << " AND `account` = " << account << " AND `time` > " << time(NULL) << db->getUpdateLimiter();
-	return db->executeQuery(query.str());
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBStatement* stmt = db->prepareStatement("UPDATE `bans` SET `time` = ? WHERE `type` = ? AND `account` = ? AND `time` > ?" + db->getUpdateLimiter());
+	if(!stmt)
+		return false;
+
+	stmt->bindInt(1, time(NULL));
+	stmt->bindInt(2, BAN_ACCOUNT);
+	stmt->bindInt(3, account);
+	stmt->bindInt(4, time(NULL));
+	return stmt->execute();
 }
 
 bool IOBan::removeAccountDeletion(uint32_t account)
 {
-	Database* db = Database::getInstance();
-
-	DBQuery query;
-	query << "DELETE FROM `bans` WHERE `type` = " << DELETE_ACCOUNT << " AND `account` = " << account << db->getUpdateLimiter();
-	return db->executeQuery(query.str());
+	return removeBans(DELETE_ACCOUNT, account);
 }
@@ -169,6 +169,9 @@ class IOBan
 	protected:
 		IOBan() {}
 		virtual ~IOBan() {}
+
+		bool addBan(BanType_t type, uint32_t id, uint64_t time, int32_t reasonId, int32_t actionId, const std::string& comment, uint32_t bannedBy);
+		bool removeBans(BanType_t type, uint32_t id);
 };
 
 #endif
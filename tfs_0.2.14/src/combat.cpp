@@ -141,10 +141,8 @@ void Combat::getCombatArea(const Position& centerPos, const Position& targetPos,
 	{
 		Tile* tile = g_game.getTile(targetPos.x, targetPos.y, targetPos.z);
 		if(!tile)
-		{
-			tile = new StaticTile(targetPos.x, targetPos.y, targetPos.z);
-			g_game.setTile(tile);
-		}
+			tile = g_game.getMap()->getTransientTile(targetPos.x, targetPos.y, targetPos.z);
+
 		list.push_back(tile);
 	}
 }
@@ -820,6 +818,13 @@ void Combat::CombatFunc(Creature* caster, const Position& pos,
 		}
 	}
 	postCombatEffects(caster, pos, params);
+
+	//squares without a map tile only got a transient one for the effects
+	for(std::list<Tile*>::iterator it = tileList.begin(); it != tileList.end(); ++it)
+	{
+		if(!(*it)->qt_node)
+			g_game.getMap()->releaseTransientTile(*it);
+	}
 }
 
 void Combat::doCombat(Creature* caster, Creature* target) const
@@ -1146,12 +1151,18 @@ AreaCombat::AreaCombat(const AreaCombat& rhs)
 
 bool AreaCombat::getList(const Position& centerPos, const Position& targetPos, std::list<Tile*>& list) const
 {
-	Tile* tile = g_game.getTile(targetPos.x, targetPos.y, targetPos.z);
-
 	const MatrixArea* area = getArea(centerPos, targetPos);
 	if(!area)
 		return false;
 
+	if(area->isCompiled())
+	{
+		area->getList(targetPos, list);
+		return true;
+	}
+
+	Tile* tile = NULL;
+
 	int32_t tmpPosX = targetPos.x;
 	int32_t tmpPosY = targetPos.y;
 	int32_t tmpPosZ = targetPos.z;
@@ -1179,10 +1190,8 @@ bool AreaCombat::getList(const Position& centerPos, const Position& targetPos, s
 					{
 						tile = g_game.getTile(tmpPosX, tmpPosY, tmpPosZ);
 						if(!tile)
-						{
-							tile = new StaticTile(tmpPosX, tmpPosY, tmpPosZ);
-							g_game.setTile(tile);
-						}
+							tile = g_game.getMap()->getTransientTile(tmpPosX, tmpPosY, tmpPosZ);
+
 						list.push_back(tile);
 					}
 				}
@@ -1343,6 +1352,11 @@ void AreaCombat::setupArea(const std::list<uint32_t>& list, uint32_t rows)
 	MatrixArea* westArea = new MatrixArea(maxOutput, maxOutput);
 	copyArea(area, westArea, MATRIXOPERATION_ROTATE270);
 	areas[WEST] = westArea;
+
+	area->compile();
+	southArea->compile();
+	eastArea->compile();
+	westArea->compile();
 }
 
 void AreaCombat::setupArea(int32_t length, int32_t spread)
@@ -1439,6 +1453,149 @@ void AreaCombat::setupExtArea(const std::list<uint32_t>& list, uint32_t rows)
 	MatrixArea* seArea = new MatrixArea(maxOutput, maxOutput);
 	copyArea(swArea, seArea, MATRIXOPERATION_MIRROR);
 	areas[SOUTHEAST] = seArea;
+
+	area->compile();
+	neArea->compile();
+	swArea->compile();
+	seArea->compile();
+}
+
+void MatrixArea::compile()
+{
+	cells.clear();
+	raySegments.clear();
+	lookupMasks.clear();
+
+	//the masks hold a row in a single word, wider areas keep the plain lookups
+	if(cols > 64 || rows == 0)
+		return;
+
+	lookupMasks.resize(rows, 0);
+	for(uint32_t row = 0; row < rows; ++row)
+	{
+		for(uint32_t col = 0; col < cols; ++col)
+		{
+			if(!data_[row][col])
+				continue;
+
+			AreaCell cell;
+			cell.row = row;
+			cell.col = col;
+
+			//Map::isSightClear casts a ray both ways, either one clear is enough
+			addSightRay(centerX, centerY, col, row, cell.forward);
+			addSightRay(col, row, centerX, centerY, cell.backward);
+
+			lookupMasks[row] |= (uint64_t)1 << col;
+			cells.push_back(cell);
+		}
+	}
+}
+
+void MatrixArea::addSightRay(int32_t fromX, int32_t fromY, int32_t toX, int32_t toY, SightRay& ray)
+{
+	ray.first = raySegments.size();
+	ray.count = 0;
+
+	//the same walk Map::checkSightLine does on a single floor, the walk
+	//only depends on the offset between both ends so it can be done here
+	int32_t startX = fromX, startY = fromY, endX = toX, endY = toY;
+	int32_t dx = std::abs(startX - endX), dy = std::abs(startY - endY);
+
+	bool swapped = false;
+	if(dy > dx)
+	{
+		std::swap(startX, startY);
+		std::swap(endX, endY);
+		std::swap(dx, dy);
+		swapped = true;
+	}
+
+	int32_t sx = ((startX < endX) ? 1 : -1);
+	int32_t sy = ((startY < endY) ? 1 : -1);
+
+	int32_t ey = 0;
+	int32_t y = startY;
+	for(int32_t x = startX; x != endX + sx; x += sx)
+	{
+		int32_t rx = (swapped ? y : x), ry = (swapped ? x : y);
+		if(!(rx == toX && ry == toY) && !(rx == fromX && ry == fromY))
+		{
+			if(ray.count == 0 || raySegments.back().row != (uint32_t)ry)
+			{
+				RaySegment segment;
+				segment.row = ry;
+				segment.mask = 0;
+				raySegments.push_back(segment);
+				++ray.count;
+			}
+
+			raySegments.back().mask |= (uint64_t)1 << rx;
+			lookupMasks[ry] |= (uint64_t)1 << rx;
+		}
+
+		ey += dy;
+		if(2 * ey >= dx)
+		{
+			y += sy;
+			ey -= dx;
+		}
+	}
+}
+
+bool MatrixArea::isRayClear(const SightRay& ray, const uint64_t* blocked) const
+{
+	for(uint32_t i = ray.first, end = ray.first + ray.count; i < end; ++i)
+	{
+		if(blocked[raySegments[i].row] & raySegments[i].mask)
+			return false;
+	}
+	return true;
+}
+
+void MatrixArea::getList(const Position& targetPos, std::list<Tile*>& list) const
+{
+	//the buffers are the caller's own, nothing is kept between two calls
+	std::vector<uint64_t> blocked(rows, 0);
+	std::vector<Tile*> tiles(rows * cols, NULL);
+
+	int32_t originX = targetPos.x - centerX;
+	int32_t originY = targetPos.y - centerY;
+
+	//every square is looked up once, no matter how many sight lines pass it
+	for(uint32_t row = 0; row < rows; ++row)
+	{
+		uint64_t mask = lookupMasks[row];
+		while(mask)
+		{
+			uint32_t col = 0;
+			while(!(mask & ((uint64_t)1 << col)))
+				++col;
+
+			mask &= ~((uint64_t)1 << col);
+
+			Tile* tile = g_game.getTile(originX + col, originY + row, targetPos.z);
+			tiles[row * cols + col] = tile;
+			if(tile && tile->hasProperty(BLOCKPROJECTILE))
+				blocked[row] |= (uint64_t)1 << col;
+		}
+	}
+
+	for(std::vector<AreaCell>::const_iterator it = cells.begin(); it != cells.end(); ++it)
+	{
+		int32_t x = originX + it->col, y = originY + it->row;
+		if(x < 0 || x >= 0xFFFF || y < 0 || y >= 0xFFFF || targetPos.z >= MAP_MAX_LAYERS)
+			continue;
+
+		if(!isRayClear(it->forward, &blocked[0]) && !isRayClear(it->backward, &blocked[0]))
+			continue;
+
+		Tile* tile = tiles[it->row * cols + it->col];
+		if(!tile)
+			tile = g_game.getMap()->getTransientTile(x, y, targetPos.z);
+
+		list.push_back(tile);
+	}
 }
 
 //**********************************************************//
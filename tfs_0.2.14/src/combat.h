@@ -146,6 +146,10 @@ class MatrixArea
 				for(uint32_t col = 0; col < cols; ++col)
 					data_[row][col] = rhs.data_[row][col];
 			}
+
+			cells = rhs.cells;
+			raySegments = rhs.raySegments;
+			lookupMasks = rhs.lookupMasks;
 		}
 
 		~MatrixArea()
@@ -167,7 +171,41 @@ class MatrixArea
 		inline const bool* operator[](uint32_t i) const { return data_[i]; }
 		inline bool* operator[](uint32_t i) { return data_[i]; }
 
+		// Precomputes the cells and the sight lines from the center to each of
+		// them as per row bitmasks, must be called once the matrix is filled
+		void compile();
+		bool isCompiled() const {return !lookupMasks.empty();}
+
+		void getList(const Position& targetPos, std::list<Tile*>& list) const;
+
 	protected:
+		struct SightRay
+		{
+			uint32_t first;
+			uint32_t count;
+		};
+
+		struct AreaCell
+		{
+			uint32_t row, col;
+			SightRay forward, backward;
+		};
+
+		// the rows a sight line passes through, with the cells it checks in each
+		struct RaySegment
+		{
+			uint32_t row;
+			uint64_t mask;
+		};
+
+		void addSightRay(int32_t fromX, int32_t fromY, int32_t toX, int32_t toY, SightRay& ray);
+		bool isRayClear(const SightRay& ray, const uint64_t* blocked) const;
+
+		std::vector<AreaCell> cells;
+		std::vector<RaySegment> raySegments;
+		// every cell that is either part of the area or on one of its sight lines
+		std::vector<uint64_t> lookupMasks;
+
 		uint32_t centerX;
 		uint32_t centerY;
 
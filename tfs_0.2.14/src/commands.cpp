@@ -53,6 +53,11 @@
 #include "admin.h"
 #include "status.h"
 #include "protocollogin.h"
+#include "workerpool.h"
+#include "databaseexecutor.h"
+#include "savejournal.h"
+
+extern WorkerPool g_loginPool;
 #endif
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
@@ -1407,6 +1412,26 @@ void Commands::serverDiag(Player* player, const std::string& cmd, const std::str
 	text << "Npc: " << g_game.getNpcsOnline() << " (" << Npc::npcCount << ")\n";
 	text << "Monster: " << g_game.getMonstersOnline() << " (" << Monster::monsterCount << ")\n";
 
+	const Map* map = g_game.getMap();
+	text << "Map sectors: " << map->getSectorCount() << " in " << map->getSectorBlockCount() << " blocks\n";
+	text << "Empty tiles: " << map->countEmptyTiles() << " (reclaimed " << map->getReclaimedTileCount() << ")\n";
+	text << "Transient tiles: " << map->getTransientTileCount() << "\n";
+	text << "\nSpectator cache:\n";
+	text << "--------------------\n";
+	text << "Cached queries: " << map->getSpectatorCacheSize() << "\n";
+	text << "Hits: " << map->getSpectatorCacheHits() << ", misses: " << map->getSpectatorCacheMisses() << "\n";
+	text << "Invalidated queries: " << map->getSpectatorCacheInvalidations() << "\n";
+
+	text << "\nFlow fields:\n";
+	text << "--------------------\n";
+	text << "Cached fields: " << map->getFlowFieldCount() << "\n";
+	text << "Shared searches: " << map->getFlowFieldHits() << ", rebuilt: " << map->getFlowFieldMisses() << "\n";
+
+	text << "\nTile descriptions:\n";
+	text << "--------------------\n";
+	text << "Cached tiles: " << ProtocolGame::getTileDescriptionCount() << "\n";
+	text << "Hits: " << ProtocolGame::tileDescriptionHits << ", misses: " << ProtocolGame::tileDescriptionMisses << "\n";
+
 	text << "\nProtocols:" << "\n";
 	text << "--------------------\n";
 	text << "ProtocolGame: " << ProtocolGame::protocolGameCount << "\n";
@@ -1417,9 +1442,27 @@ void Commands::serverDiag(Player* player, const std::string& cmd, const std::str
 	text << "\nConnections:\n";
 	text << "--------------------\n";
 	text << "Active connections: " << Connection::connectionCount << "\n";
-	text << "Total message pool: " << OutputMessagePool::getInstance()->getTotalMessageCount() << "\n";
-	text << "Auto message pool: " << OutputMessagePool::getInstance()->getAutoMessageCount() << "\n";
-	text << "Free message pool: " << OutputMessagePool::getInstance()->getAvailableMessageCount() << "\n";
+	text << "Writes: " << Connection::writeCount << " carrying " << Connection::writtenMessageCount << " messages\n";
+	text << "Reads: " << Connection::readCount << " carrying " << Connection::readMessageCount << " messages\n";
+	OutputMessagePool* outputPool = OutputMessagePool::getInstance();
+	text << "Total message pool: " << outputPool->getTotalMessageCount() << "\n";
+	text << "Auto message pool: " << outputPool->getAutoMessageCount() << "\n";
+	text << "Free message pool: " << outputPool->getAvailableMessageCount() << "\n";
+	text << "In flight messages: " << outputPool->getInFlightCount() << " (peak " << outputPool->getPeakInFlightCount() << ")\n";
+	text << "Message requests: " << outputPool->getRequestCount() << ", reused " << outputPool->getReuseCount() << "\n";
+
+	text << "\nDispatcher:\n";
+	text << "--------------------\n";
+	text << "Queued tasks: " << g_dispatcher.getPendingTaskCount() << " (peak " << g_dispatcher.getPeakTaskCount() << ")\n";
+	text << "Executed tasks: " << g_dispatcher.getExecutedTaskCount() << "\n";
+	text << "Expired tasks: " << g_dispatcher.getExpiredTaskCount() << "\n";
+	text << "Overflowed tasks: " << g_dispatcher.getOverflowTaskCount() << "\n";
+	text << "Task latency: " << g_dispatcher.getAverageLatency() << " us (max " << g_dispatcher.getMaxLatency() << " us)\n";
+	text << "Queued logins: " << g_loginPool.getPendingJobCount() << " (" << g_loginPool.getThreadCount() << " login threads)\n";
+	text << "Queued database tasks: " << DatabaseExecutor::getInstance()->getPendingTaskCount(DBLANE_PRIORITY) << " priority, "
+		<< DatabaseExecutor::getInstance()->getPendingTaskCount(DBLANE_BACKGROUND) << " background ("
+		<< Database::getThreadConnectionCount() << " thread connections)\n";
+	text << "Queued journal records: " << SaveJournal::getInstance()->getPendingRecordCount() << "\n";
 
 	text << "\nLibraries:\n";
 	text << "--------------------\n";
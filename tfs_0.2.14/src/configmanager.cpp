@@ -57,6 +57,7 @@ bool ConfigManager::loadFile(const std::string& _filename)
 		m_confBoolean[INGAME_GUILD_SYSTEM] = booleanString(getGlobalString(L, "ingameGuildSystem", "yes"));
 		m_confBoolean[BIND_ONLY_GLOBAL_ADDRESS] = booleanString(getGlobalString(L, "bindOnlyGlobalAddress", "no"));
 		m_confBoolean[OPTIMIZE_DATABASE] = booleanString(getGlobalString(L, "startupDatabaseOptimization", "yes"));
+		m_confBoolean[SAVE_JOURNAL] = booleanString(getGlobalString(L, "saveJournal", "yes"));
 
 		m_confString[CONFIG_FILE] = _filename;
 		m_confString[IP] = getGlobalString(L, "ip", "127.0.0.1");
@@ -69,6 +70,7 @@ bool ConfigManager::loadFile(const std::string& _filename)
 		m_confString[MYSQL_DB] = getGlobalString(L, "mysqlDatabase", "theforgottenserver");
 		m_confString[SQLITE_DB] = getGlobalString(L, "sqliteDatabase");
 		m_confString[PASSWORDTYPE] = getGlobalString(L, "passwordType", "plain");
+		m_confString[SAVE_JOURNAL_FILE] = getGlobalString(L, "saveJournalFile", "data/save.journal");
 		#ifdef MULTI_SQL_DRIVERS
 		m_confString[SQL_TYPE] = getGlobalString(L, "sqlType", "sqlite");
 		#endif
@@ -80,6 +82,11 @@ bool ConfigManager::loadFile(const std::string& _filename)
 		m_confInteger[GAME_PORT] = getGlobalNumber(L, "gameProtocolPort", 7172);
 		m_confInteger[LOGIN_PORT] = getGlobalNumber(L, "loginProtocolPort", 7171);
 		m_confInteger[STATUS_PORT] = getGlobalNumber(L, "statusProtocolPort", 7171);
+		m_confInteger[NETWORK_THREADS] = getGlobalNumber(L, "networkThreads", 1);
+		m_confInteger[LOGIN_THREADS] = getGlobalNumber(L, "loginThreads", 2);
+		m_confInteger[DATABASE_PRIORITY_CONNECTIONS] = getGlobalNumber(L, "databasePriorityConnections", 1);
+		m_confInteger[DATABASE_BACKGROUND_CONNECTIONS] = getGlobalNumber(L, "databaseBackgroundConnections", 1);
+		m_confInteger[SAVE_JOURNAL_INTERVAL] = getGlobalNumber(L, "saveJournalInterval", 10);
 
 		m_confInteger[MARKET_OFFER_DURATION] = getGlobalNumber(L, "marketOfferDuration",  30 * 24 * 60 * 60);
 	}
@@ -164,6 +171,9 @@ bool ConfigManager::loadFile(const std::string& _filename)
 	m_confInteger[MAX_GUILD_NAME] = getGlobalNumber(L, "maxGuildNameLength", 20);
 	m_confInteger[CHECK_EXPIRED_MARKET_OFFERS_EACH_MINUTES] = getGlobalNumber(L, "checkExpiredMarketOffersEachMinutes", 60);
 	m_confInteger[MAX_MARKET_OFFERS_AT_A_TIME_PER_PLAYER] = getGlobalNumber(L, "maxMarketOffersAtATimePerPlayer", 100);
+	m_confInteger[PATHFINDING_MAX_NODES] = getGlobalNumber(L, "pathfindingMaxNodes", 2048);
+	m_confInteger[MAX_FREE_OUTPUT_MESSAGES] = getGlobalNumber(L, "maxFreeOutputMessages", 512);
+	m_confInteger[NETWORK_STATS_DUMP_EACH_MINUTES] = getGlobalNumber(L, "networkStatsDumpEachMinutes", 0);
 
 	m_isLoaded = true;
 	lua_close(L);
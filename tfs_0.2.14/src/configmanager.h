@@ -68,6 +68,7 @@ class ConfigManager
 			OPTIMIZE_DATABASE,
 			MARKET_ENABLED,
 			MARKET_PREMIUM,
+			SAVE_JOURNAL,
 			LAST_BOOLEAN_CONFIG /* this must be the last one */
 		};
 
@@ -99,6 +100,7 @@ class ConfigManager
 			PASSWORDTYPE,
 			MAP_AUTHOR,
 			MAP_STORAGE_TYPE,
+			SAVE_JOURNAL_FILE,
 			LAST_STRING_CONFIG /* this must be the last one */
 		};
 
@@ -148,6 +150,12 @@ class ConfigManager
 			GAME_PORT,
 			LOGIN_PORT,
 			STATUS_PORT,
+			NETWORK_THREADS,
+			LOGIN_THREADS,
+			DATABASE_PRIORITY_CONNECTIONS,
+			DATABASE_BACKGROUND_CONNECTIONS,
+			MAX_FREE_OUTPUT_MESSAGES,
+			NETWORK_STATS_DUMP_EACH_MINUTES,
 			STAIRHOP_DELAY,
 			LEVEL_TO_CREATE_GUILD,
 			MIN_GUILD_NAME,
@@ -155,6 +163,8 @@ class ConfigManager
 			MARKET_OFFER_DURATION,
 			CHECK_EXPIRED_MARKET_OFFERS_EACH_MINUTES,
 			MAX_MARKET_OFFERS_AT_A_TIME_PER_PLAYER,
+			PATHFINDING_MAX_NODES,
+			SAVE_JOURNAL_INTERVAL,
 			LAST_INTEGER_CONFIG /* this must be the last one */
 		};
 
@@ -37,6 +37,11 @@ bool Connection::m_logError = true;
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
 uint32_t Connection::connectionCount = 0;
+uint64_t Connection::writeCount = 0;
+uint64_t Connection::writtenMessageCount = 0;
+uint64_t Connection::readCount = 0;
+uint64_t Connection::readMessageCount = 0;
+boost::mutex Connection::statsLock;
 #endif
 
 Connection_ptr ConnectionManager::createConnection(boost::asio::ip::tcp::socket* socket,
@@ -136,6 +141,8 @@ void Connection::closeConnectionTask()
 
 	if(m_pendingWrite == 0 || m_writeError)
 	{
+		m_outputQueue.clear();
+		m_outputQueueBytes = 0;
 		closeSocket();
 		releaseConnection();
 		m_connectionState = CONNECTION_STATE_CLOSED;
@@ -235,6 +242,11 @@ void Connection::onStopOperation()
 	delete m_socket;
 	m_socket = NULL;
 
+	m_outputQueue.clear();
+	m_outputQueueBytes = 0;
+	m_writeQueue.clear();
+	m_writeBuffers.clear();
+
 	m_connectionLock.unlock();
 	ConnectionManager::getInstance()->releaseConnection(shared_from_this());
 }
@@ -245,7 +257,7 @@ void Connection::deleteConnectionTask()
 	assert(m_refCount == 0);
 	try
 	{
-		m_io_service.dispatch(boost::bind(&Connection::onStopOperation, this));
+		m_strand.dispatch(boost::bind(&Connection::onStopOperation, this));
 	}
 	catch(boost::system::system_error& e)
 	{
@@ -267,16 +279,25 @@ void Connection::acceptConnection(Protocol* protocol)
 
 void Connection::acceptConnection()
 {
+	m_connectionLock.lock();
+	internalRead();
+	m_connectionLock.unlock();
+}
+
+void Connection::internalRead()
+{
+	//m_connectionLock held
 	try
 	{
 		++m_pendingRead;
 		m_readTimer.expires_from_now(boost::posix_time::seconds(Connection::read_timeout));
-		m_readTimer.async_wait( boost::bind(&Connection::handleReadTimeout, boost::weak_ptr<Connection>(shared_from_this()), boost::asio::placeholders::error));
+		m_readTimer.async_wait(m_strand.wrap(boost::bind(&Connection::handleReadTimeout, boost::weak_ptr<Connection>(shared_from_this()),
+			boost::asio::placeholders::error)));
 
-		// Read size of the first packet
-		boost::asio::async_read(getHandle(),
-			boost::asio::buffer(m_msg.getBuffer(), NetworkMessage::header_length),
-			boost::bind(&Connection::parseHeader, shared_from_this(), boost::asio::placeholders::error));
+		// Read whatever has arrived, up to the free space of the buffer
+		m_socket->async_read_some(boost::asio::buffer(m_readBuffer + m_readEnd, read_buffer_size - m_readEnd),
+			m_strand.wrap(boost::bind(&Connection::parseData, shared_from_this(), boost::asio::placeholders::error,
+				boost::asio::placeholders::bytes_transferred)));
 	}
 	catch(boost::system::system_error& e)
 	{
@@ -289,13 +310,12 @@ void Connection::acceptConnection()
 	}
 }
 
-void Connection::parseHeader(const boost::system::error_code& error)
+void Connection::parseData(const boost::system::error_code& error, size_t bytes)
 {
 	m_connectionLock.lock();
 	m_readTimer.cancel();
 
-	int32_t size = m_msg.decodeHeader();
-	if(error || size <= 0 || size >= NETWORKMESSAGE_MAXSIZE - 16)
+	if(error)
 		handleReadError(error);
 
 	if(m_connectionState != CONNECTION_STATE_OPEN || m_readError)
@@ -306,38 +326,42 @@ void Connection::parseHeader(const boost::system::error_code& error)
 	}
 
 	--m_pendingRead;
+	m_readEnd += bytes;
 
-	try
-	{
-		++m_pendingRead;
-		m_readTimer.expires_from_now(boost::posix_time::seconds(Connection::read_timeout));
-		m_readTimer.async_wait( boost::bind(&Connection::handleReadTimeout, boost::weak_ptr<Connection>(shared_from_this()),
-			boost::asio::placeholders::error));
-
-		// Read packet content
-		m_msg.setMessageLength(size + NetworkMessage::header_length);
-		boost::asio::async_read(getHandle(), boost::asio::buffer(m_msg.getBodyBuffer(), size),
-			boost::bind(&Connection::parsePacket, shared_from_this(), boost::asio::placeholders::error));
-	}
-	catch(boost::system::system_error& e)
+	#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+	uint32_t packets = 0;
+	#endif
+	while(m_readEnd - m_readStart >= (uint32_t)NetworkMessage::header_length)
 	{
-		if(m_logError)
+		int32_t size = m_readBuffer[m_readStart] | m_readBuffer[m_readStart + 1] << 8;
+		if(size <= 0 || size >= NETWORKMESSAGE_MAXSIZE - 16)
 		{
-			LOG_MESSAGE("NETWORK", LOGTYPE_ERROR, 1, e.what());
-			m_logError = false;
-			closeConnection();
+			handleReadError(error);
+			break;
 		}
-	}
-	m_connectionLock.unlock();
-}
 
-void Connection::parsePacket(const boost::system::error_code& error)
-{
-	m_connectionLock.lock();
-	m_readTimer.cancel();
+		uint32_t length = size + NetworkMessage::header_length;
+		if(m_readEnd - m_readStart < length)
+			break;
 
-	if(error)
-		handleReadError(error);
+		memcpy(m_msg.getBuffer(), m_readBuffer + m_readStart, length);
+		m_msg.setMessageLength(length);
+		m_msg.setReadPos(NetworkMessage::header_length);
+		m_readStart += length;
+
+		#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+		++packets;
+		#endif
+		if(!parsePacket() || m_connectionState != CONNECTION_STATE_OPEN)
+			break;
+	}
+
+	#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+	statsLock.lock();
+	++readCount;
+	readMessageCount += packets;
+	statsLock.unlock();
+	#endif
 
 	if(m_connectionState != CONNECTION_STATE_OPEN || m_readError)
 	{
@@ -346,8 +370,22 @@ void Connection::parsePacket(const boost::system::error_code& error)
 		return;
 	}
 
-	--m_pendingRead;
+	if(m_readStart == m_readEnd)
+		m_readStart = m_readEnd = 0;
+	else if(m_readStart > 0)
+	{
+		memmove(m_readBuffer, m_readBuffer + m_readStart, m_readEnd - m_readStart);
+		m_readEnd -= m_readStart;
+		m_readStart = 0;
+	}
 
+	internalRead();
+	m_connectionLock.unlock();
+}
+
+bool Connection::parsePacket()
+{
+	//m_connectionLock held, m_msg holds one complete packet
 	//Check packet checksum
 	uint32_t recvChecksum = m_msg.PeekU32();
 	uint32_t checksum = 0;
@@ -370,8 +408,7 @@ void Connection::parsePacket(const boost::system::error_code& error)
 			if(!m_protocol)
 			{
 				closeConnection();
-				m_connectionLock.unlock();
-				return;
+				return false;
 			}
 			m_protocol->setConnection(shared_from_this());
 		}
@@ -383,28 +420,7 @@ void Connection::parsePacket(const boost::system::error_code& error)
 	else
 		m_protocol->onRecvMessage(m_msg); // Send the packet to the current protocol
 
-	try
-	{
-		++m_pendingRead;
-		m_readTimer.expires_from_now(boost::posix_time::seconds(Connection::read_timeout));
-		m_readTimer.async_wait( boost::bind(&Connection::handleReadTimeout, boost::weak_ptr<Connection>(shared_from_this()),
-			boost::asio::placeholders::error));
-
-		// Wait to the next packet
-		boost::asio::async_read(getHandle(),
-			boost::asio::buffer(m_msg.getBuffer(), NetworkMessage::header_length),
-			boost::bind(&Connection::parseHeader, shared_from_this(), boost::asio::placeholders::error));
-	}
-	catch(boost::system::system_error& e)
-	{
-		if(m_logError)
-		{
-			LOG_MESSAGE("NETWORK", LOGTYPE_ERROR, 1, e.what());
-			m_logError = false;
-			closeConnection();
-		}
-	}
-	m_connectionLock.unlock();
+	return true;
 }
 
 bool Connection::send(OutputMessage_ptr msg)
@@ -420,46 +436,80 @@ bool Connection::send(OutputMessage_ptr msg)
 		return false;
 	}
 
-	if(m_pendingWrite == 0)
-	{
-		msg->getProtocol()->onSendMessage(msg);
+	msg->getProtocol()->onSendMessage(msg);
 
-		TRACK_MESSAGE(msg);
+	TRACK_MESSAGE(msg);
 
-		#ifdef __DEBUG_NET_DETAIL__
-		std::cout << "Connection::send " << msg->getMessageLength() << std::endl;
-		#endif
+	#ifdef __DEBUG_NET_DETAIL__
+	std::cout << "Connection::send " << msg->getMessageLength() << std::endl;
+	#endif
 
-		internalSend(msg);
+	m_outputQueue.push_back(msg);
+	m_outputQueueBytes += msg->getMessageLength();
+	if(m_pendingWrite > 0 && (m_outputQueueBytes > Connection::max_queued_bytes ||
+		OTSYS_TIME() - m_outputQueue.front()->getFrame() > Connection::queue_timeout * 1000))
+	{
+		//the client stopped reading, do not keep piling up frames for it
+		m_outputQueue.clear();
+		m_outputQueueBytes = 0;
+		closeSocket();
+		closeConnection();
+		m_connectionLock.unlock();
+		return false;
 	}
-	else
+
+	if(m_pendingWrite == 0)
 	{
-		#ifdef __DEBUG_NET__
+		//framing, encryption and checksums are done by the network thread that writes the queue
+		++m_pendingWrite;
+		m_strand.post(boost::bind(&Connection::internalSend, shared_from_this()));
+	}
+	#ifdef __DEBUG_NET__
+	else
 		std::cout << "Connection::send Adding to queue " << msg->getMessageLength() << std::endl;
-		#endif
+	#endif
 
-		TRACK_MESSAGE(msg);
-		OutputMessagePool* outputPool = OutputMessagePool::getInstance();
-		outputPool->addToAutoSend(msg);
-	}
 	m_connectionLock.unlock();
 	return true;
 }
 
-void Connection::internalSend(OutputMessage_ptr msg)
+void Connection::internalSend()
 {
-	TRACK_MESSAGE(msg);
+	//io_service thread, m_pendingWrite already counts this write
+	m_connectionLock.lock();
+	if(!m_socket || !m_socket->is_open())
+	{
+		m_outputQueue.clear();
+		m_outputQueueBytes = 0;
+		m_connectionLock.unlock();
+		return;
+	}
+
+	m_writeQueue.swap(m_outputQueue);
+	m_outputQueueBytes = 0;
+	m_writeBuffers.clear();
+	for(OutputMessageQueue::iterator it = m_writeQueue.begin(); it != m_writeQueue.end(); ++it)
+	{
+		TRACK_MESSAGE(*it);
+		(*it)->getProtocol()->wrapMessage(*it);
+		m_writeBuffers.push_back(boost::asio::buffer((*it)->getOutputBuffer(), (*it)->getMessageLength()));
+	}
+
+#ifdef __ENABLE_SERVER_DIAGNOSTIC__
+	statsLock.lock();
+	++writeCount;
+	writtenMessageCount += m_writeQueue.size();
+	statsLock.unlock();
+#endif
 
 	try
 	{
-		++m_pendingWrite;
 		m_writeTimer.expires_from_now(boost::posix_time::seconds(Connection::write_timeout));
-		m_writeTimer.async_wait( boost::bind(&Connection::handleWriteTimeout, boost::weak_ptr<Connection>(shared_from_this()),
-			boost::asio::placeholders::error));
+		m_writeTimer.async_wait(m_strand.wrap(boost::bind(&Connection::handleWriteTimeout, boost::weak_ptr<Connection>(shared_from_this()),
+			boost::asio::placeholders::error)));
 
-		boost::asio::async_write(getHandle(),
-			boost::asio::buffer(msg->getOutputBuffer(), msg->getMessageLength()),
-			boost::bind(&Connection::onWriteOperation, shared_from_this(), msg, boost::asio::placeholders::error));
+		boost::asio::async_write(getHandle(), m_writeBuffers,
+			m_strand.wrap(boost::bind(&Connection::onWriteOperation, shared_from_this(), boost::asio::placeholders::error)));
 	}
 	catch(boost::system::system_error& e)
 	{
@@ -469,6 +519,7 @@ void Connection::internalSend(OutputMessage_ptr msg)
 			m_logError = false;
 		}
 	}
+	m_connectionLock.unlock();
 }
 
 uint32_t Connection::getIP() const
@@ -484,7 +535,7 @@ uint32_t Connection::getIP() const
 	return htonl(endpoint.address().to_v4().to_ulong());
 }
 
-void Connection::onWriteOperation(OutputMessage_ptr msg, const boost::system::error_code& error)
+void Connection::onWriteOperation(const boost::system::error_code& error)
 {
 	#ifdef __DEBUG_NET_DETAIL__
 	std::cout << "onWriteOperation" << std::endl;
@@ -493,21 +544,28 @@ void Connection::onWriteOperation(OutputMessage_ptr msg, const boost::system::er
 	m_connectionLock.lock();
 	m_writeTimer.cancel();
 
-	TRACK_MESSAGE(msg);
-	msg.reset();
+	m_writeQueue.clear();
+	m_writeBuffers.clear();
 
 	if(error)
 		handleWriteError(error);
 
 	if(m_connectionState != CONNECTION_STATE_OPEN || m_writeError)
 	{
+		m_outputQueue.clear();
+		m_outputQueueBytes = 0;
 		closeSocket();
 		closeConnection();
 		m_connectionLock.unlock();
 		return;
 	}
 
-	--m_pendingWrite;
+	//everything queued while the last write was in flight goes out together
+	if(!m_outputQueue.empty())
+		internalSend();
+	else
+		--m_pendingWrite;
+
 	m_connectionLock.unlock();
 }
 
@@ -26,6 +26,7 @@
 
 #include <boost/utility.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/enable_shared_from_this.hpp>
 
@@ -33,7 +34,9 @@
 
 class Protocol;
 class OutputMessage;
-typedef boost::shared_ptr<OutputMessage> OutputMessage_ptr;
+typedef boost::intrusive_ptr<OutputMessage> OutputMessage_ptr;
+void intrusive_ptr_add_ref(OutputMessage* msg);
+void intrusive_ptr_release(OutputMessage* msg);
 class Connection;
 typedef boost::shared_ptr<Connection> Connection_ptr;
 class ServiceBase;
@@ -81,10 +84,19 @@ class Connection : public boost::enable_shared_from_this<Connection>, boost::non
 	public:
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
 		static uint32_t connectionCount;
+		static uint64_t writeCount;
+		static uint64_t writtenMessageCount;
+		static uint64_t readCount;
+		static uint64_t readMessageCount;
+		static boost::mutex statsLock;
 #endif
 
 		enum { write_timeout = 30 };
+		// a client that lets this much or frames this old (seconds) pile up is dropped
+		enum { max_queued_bytes = 1024 * 1024 };
+		enum { queue_timeout = 10 };
 		enum { read_timeout = 30 };
+		enum { read_buffer_size = NETWORKMESSAGE_MAXSIZE * 2 };
 
 		enum ConnectionState_t
 		{
@@ -102,16 +114,19 @@ class Connection : public boost::enable_shared_from_this<Connection>, boost::non
 				m_readTimer(io_service),
 				m_writeTimer(io_service),
 				m_io_service(io_service),
+				m_strand(io_service),
 				m_service_port(service_port)
 		{
 			m_refCount = 0;
 			m_protocol = NULL;
 			m_pendingWrite = 0;
+			m_outputQueueBytes = 0;
 			m_pendingRead = 0;
 			m_connectionState = CONNECTION_STATE_OPEN;
 			m_receivedFirst = false;
 			m_writeError = false;
 			m_readError = false;
+			m_readStart = m_readEnd = 0;
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
 			connectionCount++;
@@ -142,10 +157,11 @@ class Connection : public boost::enable_shared_from_this<Connection>, boost::non
 		int32_t unRef() {return --m_refCount;}
 
 	private:
-		void parseHeader(const boost::system::error_code& error);
-		void parsePacket(const boost::system::error_code& error);
+		void internalRead();
+		void parseData(const boost::system::error_code& error, size_t bytes);
+		bool parsePacket();
 
-		void onWriteOperation(OutputMessage_ptr msg, const boost::system::error_code& error);
+		void onWriteOperation(const boost::system::error_code& error);
 
 		void onStopOperation();
 		void handleReadError(const boost::system::error_code& error);
@@ -161,14 +177,29 @@ class Connection : public boost::enable_shared_from_this<Connection>, boost::non
 		void onReadTimeout();
 		void onWriteTimeout();
 
-		void internalSend(OutputMessage_ptr msg);
+		void internalSend();
 
+		//bytes are read as they arrive and every complete packet in the buffer is parsed
+		//before the next read, an incomplete one is moved to the front to be finished
+		uint8_t m_readBuffer[read_buffer_size];
+		uint32_t m_readStart;
+		uint32_t m_readEnd;
 		NetworkMessage m_msg;
 		boost::asio::ip::tcp::socket* m_socket;
 		boost::asio::deadline_timer m_readTimer;
 		boost::asio::deadline_timer m_writeTimer;
 		boost::asio::io_service& m_io_service;
+		boost::asio::io_service::strand m_strand;
 		ServicePort_ptr m_service_port;
+
+		//queued messages are framed and encrypted by the strand and go out with one gathered write,
+		//m_writeQueue holds the ones that write is reading from until it completes
+		typedef std::vector<OutputMessage_ptr> OutputMessageQueue;
+		OutputMessageQueue m_outputQueue;
+		uint32_t m_outputQueueBytes;
+		OutputMessageQueue m_writeQueue;
+		std::vector<boost::asio::const_buffer> m_writeBuffers;
+
 		bool m_receivedFirst;
 		bool m_writeError;
 		bool m_readError;
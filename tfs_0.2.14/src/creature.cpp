@@ -1048,7 +1048,7 @@ void Creature::goToFollowCreature()
 		FindPathParams fpp;
 		getPathSearchParams(followCreature, fpp);
 
-		if(g_game.getPathToEx(this, followCreature->getPosition(), listWalkDir, fpp))
+		if(g_game.getPathToCreature(this, followCreature, listWalkDir, fpp))
 		{
 			hasFollowPath = true;
 			startAutoWalk(listWalkDir);
@@ -22,6 +22,7 @@
 
 #include "database.h"
 #include <string>
+#include <iostream>
 
 #ifdef __USE_MYSQL__
 #include "databasemysql.h"
@@ -39,31 +40,87 @@ extern ConfigManager g_config;
 boost::recursive_mutex DBQuery::database_lock;
 
 Database* _Database::_instance = NULL;
+boost::thread_specific_ptr<Database> _Database::_threadInstance(&_Database::closeConnection);
+boost::detail::atomic_count _Database::_threadConnections(0);
 
 Database* _Database::getInstance()
 {
+	if(Database* db = _threadInstance.get())
+		return db;
+
 	if(!_instance)
-	{
+		_instance = createConnection();
+
+	return _instance;
+}
+
+Database* _Database::createConnection()
+{
 #if defined MULTI_SQL_DRIVERS
-		std::string sqlType = asLowerCaseString(g_config.getString(ConfigManager::SQL_TYPE));
-		if(sqlType == "mysql")
-			_instance = new DatabaseMySQL;
-		else if(sqlType == "sqlite")
-			_instance = new DatabaseSQLite;
-		else
-			_instance = new Database;
+	std::string sqlType = asLowerCaseString(g_config.getString(ConfigManager::SQL_TYPE));
+	if(sqlType == "mysql")
+		return new DatabaseMySQL;
+	else if(sqlType == "sqlite")
+		return new DatabaseSQLite;
+
+	return new Database;
 #else
-		_instance = new Database;
+	return new Database;
 #endif
+}
+
+bool _Database::bindThreadConnection()
+{
+	if(hasThreadConnection())
+		return true;
+
+	if(!getInstance()->getParam(DBPARAM_THREADCONNECTIONS))
+		return false;
+
+	Database* db = createConnection();
+	if(!db->isConnected())
+	{
+		std::cout << "> WARNING: Failed to open a database connection for a worker thread, it will share the main one." << std::endl;
+		delete db;
+		return false;
 	}
-	return _instance;
+
+	_threadInstance.reset(db);
+	++_threadConnections;
+	return true;
+}
+
+void _Database::closeConnection(Database* db)
+{
+	--_threadConnections;
+	delete db;
+}
+
+DBStatement* _Database::prepareStatement(const std::string &query)
+{
+	DBQuery lock; // KEEP FOR DATABASE LOCKING!
+	StatementMap::iterator it = m_statements.find(query);
+	if(it != m_statements.end())
+	{
+		for(std::vector<DBStatement*>::iterator sit = it->second.begin(); sit != it->second.end(); ++sit)
+		{
+			if(!(*sit)->isBusy())
+				return *sit;
+		}
+	}
+
+	DBStatement* statement = static_cast<Database*>(this)->createStatement(query);
+	if(statement)
+		m_statements[query].push_back(statement);
+
+	return statement;
 }
 
 DBResult* _Database::verifyResult(DBResult* result)
 {
 	if(!result->next())
 	{
-		_instance->freeResult(result);
+		static_cast<Database*>(this)->freeResult(result);
 		return NULL;
 	}
 	return result;
@@ -71,12 +128,15 @@ DBResult* _Database::verifyResult(DBResult* result)
 
 DBQuery::DBQuery()
 {
-	database_lock.lock();
+	m_locked = !_Database::hasThreadConnection();
+	if(m_locked)
+		database_lock.lock();
 }
 
 DBQuery::~DBQuery()
 {
-	database_lock.unlock();
+	if(m_locked)
+		database_lock.unlock();
 }
 
 DBInsert::DBInsert(Database* db)
@@ -138,3 +198,104 @@ bool DBInsert::execute()
 	m_buf = "";
 	return res;
 }
+
+DBInsertStatement::DBInsertStatement(Database* db, const std::string& query, uint32_t columns)
+{
+	m_db = db;
+	m_query = query;
+	m_columns = columns;
+	m_failed = false;
+
+	// a power of two, so that the rows left at the end go out in few distinct group sizes
+	m_maxRows = (m_db->getParam(DBPARAM_MULTIINSERT) ? 16 : 1);
+	m_values.reserve(m_columns * m_maxRows);
+}
+
+void DBInsertStatement::addInt(int64_t value)
+{
+	Value v;
+	v.type = Value::TYPE_INT;
+	v.number = value;
+	m_values.push_back(v);
+	if(m_values.size() == m_columns * m_maxRows)
+		flushRows();
+}
+
+void DBInsertStatement::addString(const std::string& value)
+{
+	Value v;
+	v.type = Value::TYPE_STRING;
+	v.data = value;
+	m_values.push_back(v);
+	if(m_values.size() == m_columns * m_maxRows)
+		flushRows();
+}
+
+void DBInsertStatement::addBlob(const char* value, uint32_t length)
+{
+	Value v;
+	v.type = Value::TYPE_BLOB;
+	v.data.assign(value, length);
+	m_values.push_back(v);
+	if(m_values.size() == m_columns * m_maxRows)
+		flushRows();
+}
+
+bool DBInsertStatement::execute()
+{
+	while(!m_failed && !m_values.empty())
+		flushRows();
+
+	m_values.clear();
+	bool ret = !m_failed;
+	m_failed = false;
+	return ret;
+}
+
+bool DBInsertStatement::flushRows()
+{
+	uint32_t rows = m_maxRows;
+	while(rows * m_columns > m_values.size())
+		rows >>= 1;
+
+	if(rows == 0)
+	{
+		std::cout << "Error during DBInsertStatement: incomplete row for " << m_query << std::endl;
+		m_values.clear();
+		m_failed = true;
+		return false;
+	}
+
+	std::ostringstream query;
+	query << m_query;
+	for(uint32_t row = 0; row < rows; ++row)
+	{
+		query << (row == 0 ? "(" : ",(");
+		for(uint32_t column = 0; column < m_columns; ++column)
+			query << (column == 0 ? "?" : ", ?");
+
+		query << ")";
+	}
+
+	DBStatement* statement = m_db->prepareStatement(query.str());
+	uint32_t count = rows * m_columns;
+	if(statement)
+	{
+		for(uint32_t i = 0; i < count; ++i)
+		{
+			const Value& value = m_values[i];
+			if(value.type == Value::TYPE_INT)
+				statement->bindInt(i + 1, value.number);
+			else if(value.type == Value::TYPE_STRING)
+				statement->bindString(i + 1, value.data);
+			else
+				statement->bindBlob(i + 1, value.data.c_str(), value.data.length());
+		}
+	}
+
+	if(!statement || !statement->execute())
+		m_failed = true;
+
+	m_values.erase(m_values.begin(), m_values.begin() + count);
+	return !m_failed;
+}
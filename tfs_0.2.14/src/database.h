@@ -23,27 +23,36 @@
 
 #include "definitions.h"
 #include <boost/thread.hpp>
+#include <boost/detail/atomic_count.hpp>
 #include <sstream>
+#include <map>
+#include <vector>
 #include "enums.h"
 
 #ifdef MULTI_SQL_DRIVERS
 #define DATABASE_VIRTUAL virtual
 #define DATABASE_CLASS _Database
 #define DBRES_CLASS _DBResult
+#define DBSTMT_CLASS _DBStatement
 class _Database;
 class _DBResult;
+class _DBStatement;
 #else
 #define DATABASE_VIRTUAL
 #if defined(__USE_MYSQL__)
 #define DATABASE_CLASS DatabaseMySQL
 #define DBRES_CLASS MySQLResult
+#define DBSTMT_CLASS MySQLStatement
 class DatabaseMySQL;
 class MySQLResult;
+class MySQLStatement;
 #elif defined(__USE_SQLITE__)
 #define DATABASE_CLASS DatabaseSQLite
 #define DBRES_CLASS SQLiteResult
+#define DBSTMT_CLASS SQLiteStatement
 class DatabaseSQLite;
 class SQLiteResult;
+class SQLiteStatement;
 #else
 #error "You must define at least one database driver, __USE_MYSQL__ or __USE_SQLITE__."
 #endif
@@ -51,6 +60,7 @@ class SQLiteResult;
 
 typedef DATABASE_CLASS Database;
 typedef DBRES_CLASS DBResult;
+typedef DBSTMT_CLASS DBStatement;
 
 typedef std::map<const std::string, uint32_t> listNames_t;
 
@@ -58,7 +68,8 @@ class DBQuery;
 
 enum DBParam_t
 {
-	DBPARAM_MULTIINSERT = 1
+	DBPARAM_MULTIINSERT = 1,
+	DBPARAM_THREADCONNECTIONS = 2
 };
 
 class _Database
@@ -73,6 +84,20 @@ class _Database
 		*/
 		static Database* getInstance();
 
+		/**
+		* Connection of the calling thread.
+		*
+		* Gives the calling thread a connection of its own, which getInstance() returns to it
+		* from then on and which is closed when the thread exits. Queries of such a thread don't
+		* wait for the ones of other threads. Drivers without DBPARAM_THREADCONNECTIONS keep the
+		* thread on the shared connection.
+		*
+		* @return true if the thread got its own connection
+		*/
+		static bool bindThreadConnection();
+		static bool hasThreadConnection() {return _threadInstance.get() != NULL;}
+		static long getThreadConnectionCount() {return _threadConnections;}
+
 		/**
 		* Database information.
 		*
@@ -135,6 +160,19 @@ class _Database
 		*/
 		DATABASE_VIRTUAL DBResult* storeQuery(const std::string &query) { return 0; }
 
+		/**
+		* Prepared statement.
+		*
+		* Returns a statement for query, which marks its parameters with "?". Statements are
+		* prepared once and kept by query text, so the query should be a constant. The
+		* statement belongs to the database and must not be freed; use it while holding a
+		* DBQuery, as any other query.
+		*
+		* @param std::string query with placeholders
+		* @return statement handler, null on error
+		*/
+		DBStatement* prepareStatement(const std::string &query);
+
 		/**
 		* Escapes string for query.
 		*
@@ -223,10 +261,26 @@ class _Database
 
 		DBResult* verifyResult(DBResult* result);
 
+		/**
+		* Prepares a new statement for prepareStatement().
+		*
+		* @return statement handler, null on error
+		*/
+		DATABASE_VIRTUAL DBStatement* createStatement(const std::string &query) { return 0; }
+
 		bool m_connected;
 
+		// a query may have more than one statement while results are read from the first
+		typedef std::map<std::string, std::vector<DBStatement*> > StatementMap;
+		StatementMap m_statements;
+
 	private:
+		static Database* createConnection();
+		static void closeConnection(Database* db);
+
 		static Database* _instance;
+		static boost::thread_specific_ptr<Database> _threadInstance;
+		static boost::detail::atomic_count _threadConnections;
 };
 
 class _DBResult
@@ -238,6 +292,14 @@ class _DBResult
 		*/
 		DATABASE_VIRTUAL int32_t getDataInt(const std::string &s) { return 0; }
 
+		/** Field accessors by position, counted from 0 in the order of the SELECT list.
+		* They skip the lookup by name, which matters when reading many rows.
+		*/
+		DATABASE_VIRTUAL int32_t getDataInt(uint32_t column) { return 0; }
+		DATABASE_VIRTUAL int64_t getDataLong(uint32_t column) { return 0; }
+		DATABASE_VIRTUAL std::string getDataString(uint32_t column) { return "''"; }
+		DATABASE_VIRTUAL const char* getDataStream(uint32_t column, unsigned long &size) { return 0; }
+
 		/** Get the Long value of a field in database
 		*\return The Long value of the selected field and row
 		*\param s The name of the field
@@ -272,10 +334,49 @@ class _DBResult
 		listNames_t m_listNames;
 };
 
+/**
+ * Prepared statement.
+ *
+ * Parameters are bound by their position, counted from 1, and keep their value until
+ * bound again. Get statements from Database::prepareStatement().
+ */
+class _DBStatement
+{
+	public:
+		DATABASE_VIRTUAL bool bindInt(uint32_t index, int64_t value) { return false; }
+		DATABASE_VIRTUAL bool bindString(uint32_t index, const std::string &value) { return false; }
+		DATABASE_VIRTUAL bool bindBlob(uint32_t index, const char* value, uint32_t length) { return false; }
+
+		/**
+		* Executes statement which doesn't generate results (eg. INSERT, UPDATE, DELETE...).
+		*
+		* @return true on success, false on error
+		*/
+		DATABASE_VIRTUAL bool execute() { return false; }
+
+		/**
+		* Executes statement which generates results (mostly SELECT).
+		*
+		* The statement stays busy until the result is freed with Database::freeResult().
+		*
+		* @return results object (null on error or when there are no rows)
+		*/
+		DATABASE_VIRTUAL DBResult* storeQuery() { return 0; }
+
+		bool isBusy() const { return m_busy; }
+
+	protected:
+		_DBStatement() : m_busy(false) {}
+		DATABASE_VIRTUAL ~_DBStatement() {}
+
+		bool m_busy;
+};
+
 /**
  * Thread locking hack.
  *
- * By using this class for your queries you lock and unlock database for threads.
+ * By using this class for your queries you lock and unlock database for threads. Threads
+ * with a connection of their own have nobody to wait for and take no lock.
 */
 class DBQuery : public std::ostringstream
 {
@@ -286,6 +387,7 @@ class DBQuery : public std::ostringstream
 		virtual ~DBQuery();
 
 	protected:
+		bool m_locked;
 		static boost::recursive_mutex database_lock;
 };
 
@@ -343,6 +445,53 @@ class DBInsert
 		std::string m_buf;
 };
 
+/**
+ * INSERT statement with bound parameters.
+ *
+ * Same as DBInsert, but values are bound instead of escaped. Rows are sent in groups on
+ * databases that support multiline INSERTs, with one prepared statement per group size.
+ */
+class DBInsertStatement
+{
+	public:
+		/**
+		* @param Database* database wrapper
+		* @param std::string& INSERT query up to VALUES
+		* @param uint32_t number of values in a row
+		*/
+		DBInsertStatement(Database* db, const std::string& query, uint32_t columns);
+		~DBInsertStatement() {}
+
+		/**
+		* Adds a value to the current row, a row is complete after columns values.
+		*/
+		void addInt(int64_t value);
+		void addString(const std::string& value);
+		void addBlob(const char* value, uint32_t length);
+
+		/**
+		* Executes the rows added so far.
+		*/
+		bool execute();
+
+	protected:
+		bool flushRows();
+
+		struct Value
+		{
+			enum Type {TYPE_INT, TYPE_STRING, TYPE_BLOB} type;
+			int64_t number;
+			std::string data;
+		};
+
+		Database* m_db;
+		std::string m_query;
+		uint32_t m_columns;
+		uint32_t m_maxRows;
+		bool m_failed;
+		std::vector<Value> m_values;
+};
+
 #ifndef MULTI_SQL_DRIVERS
 #if defined(__USE_MYSQL__)
 #include "databasemysql.h"
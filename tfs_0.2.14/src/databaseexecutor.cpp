@@ -0,0 +1,89 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include <boost/bind.hpp>
+
+#include "databaseexecutor.h"
+#include "tasks.h"
+
+void DatabaseExecutor::start(int32_t priorityThreads, int32_t backgroundThreads)
+{
+	// a lane needs at least one thread, otherwise its tasks would never run
+	m_lanes[DBLANE_PRIORITY].start(std::max<int32_t>(1, priorityThreads), &Database::bindThreadConnection);
+	m_lanes[DBLANE_BACKGROUND].start(std::max<int32_t>(1, backgroundThreads), &Database::bindThreadConnection);
+	m_running = true;
+}
+
+void DatabaseExecutor::shutdown()
+{
+	m_running = false;
+	for(int32_t i = 0; i <= DBLANE_LAST; ++i)
+		m_lanes[i].shutdown();
+}
+
+void DatabaseExecutor::join()
+{
+	for(int32_t i = 0; i <= DBLANE_LAST; ++i)
+		m_lanes[i].join();
+}
+
+void DatabaseExecutor::addTask(DatabaseLane_t lane, const boost::function<void (void)>& f)
+{
+	if(m_running)
+		m_lanes[lane].addJob(f);
+	else
+		f();
+}
+
+void DatabaseExecutor::storeQuery(DatabaseLane_t lane, const std::string& query, const boost::function<void (DBResult*)>& callback)
+{
+	addTask(lane, boost::bind(&DatabaseExecutor::runStoreQuery, query, callback));
+}
+
+void DatabaseExecutor::executeQuery(DatabaseLane_t lane, const std::string& query, const boost::function<void (bool)>& callback)
+{
+	addTask(lane, boost::bind(&DatabaseExecutor::runExecuteQuery, query, callback));
+}
+
+void DatabaseExecutor::runStoreQuery(const std::string& query, const boost::function<void (DBResult*)>& callback)
+{
+	DBResult* result;
+	{
+		DBQuery lock; // KEEP FOR DATABASE LOCKING!
+		result = Database::getInstance()->storeQuery(query);
+	}
+
+	// MySQL buffers plain results and SQLite threads all share one serialized connection,
+	// either way the result can be read on the dispatcher
+	g_dispatcher.addTask(createTask(boost::bind(callback, result)));
+}
+
+void DatabaseExecutor::runExecuteQuery(const std::string& query, const boost::function<void (bool)>& callback)
+{
+	bool success;
+	{
+		DBQuery lock; // KEEP FOR DATABASE LOCKING!
+		success = Database::getInstance()->executeQuery(query);
+	}
+
+	if(callback)
+		g_dispatcher.addTask(createTask(boost::bind(callback, success)));
+}
@@ -0,0 +1,78 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Runs database work on threads with connections of their own
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_DATABASEEXECUTOR_H__
+#define __OTSERV_DATABASEEXECUTOR_H__
+
+#include "definitions.h"
+#include <string>
+#include <boost/function.hpp>
+
+#include "database.h"
+#include "workerpool.h"
+
+enum DatabaseLane_t
+{
+	DBLANE_PRIORITY = 0, // game state saves
+	DBLANE_BACKGROUND = 1, // market browsing, highscores, statistics, cleanup and scripts
+	DBLANE_LAST = DBLANE_BACKGROUND
+};
+
+// Each lane has its own threads, so a slow background query never delays a
+// save. Tasks must not touch the game; results go back through callbacks,
+// which the dispatcher runs.
+class DatabaseExecutor
+{
+	public:
+		~DatabaseExecutor() {}
+
+		static DatabaseExecutor* getInstance()
+		{
+			static DatabaseExecutor instance;
+			return &instance;
+		}
+
+		void start(int32_t priorityThreads, int32_t backgroundThreads);
+		// runs what is queued, then lets the threads exit
+		void shutdown();
+		void join();
+
+		// runs right away on the calling thread when the lane has no threads
+		void addTask(DatabaseLane_t lane, const boost::function<void (void)>& f);
+
+		// the callback gets the result (NULL when there are no rows or on error) and has
+		// to free it
+		void storeQuery(DatabaseLane_t lane, const std::string& query, const boost::function<void (DBResult*)>& callback);
+		void executeQuery(DatabaseLane_t lane, const std::string& query, const boost::function<void (bool)>& callback);
+
+		int32_t getThreadCount(DatabaseLane_t lane) const {return m_running ? m_lanes[lane].getThreadCount() : 0;}
+		long getPendingTaskCount(DatabaseLane_t lane) const {return m_lanes[lane].getPendingJobCount();}
+
+	protected:
+		DatabaseExecutor() : m_running(false) {}
+
+		static void runStoreQuery(const std::string& query, const boost::function<void (DBResult*)>& callback);
+		static void runExecuteQuery(const std::string& query, const boost::function<void (bool)>& callback);
+
+		WorkerPool m_lanes[DBLANE_LAST + 1];
+		bool m_running;
+};
+
+#endif
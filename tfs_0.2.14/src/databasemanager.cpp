@@ -293,6 +293,18 @@ uint32_t DatabaseManager::updateDatabase()
 			return 7;
 		}
 
+		case 7:
+		{
+			std::cout << "> Updating database to version 8 (unique player storage keys)" << std::endl;
+			if(db->getDatabaseEngine() == DATABASE_ENGINE_MYSQL)
+				db->executeQuery("ALTER TABLE `player_storage` ADD PRIMARY KEY (`player_id`, `key`);");
+			else
+				db->executeQuery("CREATE UNIQUE INDEX IF NOT EXISTS player_storage_key ON player_storage(player_id, key);");
+
+			registerDatabaseConfig("db_version", 8);
+			return 8;
+		}
+
 		/*
 		case ?-1:
 		{
@@ -92,12 +92,19 @@ DatabaseMySQL::DatabaseMySQL()
 
 DatabaseMySQL::~DatabaseMySQL()
 {
+	for(StatementMap::iterator it = m_statements.begin(); it != m_statements.end(); ++it)
+	{
+		for(std::vector<DBStatement*>::iterator sit = it->second.begin(); sit != it->second.end(); ++sit)
+			delete (MySQLStatement*)*sit;
+	}
+
+	m_statements.clear();
 	mysql_close(&m_handle);
 }
 
 bool DatabaseMySQL::getParam(DBParam_t param)
 {
-	return param == DBPARAM_MULTIINSERT;
+	return param == DBPARAM_MULTIINSERT || param == DBPARAM_THREADCONNECTIONS;
 }
 
 bool DatabaseMySQL::beginTransaction()
@@ -248,83 +255,340 @@ void DatabaseMySQL::freeResult(DBResult* res)
 	delete (MySQLResult*)res;
 }
 
-/** MySQLResult definitions */
+DBStatement* DatabaseMySQL::createStatement(const std::string &query)
+{
+	if(!m_connected)
+		return NULL;
 
-int32_t MySQLResult::getDataInt(const std::string &s)
+	MySQLStatement* statement = new MySQLStatement(this, query);
+	if(!statement->prepare())
+	{
+		delete statement;
+		return NULL;
+	}
+	return statement;
+}
+
+/** MySQLStatement definitions */
+
+MySQLStatement::MySQLStatement(DatabaseMySQL* database, const std::string &query)
 {
-	listNames_t::iterator it = m_listNames.find(s);
-	if(it == m_listNames.end())
+	m_database = database;
+	m_handle = NULL;
+
+	// unlike mysql_real_query(), statements must not end with a semicolon
+	m_query = query;
+	std::string::size_type end = m_query.find_last_not_of("; ");
+	if(end != std::string::npos)
+		m_query.erase(end + 1);
+}
+
+MySQLStatement::~MySQLStatement()
+{
+	if(m_handle)
+		mysql_stmt_close(m_handle);
+}
+
+bool MySQLStatement::prepare()
+{
+	#ifdef __DEBUG_SQL__
+	std::cout << "MYSQL PREPARE: " << m_query << std::endl;
+	#endif
+
+	if(m_handle)
+		mysql_stmt_close(m_handle);
+
+	if(!(m_handle = mysql_stmt_init(&m_database->m_handle)))
 	{
-		std::cout << "Error during getDataInt(" << s << ")." << std::endl;
-		return 0;
+		std::cout << "mysql_stmt_init(): MYSQL ERROR: " << mysql_error(&m_database->m_handle) << std::endl;
+		return false;
 	}
 
-	if(m_row[it->second] == NULL)
-		return 0;
+	if(mysql_stmt_prepare(m_handle, m_query.c_str(), m_query.length()) != 0)
+	{
+		std::cout << "mysql_stmt_prepare(): " << m_query.substr(0, 256) << ": MYSQL ERROR: " << mysql_stmt_error(m_handle) << std::endl;
+		return false;
+	}
 
-	return atoi(m_row[it->second]);
+	// a prepared again statement keeps the values bound so far
+	uint32_t count = mysql_stmt_param_count(m_handle);
+	if(m_params.size() != count)
+	{
+		m_params.assign(count, MYSQL_BIND());
+		m_numbers.assign(count, 0);
+		m_strings.assign(count, std::string());
+		m_lengths.assign(count, 0);
+		for(uint32_t i = 0; i < count; ++i)
+		{
+			memset(&m_params[i], 0, sizeof(MYSQL_BIND));
+			m_params[i].buffer_type = MYSQL_TYPE_NULL;
+		}
+	}
+	return true;
 }
 
-int64_t MySQLResult::getDataLong(const std::string &s)
+MYSQL_BIND* MySQLStatement::getParam(uint32_t index)
 {
-	listNames_t::iterator it = m_listNames.find(s);
-	if(it == m_listNames.end())
+	if(index == 0 || index > m_params.size())
 	{
-		std::cout << "Error during getDataLong(" << s << ")." << std::endl;
-		return 0;
+		std::cout << "Error during MySQLStatement bind(" << index << "): " << m_query.substr(0, 256) << std::endl;
+		return NULL;
 	}
 
-	if(m_row[it->second] == NULL)
-		return 0;
+	MYSQL_BIND* param = &m_params[index - 1];
+	memset(param, 0, sizeof(MYSQL_BIND));
+	return param;
+}
+
+bool MySQLStatement::bindInt(uint32_t index, int64_t value)
+{
+	MYSQL_BIND* param = getParam(index);
+	if(!param)
+		return false;
 
-	return ATOI64(m_row[it->second]);
+	m_numbers[index - 1] = value;
+	param->buffer_type = MYSQL_TYPE_LONGLONG;
+	param->buffer = &m_numbers[index - 1];
+	return true;
 }
 
-std::string MySQLResult::getDataString(const std::string &s)
+bool MySQLStatement::bindString(uint32_t index, const std::string &value)
+{
+	MYSQL_BIND* param = getParam(index);
+	if(!param)
+		return false;
+
+	std::string& buffer = m_strings[index - 1];
+	buffer = value;
+	m_lengths[index - 1] = buffer.length();
+	param->buffer_type = MYSQL_TYPE_STRING;
+	param->buffer = (void*)buffer.data();
+	param->buffer_length = buffer.length();
+	param->length = &m_lengths[index - 1];
+	return true;
+}
+
+bool MySQLStatement::bindBlob(uint32_t index, const char* value, uint32_t length)
+{
+	MYSQL_BIND* param = getParam(index);
+	if(!param)
+		return false;
+
+	std::string& buffer = m_strings[index - 1];
+	buffer.assign(value, length);
+	m_lengths[index - 1] = buffer.length();
+	param->buffer_type = MYSQL_TYPE_BLOB;
+	param->buffer = (void*)buffer.data();
+	param->buffer_length = buffer.length();
+	param->length = &m_lengths[index - 1];
+	return true;
+}
+
+bool MySQLStatement::run()
+{
+	if(!m_database->m_connected || !m_handle)
+		return false;
+
+	#ifdef __DEBUG_SQL__
+	std::cout << "MYSQL EXECUTE: " << m_query << std::endl;
+	#endif
+
+	for(int32_t tries = 0; tries < 2; ++tries)
+	{
+		if((m_params.empty() || mysql_stmt_bind_param(m_handle, &m_params[0]) == 0) && mysql_stmt_execute(m_handle) == 0)
+			return true;
+
+		std::cout << "mysql_stmt_execute(): " << m_query.substr(0, 256) << ": MYSQL ERROR: " << mysql_stmt_error(m_handle) << std::endl;
+		int error = mysql_stmt_errno(m_handle);
+		if(error == CR_SERVER_LOST || error == CR_SERVER_GONE_ERROR)
+		{
+			m_database->m_connected = false;
+			return false;
+		}
+
+		// statements do not survive an automatic reconnect (ER_UNKNOWN_STMT_HANDLER)
+		if(error != 1243 || !prepare())
+			return false;
+	}
+	return false;
+}
+
+bool MySQLStatement::execute()
+{
+	bool state = run();
+	// as for executeQuery, someone could execute a SELECT this way
+	if(state)
+		mysql_stmt_free_result(m_handle);
+
+	return state;
+}
+
+DBResult* MySQLStatement::storeQuery()
+{
+	if(!run())
+		return NULL;
+
+	MYSQL_RES* metadata = mysql_stmt_result_metadata(m_handle);
+	if(!metadata)
+	{
+		std::cout << "mysql_stmt_result_metadata(): " << m_query.substr(0, 256) << ": MYSQL ERROR: " << mysql_stmt_error(m_handle) << std::endl;
+		return NULL;
+	}
+
+	// buffers the rows, so that other queries can run while they are read
+	if(mysql_stmt_store_result(m_handle) != 0)
+	{
+		std::cout << "mysql_stmt_store_result(): " << m_query.substr(0, 256) << ": MYSQL ERROR: " << mysql_stmt_error(m_handle) << std::endl;
+		mysql_free_result(metadata);
+		return NULL;
+	}
+
+	DBResult* res = new MySQLResult(this, metadata);
+	return m_database->verifyResult(res);
+}
+
+/** MySQLResult definitions */
+
+int32_t MySQLResult::getColumn(const std::string &s, const char* function)
 {
 	listNames_t::iterator it = m_listNames.find(s);
 	if(it == m_listNames.end())
 	{
-		std::cout << "Error during getDataString(" << s << ")." << std::endl;
-		return std::string("");
+		std::cout << "Error during " << function << "(" << s << ")." << std::endl;
+		return -1;
 	}
+	return it->second;
+}
+
+int32_t MySQLResult::getDataInt(const std::string &s)
+{
+	int32_t column = getColumn(s, "getDataInt");
+	if(column == -1)
+		return 0;
+
+	return getDataInt((uint32_t)column);
+}
 
-	if(m_row[it->second] == NULL)
+int64_t MySQLResult::getDataLong(const std::string &s)
+{
+	int32_t column = getColumn(s, "getDataLong");
+	if(column == -1)
+		return 0;
+
+	return getDataLong((uint32_t)column);
+}
+
+std::string MySQLResult::getDataString(const std::string &s)
+{
+	int32_t column = getColumn(s, "getDataString");
+	if(column == -1)
 		return std::string("");
 
-	return std::string(m_row[it->second]);
+	return getDataString((uint32_t)column);
 }
 
 const char* MySQLResult::getDataStream(const std::string &s, unsigned long &size)
 {
-	listNames_t::iterator it = m_listNames.find(s);
-	if(it == m_listNames.end())
+	int32_t column = getColumn(s, "getDataStream");
+	if(column == -1)
 	{
-		std::cout << "Error during getDataStream(" << s << ")." << std::endl;
 		size = 0;
 		return NULL;
 	}
 
-	if(m_row[it->second] == NULL)
+	return getDataStream((uint32_t)column, size);
+}
+
+int32_t MySQLResult::getDataInt(uint32_t column)
+{
+	if(column >= m_columns || m_row[column] == NULL)
+		return 0;
+
+	return atoi(m_row[column]);
+}
+
+int64_t MySQLResult::getDataLong(uint32_t column)
+{
+	if(column >= m_columns || m_row[column] == NULL)
+		return 0;
+
+	return ATOI64(m_row[column]);
+}
+
+std::string MySQLResult::getDataString(uint32_t column)
+{
+	if(column >= m_columns || m_row[column] == NULL)
+		return std::string("");
+
+	return std::string(m_row[column]);
+}
+
+const char* MySQLResult::getDataStream(uint32_t column, unsigned long &size)
+{
+	if(column >= m_columns || m_row[column] == NULL)
 	{
 		size = 0;
 		return NULL;
 	}
 
-	size = mysql_fetch_lengths(m_handle)[it->second];
-	return m_row[it->second];
+	if(m_statement)
+		size = m_rowLengths[column];
+	else
+		size = mysql_fetch_lengths(m_handle)[column];
 
+	return m_row[column];
 }
 
 bool MySQLResult::next()
 {
+	if(m_statement)
+		return nextStatementRow();
+
 	m_row = mysql_fetch_row(m_handle);
 	return m_row != NULL;
 }
 
-MySQLResult::MySQLResult(MYSQL_RES* res)
+bool MySQLResult::nextStatementRow()
+{
+	int ret = mysql_stmt_fetch(m_statement->m_handle);
+	if(ret != 0 && ret != MYSQL_DATA_TRUNCATED)
+	{
+		m_row = NULL;
+		return false;
+	}
+
+	// fields longer than their buffer are fetched again into a bigger one
+	bool rebind = false;
+	for(uint32_t i = 0; i < m_columns; ++i)
+	{
+		if(m_nulls[i])
+		{
+			m_rowData[i] = NULL;
+			continue;
+		}
+
+		if(m_rowLengths[i] >= m_buffers[i].size())
+		{
+			m_buffers[i].resize(m_rowLengths[i] + 1);
+			m_binds[i].buffer = &m_buffers[i][0];
+			m_binds[i].buffer_length = m_buffers[i].size();
+			mysql_stmt_fetch_column(m_statement->m_handle, &m_binds[i], i, 0);
+			rebind = true;
+		}
+
+		m_buffers[i][m_rowLengths[i]] = '\0';
+		m_rowData[i] = &m_buffers[i][0];
+	}
+
+	if(rebind)
+		mysql_stmt_bind_result(m_statement->m_handle, &m_binds[0]);
+
+	m_row = &m_rowData[0];
+	return true;
+}
+
+void MySQLResult::setColumnNames()
 {
-	m_handle = res;
 	m_listNames.clear();
 
 	MYSQL_FIELD* field;
@@ -334,11 +598,55 @@ MySQLResult::MySQLResult(MYSQL_RES* res)
 		m_listNames[field->name] = i;
 		i++;
 	}
+	m_columns = i;
+}
+
+MySQLResult::MySQLResult(MYSQL_RES* res)
+{
+	m_handle = res;
+	m_row = NULL;
+	m_statement = NULL;
+	setColumnNames();
+}
+
+MySQLResult::MySQLResult(MySQLStatement* statement, MYSQL_RES* metadata)
+{
+	m_handle = metadata;
+	m_row = NULL;
+	m_statement = statement;
+	m_statement->m_busy = true;
+	setColumnNames();
+
+	// every field is read as text, as from mysql_fetch_row()
+	MYSQL_FIELD* fields = mysql_fetch_fields(m_handle);
+	m_binds.assign(m_columns, MYSQL_BIND());
+	m_buffers.assign(m_columns, std::vector<char>(64));
+	m_rowLengths.assign(m_columns, 0);
+	m_nulls.assign(m_columns, 0);
+	m_rowData.assign(m_columns, (char*)NULL);
+	for(uint32_t i = 0; i < m_columns; ++i)
+	{
+		MYSQL_BIND& bind = m_binds[i];
+		memset(&bind, 0, sizeof(MYSQL_BIND));
+		bind.buffer_type = (fields[i].type == MYSQL_TYPE_BLOB ? MYSQL_TYPE_BLOB : MYSQL_TYPE_STRING);
+		bind.buffer = &m_buffers[i][0];
+		bind.buffer_length = m_buffers[i].size();
+		bind.length = &m_rowLengths[i];
+		bind.is_null = &m_nulls[i];
+	}
+
+	if(m_columns > 0)
+		mysql_stmt_bind_result(m_statement->m_handle, &m_binds[0]);
 }
 
 MySQLResult::~MySQLResult()
 {
 	mysql_free_result(m_handle);
+	if(m_statement)
+	{
+		mysql_stmt_free_result(m_statement->m_handle);
+		m_statement->m_busy = false;
+	}
 }
 
 #endif
@@ -38,9 +38,13 @@
 
 #include <sstream>
 #include <map>
+#include <vector>
 
 class DatabaseMySQL : public _Database
 {
+	friend class _Database;
+	friend class MySQLStatement;
+
 	public:
 		DatabaseMySQL();
 		DATABASE_VIRTUAL ~DatabaseMySQL();
@@ -71,12 +75,47 @@ class DatabaseMySQL : public _Database
 		DATABASE_VIRTUAL uint64_t getClientVersionNumeric() {return mysql_get_client_version();}
 
 	protected:
+		DATABASE_VIRTUAL DBStatement* createStatement(const std::string &query);
+
 		MYSQL m_handle;
 };
 
+class MySQLStatement : public _DBStatement
+{
+	friend class DatabaseMySQL;
+	friend class MySQLResult;
+
+	public:
+		DATABASE_VIRTUAL bool bindInt(uint32_t index, int64_t value);
+		DATABASE_VIRTUAL bool bindString(uint32_t index, const std::string &value);
+		DATABASE_VIRTUAL bool bindBlob(uint32_t index, const char* value, uint32_t length);
+
+		DATABASE_VIRTUAL bool execute();
+		DATABASE_VIRTUAL DBResult* storeQuery();
+
+	protected:
+		MySQLStatement(DatabaseMySQL* database, const std::string &query);
+		DATABASE_VIRTUAL ~MySQLStatement();
+
+		bool prepare();
+		bool run();
+		MYSQL_BIND* getParam(uint32_t index);
+
+		DatabaseMySQL* m_database;
+		std::string m_query;
+		MYSQL_STMT* m_handle;
+
+		// bound values have to outlive the execution, so they are kept here
+		std::vector<MYSQL_BIND> m_params;
+		std::vector<int64_t> m_numbers;
+		std::vector<std::string> m_strings;
+		std::vector<unsigned long> m_lengths;
+};
+
 class MySQLResult : public _DBResult
 {
 	friend class DatabaseMySQL;
+	friend class MySQLStatement;
 
 	public:
 		DATABASE_VIRTUAL int32_t getDataInt(const std::string &s);
@@ -84,14 +123,34 @@ class MySQLResult : public _DBResult
 		DATABASE_VIRTUAL std::string getDataString(const std::string &s);
 		DATABASE_VIRTUAL const char* getDataStream(const std::string &s, unsigned long &size);
 
+		DATABASE_VIRTUAL int32_t getDataInt(uint32_t column);
+		DATABASE_VIRTUAL int64_t getDataLong(uint32_t column);
+		DATABASE_VIRTUAL std::string getDataString(uint32_t column);
+		DATABASE_VIRTUAL const char* getDataStream(uint32_t column, unsigned long &size);
+
 		DATABASE_VIRTUAL bool next();
 
 	protected:
 		MySQLResult(MYSQL_RES* res);
+		// reads the results of an executed statement
+		MySQLResult(MySQLStatement* statement, MYSQL_RES* metadata);
 		DATABASE_VIRTUAL ~MySQLResult();
 
+		int32_t getColumn(const std::string &s, const char* function);
+		void setColumnNames();
+		bool nextStatementRow();
+
 		MYSQL_RES* m_handle;
 		MYSQL_ROW m_row;
+		uint32_t m_columns;
+
+		// statement results are fetched into these buffers, m_row then points at them
+		MySQLStatement* m_statement;
+		std::vector<MYSQL_BIND> m_binds;
+		std::vector<std::vector<char> > m_buffers;
+		std::vector<unsigned long> m_rowLengths;
+		std::vector<my_bool> m_nulls;
+		std::vector<char*> m_rowData;
 };
 
 #endif
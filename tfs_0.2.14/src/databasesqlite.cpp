@@ -66,6 +66,13 @@ DatabaseSQLite::DatabaseSQLite()
 
 DatabaseSQLite::~DatabaseSQLite()
 {
+	for(StatementMap::iterator it = m_statements.begin(); it != m_statements.end(); ++it)
+	{
+		for(std::vector<DBStatement*>::iterator sit = it->second.begin(); sit != it->second.end(); ++sit)
+			delete (SQLiteStatement*)*sit;
+	}
+
+	m_statements.clear();
 	sqlite3_close(m_handle);
 }
 
@@ -223,6 +230,98 @@ void DatabaseSQLite::freeResult(DBResult* res)
 	delete (SQLiteResult*)res;
 }
 
+DBStatement* DatabaseSQLite::createStatement(const std::string &query)
+{
+	boost::recursive_mutex::scoped_lock lockClass(sqliteLock);
+	if(!m_connected)
+		return NULL;
+
+	#ifdef __DEBUG_SQL__
+	std::cout << "SQLITE PREPARE: " << query << std::endl;
+	#endif
+
+	std::string buf = _parse(query);
+	sqlite3_stmt* stmt;
+	if(OTS_SQLITE3_PREPARE(m_handle, buf.c_str(), buf.length(), &stmt, NULL) != SQLITE_OK)
+	{
+		sqlite3_finalize(stmt);
+		std::cout << "OTS_SQLITE3_PREPARE(): SQLITE ERROR: " << sqlite3_errmsg(m_handle) << " (" << buf << ")" << std::endl;
+		return NULL;
+	}
+	return new SQLiteStatement(this, stmt);
+}
+
+/** SQLiteStatement definitions */
+
+SQLiteStatement::SQLiteStatement(DatabaseSQLite* database, sqlite3_stmt* stmt)
+{
+	m_database = database;
+	m_handle = stmt;
+}
+
+SQLiteStatement::~SQLiteStatement()
+{
+	sqlite3_finalize(m_handle);
+}
+
+bool SQLiteStatement::checkBind(uint32_t index, int ret)
+{
+	if(ret == SQLITE_OK)
+		return true;
+
+	std::cout << "sqlite3_bind(" << index << "): SQLITE ERROR: " << sqlite3_errmsg(m_database->m_handle) << " (" << sqlite3_sql(m_handle) << ")" << std::endl;
+	return false;
+}
+
+bool SQLiteStatement::bindInt(uint32_t index, int64_t value)
+{
+	return checkBind(index, sqlite3_bind_int64(m_handle, index, value));
+}
+
+bool SQLiteStatement::bindString(uint32_t index, const std::string &value)
+{
+	return checkBind(index, sqlite3_bind_text(m_handle, index, value.c_str(), value.length(), SQLITE_TRANSIENT));
+}
+
+bool SQLiteStatement::bindBlob(uint32_t index, const char* value, uint32_t length)
+{
+	return checkBind(index, sqlite3_bind_blob(m_handle, index, value, length, SQLITE_TRANSIENT));
+}
+
+bool SQLiteStatement::execute()
+{
+	boost::recursive_mutex::scoped_lock lockClass(m_database->sqliteLock);
+	if(!m_database->m_connected)
+		return false;
+
+	#ifdef __DEBUG_SQL__
+	std::cout << "SQLITE EXECUTE: " << sqlite3_sql(m_handle) << std::endl;
+	#endif
+
+	int ret = sqlite3_step(m_handle);
+	sqlite3_reset(m_handle);
+	if(ret != SQLITE_OK && ret != SQLITE_DONE && ret != SQLITE_ROW)
+	{
+		std::cout << "sqlite3_step(): SQLITE ERROR: " << sqlite3_errmsg(m_database->m_handle) << " (" << sqlite3_sql(m_handle) << ")" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+DBResult* SQLiteStatement::storeQuery()
+{
+	boost::recursive_mutex::scoped_lock lockClass(m_database->sqliteLock);
+	if(!m_database->m_connected)
+		return NULL;
+
+	#ifdef __DEBUG_SQL__
+	std::cout << "SQLITE EXECUTE: " << sqlite3_sql(m_handle) << std::endl;
+	#endif
+
+	DBResult* results = new SQLiteResult(m_handle, this);
+	return m_database->verifyResult(results);
+}
+
 /** SQLiteResult definitions */
 
 int32_t SQLiteResult::getDataInt(const std::string &s)
@@ -274,15 +373,45 @@ const char* SQLiteResult::getDataStream(const std::string &s, unsigned long &siz
 	return value;
 }
 
+int32_t SQLiteResult::getDataInt(uint32_t column)
+{
+	return sqlite3_column_int(m_handle, column);
+}
+
+int64_t SQLiteResult::getDataLong(uint32_t column)
+{
+	return sqlite3_column_int64(m_handle, column);
+}
+
+std::string SQLiteResult::getDataString(uint32_t column)
+{
+	const char* value = (const char*)sqlite3_column_text(m_handle, column);
+	if(!value)
+		return std::string("");
+
+	return std::string(value);
+}
+
+const char* SQLiteResult::getDataStream(uint32_t column, unsigned long &size)
+{
+	const char* value = (const char*)sqlite3_column_blob(m_handle, column);
+	size = sqlite3_column_bytes(m_handle, column);
+	return value;
+}
+
 bool SQLiteResult::next()
 {
 	// checks if after moving to next step we have a row result
 	return sqlite3_step(m_handle) == SQLITE_ROW;
 }
 
-SQLiteResult::SQLiteResult(sqlite3_stmt* stmt)
+SQLiteResult::SQLiteResult(sqlite3_stmt* stmt, SQLiteStatement* statement/* = NULL*/)
 {
 	m_handle = stmt;
+	m_statement = statement;
+	if(m_statement)
+		m_statement->m_busy = true;
+
 	m_listNames.clear();
 
 	int32_t fields = sqlite3_column_count(m_handle);
@@ -292,7 +421,13 @@ SQLiteResult::SQLiteResult(sqlite3_stmt* stmt)
 
 SQLiteResult::~SQLiteResult()
 {
-	sqlite3_finalize(m_handle);
+	if(m_statement)
+	{
+		sqlite3_reset(m_handle);
+		m_statement->m_busy = false;
+	}
+	else
+		sqlite3_finalize(m_handle);
 }
 
 #endif
@@ -34,6 +34,9 @@
 
 class DatabaseSQLite : public _Database
 {
+	friend class _Database;
+	friend class SQLiteStatement;
+
 	public:
 		DatabaseSQLite();
 		DATABASE_VIRTUAL ~DatabaseSQLite();
@@ -66,15 +69,41 @@ class DatabaseSQLite : public _Database
 		DATABASE_VIRTUAL uint64_t getClientVersionNumeric() {return sqlite3_libversion_number();}
 
 	protected:
+		DATABASE_VIRTUAL DBStatement* createStatement(const std::string &query);
+
 		std::string _parse(const std::string &s);
 
 		boost::recursive_mutex sqliteLock;
 		sqlite3* m_handle;
 };
 
+class SQLiteStatement : public _DBStatement
+{
+	friend class DatabaseSQLite;
+	friend class SQLiteResult;
+
+	public:
+		DATABASE_VIRTUAL bool bindInt(uint32_t index, int64_t value);
+		DATABASE_VIRTUAL bool bindString(uint32_t index, const std::string &value);
+		DATABASE_VIRTUAL bool bindBlob(uint32_t index, const char* value, uint32_t length);
+
+		DATABASE_VIRTUAL bool execute();
+		DATABASE_VIRTUAL DBResult* storeQuery();
+
+	protected:
+		SQLiteStatement(DatabaseSQLite* database, sqlite3_stmt* stmt);
+		DATABASE_VIRTUAL ~SQLiteStatement();
+
+		bool checkBind(uint32_t index, int ret);
+
+		DatabaseSQLite* m_database;
+		sqlite3_stmt* m_handle;
+};
+
 class SQLiteResult : public _DBResult
 {
 	friend class DatabaseSQLite;
+	friend class SQLiteStatement;
 
 	public:
 		DATABASE_VIRTUAL int32_t getDataInt(const std::string &s);
@@ -82,13 +111,20 @@ class SQLiteResult : public _DBResult
 		DATABASE_VIRTUAL std::string getDataString(const std::string &s);
 		DATABASE_VIRTUAL const char* getDataStream(const std::string &s, unsigned long &size);
 
+		DATABASE_VIRTUAL int32_t getDataInt(uint32_t column);
+		DATABASE_VIRTUAL int64_t getDataLong(uint32_t column);
+		DATABASE_VIRTUAL std::string getDataString(uint32_t column);
+		DATABASE_VIRTUAL const char* getDataStream(uint32_t column, unsigned long &size);
+
 		DATABASE_VIRTUAL bool next();
 
 	protected:
-		SQLiteResult(sqlite3_stmt* stmt);
+		SQLiteResult(sqlite3_stmt* stmt, SQLiteStatement* statement = NULL);
 		DATABASE_VIRTUAL ~SQLiteResult();
 
 		sqlite3_stmt* m_handle;
+		// a statement result only resets the handle, the statement keeps it
+		SQLiteStatement* m_statement;
 };
 
 #endif
@@ -21,11 +21,13 @@
 
 #include "depot.h"
 #include "tools.h"
+#include "savejournal.h"
 
 Depot::Depot(uint16_t _type) :
 Container(_type)
 {
 	depotId = 0;
+	ownerId = 0;
 	maxSize = 3;
 	maxDepotLimit = 1500;
 	inbox = NULL;
@@ -88,12 +90,19 @@ ReturnValue Depot::__queryMaxCount(int32_t index, const Thing* thing, uint32_t c
 
 void Depot::postAddNotification(Thing* thing, const Cylinder* oldParent, int32_t index, cylinderlink_t link /*= LINK_OWNER*/)
 {
+	//containers in the depot pass on what happens inside them
+	if(ownerId != 0 && thing->getItem())
+		SaveJournal::getInstance()->onDepotChanged(ownerId);
+
 	if(getParent() != NULL)
 		getParent()->postAddNotification(thing, oldParent, index, LINK_PARENT);
 }
 
 void Depot::postRemoveNotification(Thing* thing, const Cylinder* newParent, int32_t index, bool isCompleteRemoval, cylinderlink_t link /*= LINK_OWNER*/)
 {
+	if(ownerId != 0 && thing->getItem())
+		SaveJournal::getInstance()->onDepotChanged(ownerId);
+
 	if(getParent() != NULL)
 		getParent()->postRemoveNotification(thing, newParent, index, isCompleteRemoval, LINK_PARENT);
 }
@@ -45,6 +45,10 @@ class Depot : public Container
 		void setMaxDepotLimit(uint32_t maxitems) {maxDepotLimit = maxitems;}
 		void setDepotId(uint32_t id) {depotId = id;}
 
+		// guid of the player the depot belongs to, 0 for the lockers on the map
+		uint32_t getOwnerId() const {return ownerId;}
+		void setOwnerId(uint32_t guid) {ownerId = guid;}
+
 		//cylinder implementations
 		virtual ReturnValue __queryAdd(int32_t index, const Thing* thing, uint32_t count,
 			uint32_t flags, Creature* actor = NULL) const;
@@ -63,6 +67,7 @@ class Depot : public Container
 	private:
 		uint32_t maxDepotLimit;
 		uint32_t depotId;
+		uint32_t ownerId;
 
 		Container* chest;
 		Container* inbox;
@@ -42,6 +42,7 @@
 #include "combat.h"
 #include "iologindata.h"
 #include "iomarket.h"
+#include "iomapserialize.h"
 #include "chat.h"
 #include "luascript.h"
 #include "talkaction.h"
@@ -55,6 +56,9 @@
 #include "quests.h"
 #include "globalevent.h"
 #include "mounts.h"
+#include "workerpool.h"
+#include "databaseexecutor.h"
+#include "savejournal.h"
 
 extern ConfigManager g_config;
 extern Actions* g_actions;
@@ -64,6 +68,7 @@ extern TalkActions* g_talkActions;
 extern Spells* g_spells;
 extern Vocations g_vocations;
 extern GlobalEvents* g_globalEvents;
+extern WorkerPool g_loginPool;
 
 Game::Game()
 {
@@ -80,6 +85,7 @@ Game::Game()
 	useLastStageLevel = false;
 	stagesEnabled = false;
 	stateTime = OTSYS_TIME();
+	saveGeneration = writtenSaveGeneration = 0;
 	for(int16_t i = 0; i < 3; i++)
 		serverSaveMessage[i] = false;
 
@@ -214,26 +220,120 @@ void Game::setGameState(GameState_t newState)
 	}
 }
 
-void Game::saveGameState()
+struct GameStateSnapshot
+{
+	uint64_t generation;
+	std::vector<PlayerSnapshot_ptr> players;
+	MapSnapshot map;
+	ScriptEnvironment::StorageMap globalStorage;
+};
+
+void Game::saveGameState(bool async/* = false*/)
 {
 	if(gameState == GAME_STATE_NORMAL)
 		setGameState(GAME_STATE_MAINTAIN);
 
 	stateTime = 0;
 	std::cout << "Saving server..." << std::endl;
+
+	boost::shared_ptr<GameStateSnapshot> snapshot(new GameStateSnapshot);
+	snapshot->generation = ++saveGeneration;
+
 	IOLoginData* ioLoginData = IOLoginData::getInstance();
 	for(AutoList<Player>::listiterator it = Player::listPlayer.list.begin(); it != Player::listPlayer.list.end(); ++it)
 	{
 		(*it).second->loginPosition = (*it).second->getPosition();
-		ioLoginData->savePlayer((*it).second, false);
+		if(PlayerSnapshot_ptr playerSnapshot = ioLoginData->capturePlayer((*it).second, false))
+			snapshot->players.push_back(playerSnapshot);
+		else
+			std::cout << "> ERROR: Failed to save player: " << (*it).second->getName() << "!" << std::endl;
 	}
 
-	map->saveMap();
-	ScriptEnvironment::saveGameState();
+	map->captureMap(snapshot->map);
+	ScriptEnvironment::captureGameState(snapshot->globalStorage);
+	//journal records after this are not part of the snapshot
+	SaveJournal::getInstance()->mark(snapshot->generation);
 	stateTime = OTSYS_TIME() + STATE_TIME;
 
 	if(gameState == GAME_STATE_MAINTAIN)
 		setGameState(GAME_STATE_NORMAL);
+
+	if(async && DatabaseExecutor::getInstance()->getThreadCount(DBLANE_PRIORITY) > 0)
+		DatabaseExecutor::getInstance()->addTask(DBLANE_PRIORITY, boost::bind(&Game::writeGameState, this, snapshot, true));
+	else
+		writeGameState(snapshot, false);
+}
+
+void Game::writeGameState(boost::shared_ptr<GameStateSnapshot> snapshot, bool async)
+{
+	int64_t start = OTSYS_TIME();
+
+	//each player is written in its own transaction, so the dispatcher never waits long for the database
+	std::vector<PlayerSnapshot_ptr> savedPlayers;
+	std::vector<std::string> failedPlayers;
+	IOLoginData* ioLoginData = IOLoginData::getInstance();
+	for(std::vector<PlayerSnapshot_ptr>::const_iterator it = snapshot->players.begin(); it != snapshot->players.end(); ++it)
+	{
+		if(ioLoginData->writePlayer(**it))
+			savedPlayers.push_back(*it);
+		else
+			failedPlayers.push_back((*it)->name);
+	}
+
+	bool mapSaved = true, storageSaved = true;
+	{
+		//a synchronous save may have overtaken a queued one, and runs on another connection
+		boost::recursive_mutex::scoped_lock lockClass(saveLock);
+		if(snapshot->generation > writtenSaveGeneration)
+		{
+			mapSaved = map->writeMap(snapshot->map);
+			storageSaved = ScriptEnvironment::writeGameState(snapshot->globalStorage);
+			writtenSaveGeneration = snapshot->generation;
+		}
+	}
+
+	int64_t duration = OTSYS_TIME() - start;
+	if(async)
+	{
+		g_dispatcher.addTask(createTask(boost::bind(&Game::onGameStateSaved, this, snapshot->generation,
+			savedPlayers, failedPlayers, mapSaved, storageSaved, duration)));
+	}
+	else
+		onGameStateSaved(snapshot->generation, savedPlayers, failedPlayers, mapSaved, storageSaved, duration);
+}
+
+void Game::onGameStateSaved(uint64_t generation, const std::vector<PlayerSnapshot_ptr>& savedPlayers, const std::vector<std::string>& failedPlayers,
+	bool mapSaved, bool storageSaved, int64_t duration)
+{
+	//players keep writing what changed since their last acknowledged save
+	std::map<uint32_t, Player*> players;
+	for(AutoList<Player>::listiterator it = Player::listPlayer.list.begin(); it != Player::listPlayer.list.end(); ++it)
+	{
+		if(!it->second->isRemoved())
+			players[it->second->getGUID()] = it->second;
+	}
+
+	for(std::vector<PlayerSnapshot_ptr>::const_iterator it = savedPlayers.begin(); it != savedPlayers.end(); ++it)
+	{
+		std::map<uint32_t, Player*>::iterator pit = players.find((*it)->guid);
+		if(pit != players.end())
+			IOLoginData::getInstance()->onPlayerSaved(pit->second, **it);
+	}
+
+	for(std::vector<std::string>::const_iterator it = failedPlayers.begin(); it != failedPlayers.end(); ++it)
+		std::cout << "> ERROR: Failed to save player: " << *it << "!" << std::endl;
+
+	if(!mapSaved)
+		std::cout << "> ERROR: Failed to save the map!" << std::endl;
+
+	if(!storageSaved)
+		std::cout << "> ERROR: Failed to save the global storage!" << std::endl;
+
+	//the journal keeps everything until a save has written all of it
+	if(failedPlayers.empty() && mapSaved && storageSaved)
+		SaveJournal::getInstance()->compact(generation);
+
+	std::cout << "Notice: Server save took : " << duration / 1000. << " s" << std::endl;
 }
 
 void Game::loadGameState()
@@ -512,10 +612,13 @@ Creature* Game::getCreatureByName(const std::string& s)
 	if(s.empty())
 		return NULL;
 
+	if(Player* player = getPlayerByName(s))
+		return player;
+
 	std::string txt1 = asUpperCaseString(s);
 	for(AutoList<Creature>::listiterator it = listCreature.list.begin(); it != listCreature.list.end(); ++it)
 	{
-		if(!(*it).second->isRemoved())
+		if(!(*it).second->isRemoved() && !(*it).second->getPlayer())
 		{
 			std::string txt2 = asUpperCaseString((*it).second->getName());
 			if(txt1 == txt2)
@@ -530,17 +633,29 @@ Player* Game::getPlayerByName(const std::string& s)
 	if(s.empty())
 		return NULL;
 
-	std::string txt1 = asUpperCaseString(s);
-	for(AutoList<Player>::listiterator it = Player::listPlayer.list.begin(); it != Player::listPlayer.list.end(); ++it)
+	PlayerNameMap::iterator it = playersByName.find(asUpperCaseString(s));
+	if(it != playersByName.end() && !it->second->isRemoved())
+		return it->second;
+
+	return NULL; //just in case the player doesnt exist
+}
+
+void Game::addPlayerName(Player* player)
+{
+	std::string name = asUpperCaseString(player->getName());
+	playersByName[name] = player;
+	playerNameIndex[name] = player;
+}
+
+void Game::removePlayerName(Player* player)
+{
+	std::string name = asUpperCaseString(player->getName());
+	PlayerNameMap::iterator it = playersByName.find(name);
+	if(it != playersByName.end() && it->second == player)
 	{
-		if(!(*it).second->isRemoved())
-		{
-			std::string txt2 = asUpperCaseString((*it).second->getName());
-			if(txt1 == txt2)
-				return it->second;
-		}
+		playersByName.erase(it);
+		playerNameIndex.erase(name);
 	}
-	return NULL; //just in case the player doesnt exist
 }
 
 Player* Game::getPlayerByGUID(const uint32_t& guid)
@@ -576,20 +691,20 @@ ReturnValue Game::getPlayerByNameWildcard(const std::string& s, Player*& player)
 		return RET_NOERROR;
 	}
 
+	//names sharing the prefix are adjacent in the sorted index
 	Player* lastFound = NULL;
 	std::string txt1 = asUpperCaseString(s.substr(0, s.length() - 1));
-	for(AutoList<Player>::listiterator it = Player::listPlayer.list.begin(); it != Player::listPlayer.list.end(); ++it)
+	for(PlayerNameIndex::iterator it = playerNameIndex.lower_bound(txt1); it != playerNameIndex.end(); ++it)
 	{
-		if(!(*it).second->isRemoved())
+		if(it->first.compare(0, txt1.length(), txt1) != 0)
+			break;
+
+		if(!it->second->isRemoved())
 		{
-			std::string txt2 = asUpperCaseString((*it).second->getName());
-			if(txt2.substr(0, txt1.length()) == txt1)
-			{
-				if(lastFound == NULL)
-					lastFound = (*it).second;
-				else
-					return RET_NAMEISTOOAMBIGIOUS;
-			}
+			if(lastFound == NULL)
+				lastFound = it->second;
+			else
+				return RET_NAMEISTOOAMBIGIOUS;
 		}
 	}
 
@@ -654,6 +769,9 @@ bool Game::internalPlaceCreature(Creature* creature, const Position& pos, bool e
 	creature->setID();
 	listCreature.addList(creature);
 	creature->addList();
+	if(Player* player = creature->getPlayer())
+		addPlayerName(player);
+
 	return true;
 }
 
@@ -800,6 +918,9 @@ bool Game::removeCreature(Creature* creature, bool isLogout /*= true*/)
 
 	listCreature.removeList(creature->getID());
 	creature->removeList();
+	if(Player* player = creature->getPlayer())
+		removePlayerName(player);
+
 	creature->setRemoved();
 	FreeThing(creature);
 
@@ -3807,6 +3928,12 @@ bool Game::getPathToEx(const Creature* creature, const Position& targetPos,
 	return map->getPathMatching(creature, dirList, FrozenPathingConditionCall(targetPos), fpp);
 }
 
+bool Game::getPathToCreature(const Creature* creature, const Creature* target,
+	std::list<Direction>& dirList, const FindPathParams& fpp)
+{
+	return map->getPathToCreature(creature, target, dirList, fpp);
+}
+
 bool Game::getPathToEx(const Creature* creature, const Position& targetPos, std::list<Direction>& dirList,
 	uint32_t minTargetDist, uint32_t maxTargetDist, bool fullPathSearch /*= true*/,
 	bool clearSight /*= true*/, int32_t maxSearchDist /*= -1*/)
@@ -4487,11 +4614,14 @@ void Game::addCreatureHealth(const Creature* target)
 
 void Game::addCreatureHealth(const SpectatorVec& list, const Creature* target)
 {
+	NetworkMessage& packet = ProtocolGame::getBroadcastPacket();
+	ProtocolGame::AddCreatureHealth(packet, target);
+
 	Player* player = NULL;
 	for(SpectatorVec::const_iterator it = list.begin(); it != list.end(); ++it)
 	{
 		if((player = (*it)->getPlayer()))
-			player->sendCreatureHealth(target);
+			player->sendCreatureHealth(packet);
 	}
 }
 
@@ -4509,11 +4639,15 @@ void Game::addMagicEffect(const SpectatorVec& list, const Position& pos, uint8_t
 	if(ghostMode)
 		return;
 
+	NetworkMessage& packet = ProtocolGame::getBroadcastPacket();
+	if(!ProtocolGame::AddMagicEffect(packet, pos, effect))
+		return;
+
 	Player* player = NULL;
 	for(SpectatorVec::const_iterator it = list.begin(); it != list.end(); ++it)
 	{
 		if((player = (*it)->getPlayer()))
-			player->sendMagicEffect(pos, effect);
+			player->sendMagicEffect(packet, pos);
 	}
 }
 
@@ -4525,11 +4659,15 @@ void Game::addDistanceEffect(const Position& fromPos, const Position& toPos,
 	getSpectators(list, fromPos, false, true);
 	getSpectators(list, toPos, true, true);
 
+	NetworkMessage& packet = ProtocolGame::getBroadcastPacket();
+	if(!ProtocolGame::AddDistanceShoot(packet, fromPos, toPos, effect))
+		return;
+
 	Player* player = NULL;
 	for(SpectatorVec::const_iterator it = list.begin(); it != list.end(); ++it)
 	{
 		if((player = (*it)->getPlayer()))
-			player->sendDistanceShoot(fromPos, toPos, effect);
+			player->sendDistanceShoot(packet, fromPos, toPos);
 	}
 }
 
@@ -4707,6 +4845,9 @@ void Game::shutdown()
 
 	g_scheduler.shutdown();
 	g_dispatcher.shutdown();
+	g_loginPool.shutdown();
+	DatabaseExecutor::getInstance()->shutdown();
+	SaveJournal::getInstance()->shutdown();
 	Spawns::getInstance()->clear();
 	Raids::getInstance()->clear();
 
@@ -4743,11 +4884,26 @@ void Game::FreeThing(Thing* thing)
 }
 
 bool Game::reloadHighscores()
+{
+	DatabaseExecutor::getInstance()->addTask(DBLANE_BACKGROUND, boost::bind(&Game::loadHighscores, this));
+	return true;
+}
+
+void Game::loadHighscores()
+{
+	//database thread
+	boost::shared_ptr<std::vector<Highscore> > highscores(new std::vector<Highscore>);
+	for(int16_t i = 0; i <= 8; i++)
+		highscores->push_back(getHighscore(i));
+
+	g_dispatcher.addTask(createTask(boost::bind(&Game::onHighscoresLoaded, this, highscores)));
+}
+
+void Game::onHighscoresLoaded(boost::shared_ptr<std::vector<Highscore> > highscores)
 {
 	lastHSUpdate = time(NULL);
 	for(int16_t i = 0; i <= 8; i++)
-		highscoreStorage[i] = getHighscore(i);
-	return true;
+		highscoreStorage[i] = (*highscores)[i];
 }
 
 void Game::timedHighscoreUpdate()
@@ -4912,7 +5068,7 @@ void Game::autoSave()
 	if(autoSaveEachMinutes <= 0)
 		return;
 
-	g_dispatcher.addTask(createTask(boost::bind(&Game::saveGameState, this)));
+	g_dispatcher.addTask(createTask(boost::bind(&Game::saveGameState, this, true)));
 	g_scheduler.addEvent(createSchedulerTask(autoSaveEachMinutes * 1000 * 60, boost::bind(&Game::autoSave, this)));
 }
 
@@ -5365,13 +5521,28 @@ bool Game::playerBrowseMarket(uint32_t playerId, uint16_t spriteId)
 	if(!it.ware)
 		return false;
 
-	const MarketOfferList& buyOffers = IOMarket::getInstance()->getActiveOffers(MARKETACTION_BUY, it.id);
-	const MarketOfferList& sellOffers = IOMarket::getInstance()->getActiveOffers(MARKETACTION_SELL, it.id);
-	player->sendMarketBrowseItem(it.id, buyOffers, sellOffers);
-	player->sendMarketDetail(it.id);
+	DatabaseExecutor::getInstance()->addTask(DBLANE_BACKGROUND, boost::bind(&Game::loadMarketBrowse, this, playerId, it.id));
 	return true;
 }
 
+void Game::loadMarketBrowse(uint32_t playerId, uint16_t itemId)
+{
+	//database thread
+	const MarketOfferList& buyOffers = IOMarket::getInstance()->getActiveOffers(MARKETACTION_BUY, itemId);
+	const MarketOfferList& sellOffers = IOMarket::getInstance()->getActiveOffers(MARKETACTION_SELL, itemId);
+	g_dispatcher.addTask(createTask(boost::bind(&Game::onMarketBrowseLoaded, this, playerId, itemId, buyOffers, sellOffers)));
+}
+
+void Game::onMarketBrowseLoaded(uint32_t playerId, uint16_t itemId, const MarketOfferList& buyOffers, const MarketOfferList& sellOffers)
+{
+	Player* player = getPlayerByID(playerId);
+	if(!player || player->isRemoved() || player->getMarketDepotId() == -1)
+		return;
+
+	player->sendMarketBrowseItem(itemId, buyOffers, sellOffers);
+	player->sendMarketDetail(itemId);
+}
+
 bool Game::playerBrowseMarketOwnOffers(uint32_t playerId)
 {
 	Player* player = getPlayerByID(playerId);
@@ -5519,7 +5690,7 @@ bool Game::playerCreateMarketOffer(uint32_t playerId, uint8_t type, uint16_t spr
 			for(ItemList::const_iterator iter = itemList.begin(), end = itemList.end(); iter != end; ++iter)
 				internalRemoveItem(*iter);
 		}
-		player->bankBalance -= fee;
+		player->setBankBalance(player->bankBalance - fee);
 	}
 	else
 	{
@@ -5528,7 +5699,7 @@ bool Game::playerCreateMarketOffer(uint32_t playerId, uint8_t type, uint16_t spr
 		if(totalPrice > player->bankBalance)
 			return false;
 
-		player->bankBalance -= totalPrice;
+		player->setBankBalance(player->bankBalance - totalPrice);
 	}
 
 	IOMarket::getInstance()->createOffer(player->getGUID(), (MarketAction_t)type, it.id, amount, price, anonymous);
@@ -5559,7 +5730,7 @@ bool Game::playerCancelMarketOffer(uint32_t playerId, uint32_t timestamp, uint16
 
 	if(offer.type == MARKETACTION_BUY)
 	{
-		player->bankBalance += (uint64_t)offer.price * offer.amount;
+		player->setBankBalance(player->bankBalance + (uint64_t)offer.price * offer.amount);
 		player->sendMarketEnter(player->getMarketDepotId());
 	}
 	else
@@ -5705,7 +5876,7 @@ bool Game::playerAcceptMarketOffer(uint32_t playerId, uint32_t timestamp, uint16
 				internalRemoveItem(*iter);
 		}
 
-		player->bankBalance += totalPrice;
+		player->setBankBalance(player->bankBalance + totalPrice);
 
 		Player* buyerPlayer = getPlayerByGUID(offer.playerId);
 		if(!buyerPlayer)
@@ -5768,7 +5939,7 @@ bool Game::playerAcceptMarketOffer(uint32_t playerId, uint32_t timestamp, uint16
 		if(totalPrice > player->bankBalance)
 			return false;
 
-		player->bankBalance -= totalPrice;
+		player->setBankBalance(player->bankBalance - totalPrice);
 
 		Depot* depot = player->getDepot(player->getMarketDepotId(), true);
 		if(it.stackable)
@@ -5806,7 +5977,7 @@ bool Game::playerAcceptMarketOffer(uint32_t playerId, uint32_t timestamp, uint16
 
 		Player* sellerPlayer = getPlayerByGUID(offer.playerId);
 		if(sellerPlayer)
-			sellerPlayer->bankBalance += totalPrice;
+			sellerPlayer->setBankBalance(sellerPlayer->bankBalance + totalPrice);
 		else
 			IOLoginData::getInstance()->increaseBankBalance(offer.playerId, totalPrice);
 	}
@@ -5829,7 +6000,7 @@ bool Game::playerAcceptMarketOffer(uint32_t playerId, uint32_t timestamp, uint16
 
 void Game::checkExpiredMarketOffers()
 {
-	IOMarket::getInstance()->clearOldHistory();
+	DatabaseExecutor::getInstance()->addTask(DBLANE_BACKGROUND, boost::bind(&IOMarket::clearOldHistory, IOMarket::getInstance()));
 
 	const ExpiredMarketOfferList& expiredBuyOffers = IOMarket::getInstance()->getExpiredOffers(MARKETACTION_BUY);
 	for(ExpiredMarketOfferList::const_iterator it = expiredBuyOffers.begin(), end = expiredBuyOffers.end(); it != end; ++it)
@@ -5839,7 +6010,7 @@ void Game::checkExpiredMarketOffers()
 		Player* player = getPlayerByGUID(offer.playerId);
 		uint64_t totalPrice = (uint64_t)offer.price * offer.amount;
 		if(player)
-			player->bankBalance += totalPrice;
+			player->setBankBalance(player->bankBalance + totalPrice);
 		else
 			IOLoginData::getInstance()->increaseBankBalance(offer.playerId, totalPrice);
 
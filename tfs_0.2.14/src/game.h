@@ -42,6 +42,7 @@ class Monster;
 class Npc;
 class CombatInfo;
 class Commands;
+struct GameStateSnapshot;
 
 enum stackPosType_t
 {
@@ -270,10 +271,16 @@ class Game
 
 		const SpectatorVec& getSpectators(const Position& centerPos) {return map->getSpectators(centerPos);}
 
-		void clearSpectatorCache()
+		void invalidateSpectatorCache(Tile* tile)
+		{
+			if(map && tile->qt_node)
+				map->invalidateSpectators(tile->qt_node);
+		}
+
+		void recycleSpectatorCache()
 		{
 			if(map)
-				map->clearSpectatorCache();
+				map->recycleSpectators();
 		}
 
 		ReturnValue internalMoveCreature(Creature* creature, Direction direction, uint32_t flags = 0);
@@ -458,6 +465,8 @@ class Game
 		bool playerBrowseMarket(uint32_t playerId, uint16_t spriteId);
 		bool playerBrowseMarketOwnOffers(uint32_t playerId);
 		bool playerBrowseMarketOwnHistory(uint32_t playerId);
+		void loadMarketBrowse(uint32_t playerId, uint16_t itemId);
+		void onMarketBrowseLoaded(uint32_t playerId, uint16_t itemId, const MarketOfferList& buyOffers, const MarketOfferList& sellOffers);
 		bool playerCreateMarketOffer(uint32_t playerId, uint8_t type, uint16_t spriteId, uint16_t amount, uint32_t price, bool anonymous);
 		bool playerCancelMarketOffer(uint32_t playerId, uint32_t timestamp, uint16_t counter);
 		bool playerAcceptMarketOffer(uint32_t playerId, uint32_t timestamp, uint16_t counter, uint16_t amount);
@@ -479,6 +488,9 @@ class Game
 		bool getPathToEx(const Creature* creature, const Position& targetPos, std::list<Direction>& dirList,
 			const FindPathParams& fpp);
 
+		bool getPathToCreature(const Creature* creature, const Creature* target, std::list<Direction>& dirList,
+			const FindPathParams& fpp);
+
 		bool getPathToEx(const Creature* creature, const Position& targetPos, std::list<Direction>& dirList,
 			uint32_t minTargetDist, uint32_t maxTargetDist, bool fullPathSearch = true,
 			bool clearSight = true, int32_t maxSearchDist = -1);
@@ -493,7 +505,12 @@ class Game
 
 		GameState_t getGameState() const;
 		void setGameState(GameState_t newState);
-		void saveGameState();
+		/**
+		  * Save players, houses and global storage. The state is copied on the
+		  * dispatcher and written by the database worker; an asynchronous save
+		  * returns right after the copy and reports back on the dispatcher.
+		  */
+		void saveGameState(bool async = false);
 		void loadGameState();
 		void refreshMap();
 		void cleanMap() {map->clean();}
@@ -555,9 +572,21 @@ class Game
 		Highscore highscoreStorage[9];
 		time_t lastHSUpdate;
 
+		void loadHighscores();
+		void onHighscoresLoaded(boost::shared_ptr<std::vector<Highscore> > highscores);
+
 		bool serverSaveMessage[3];
 		int64_t stateTime;
 
+		void writeGameState(boost::shared_ptr<GameStateSnapshot> snapshot, bool async);
+		void onGameStateSaved(uint64_t generation, const std::vector<PlayerSnapshot_ptr>& savedPlayers, const std::vector<std::string>& failedPlayers,
+			bool mapSaved, bool storageSaved, int64_t duration);
+
+		uint64_t saveGeneration;
+		//guarded by saveLock
+		uint64_t writtenSaveGeneration;
+		boost::recursive_mutex saveLock;
+
 		std::vector<Thing*> ToReleaseThings;
 
 		uint32_t checkLightEvent;
@@ -569,6 +598,15 @@ class Game
 
 		AutoList<Creature> listCreature;
 
+		//online players by upper-cased name, the sorted copy serves the "~" wildcard
+		typedef OTSERV_HASH_MAP<std::string, Player*> PlayerNameMap;
+		PlayerNameMap playersByName;
+		typedef std::map<std::string, Player*> PlayerNameIndex;
+		PlayerNameIndex playerNameIndex;
+
+		void addPlayerName(Player* player);
+		void removePlayerName(Player* player);
+
 		size_t checkCreatureLastIndex;
 		std::vector<Creature*> checkCreatureVectors[EVENT_CREATURECOUNT];
 		std::vector<Creature*> toAddCheckCreatureVector;
@@ -22,6 +22,7 @@
 #include "housetile.h"
 #include "house.h"
 #include "game.h"
+#include "savejournal.h"
 
 extern Game g_game;
 
@@ -57,6 +58,23 @@ void HouseTile::__internalAddThing(uint32_t index, Thing* thing)
 		updateHouse(item);
 }
 
+void HouseTile::postAddNotification(Thing* thing, const Cylinder* oldParent, int32_t index, cylinderlink_t link /*= LINK_OWNER*/)
+{
+	//containers on the tile pass on what happens inside them
+	if(thing->getItem())
+		SaveJournal::getInstance()->onHouseChanged(house);
+
+	Tile::postAddNotification(thing, oldParent, index, link);
+}
+
+void HouseTile::postRemoveNotification(Thing* thing, const Cylinder* newParent, int32_t index, bool isCompleteRemoval, cylinderlink_t link /*= LINK_OWNER*/)
+{
+	if(thing->getItem())
+		SaveJournal::getInstance()->onHouseChanged(house);
+
+	Tile::postRemoveNotification(thing, newParent, index, isCompleteRemoval, link);
+}
+
 void HouseTile::updateHouse(Item* item)
 {
 	if(item->getTile() == this)
@@ -41,6 +41,9 @@ class HouseTile : public DynamicTile
 		virtual void __addThing(int32_t index, Thing* thing);
 		virtual void __internalAddThing(uint32_t index, Thing* thing);
 
+		virtual void postAddNotification(Thing* thing, const Cylinder* oldParent, int32_t index, cylinderlink_t link = LINK_OWNER);
+		virtual void postRemoveNotification(Thing* thing, const Cylinder* newParent, int32_t index, bool isCompleteRemoval, cylinderlink_t link = LINK_OWNER);
+
 		House* getHouse() {return house;}
 
 	private:
@@ -30,8 +30,10 @@
 #include "game.h"
 #include "vocation.h"
 #include "house.h"
+#include "savejournal.h"
 #include <iostream>
 #include <iomanip>
+#include <boost/functional/hash.hpp>
 
 extern ConfigManager g_config;
 extern Vocations g_vocations;
@@ -330,24 +332,73 @@ bool IOLoginData::updateOnlineStatus(uint32_t guid, bool login)
 	return db->executeQuery(query.str());
 }
 
+// positions in the SELECT of loadPlayer
+enum PlayerColumn_t
+{
+	PLAYERCOLUMN_ID = 0,
+	PLAYERCOLUMN_ACCOUNT_ID,
+	PLAYERCOLUMN_GROUP_ID,
+	PLAYERCOLUMN_SEX,
+	PLAYERCOLUMN_VOCATION,
+	PLAYERCOLUMN_EXPERIENCE,
+	PLAYERCOLUMN_LEVEL,
+	PLAYERCOLUMN_MAGLEVEL,
+	PLAYERCOLUMN_HEALTH,
+	PLAYERCOLUMN_HEALTHMAX,
+	PLAYERCOLUMN_BLESSINGS,
+	PLAYERCOLUMN_MANA,
+	PLAYERCOLUMN_MANAMAX,
+	PLAYERCOLUMN_MANASPENT,
+	PLAYERCOLUMN_SOUL,
+	PLAYERCOLUMN_LOOKBODY,
+	PLAYERCOLUMN_LOOKFEET,
+	PLAYERCOLUMN_LOOKHEAD,
+	PLAYERCOLUMN_LOOKLEGS,
+	PLAYERCOLUMN_LOOKTYPE,
+	PLAYERCOLUMN_LOOKADDONS,
+	PLAYERCOLUMN_POSX,
+	PLAYERCOLUMN_POSY,
+	PLAYERCOLUMN_POSZ,
+	PLAYERCOLUMN_CAP,
+	PLAYERCOLUMN_LASTLOGIN,
+	PLAYERCOLUMN_LASTLOGOUT,
+	PLAYERCOLUMN_LASTIP,
+	PLAYERCOLUMN_CONDITIONS,
+	PLAYERCOLUMN_SKULLTIME,
+	PLAYERCOLUMN_SKULL,
+	PLAYERCOLUMN_GUILDNICK,
+	PLAYERCOLUMN_RANK_ID,
+	PLAYERCOLUMN_TOWN_ID,
+	PLAYERCOLUMN_BALANCE,
+	PLAYERCOLUMN_OFFLINETRAINING_TIME,
+	PLAYERCOLUMN_OFFLINETRAINING_SKILL
+};
+
 bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool preload /*= false*/)
 {
 	Database* db = Database::getInstance();
 
-	DBQuery query;
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
 	DBResult* result;
 
-	query << "SELECT `id`, `account_id`, `group_id`, `sex`, `vocation`, `experience`, `level`, `maglevel`, `health`, `healthmax`, `blessings`, `mana`, `manamax`, `manaspent`, `soul`, `lookbody`, `lookfeet`, `lookhead`, `looklegs`, `looktype`, `lookaddons`, `posx`, `posy`, `posz`, `cap`, `lastlogin`, `lastlogout`, `lastip`, `conditions`, `skulltime`, `skull`, `guildnick`, `rank_id`, `town_id`, `balance`, `offlinetraining_time`, `offlinetraining_skill` FROM `players` WHERE `name` " << db->getStringComparer() << db->escapePatternString(name) << " LIMIT 1;";
-	if(!(result = db->storeQuery(query.str())))
+	DBStatement* stmt = db->prepareStatement("SELECT `id`, `account_id`, `group_id`, `sex`, `vocation`, `experience`, `level`, `maglevel`, `health`, `healthmax`, `blessings`, `mana`, `manamax`, `manaspent`, `soul`, `lookbody`, `lookfeet`, `lookhead`, `looklegs`, `looktype`, `lookaddons`, `posx`, `posy`, `posz`, `cap`, `lastlogin`, `lastlogout`, `lastip`, `conditions`, `skulltime`, `skull`, `guildnick`, `rank_id`, `town_id`, `balance`, `offlinetraining_time`, `offlinetraining_skill` FROM `players` WHERE `name` " + db->getStringComparer() + "? LIMIT 1;");
+	if(!stmt)
 		return false;
 
-	uint32_t accno = result->getDataInt("account_id");
+	stmt->bindString(1, name);
+	if(!(result = stmt->storeQuery()))
+		return false;
+
+	uint32_t accno = result->getDataInt(PLAYERCOLUMN_ACCOUNT_ID);
 	if(accno < 1)
+	{
+		db->freeResult(result);
 		return false;
+	}
 
 	Account acc = loadAccount(accno);
 
-	player->setGUID(result->getDataInt("id"));
+	player->setGUID(result->getDataInt(PLAYERCOLUMN_ID));
 	player->accountNumber = accno;
 
 	player->accountType = acc.accountType;
@@ -357,22 +408,23 @@ bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool prelo
 	else
 		player->premiumDays = acc.premiumDays;
 
-	player->setGroupId(result->getDataInt("group_id"));
+	player->setGroupId(result->getDataInt(PLAYERCOLUMN_GROUP_ID));
 
 	if(preload)
 	{
 		//only loading basic info
+		db->freeResult(result);
 		return true;
 	}
 
-	player->bankBalance = (uint64_t)result->getDataLong("balance");
+	player->bankBalance = (uint64_t)result->getDataLong(PLAYERCOLUMN_BALANCE);
 
-	player->setSex((PlayerSex_t)result->getDataInt("sex"));
-	player->level = std::max((uint32_t)1, (uint32_t)result->getDataInt("level"));
+	player->setSex((PlayerSex_t)result->getDataInt(PLAYERCOLUMN_SEX));
+	player->level = std::max((uint32_t)1, (uint32_t)result->getDataInt(PLAYERCOLUMN_LEVEL));
 
 	uint64_t currExpCount = Player::getExpForLevel(player->level);
 	uint64_t nextExpCount = Player::getExpForLevel(player->level + 1);
-	uint64_t experience = (uint64_t)result->getDataLong("experience");
+	uint64_t experience = (uint64_t)result->getDataLong(PLAYERCOLUMN_EXPERIENCE);
 	if(experience < currExpCount || experience > nextExpCount)
 		experience = currExpCount;
 
@@ -382,12 +434,12 @@ bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool prelo
 	else
 		player->levelPercent = 0;
 
-	player->soul = result->getDataInt("soul");
-	player->capacity = result->getDataInt("cap");
-	player->blessings = result->getDataInt("blessings");
+	player->soul = result->getDataInt(PLAYERCOLUMN_SOUL);
+	player->capacity = result->getDataInt(PLAYERCOLUMN_CAP);
+	player->blessings = result->getDataInt(PLAYERCOLUMN_BLESSINGS);
 
 	unsigned long conditionsSize = 0;
-	const char* conditions = result->getDataStream("conditions", conditionsSize);
+	const char* conditions = result->getDataStream(PLAYERCOLUMN_CONDITIONS, conditionsSize);
 	PropStream propStream;
 	propStream.init(conditions, conditionsSize);
 
@@ -400,13 +452,13 @@ bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool prelo
 			delete condition;
 	}
 
-	player->setVocation(result->getDataInt("vocation"));
-	player->mana = result->getDataInt("mana");
-	player->manaMax = result->getDataInt("manamax");
-	player->magLevel = result->getDataInt("maglevel");
+	player->setVocation(result->getDataInt(PLAYERCOLUMN_VOCATION));
+	player->mana = result->getDataInt(PLAYERCOLUMN_MANA);
+	player->manaMax = result->getDataInt(PLAYERCOLUMN_MANAMAX);
+	player->magLevel = result->getDataInt(PLAYERCOLUMN_MAGLEVEL);
 
 	uint64_t nextManaCount = player->vocation->getReqMana(player->magLevel + 1);
-	uint64_t manaSpent = result->getDataLong("manaspent");
+	uint64_t manaSpent = result->getDataLong(PLAYERCOLUMN_MANASPENT);
 	if(manaSpent > nextManaCount)
 		manaSpent = 0;
 
@@ -414,8 +466,8 @@ bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool prelo
 	player->magLevelPercent = Player::getPercentLevel(player->manaSpent,
 		nextManaCount);
 
-	player->health = result->getDataInt("health");
-	player->healthMax = result->getDataInt("healthmax");
+	player->health = result->getDataInt(PLAYERCOLUMN_HEALTH);
+	player->healthMax = result->getDataInt(PLAYERCOLUMN_HEALTHMAX);
 
 	if(player->accessLevel)
 	{
@@ -425,23 +477,23 @@ bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool prelo
 			player->defaultOutfit.lookType = 75;
 	}
 	else
-		player->defaultOutfit.lookType = result->getDataInt("looktype");
+		player->defaultOutfit.lookType = result->getDataInt(PLAYERCOLUMN_LOOKTYPE);
 
-	player->defaultOutfit.lookHead = result->getDataInt("lookhead");
-	player->defaultOutfit.lookBody = result->getDataInt("lookbody");
-	player->defaultOutfit.lookLegs = result->getDataInt("looklegs");
-	player->defaultOutfit.lookFeet = result->getDataInt("lookfeet");
-	player->defaultOutfit.lookAddons = result->getDataInt("lookaddons");
+	player->defaultOutfit.lookHead = result->getDataInt(PLAYERCOLUMN_LOOKHEAD);
+	player->defaultOutfit.lookBody = result->getDataInt(PLAYERCOLUMN_LOOKBODY);
+	player->defaultOutfit.lookLegs = result->getDataInt(PLAYERCOLUMN_LOOKLEGS);
+	player->defaultOutfit.lookFeet = result->getDataInt(PLAYERCOLUMN_LOOKFEET);
+	player->defaultOutfit.lookAddons = result->getDataInt(PLAYERCOLUMN_LOOKADDONS);
 	player->currentOutfit = player->defaultOutfit;
 
 	if(g_game.getWorldType() != WORLD_TYPE_PVP_ENFORCED)
 	{
-		int32_t skullSeconds = result->getDataInt("skulltime") - time(NULL);
+		int32_t skullSeconds = result->getDataInt(PLAYERCOLUMN_SKULLTIME) - time(NULL);
 		if(skullSeconds > 0)
 		{
 			//ensure that we round up the number of ticks
 			player->skullTicks = (skullSeconds + 2) * 1000;
-			int32_t skull = result->getDataInt("skull");
+			int32_t skull = result->getDataInt(PLAYERCOLUMN_SKULL);
 			if(skull == SKULL_RED)
 				player->skull = SKULL_RED;
 			else if (skull == SKULL_BLACK)
@@ -449,17 +501,17 @@ bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool prelo
 		}
 	}
 
-	player->loginPosition.x = result->getDataInt("posx");
-	player->loginPosition.y = result->getDataInt("posy");
-	player->loginPosition.z = result->getDataInt("posz");
+	player->loginPosition.x = result->getDataInt(PLAYERCOLUMN_POSX);
+	player->loginPosition.y = result->getDataInt(PLAYERCOLUMN_POSY);
+	player->loginPosition.z = result->getDataInt(PLAYERCOLUMN_POSZ);
 
-	player->lastLoginSaved = result->getDataLong("lastlogin");
-	player->lastLogout = result->getDataLong("lastlogout");
+	player->lastLoginSaved = result->getDataLong(PLAYERCOLUMN_LASTLOGIN);
+	player->lastLogout = result->getDataLong(PLAYERCOLUMN_LASTLOGOUT);
 
-	player->offlineTrainingTime = result->getDataInt("offlinetraining_time") * 1000;
-	player->offlineTrainingSkill = result->getDataInt("offlinetraining_skill");
+	player->offlineTrainingTime = result->getDataInt(PLAYERCOLUMN_OFFLINETRAINING_TIME) * 1000;
+	player->offlineTrainingSkill = result->getDataInt(PLAYERCOLUMN_OFFLINETRAINING_SKILL);
 
-	player->town = result->getDataInt("town_id");
+	player->town = result->getDataInt(PLAYERCOLUMN_TOWN_ID);
 	Town* town = Towns::getInstance().getTown(player->town);
 	if(town)
 		player->masterPos = town->getTemplePosition();
@@ -467,19 +519,18 @@ bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool prelo
 	if(loginPos.x == 0 && loginPos.y == 0 && loginPos.z == 0)
 		player->loginPosition = player->masterPos;
 
-	uint32_t rankid = result->getDataInt("rank_id");
+	uint32_t rankid = result->getDataInt(PLAYERCOLUMN_RANK_ID);
 	if(rankid)
 	{
-		player->guildNick = result->getDataString("guildnick");
+		player->guildNick = result->getDataString(PLAYERCOLUMN_GUILDNICK);
 		db->freeResult(result);
-		query.str("");
-		query << "SELECT `guild_ranks`.`name` AS `rank`, `guild_ranks`.`guild_id` AS `guildid`, `guild_ranks`.`level` AS `level`, `guilds`.`name` AS `guildname` FROM `guild_ranks`, `guilds` WHERE `guild_ranks`.`id` = " << rankid << " AND `guild_ranks`.`guild_id` = `guilds`.`id` LIMIT 1;";
-		if((result = db->storeQuery(query.str())))
+		stmt = db->prepareStatement("SELECT `guild_ranks`.`name` AS `rank`, `guild_ranks`.`guild_id` AS `guildid`, `guild_ranks`.`level` AS `level`, `guilds`.`name` AS `guildname` FROM `guild_ranks`, `guilds` WHERE `guild_ranks`.`id` = ? AND `guild_ranks`.`guild_id` = `guilds`.`id` LIMIT 1;");
+		if(stmt && stmt->bindInt(1, rankid) && (result = stmt->storeQuery()))
 		{
-			player->guildName = result->getDataString("guildname");
-			player->guildLevel = result->getDataInt("level");
-			player->guildId = result->getDataInt("guildid");
-			player->guildRank = result->getDataString("rank");
+			player->guildName = result->getDataString(3);
+			player->guildLevel = result->getDataInt(2);
+			player->guildId = result->getDataInt(1);
+			player->guildRank = result->getDataString(0);
 			player->guildWarList = IOGuild::getInstance()->getWarList(player->guildId);
 			db->freeResult(result);
 		}
@@ -487,13 +538,12 @@ bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool prelo
 	else if(g_config.getBoolean(ConfigManager::INGAME_GUILD_SYSTEM))
 	{
 		db->freeResult(result);
-		query.str("");
-		query << "SELECT `guild_id` FROM `guild_invites` WHERE `player_id` = " << player->getGUID();
-		if((result = db->storeQuery(query.str())))
+		stmt = db->prepareStatement("SELECT `guild_id` FROM `guild_invites` WHERE `player_id` = ?;");
+		if(stmt && stmt->bindInt(1, player->getGUID()) && (result = stmt->storeQuery()))
 		{
 			do
 			{
-				player->invitedToGuildsList.push_back(result->getDataInt("guild_id"));
+				player->invitedToGuildsList.push_back(result->getDataInt(0));
 			}
 			while(result->next());
 			db->freeResult(result);
@@ -503,28 +553,26 @@ bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool prelo
 		db->freeResult(result);
 
 	//get password
-	query.str("");
-	query << "SELECT `password` FROM `accounts` WHERE `id` = " << accno << ";";
-	if(!(result = db->storeQuery(query.str())))
+	stmt = db->prepareStatement("SELECT `password` FROM `accounts` WHERE `id` = ?;");
+	if(!stmt || !stmt->bindInt(1, accno) || !(result = stmt->storeQuery()))
 		return false;
 
-	player->password = result->getDataString("password");
+	player->password = result->getDataString(0);
 	db->freeResult(result);
 
 	// we need to find out our skills
 	// so we query the skill table
-	query.str("");
-	query << "SELECT `skillid`, `value`, `count` FROM `player_skills` WHERE `player_id` = " << player->getGUID() << ";";
-	if((result = db->storeQuery(query.str())))
+	stmt = db->prepareStatement("SELECT `skillid`, `value`, `count` FROM `player_skills` WHERE `player_id` = ?;");
+	if(stmt && stmt->bindInt(1, player->getGUID()) && (result = stmt->storeQuery()))
 	{
 		//now iterate over the skills
 		do
 		{
-			int32_t skillid = result->getDataInt("skillid");
+			int32_t skillid = result->getDataInt(0);
 			if(skillid >= SKILL_FIRST && skillid <= SKILL_LAST)
 			{
-				uint32_t skillLevel = result->getDataInt("value");
-				uint64_t skillCount = result->getDataLong("count");
+				uint32_t skillLevel = result->getDataInt(1);
+				uint64_t skillCount = result->getDataLong(2);
 
 				uint64_t nextSkillCount = player->vocation->getReqSkillTries(skillid, skillLevel + 1);
 				if(skillCount > nextSkillCount)
@@ -539,13 +587,12 @@ bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool prelo
 		db->freeResult(result);
 	}
 
-	query.str("");
- 	query << "SELECT `player_id`, `name` FROM `player_spells` WHERE `player_id` = " << player->getGUID() << ";";
-	if((result = db->storeQuery(query.str())))
+	stmt = db->prepareStatement("SELECT `name` FROM `player_spells` WHERE `player_id` = ?;");
+	if(stmt && stmt->bindInt(1, player->getGUID()) && (result = stmt->storeQuery()))
 	{
 		do
 		{
-			std::string spellName = result->getDataString("name");
+			std::string spellName = result->getDataString(0);
 			player->learnedInstantSpellList.push_back(spellName);
 		}
 		while(result->next());
@@ -555,9 +602,8 @@ bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool prelo
 	//load inventory items
 	ItemMap itemMap;
 
-	query.str("");
-	query << "SELECT `pid`, `sid`, `itemtype`, `count`, `attributes` FROM `player_items` WHERE `player_id` = " << player->getGUID() << " ORDER BY `sid` DESC;";
-	if((result = db->storeQuery(query.str())))
+	stmt = db->prepareStatement("SELECT `pid`, `sid`, `itemtype`, `count`, `attributes` FROM `player_items` WHERE `player_id` = ? ORDER BY `sid` DESC;");
+	if(stmt && stmt->bindInt(1, player->getGUID()) && (result = stmt->storeQuery()))
 	{
 		loadItems(itemMap, result);
 		db->freeResult(result);
@@ -587,10 +633,9 @@ bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool prelo
 	//load depot items
 	itemMap.clear();
 
-	query.str("");
-	query << "SELECT `pid`, `sid`, `itemtype`, `count`, `attributes` FROM `player_depotitems` WHERE `player_id` = " << player->getGUID() << " ORDER BY `sid` DESC;";
+	stmt = db->prepareStatement("SELECT `pid`, `sid`, `itemtype`, `count`, `attributes` FROM `player_depotitems` WHERE `player_id` = ? ORDER BY `sid` DESC;");
 	DepotMap depotsMap;
-	if((result = db->storeQuery(query.str())))
+	if(stmt && stmt->bindInt(1, player->getGUID()) && (result = stmt->storeQuery()))
 	{
 		loadItems(itemMap, result);
 		db->freeResult(result);
@@ -651,26 +696,29 @@ bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool prelo
 	}
 
 	//load storage map
-	query.str("");
-	query << "SELECT `key`, `value` FROM `player_storage` WHERE `player_id` = " << player->getGUID() << ";";
-	if((result = db->storeQuery(query.str())))
+	stmt = db->prepareStatement("SELECT `key`, `value` FROM `player_storage` WHERE `player_id` = ?;");
+	if(stmt && stmt->bindInt(1, player->getGUID()) && (result = stmt->storeQuery()))
 	{
 		do
 		{
-			player->addStorageValue(result->getDataInt("key"), result->getDataLong("value"), true);
+			player->addStorageValue(result->getDataInt(0), result->getDataLong(1), true);
+			player->savedStorageMap[result->getDataInt(0)] = result->getDataLong(1);
 		}
 		while(result->next());
 		db->freeResult(result);
 	}
 
+	//saves taken before this load are older than what it read
+	player->savedDigests[PLAYERSAVE_STORAGE] = digestStorage(player->savedStorageMap);
+	player->savedGeneration = player->capturedGeneration = m_saveGeneration;
+
 	//load vip
-	query.str("");
-	query << "SELECT `vip_id` FROM `player_viplist` WHERE `player_id` = " << player->getGUID() << ";";
-	if((result = db->storeQuery(query.str())))
+	stmt = db->prepareStatement("SELECT `vip_id` FROM `player_viplist` WHERE `player_id` = ?;");
+	if(stmt && stmt->bindInt(1, player->getGUID()) && (result = stmt->storeQuery()))
 	{
 		do
 		{
-			uint32_t vip_id = result->getDataInt("vip_id");
+			uint32_t vip_id = result->getDataInt(0);
 			std::string dummy_str;
 			if(storeNameByGuid(*db, vip_id))
 				player->addVIP(vip_id, dummy_str, false, true);
@@ -685,36 +733,78 @@ bool IOLoginData::loadPlayer(Player* player, const std::string& name, bool prelo
 	return true;
 }
 
-bool IOLoginData::saveItems(const Player* player, const ItemBlockList& itemList, DBInsert& query_insert)
+static size_t digestItems(const PlayerSnapshot::ItemRowList& rows)
+{
+	size_t seed = rows.size() + 1;
+	for(PlayerSnapshot::ItemRowList::const_iterator it = rows.begin(); it != rows.end(); ++it)
+	{
+		boost::hash_combine(seed, it->pid);
+		boost::hash_combine(seed, it->sid);
+		boost::hash_combine(seed, it->type);
+		boost::hash_combine(seed, it->count);
+		boost::hash_combine(seed, it->attributes);
+	}
+	return seed;
+}
+
+template<typename T>
+static size_t digestList(const T& list)
 {
-	std::list<Container*> listContainer;
-	std::ostringstream stream;
+	size_t seed = list.size() + 1;
+	boost::hash_range(seed, list.begin(), list.end());
+	return seed;
+}
+
+size_t IOLoginData::digestStorage(const StorageMap& storage)
+{
+	return digestList(storage);
+}
+
+size_t IOLoginData::capturePlayerItems(Player* player, PlayerSaveSection_t section, PlayerSnapshot::ItemRowList& rows)
+{
+	ItemBlockList itemList;
+	if(section == PLAYERSAVE_DEPOT)
+	{
+		for(DepotMap::iterator it = player->depots.begin(); it != player->depots.end(); ++it)
+			itemList.push_back(itemBlock(it->first, it->second));
+	}
+	else
+	{
+		for(int32_t slotId = 1; slotId <= 10; ++slotId)
+		{
+			if(Item* item = player->inventory[slotId])
+				itemList.push_back(itemBlock(slotId, item));
+		}
+	}
+
+	captureItems(itemList, rows);
+	return digestItems(rows);
+}
 
+void IOLoginData::captureItems(const ItemBlockList& itemList, PlayerSnapshot::ItemRowList& rows)
+{
 	typedef std::pair<Container*, int32_t> containerBlock;
 	std::list<containerBlock> stack;
 
-	int32_t parentId = 0;
 	int32_t runningId = 100;
-
-	Database* db = Database::getInstance();
-	Item* item;
-	int32_t pid;
-
 	for(ItemBlockList::const_iterator it = itemList.begin(); it != itemList.end(); ++it)
 	{
-		pid = it->first;
-		item = it->second;
+		Item* item = it->second;
 		++runningId;
 
-		uint32_t attributesSize = 0;
+		PlayerSnapshot::ItemRow row;
+		row.pid = it->first;
+		row.sid = runningId;
+		row.type = item->getID();
+		row.count = item->getSubType();
 
 		PropWriteStream propWriteStream;
 		item->serializeAttr(propWriteStream);
-		const char* attributes = propWriteStream.getStream(attributesSize);
 
-		stream << player->getGUID() << "," << pid << "," << runningId << "," << item->getID() << "," << (int32_t)item->getSubType() << "," << db->escapeBlob(attributes, attributesSize);
-		if(!query_insert.addRow(stream))
-			return false;
+		uint32_t attributesSize = 0;
+		const char* attributes = propWriteStream.getStream(attributesSize);
+		row.attributes.assign(attributes, attributesSize);
+		rows.push_back(row);
 
 		if(Container* container = item->getContainer())
 			stack.push_back(containerBlock(container, runningId));
@@ -722,53 +812,72 @@ bool IOLoginData::saveItems(const Player* player, const ItemBlockList& itemList,
 
 	while(!stack.empty())
 	{
-		const containerBlock& cb = stack.front();
-		Container* container = cb.first;
-		parentId = cb.second;
+		Container* container = stack.front().first;
+		int32_t parentId = stack.front().second;
 		stack.pop_front();
 		for(ItemList::const_iterator it = container->getItems(), end = container->getEnd(); it != end; ++it)
 		{
+			Item* item = *it;
 			++runningId;
-			item = *it;
-			Container* container = item->getContainer();
-			if(container)
-				stack.push_back(containerBlock(container, runningId));
+			if(Container* subContainer = item->getContainer())
+				stack.push_back(containerBlock(subContainer, runningId));
+
+			PlayerSnapshot::ItemRow row;
+			row.pid = parentId;
+			row.sid = runningId;
+			row.type = item->getID();
+			row.count = item->getSubType();
 
-			uint32_t attributesSize = 0;
 			PropWriteStream propWriteStream;
 			item->serializeAttr(propWriteStream);
-			const char* attributes = propWriteStream.getStream(attributesSize);
 
-			stream << player->getGUID() << "," << parentId << "," << runningId << "," << item->getID() << "," << (int32_t)item->getSubType() << "," << db->escapeBlob(attributes, attributesSize);
-			if(!query_insert.addRow(stream))
-				return false;
+			uint32_t attributesSize = 0;
+			const char* attributes = propWriteStream.getStream(attributesSize);
+			row.attributes.assign(attributes, attributesSize);
+			rows.push_back(row);
 		}
 	}
-	return query_insert.execute();
+}
+
+bool IOLoginData::writeItems(uint32_t guid, const PlayerSnapshot::ItemRowList& rows, DBInsertStatement& stmt)
+{
+	for(PlayerSnapshot::ItemRowList::const_iterator it = rows.begin(); it != rows.end(); ++it)
+	{
+		stmt.addInt(guid);
+		stmt.addInt(it->pid);
+		stmt.addInt(it->sid);
+		stmt.addInt(it->type);
+		stmt.addInt(it->count);
+		stmt.addBlob(it->attributes.c_str(), it->attributes.length());
+	}
+	return stmt.execute();
 }
 
 bool IOLoginData::savePlayer(Player* player, bool preSave)
 {
-	if(preSave)
-		player->preSave();
+	//should the save fail, the journal still has what changed
+	SaveJournal::getInstance()->flush(player);
 
-	Database* db = Database::getInstance();
+	PlayerSnapshot_ptr snapshot = capturePlayer(player, preSave);
+	if(!snapshot || !writePlayer(*snapshot))
+		return false;
 
-	DBQuery query;
-	DBResult* result;
+	onPlayerSaved(player, *snapshot);
+	SaveJournal::getInstance()->onPlayerSaved(player);
+	return true;
+}
 
-	query << "SELECT `save` FROM `players` WHERE `id` = " << player->getGUID() << ";";
-	if(!(result = db->storeQuery(query.str())))
-		return false;
+PlayerSnapshot_ptr IOLoginData::capturePlayer(Player* player, bool preSave)
+{
+	if(preSave)
+		player->preSave();
 
-	if(result->getDataInt("save") == 0)
-	{
-		db->freeResult(result);
-		query.str("");
-		query << "UPDATE `players` SET `lastlogin` = " << player->lastLoginSaved << ", `lastip` = " << player->lastIP << " WHERE `id` = " << player->getGUID() << ";";
-		return db->executeQuery(query.str());
-	}
-	db->freeResult(result);
+	PlayerSnapshot_ptr snapshot(new PlayerSnapshot);
+	snapshot->generation = ++m_saveGeneration;
+	snapshot->guid = player->getGUID();
+	snapshot->name = player->getName();
+	snapshot->lastLoginSaved = player->lastLoginSaved;
+	snapshot->lastIP = player->lastIP;
 
 	//serialize conditions
 	PropWriteStream propWriteStream;
@@ -777,7 +886,7 @@ bool IOLoginData::savePlayer(Player* player, bool preSave)
 		if((*it)->isPersistent())
 		{
 			if(!(*it)->serialize(propWriteStream))
-				return false;
+				return PlayerSnapshot_ptr();
 
 			propWriteStream.ADD_UCHAR(CONDITIONATTR_END);
 		}
@@ -785,44 +894,41 @@ bool IOLoginData::savePlayer(Player* player, bool preSave)
 
 	uint32_t conditionsSize = 0;
 	const char* conditions = propWriteStream.getStream(conditionsSize);
-
-	//First, an UPDATE query to write the player itself
-	query.str("");
-	query << "UPDATE `players` SET ";
-	query << "`level` = " << player->level << ", ";
-	query << "`group_id` = " << player->groupId << ", ";
-	query << "`vocation` = " << (int32_t)player->getVocationId() << ", ";
-	query << "`health` = " << player->health << ", ";
-	query << "`healthmax` = " << player->healthMax << ", ";
-	query << "`experience` = " << player->experience << ", ";
-	query << "`lookbody` = " << (int32_t)player->defaultOutfit.lookBody << ", ";
-	query << "`lookfeet` = " << (int32_t)player->defaultOutfit.lookFeet << ", ";
-	query << "`lookhead` = " << (int32_t)player->defaultOutfit.lookHead << ", ";
-	query << "`looklegs` = " << (int32_t)player->defaultOutfit.lookLegs << ", ";
-	query << "`looktype` = " << (int32_t)player->defaultOutfit.lookType << ", ";
-	query << "`lookaddons` = " << (int32_t)player->defaultOutfit.lookAddons << ", ";
-	query << "`maglevel` = " << player->magLevel << ", ";
-	query << "`mana` = " << player->mana << ", ";
-	query << "`manamax` = " << player->manaMax << ", ";
-	query << "`manaspent` = " << player->manaSpent << ", ";
-	query << "`soul` = " << player->soul << ", ";
-	query << "`town_id` = " << player->town << ", ";
+	snapshot->conditions.assign(conditions, conditionsSize);
+
+	PlayerSnapshot::ColumnList& columns = snapshot->columns;
+	columns.push_back(std::make_pair("level", (int64_t)player->level));
+	columns.push_back(std::make_pair("group_id", (int64_t)player->groupId));
+	columns.push_back(std::make_pair("vocation", (int64_t)player->getVocationId()));
+	columns.push_back(std::make_pair("health", (int64_t)player->health));
+	columns.push_back(std::make_pair("healthmax", (int64_t)player->healthMax));
+	columns.push_back(std::make_pair("experience", (int64_t)player->experience));
+	columns.push_back(std::make_pair("lookbody", (int64_t)player->defaultOutfit.lookBody));
+	columns.push_back(std::make_pair("lookfeet", (int64_t)player->defaultOutfit.lookFeet));
+	columns.push_back(std::make_pair("lookhead", (int64_t)player->defaultOutfit.lookHead));
+	columns.push_back(std::make_pair("looklegs", (int64_t)player->defaultOutfit.lookLegs));
+	columns.push_back(std::make_pair("looktype", (int64_t)player->defaultOutfit.lookType));
+	columns.push_back(std::make_pair("lookaddons", (int64_t)player->defaultOutfit.lookAddons));
+	columns.push_back(std::make_pair("maglevel", (int64_t)player->magLevel));
+	columns.push_back(std::make_pair("mana", (int64_t)player->mana));
+	columns.push_back(std::make_pair("manamax", (int64_t)player->manaMax));
+	columns.push_back(std::make_pair("manaspent", (int64_t)player->manaSpent));
+	columns.push_back(std::make_pair("soul", (int64_t)player->soul));
+	columns.push_back(std::make_pair("town_id", (int64_t)player->town));
 
 	const Position& loginPosition = player->getLoginPosition();
-	query << "`posx` = " << loginPosition.x << ", ";
-	query << "`posy` = " << loginPosition.y << ", ";
-	query << "`posz` = " << loginPosition.z << ", ";
+	columns.push_back(std::make_pair("posx", (int64_t)loginPosition.x));
+	columns.push_back(std::make_pair("posy", (int64_t)loginPosition.y));
+	columns.push_back(std::make_pair("posz", (int64_t)loginPosition.z));
 
-	query << "`cap` = " << player->getCapacity() << ", ";
-	query << "`sex` = " << player->sex << ", ";
+	columns.push_back(std::make_pair("cap", (int64_t)player->getCapacity()));
+	columns.push_back(std::make_pair("sex", (int64_t)player->sex));
 
 	if(player->lastLoginSaved != 0)
-		query << "`lastlogin` = " << player->lastLoginSaved << ", ";
+		columns.push_back(std::make_pair("lastlogin", (int64_t)player->lastLoginSaved));
 
 	if(player->lastIP != 0)
-		query << "`lastip` = " << player->lastIP << ", ";
-
-	query << "`conditions` = " << db->escapeBlob(conditions, conditionsSize) << ", ";
+		columns.push_back(std::make_pair("lastip", (int64_t)player->lastIP));
 
 	if(g_game.getWorldType() != WORLD_TYPE_PVP_ENFORCED)
 	{
@@ -830,165 +936,409 @@ bool IOLoginData::savePlayer(Player* player, bool preSave)
 		if(player->skullTicks > 0)
 			skullTime = time(NULL) + player->skullTicks / 1000;
 
-		query << "`skulltime` = " << skullTime << ", ";
+		columns.push_back(std::make_pair("skulltime", (int64_t)skullTime));
 		int32_t skull = 0;
 		if(player->skull == SKULL_RED)
 			skull = SKULL_RED;
 		else if(player->skull == SKULL_BLACK)
 			skull = SKULL_BLACK;
 
-		query << "`skull` = " << skull << ", ";
+		columns.push_back(std::make_pair("skull", (int64_t)skull));
 	}
-	query << "`lastlogout` = " << player->getLastLogout() << ", ";
-	query << "`balance` = " << player->bankBalance << ", ";
-	query << "`offlinetraining_time` = " << player->getOfflineTrainingTime() / 1000 << ", ";
-	query << "`offlinetraining_skill` = " << player->getOfflineTrainingSkill() << ", ";
-	query << "`blessings` = " << player->blessings;
-	if(g_config.getBoolean(ConfigManager::INGAME_GUILD_SYSTEM))
+	columns.push_back(std::make_pair("lastlogout", (int64_t)player->getLastLogout()));
+	columns.push_back(std::make_pair("balance", (int64_t)player->bankBalance));
+	columns.push_back(std::make_pair("offlinetraining_time", (int64_t)(player->getOfflineTrainingTime() / 1000)));
+	columns.push_back(std::make_pair("offlinetraining_skill", (int64_t)player->getOfflineTrainingSkill()));
+	columns.push_back(std::make_pair("blessings", (int64_t)player->blessings));
+
+	snapshot->guildNick = player->guildNick;
+	snapshot->guildId = player->getGuildId();
+	snapshot->guildLevel = player->getGuildLevel();
+	for(int32_t i = SKILL_FIRST; i <= SKILL_LAST; i++)
 	{
-		query << ", `guildnick` = " << db->escapeString(player->guildNick) << ", ";
-		query << "`rank_id` = " << IOGuild::getInstance()->getRankIdByGuildIdAndLevel(player->getGuildId(), player->getGuildLevel()) << " ";
+		snapshot->skills[i][SKILL_LEVEL] = player->skills[i][SKILL_LEVEL];
+		snapshot->skills[i][SKILL_TRIES] = player->skills[i][SKILL_TRIES];
 	}
-	query << " WHERE `id` = " << player->getGUID() << ";";
 
-	DBTransaction transaction(db);
-	if(!transaction.begin())
-		return false;
+	size_t& stats = snapshot->digests[PLAYERSAVE_STATS];
+	stats = 1;
+	for(PlayerSnapshot::ColumnList::const_iterator it = columns.begin(); it != columns.end(); ++it)
+	{
+		boost::hash_combine(stats, it->first);
+		boost::hash_combine(stats, it->second);
+	}
 
-	if(!db->executeQuery(query.str()))
-		return false;
+	boost::hash_combine(stats, snapshot->conditions);
+	boost::hash_combine(stats, snapshot->guildNick);
+	boost::hash_combine(stats, snapshot->guildId);
+	boost::hash_combine(stats, snapshot->guildLevel);
 
-	// skills
+	size_t& skills = snapshot->digests[PLAYERSAVE_SKILLS];
+	skills = 1;
 	for(int32_t i = SKILL_FIRST; i <= SKILL_LAST; i++)
 	{
-		query.str("");
-		query << "UPDATE `player_skills` SET `value` = " << player->skills[i][SKILL_LEVEL] << ", `count` = " << player->skills[i][SKILL_TRIES] << " WHERE `player_id` = " << player->getGUID() << " AND `skillid` = " << i << db->getUpdateLimiter();
-		if(!db->executeQuery(query.str()))
-			return false;
+		boost::hash_combine(skills, snapshot->skills[i][SKILL_LEVEL]);
+		boost::hash_combine(skills, snapshot->skills[i][SKILL_TRIES]);
 	}
 
-	// learned spells
-	query.str("");
-	query << "DELETE FROM `player_spells` WHERE `player_id` = " << player->getGUID() << ";";
-	if(!db->executeQuery(query.str()))
-		return false;
+	snapshot->spells = player->learnedInstantSpellList;
+	snapshot->digests[PLAYERSAVE_SPELLS] = digestList(snapshot->spells);
 
-	query.str("");
+	snapshot->digests[PLAYERSAVE_ITEMS] = capturePlayerItems(player, PLAYERSAVE_ITEMS, snapshot->items);
+
+	//the depots are left alone until the player has touched them
+	snapshot->digests[PLAYERSAVE_DEPOT] = player->savedDigests[PLAYERSAVE_DEPOT];
+	if(player->depotChange)
+		snapshot->digests[PLAYERSAVE_DEPOT] = capturePlayerItems(player, PLAYERSAVE_DEPOT, snapshot->depotItems);
+
+	player->genReservedStorageRange();
+	snapshot->storage.insert(player->getStorageIteratorBegin(), player->getStorageIteratorEnd());
+	snapshot->digests[PLAYERSAVE_STORAGE] = digestStorage(snapshot->storage);
 
-	DBInsert stmt(db);
-	stmt.setQuery("INSERT INTO `player_spells` (`player_id`, `name` ) VALUES ");
-	for(LearnedInstantSpellList::const_iterator it = player->learnedInstantSpellList.begin();
-			it != player->learnedInstantSpellList.end(); ++it)
+	snapshot->guildInvites = player->invitedToGuildsList;
+	snapshot->digests[PLAYERSAVE_GUILDINVITES] = digestList(snapshot->guildInvites);
+	snapshot->vips = player->VIPList;
+	snapshot->digests[PLAYERSAVE_VIPLIST] = digestList(snapshot->vips);
+
+	//a section is written when it differs from what was saved last, or when an
+	//earlier save wrote it and may still land after this one
+	for(int32_t i = PLAYERSAVE_FIRST; i <= PLAYERSAVE_LAST; ++i)
 	{
-		query << player->getGUID() << "," << db->escapeString(*it);
-		if(!stmt.addRow(query))
-			return false;
+		snapshot->dirty[i] = player->pendingSections[i] || snapshot->digests[i] != player->savedDigests[i];
+		if(snapshot->dirty[i])
+			player->pendingSections[i] = true;
 	}
 
-	if(!stmt.execute())
-		return false;
+	if(!player->depotChange)
+		snapshot->dirty[PLAYERSAVE_DEPOT] = false;
 
-	//item saving
-	query << "DELETE FROM `player_items` WHERE `player_id` = " << player->getGUID() << ";";
-	if(!db->executeQuery(query.str()))
-		return false;
+	snapshot->fullStorage = (player->savedDigests[PLAYERSAVE_STORAGE] == 0);
+	if(snapshot->dirty[PLAYERSAVE_STORAGE] && !snapshot->fullStorage)
+	{
+		const StorageMap& saved = player->savedStorageMap;
+		for(StorageMap::const_iterator it = snapshot->storage.begin(); it != snapshot->storage.end(); ++it)
+		{
+			StorageMap::const_iterator sit = saved.find(it->first);
+			if(sit == saved.end() || sit->second != it->second)
+				player->pendingStorageKeys.insert(it->first);
+		}
 
-	stmt.setQuery("INSERT INTO `player_items` (`player_id`, `pid`, `sid`, `itemtype`, `count`, `attributes`) VALUES ");
+		for(StorageMap::const_iterator it = saved.begin(); it != saved.end(); ++it)
+		{
+			if(snapshot->storage.find(it->first) == snapshot->storage.end())
+				player->pendingStorageKeys.insert(it->first);
+		}
 
-	ItemBlockList itemList;
-	Item* item;
-	for(int32_t slotId = 1; slotId <= 10; ++slotId)
+		for(std::set<uint32_t>::const_iterator it = player->pendingStorageKeys.begin(); it != player->pendingStorageKeys.end(); ++it)
+		{
+			StorageMap::const_iterator sit = snapshot->storage.find(*it);
+			if(sit != snapshot->storage.end())
+				snapshot->changedStorage[*it] = sit->second;
+			else
+				snapshot->removedStorage.push_back(*it);
+		}
+	}
+
+	player->capturedGeneration = snapshot->generation;
+	return snapshot;
+}
+
+void IOLoginData::onPlayerSaved(Player* player, const PlayerSnapshot& snapshot)
+{
+	if(snapshot.generation <= player->savedGeneration)
+		return;
+
+	player->savedGeneration = snapshot.generation;
+	for(int32_t i = PLAYERSAVE_FIRST; i <= PLAYERSAVE_LAST; ++i)
+		player->savedDigests[i] = snapshot.digests[i];
+
+	player->savedStorageMap = snapshot.storage;
+	//no later save is in flight, so the database holds exactly this snapshot
+	if(snapshot.generation == player->capturedGeneration)
+	{
+		for(int32_t i = PLAYERSAVE_FIRST; i <= PLAYERSAVE_LAST; ++i)
+			player->pendingSections[i] = false;
+
+		player->pendingStorageKeys.clear();
+	}
+}
+
+bool IOLoginData::deletePlayerRows(const char* table, uint32_t guid)
+{
+	DBStatement* stmt = Database::getInstance()->prepareStatement(std::string("DELETE FROM `") + table + "` WHERE `player_id` = ?;");
+	return stmt && stmt->bindInt(1, guid) && stmt->execute();
+}
+
+bool IOLoginData::writePlayer(const PlayerSnapshot& snapshot)
+{
+	Database* db = Database::getInstance();
+
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBResult* result;
+
+	//each database thread has its own connection, so writes of one player are kept in order here
+	boost::recursive_mutex::scoped_lock lockClass(m_writeLock);
+
+	//a snapshot taken later has been written already, e.g. on logout while this one was queued
+	GenerationMap::iterator git = m_writtenGenerations.find(snapshot.guid);
+	if(git != m_writtenGenerations.end() && git->second > snapshot.generation)
+		return true;
+
+	DBStatement* stmt = db->prepareStatement("SELECT `save` FROM `players` WHERE `id` = ?;");
+	if(!stmt || !stmt->bindInt(1, snapshot.guid) || !(result = stmt->storeQuery()))
+		return false;
+
+	if(result->getDataInt(0) == 0)
 	{
-		if((item = player->inventory[slotId]))
-			itemList.push_back(itemBlock(slotId, item));
+		db->freeResult(result);
+		stmt = db->prepareStatement("UPDATE `players` SET `lastlogin` = ?, `lastip` = ? WHERE `id` = ?;");
+		if(!stmt)
+			return false;
+
+		stmt->bindInt(1, snapshot.lastLoginSaved);
+		stmt->bindInt(2, snapshot.lastIP);
+		stmt->bindInt(3, snapshot.guid);
+		return stmt->execute();
 	}
+	db->freeResult(result);
 
-	if(!saveItems(player, itemList, stmt))
+	DBTransaction transaction(db);
+	if(!transaction.begin())
 		return false;
 
-	if(player->depotChange)
+	if(snapshot.dirty[PLAYERSAVE_STATS])
 	{
-		//save depot items
-		query.str("");
-		query << "DELETE FROM `player_depotitems` WHERE `player_id` = " << player->getGUID() << ";";
-		if(!db->executeQuery(query.str()))
+		//First, an UPDATE query to write the player itself
+		bool guildSystem = g_config.getBoolean(ConfigManager::INGAME_GUILD_SYSTEM);
+		query << "UPDATE `players` SET ";
+		for(PlayerSnapshot::ColumnList::const_iterator it = snapshot.columns.begin(); it != snapshot.columns.end(); ++it)
+			query << "`" << it->first << "` = ?, ";
+
+		query << "`conditions` = ?";
+		if(guildSystem)
+			query << ", `guildnick` = ?, `rank_id` = ?";
+
+		query << " WHERE `id` = ?;";
+		if(!(stmt = db->prepareStatement(query.str())))
 			return false;
 
-		stmt.setQuery("INSERT INTO `player_depotitems` (`player_id`, `pid`, `sid`, `itemtype`, `count`, `attributes`) VALUES ");
-		itemList.clear();
-		for(DepotMap::iterator it = player->depots.begin(); it !=player->depots.end() ;++it)
-			itemList.push_back(itemBlock(it->first, it->second));
+		uint32_t index = 0;
+		for(PlayerSnapshot::ColumnList::const_iterator it = snapshot.columns.begin(); it != snapshot.columns.end(); ++it)
+			stmt->bindInt(++index, it->second);
+
+		stmt->bindBlob(++index, snapshot.conditions.c_str(), snapshot.conditions.length());
+		if(guildSystem)
+		{
+			stmt->bindString(++index, snapshot.guildNick);
+			stmt->bindInt(++index, IOGuild::getInstance()->getRankIdByGuildIdAndLevel(snapshot.guildId, snapshot.guildLevel));
+		}
 
-		if(!saveItems(player, itemList, stmt))
+		stmt->bindInt(++index, snapshot.guid);
+		if(!stmt->execute())
 			return false;
 	}
 
-	query.str("");
-	query << "DELETE FROM `player_storage` WHERE `player_id` = " << player->getGUID() << ";";
-
-	if(!db->executeQuery(query.str()))
-		return false;
+	if(snapshot.dirty[PLAYERSAVE_SKILLS])
+	{
+		if(!(stmt = db->prepareStatement("UPDATE `player_skills` SET `value` = ?, `count` = ? WHERE `player_id` = ? AND `skillid` = ?" + db->getUpdateLimiter())))
+			return false;
 
-	query.str("");
+		stmt->bindInt(3, snapshot.guid);
+		for(int32_t i = SKILL_FIRST; i <= SKILL_LAST; i++)
+		{
+			stmt->bindInt(1, snapshot.skills[i][SKILL_LEVEL]);
+			stmt->bindInt(2, snapshot.skills[i][SKILL_TRIES]);
+			stmt->bindInt(4, i);
+			if(!stmt->execute())
+				return false;
+		}
+	}
 
-	stmt.setQuery("INSERT INTO `player_storage` (`player_id`, `key`, `value`) VALUES ");
-	player->genReservedStorageRange();
-	for(StorageMap::const_iterator cit = player->getStorageIteratorBegin(), end = player->getStorageIteratorEnd(); cit != end; ++cit)
+	if(snapshot.dirty[PLAYERSAVE_SPELLS])
 	{
-		query << player->getGUID() << "," << cit->first << "," << cit->second;
-		if(!stmt.addRow(query))
+		if(!deletePlayerRows("player_spells", snapshot.guid))
+			return false;
+
+		DBInsertStatement insert(db, "INSERT INTO `player_spells` (`player_id`, `name`) VALUES ", 2);
+		for(LearnedInstantSpellList::const_iterator it = snapshot.spells.begin(); it != snapshot.spells.end(); ++it)
+		{
+			insert.addInt(snapshot.guid);
+			insert.addString(*it);
+		}
+
+		if(!insert.execute())
 			return false;
 	}
 
-	if(!stmt.execute())
+	if(snapshot.dirty[PLAYERSAVE_ITEMS] && !writeItemSection(snapshot.guid, PLAYERSAVE_ITEMS, snapshot.items))
 		return false;
 
-	if(g_config.getBoolean(ConfigManager::INGAME_GUILD_SYSTEM))
+	if(snapshot.dirty[PLAYERSAVE_DEPOT] && !writeItemSection(snapshot.guid, PLAYERSAVE_DEPOT, snapshot.depotItems))
+		return false;
+
+	if(snapshot.dirty[PLAYERSAVE_STORAGE] && !writeStorage(snapshot))
+		return false;
+
+	if(snapshot.dirty[PLAYERSAVE_GUILDINVITES] && g_config.getBoolean(ConfigManager::INGAME_GUILD_SYSTEM))
 	{
-		//save guild invites
-		query << "DELETE FROM `guild_invites` WHERE `player_id` = " << player->getGUID() << ";";
-		if(!db->executeQuery(query.str()))
+		if(!deletePlayerRows("guild_invites", snapshot.guid))
 			return false;
 
-		query.str("");
-
-		stmt.setQuery("INSERT INTO `guild_invites` (`player_id`, `guild_id`) VALUES ");
-		for(InvitedToGuildsList::const_iterator it = player->invitedToGuildsList.begin(); it != player->invitedToGuildsList.end(); ++it)
+		DBInsertStatement insert(db, "INSERT INTO `guild_invites` (`player_id`, `guild_id`) VALUES ", 2);
+		for(InvitedToGuildsList::const_iterator it = snapshot.guildInvites.begin(); it != snapshot.guildInvites.end(); ++it)
 		{
 			if(IOGuild::getInstance()->guildExists(*it))
 			{
-				query << player->getGUID() << "," << *it;
-				if(!stmt.addRow(query))
-					return false;
+				insert.addInt(snapshot.guid);
+				insert.addInt(*it);
 			}
 		}
 
-		if(!stmt.execute())
+		if(!insert.execute())
 			return false;
 	}
 
-	//save vip list
-	query << "DELETE FROM `player_viplist` WHERE `player_id` = " << player->getGUID() << ";";
-	if(!db->executeQuery(query.str()))
+	if(snapshot.dirty[PLAYERSAVE_VIPLIST])
+	{
+		if(!deletePlayerRows("player_viplist", snapshot.guid))
+			return false;
+
+		DBInsertStatement insert(db, "INSERT INTO `player_viplist` (`player_id`, `vip_id`) VALUES ", 2);
+		for(VIPListSet::const_iterator it = snapshot.vips.begin(), end = snapshot.vips.end(); it != end; ++it)
+		{
+			if(playerExists(*it))
+			{
+				insert.addInt(snapshot.guid);
+				insert.addInt(*it);
+			}
+		}
+
+		if(!insert.execute())
+			return false;
+	}
+
+	//End the transaction
+	if(!transaction.commit())
 		return false;
 
-	query.str("");
+	m_writtenGenerations[snapshot.guid] = snapshot.generation;
+	return true;
+}
+
+bool IOLoginData::writeStorage(const PlayerSnapshot& snapshot)
+{
+	Database* db = Database::getInstance();
+	DBStatement* stmt;
 
-	stmt.setQuery("INSERT INTO `player_viplist` (`player_id`, `vip_id`) VALUES ");
-	for(VIPListSet::iterator it = player->VIPList.begin(), end = player->VIPList.end(); it != end; ++it)
+	const StorageMap& rows = (snapshot.fullStorage ? snapshot.storage : snapshot.changedStorage);
+	std::string insertQuery;
+	if(snapshot.fullStorage)
 	{
-		if(playerExists(*it))
+		if(!deletePlayerRows("player_storage", snapshot.guid))
+			return false;
+
+		insertQuery = "INSERT INTO `player_storage` (`player_id`, `key`, `value`) VALUES ";
+	}
+	else
+	{
+		if(!snapshot.removedStorage.empty())
 		{
-			query << player->getGUID() << "," << *it;
-			if(!stmt.addRow(query))
+			if(!(stmt = db->prepareStatement("DELETE FROM `player_storage` WHERE `player_id` = ? AND `key` = ?;")))
 				return false;
+
+			stmt->bindInt(1, snapshot.guid);
+			for(std::vector<uint32_t>::const_iterator it = snapshot.removedStorage.begin(); it != snapshot.removedStorage.end(); ++it)
+			{
+				stmt->bindInt(2, *it);
+				if(!stmt->execute())
+					return false;
+			}
 		}
+
+		//(`player_id`, `key`) is unique, so this overwrites the old values
+		insertQuery = "REPLACE INTO `player_storage` (`player_id`, `key`, `value`) VALUES ";
+	}
+
+	DBInsertStatement insert(db, insertQuery, 3);
+	for(StorageMap::const_iterator it = rows.begin(); it != rows.end(); ++it)
+	{
+		insert.addInt(snapshot.guid);
+		insert.addInt(it->first);
+		insert.addInt(it->second);
 	}
 
-	if(!stmt.execute())
+	return insert.execute();
+}
+
+bool IOLoginData::writeItemSection(uint32_t guid, PlayerSaveSection_t section, const PlayerSnapshot::ItemRowList& rows)
+{
+	const char* table = (section == PLAYERSAVE_DEPOT ? "player_depotitems" : "player_items");
+	if(!deletePlayerRows(table, guid))
+		return false;
+
+	DBInsertStatement insert(Database::getInstance(), std::string("INSERT INTO `") + table + "` (`player_id`, `pid`, `sid`, `itemtype`, `count`, `attributes`) VALUES ", 6);
+	return writeItems(guid, rows, insert);
+}
+
+bool IOLoginData::writeJournal(const PlayerSnapshot& snapshot)
+{
+	Database* db = Database::getInstance();
+
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBResult* result;
+
+	boost::recursive_mutex::scoped_lock lockClass(m_writeLock);
+
+	//the player may have been deleted since, or is not saved at all
+	DBStatement* stmt = db->prepareStatement("SELECT `save` FROM `players` WHERE `id` = ?;");
+	if(!stmt || !stmt->bindInt(1, snapshot.guid))
+		return false;
+
+	if(!(result = stmt->storeQuery()))
+		return true;
+
+	bool save = (result->getDataInt(0) != 0);
+	db->freeResult(result);
+	if(!save)
+		return true;
+
+	DBTransaction transaction(db);
+	if(!transaction.begin())
+		return false;
+
+	if(!snapshot.columns.empty())
+	{
+		query << "UPDATE `players` SET ";
+		for(PlayerSnapshot::ColumnList::const_iterator it = snapshot.columns.begin(); it != snapshot.columns.end(); ++it)
+		{
+			if(it != snapshot.columns.begin())
+				query << ", ";
+
+			query << "`" << it->first << "` = ?";
+		}
+
+		query << " WHERE `id` = ?;";
+		if(!(stmt = db->prepareStatement(query.str())))
+			return false;
+
+		uint32_t index = 0;
+		for(PlayerSnapshot::ColumnList::const_iterator it = snapshot.columns.begin(); it != snapshot.columns.end(); ++it)
+			stmt->bindInt(++index, it->second);
+
+		stmt->bindInt(++index, snapshot.guid);
+		if(!stmt->execute())
+			return false;
+	}
+
+	if(snapshot.dirty[PLAYERSAVE_ITEMS] && !writeItemSection(snapshot.guid, PLAYERSAVE_ITEMS, snapshot.items))
+		return false;
+
+	if(snapshot.dirty[PLAYERSAVE_DEPOT] && !writeItemSection(snapshot.guid, PLAYERSAVE_DEPOT, snapshot.depotItems))
+		return false;
+
+	if(snapshot.dirty[PLAYERSAVE_STORAGE] && !writeStorage(snapshot))
 		return false;
 
-	//End the transaction
 	return transaction.commit();
 }
 
@@ -997,26 +1347,34 @@ bool IOLoginData::storeNameByGuid(Database &db, uint32_t guid)
 	DBQuery query;
 	DBResult* result;
 
-	NameCacheMap::iterator it = nameCacheMap.find(guid);
-	if(it != nameCacheMap.end())
-		return true;
+	{
+		boost::mutex::scoped_lock lockClass(m_cacheLock);
+		if(nameCacheMap.find(guid) != nameCacheMap.end())
+			return true;
+	}
 
 	query << "SELECT `name` FROM `players` WHERE `id` = " << guid << ";";
 	if(!(result = db.storeQuery(query.str())))
 		return false;
 
-	nameCacheMap[guid] = result->getDataString("name");
+	std::string name = result->getDataString("name");
 	db.freeResult(result);
+
+	boost::mutex::scoped_lock lockClass(m_cacheLock);
+	nameCacheMap[guid] = name;
 	return true;
 }
 
 bool IOLoginData::getNameByGuid(uint32_t guid, std::string& name)
 {
-	NameCacheMap::iterator it = nameCacheMap.find(guid);
-	if(it != nameCacheMap.end())
 	{
-		name = it->second;
-		return true;
+		boost::mutex::scoped_lock lockClass(m_cacheLock);
+		NameCacheMap::iterator it = nameCacheMap.find(guid);
+		if(it != nameCacheMap.end())
+		{
+			name = it->second;
+			return true;
+		}
 	}
 
 	DBQuery query;
@@ -1030,18 +1388,22 @@ bool IOLoginData::getNameByGuid(uint32_t guid, std::string& name)
 	name = result->getDataString("name");
 	db->freeResult(result);
 
+	boost::mutex::scoped_lock lockClass(m_cacheLock);
 	nameCacheMap[guid] = name;
 	return true;
 }
 
 bool IOLoginData::getGuidByName(uint32_t &guid, std::string& name)
 {
-	GuidCacheMap::iterator it = guidCacheMap.find(name);
-	if(it != guidCacheMap.end())
 	{
-		name = it->first;
-		guid = it->second;
-		return true;
+		boost::mutex::scoped_lock lockClass(m_cacheLock);
+		GuidCacheMap::iterator it = guidCacheMap.find(name);
+		if(it != guidCacheMap.end())
+		{
+			name = it->first;
+			guid = it->second;
+			return true;
+		}
 	}
 
 	Database* db = Database::getInstance();
@@ -1057,6 +1419,7 @@ bool IOLoginData::getGuidByName(uint32_t &guid, std::string& name)
 	guid = result->getDataInt("id");
 	db->freeResult(result);
 
+	boost::mutex::scoped_lock lockClass(m_cacheLock);
 	guidCacheMap[name] = guid;
 	return true;
 }
@@ -1167,13 +1530,13 @@ void IOLoginData::loadItems(ItemMap& itemMap, DBResult* result)
 {
 	do
 	{
-		int32_t sid = result->getDataInt("sid");
-		int32_t pid = result->getDataInt("pid");
-		int32_t type = result->getDataInt("itemtype");
-		int32_t count = result->getDataInt("count");
+		int32_t sid = result->getDataInt(1);
+		int32_t pid = result->getDataInt(0);
+		int32_t type = result->getDataInt(2);
+		int32_t count = result->getDataInt(3);
 
 		unsigned long attrSize = 0;
-		const char* attr = result->getDataStream("attributes", attrSize);
+		const char* attr = result->getDataStream(4, attrSize);
 
 		PropStream propStream;
 		propStream.init(attr, attrSize);
@@ -1245,6 +1608,7 @@ bool IOLoginData::changeName(uint32_t guid, std::string newName)
 	if(!db->executeQuery(query.str()))
 		return false;
 
+	boost::mutex::scoped_lock lockClass(m_cacheLock);
 	nameCacheMap[guid] = newName;
 	return true;
 }
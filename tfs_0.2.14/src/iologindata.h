@@ -22,6 +22,8 @@
 #define __IOLOGINDATA_H
 
 #include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 #include "account.h"
 #include "player.h"
 #include "database.h"
@@ -38,10 +40,56 @@ struct PlayerGroup
 typedef std::pair<int32_t, Item*> itemBlock;
 typedef std::list<itemBlock> ItemBlockList;
 
+// Everything savePlayer writes, copied out of the player on the dispatcher
+// so that the database part can run on another thread.
+struct PlayerSnapshot
+{
+	struct ItemRow
+	{
+		int32_t pid;
+		int32_t sid;
+		uint16_t type;
+		int32_t count;
+		std::string attributes;
+	};
+	typedef std::vector<ItemRow> ItemRowList;
+
+	uint64_t generation;
+	uint32_t guid;
+	std::string name;
+	time_t lastLoginSaved;
+	uint32_t lastIP;
+
+	// numeric `players` columns, the names only vary by which are written at all
+	typedef std::vector<std::pair<const char*, int64_t> > ColumnList;
+	ColumnList columns;
+	std::string conditions;
+	std::string guildNick;
+	uint32_t guildId;
+	uint32_t guildLevel;
+
+	uint32_t skills[SKILL_LAST + 1][2];
+	LearnedInstantSpellList spells;
+	ItemRowList items;
+	ItemRowList depotItems;
+	InvitedToGuildsList guildInvites;
+	VIPListSet vips;
+
+	// the whole storage, and what has to be written of it unless fullStorage is set
+	StorageMap storage;
+	StorageMap changedStorage;
+	std::vector<uint32_t> removedStorage;
+	bool fullStorage;
+
+	size_t digests[PLAYERSAVE_LAST + 1];
+	bool dirty[PLAYERSAVE_LAST + 1];
+};
+typedef boost::shared_ptr<PlayerSnapshot> PlayerSnapshot_ptr;
+
 class IOLoginData
 {
 	public:
-		IOLoginData() {}
+		IOLoginData() : m_saveGeneration(0) {}
 		~IOLoginData() {}
 
 		static IOLoginData* getInstance()
@@ -68,6 +116,17 @@ class IOLoginData
 
 		bool loadPlayer(Player* player, const std::string& name, bool preload = false);
 		bool savePlayer(Player* player, bool preSave);
+		// savePlayer in two steps, capturePlayer has to run on the dispatcher
+		// while writePlayer may run on any thread
+		PlayerSnapshot_ptr capturePlayer(Player* player, bool preSave);
+		bool writePlayer(const PlayerSnapshot& snapshot);
+		// marks what a written snapshot holds as saved, on the dispatcher
+		void onPlayerSaved(Player* player, const PlayerSnapshot& snapshot);
+		// one item list (PLAYERSAVE_ITEMS or PLAYERSAVE_DEPOT) and its digest
+		size_t capturePlayerItems(Player* player, PlayerSaveSection_t section, PlayerSnapshot::ItemRowList& rows);
+		// writes what the save journal held of a player: the columns, the dirty
+		// item lists and changedStorage/removedStorage
+		bool writeJournal(const PlayerSnapshot& snapshot);
 		bool getGuidByName(uint32_t& guid, std::string& name);
 		bool getGuidByNameEx(uint32_t &guid, bool& specialVip, std::string& name);
 		bool getNameByGuid(uint32_t guid, std::string& name);
@@ -101,15 +160,29 @@ class IOLoginData
 		typedef std::map<int32_t ,std::pair<Item*, int32_t> > ItemMap;
 
 		void loadItems(ItemMap& itemMap, DBResult* result);
-		bool saveItems(const Player* player, const ItemBlockList& itemList, DBInsert& query_insert);
+		void captureItems(const ItemBlockList& itemList, PlayerSnapshot::ItemRowList& rows);
+		bool writeItems(uint32_t guid, const PlayerSnapshot::ItemRowList& rows, DBInsertStatement& stmt);
+		bool writeItemSection(uint32_t guid, PlayerSaveSection_t section, const PlayerSnapshot::ItemRowList& rows);
+		bool writeStorage(const PlayerSnapshot& snapshot);
+		bool deletePlayerRows(const char* table, uint32_t guid);
+		static size_t digestStorage(const StorageMap& storage);
 
 		typedef std::map<uint32_t, std::string> NameCacheMap;
 		typedef std::map<std::string, uint32_t, StringCompareCase> GuidCacheMap;
 		typedef std::map<uint32_t, PlayerGroup*> PlayerGroupMap;
 
 		PlayerGroupMap playerGroupMap;
+
+		// generation of the last snapshot written per player, guarded by m_writeLock
+		typedef std::map<uint32_t, uint64_t> GenerationMap;
+		GenerationMap m_writtenGenerations;
+		uint64_t m_saveGeneration;
+		boost::recursive_mutex m_writeLock;
+
+		// database threads look names up as well
 		NameCacheMap nameCacheMap;
 		GuidCacheMap guidCacheMap;
+		boost::mutex m_cacheLock;
 };
 
 #endif
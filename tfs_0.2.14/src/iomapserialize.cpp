@@ -52,18 +52,36 @@ bool IOMapSerialize::loadMap(Map* map)
 }
 
 bool IOMapSerialize::saveMap(Map* map)
+{
+	MapSnapshot snapshot;
+	captureMap(map, snapshot);
+	return writeMap(snapshot);
+}
+
+void IOMapSerialize::captureMap(Map* map, MapSnapshot& snapshot)
+{
+	snapshot.storageType = g_config.getString(ConfigManager::MAP_STORAGE_TYPE);
+	if(snapshot.storageType == "binary-tilebased")
+		captureMapBinaryTileBased(map, snapshot);
+	else if(snapshot.storageType == "binary")
+		captureMapBinary(map, snapshot);
+	else
+		captureMapRelational(map, snapshot);
+}
+
+bool IOMapSerialize::writeMap(const MapSnapshot& snapshot)
 {
 	int64_t start = OTSYS_TIME();
 	bool s = false;
 
-	if(g_config.getString(ConfigManager::MAP_STORAGE_TYPE) == "binary-tilebased")
-		s = saveMapBinaryTileBased(map);
-	else if(g_config.getString(ConfigManager::MAP_STORAGE_TYPE) == "binary")
-		s = saveMapBinary(map);
+	if(snapshot.storageType == "binary-tilebased")
+		s = writeMapBinary(snapshot, "tile_store");
+	else if(snapshot.storageType == "binary")
+		s = writeMapBinary(snapshot, "map_store");
 	else
-		s = saveMapRelational(map);
+		s = writeMapRelational(snapshot);
 
-	std::cout << "Notice: Map save (" << g_config.getString(ConfigManager::MAP_STORAGE_TYPE) << ") took : " <<
+	std::cout << "Notice: Map save (" << snapshot.storageType << ") took : " <<
 		(OTSYS_TIME() - start)/(1000.) << " s" << std::endl;
 
 	return s;
@@ -212,7 +230,24 @@ bool IOMapSerialize::loadTile(Database& db, Tile* tile)
 	return true;
 }
 
-bool IOMapSerialize::saveMapRelational(Map* map)
+void IOMapSerialize::captureMapRelational(Map* map, MapSnapshot& snapshot)
+{
+	uint32_t tileId = 0;
+	for(HouseMap::iterator it = Houses::getInstance().getHouseBegin(); it != Houses::getInstance().getHouseEnd(); ++it)
+	{
+		//save house items
+		House* house = it->second;
+		for(HouseTileList::iterator it = house->getHouseTileBegin(); it != house->getHouseTileEnd(); ++it)
+		{
+			++tileId;
+			MapSnapshot::TileRow row;
+			if(captureTile(tileId, *it, row))
+				snapshot.tiles.push_back(row);
+		}
+	}
+}
+
+bool IOMapSerialize::writeMapRelational(const MapSnapshot& snapshot)
 {
 	Database* db = Database::getInstance();
 	DBQuery query; // KEEP FOR DATABASE LOCKING!
@@ -229,41 +264,27 @@ bool IOMapSerialize::saveMapRelational(Map* map)
 	if(!db->executeQuery("DELETE FROM `tiles`;"))
 		return false;
 
-	uint32_t tileId = 0;
-	for(HouseMap::iterator it = Houses::getInstance().getHouseBegin(); it != Houses::getInstance().getHouseEnd(); ++it)
-	{
-		//save house items
-		House* house = it->second;
-		for(HouseTileList::iterator it = house->getHouseTileBegin(); it != house->getHouseTileEnd(); ++it)
-		{
-			++tileId;
-			saveTile(db, tileId, *it);
-		}
-	}
+	for(std::vector<MapSnapshot::TileRow>::const_iterator it = snapshot.tiles.begin(); it != snapshot.tiles.end(); ++it)
+		writeTile(db, *it);
 
 	//End the transaction
 	return transaction.commit();
 }
 
-bool IOMapSerialize::saveTile(Database* db, uint32_t tileId, const Tile* tile)
+bool IOMapSerialize::captureTile(uint32_t tileId, const Tile* tile, MapSnapshot::TileRow& row)
 {
 	typedef std::list<std::pair<Container*, int> > ContainerStackList;
 	typedef ContainerStackList::value_type ContainerStackList_Pair;
 	ContainerStackList containerStackList;
 
-	bool storedTile = false;
 	int32_t runningID = 0;
 	Item* item = NULL;
 	Container* container = NULL;
 
 	int32_t parentid = 0;
-	std::ostringstream streamitems;
-	std::string itemsstring;
 
-	DBQuery tileListQuery;
-
-	DBInsert stmt(db);
-	stmt.setQuery("INSERT INTO `tile_items` (`tile_id`, `sid` , `pid` , `itemtype` , `count`, `attributes` ) VALUES ");
+	row.id = tileId;
+	row.pos = tile->getPosition();
 	if(const TileItemVector* items = tile->getItemList())
 	{
 		for(ItemVector::const_reverse_iterator it = items->rbegin(), rend = items->rend(); it != rend; ++it)
@@ -280,29 +301,8 @@ bool IOMapSerialize::saveTile(Database* db, uint32_t tileId, const Tile* tile)
 			if(item->getBed() && !tile->hasFlag(TILESTATE_HOUSE))
 				continue;
 
-			if(!storedTile)
-			{
-				const Position& tilePos = tile->getPosition();
-				tileListQuery << "INSERT INTO `tiles` (`id`, `x` , `y` , `z` ) VALUES (" << tileId << "," << tilePos.x << "," << tilePos.y << "," << tilePos.z << ")";
-				if(!db->executeQuery(tileListQuery.str()))
-					return false;
-
-				tileListQuery.str("");
-				storedTile = true;
-			}
 			++runningID;
-
-			uint32_t attributesSize;
-
-			PropWriteStream propWriteStream;
-			item->serializeAttr(propWriteStream);
-			const char* attributes = propWriteStream.getStream(attributesSize);
-
-			streamitems << tileId << "," << runningID << "," << parentid << "," << item->getID() << ","
-				<< (int32_t)item->getSubType() << "," << db->escapeBlob(attributes, attributesSize);
-			if(!stmt.addRow(streamitems))
-				return false;
-
+			row.items.push_back(captureItem(runningID, parentid, item));
 			if(item->getContainer())
 				containerStackList.push_back(ContainerStackList_Pair(item->getContainer(), runningID));
 		}
@@ -321,19 +321,47 @@ bool IOMapSerialize::saveTile(Database* db, uint32_t tileId, const Tile* tile)
 				if(item->getContainer())
 					containerStackList.push_back(ContainerStackList_Pair(item->getContainer(), runningID));
 
-				uint32_t attributesSize;
-
-				PropWriteStream propWriteStream;
-				item->serializeAttr(propWriteStream);
-				const char* attributes = propWriteStream.getStream(attributesSize);
-
-				streamitems << tileId << "," << runningID << "," << parentid << "," << item->getID() << ","
-					<< (int32_t)item->getSubType() << "," << db->escapeBlob(attributes, attributesSize);
-				if(!stmt.addRow(streamitems))
-					return false;
+				row.items.push_back(captureItem(runningID, parentid, item));
 			}
 		}
 	}
+	return !row.items.empty();
+}
+
+MapSnapshot::ItemRow IOMapSerialize::captureItem(int32_t sid, int32_t pid, const Item* item)
+{
+	MapSnapshot::ItemRow row;
+	row.sid = sid;
+	row.pid = pid;
+	row.type = item->getID();
+	row.count = item->getSubType();
+
+	uint32_t attributesSize;
+
+	PropWriteStream propWriteStream;
+	item->serializeAttr(propWriteStream);
+	const char* attributes = propWriteStream.getStream(attributesSize);
+	row.attributes.assign(attributes, attributesSize);
+	return row;
+}
+
+bool IOMapSerialize::writeTile(Database* db, const MapSnapshot::TileRow& row)
+{
+	DBQuery tileListQuery;
+	tileListQuery << "INSERT INTO `tiles` (`id`, `x` , `y` , `z` ) VALUES (" << row.id << "," << row.pos.x << "," << row.pos.y << "," << row.pos.z << ")";
+	if(!db->executeQuery(tileListQuery.str()))
+		return false;
+
+	std::ostringstream streamitems;
+	DBInsert stmt(db);
+	stmt.setQuery("INSERT INTO `tile_items` (`tile_id`, `sid` , `pid` , `itemtype` , `count`, `attributes` ) VALUES ");
+	for(std::vector<MapSnapshot::ItemRow>::const_iterator it = row.items.begin(); it != row.items.end(); ++it)
+	{
+		streamitems << row.id << "," << it->sid << "," << it->pid << "," << it->type << ","
+			<< it->count << "," << db->escapeBlob(it->attributes.c_str(), it->attributes.length());
+		if(!stmt.addRow(streamitems))
+			return false;
+	}
 	return stmt.execute();
 }
 
@@ -547,65 +575,76 @@ bool IOMapSerialize::loadItem(PropStream& propStream, Cylinder* parent)
 	return true;
 }
 
-bool IOMapSerialize::saveMapBinary(Map* map)
+void IOMapSerialize::captureMapBinary(Map* map, MapSnapshot& snapshot)
 {
- 	Database* db = Database::getInstance();
-	DBQuery query;
-
-	//Start the transaction
-	DBTransaction transaction(db);
-	if(!transaction.begin())
-		return false;
-
-	if(!db->executeQuery("DELETE FROM `map_store`;"))
- 		return false;
-
-	DBInsert stmt(db);
-	stmt.setQuery("INSERT INTO `map_store` (`house_id`, `data`) VALUES ");
-
-	//clear old tile data
  	for(HouseMap::iterator it = Houses::getInstance().getHouseBegin();
 		it != Houses::getInstance().getHouseEnd();
 		++it)
 	{
  		//save house items
- 		House* house = it->second;
-		PropWriteStream stream;
-		for(HouseTileList::iterator tile_iter = house->getHouseTileBegin(); tile_iter != house->getHouseTileEnd(); ++tile_iter)
-			saveTile(stream, *tile_iter);
-
-		uint32_t attributesSize;
-		const char* attributes = stream.getStream(attributesSize);
-
-		query << it->second->getHouseId() << "," << db->escapeBlob(attributes, attributesSize);
-		if(!stmt.addRow(query))
-			return false;
+		snapshot.blobs.push_back(std::make_pair(it->second->getHouseId(), std::string()));
+		captureHouseItems(it->second, snapshot.blobs.back().second);
 	}
+}
 
-	if(!stmt.execute())
-		return false;
+void IOMapSerialize::captureHouseItems(House* house, std::string& data)
+{
+	PropWriteStream stream;
+	for(HouseTileList::iterator it = house->getHouseTileBegin(); it != house->getHouseTileEnd(); ++it)
+		saveTile(stream, *it);
 
- 	//End the transaction
- 	return transaction.commit();
+	uint32_t attributesSize;
+	const char* attributes = stream.getStream(attributesSize);
+	data.assign(attributes, attributesSize);
 }
 
-bool IOMapSerialize::saveMapBinaryTileBased(Map* map)
+bool IOMapSerialize::loadHouseItems(Map* map, House* house, const std::string& data)
 {
- 	Database* db = Database::getInstance();
- 	DBQuery query;
+	//take away what loadMap put there, the same items saveTile writes
+	for(HouseTileList::iterator it = house->getHouseTileBegin(); it != house->getHouseTileEnd(); ++it)
+	{
+		std::vector<Item*> removeItems;
+		if(const TileItemVector* items = (*it)->getItemList())
+		{
+			for(ItemVector::const_iterator iit = items->begin(), end = items->end(); iit != end; ++iit)
+			{
+				Item* item = *iit;
+				if(!item->isNotMoveable())
+					removeItems.push_back(item);
+				else if(Container* container = item->getContainer())
+					removeItems.insert(removeItems.end(), container->getItems(), container->getEnd());
+			}
+		}
 
-	//Start the transaction
-	DBTransaction transaction(db);
-	if(!transaction.begin())
-		return false;
+		for(std::vector<Item*>::iterator iit = removeItems.begin(); iit != removeItems.end(); ++iit)
+			g_game.internalRemoveItem(*iit);
+	}
 
-	if(!db->executeQuery("DELETE FROM `tile_store`;"))
- 		return false;
+	PropStream propStream;
+	propStream.init(data.c_str(), data.length());
+	while(propStream.size())
+	{
+		uint16_t x = 0, y = 0;
+		uint8_t z = 0;
+		uint32_t itemCount = 0;
+		if(!propStream.GET_USHORT(x) || !propStream.GET_USHORT(y) || !propStream.GET_UCHAR(z) || !propStream.GET_ULONG(itemCount))
+			return false;
 
-	DBInsert stmt(db);
-	stmt.setQuery("INSERT INTO `tile_store` (`house_id`, `data`) VALUES ");
+		Tile* tile = map->getTile(x, y, z);
+		if(!tile)
+			return false;
 
-	//clear old tile data
+		while(itemCount--)
+		{
+			if(!loadItem(propStream, tile))
+				return false;
+		}
+	}
+	return true;
+}
+
+void IOMapSerialize::captureMapBinaryTileBased(Map* map, MapSnapshot& snapshot)
+{
  	for(HouseMap::iterator it = Houses::getInstance().getHouseBegin();
  		it != Houses::getInstance().getHouseEnd();
 		++it)
@@ -620,13 +659,32 @@ bool IOMapSerialize::saveMapBinaryTileBased(Map* map)
 			const char* attributes = stream.getStream(attributesSize);
 
 			if(attributesSize > 0)
-			{
-				query << it->second->getHouseId() << "," << db->escapeBlob(attributes, attributesSize);
-				if(!stmt.addRow(query))
-					return false;
-			}
+				snapshot.blobs.push_back(std::make_pair(house->getHouseId(), std::string(attributes, attributesSize)));
 		}
 	}
+}
+
+bool IOMapSerialize::writeMapBinary(const MapSnapshot& snapshot, const std::string& table)
+{
+ 	Database* db = Database::getInstance();
+	DBQuery query;
+
+	//Start the transaction
+	DBTransaction transaction(db);
+	if(!transaction.begin())
+		return false;
+
+	if(!db->executeQuery("DELETE FROM `" + table + "`;"))
+ 		return false;
+
+	DBInsert stmt(db);
+	stmt.setQuery("INSERT INTO `" + table + "` (`house_id`, `data`) VALUES ");
+	for(std::vector<std::pair<uint32_t, std::string> >::const_iterator it = snapshot.blobs.begin(); it != snapshot.blobs.end(); ++it)
+	{
+		query << it->first << "," << db->escapeBlob(it->second.c_str(), it->second.length());
+		if(!stmt.addRow(query))
+			return false;
+	}
 
 	if(!stmt.execute())
 		return false;
@@ -734,6 +792,42 @@ bool IOMapSerialize::loadHouseInfo(Map* map)
 }
 
 bool IOMapSerialize::saveHouseInfo(Map* map)
+{
+	MapSnapshot snapshot;
+	captureHouseInfo(map, snapshot);
+	return writeHouseInfo(snapshot);
+}
+
+void IOMapSerialize::captureHouseInfo(Map* map, MapSnapshot& snapshot)
+{
+	for(HouseMap::iterator it = Houses::getInstance().getHouseBegin(); it != Houses::getInstance().getHouseEnd(); ++it)
+	{
+		House* house = it->second;
+
+		MapSnapshot::HouseRow row;
+		row.id = house->getHouseId();
+		row.owner = house->getHouseOwner();
+		row.paid = house->getPaidUntil();
+		row.warnings = house->getPayRentWarnings();
+		snapshot.houses.push_back(row);
+
+		std::string listText;
+		if(house->getAccessList(GUEST_LIST, listText) && listText != "")
+			snapshot.accessLists.push_back(MapSnapshot::AccessRow(row.id, GUEST_LIST, listText));
+
+		if(house->getAccessList(SUBOWNER_LIST, listText) && listText != "")
+			snapshot.accessLists.push_back(MapSnapshot::AccessRow(row.id, SUBOWNER_LIST, listText));
+
+		for(HouseDoorList::iterator it = house->getHouseDoorBegin(); it != house->getHouseDoorEnd(); ++it)
+		{
+			const Door* door = *it;
+			if(door->getAccessList(listText) && listText != "")
+				snapshot.accessLists.push_back(MapSnapshot::AccessRow(row.id, door->getDoorId(), listText));
+		}
+	}
+}
+
+bool IOMapSerialize::writeHouseInfo(const MapSnapshot& snapshot)
 {
 	Database* db = Database::getInstance();
 	DBQuery query;
@@ -750,11 +844,9 @@ bool IOMapSerialize::saveHouseInfo(Map* map)
 
 	DBInsert stmt(db);
 	stmt.setQuery("INSERT INTO `houses` (`id` , `owner` , `paid`, `warnings`) VALUES ");
-	for(HouseMap::iterator it = Houses::getInstance().getHouseBegin(); it != Houses::getInstance().getHouseEnd(); ++it)
+	for(std::vector<MapSnapshot::HouseRow>::const_iterator it = snapshot.houses.begin(); it != snapshot.houses.end(); ++it)
 	{
-		House* house = it->second;
-
-		query << house->getHouseId() << "," << house->getHouseOwner() << "," << house->getPaidUntil() << "," << house->getPayRentWarnings();
+		query << it->id << "," << it->owner << "," << it->paid << "," << it->warnings;
 		if(!stmt.addRow(query))
 			return false;
 	}
@@ -763,35 +855,11 @@ bool IOMapSerialize::saveHouseInfo(Map* map)
 		return false;
 
 	stmt.setQuery("INSERT INTO `house_lists` (`house_id` , `listid` , `list`) VALUES ");
-	for(HouseMap::iterator it = Houses::getInstance().getHouseBegin(); it != Houses::getInstance().getHouseEnd(); ++it)
+	for(std::vector<MapSnapshot::AccessRow>::const_iterator it = snapshot.accessLists.begin(); it != snapshot.accessLists.end(); ++it)
 	{
-		House* house = it->second;
-
-		std::string listText;
-		if(house->getAccessList(GUEST_LIST, listText) && listText != "")
-		{
-			query << house->getHouseId() << "," << GUEST_LIST << "," << db->escapeString(listText);
-			if(!stmt.addRow(query))
-				return false;
-		}
-
-		if(house->getAccessList(SUBOWNER_LIST, listText) && listText != "")
-		{
-			query << house->getHouseId() << "," << SUBOWNER_LIST << "," << db->escapeString(listText);
-			if(!stmt.addRow(query))
-				return false;
-		}
-
-		for(HouseDoorList::iterator it = house->getHouseDoorBegin(); it != house->getHouseDoorEnd(); ++it)
-		{
-			const Door* door = *it;
-			if(door->getAccessList(listText) && listText != "")
-			{
-				query << house->getHouseId() << "," << door->getDoorId() << "," << db->escapeString(listText);
-				if(!stmt.addRow(query))
-					return false;
-			}
-		}
+		query << it->houseId << "," << it->listId << "," << db->escapeString(it->list);
+		if(!stmt.addRow(query))
+			return false;
 	}
 
 	if(!stmt.execute())
@@ -26,6 +26,56 @@
 
 #include <string>
 
+class House;
+
+// What saveMap and saveHouseInfo write, copied out of the houses on the
+// dispatcher so that the database part can run on another thread.
+struct MapSnapshot
+{
+	struct HouseRow
+	{
+		uint32_t id;
+		uint32_t owner;
+		uint32_t paid;
+		uint32_t warnings;
+	};
+
+	struct AccessRow
+	{
+		AccessRow(uint32_t _houseId, uint32_t _listId, const std::string& _list) :
+			houseId(_houseId), listId(_listId), list(_list) {}
+
+		uint32_t houseId;
+		uint32_t listId;
+		std::string list;
+	};
+
+	struct ItemRow
+	{
+		int32_t sid;
+		int32_t pid;
+		uint16_t type;
+		int32_t count;
+		std::string attributes;
+	};
+
+	struct TileRow
+	{
+		uint32_t id;
+		Position pos;
+		std::vector<ItemRow> items;
+	};
+
+	std::string storageType;
+	std::vector<HouseRow> houses;
+	std::vector<AccessRow> accessLists;
+
+	// relational storage
+	std::vector<TileRow> tiles;
+	// binary storages, house id and serialized tiles
+	std::vector<std::pair<uint32_t, std::string> > blobs;
+};
+
 class IOMapSerialize
 {
 	public:
@@ -37,23 +87,41 @@ class IOMapSerialize
 		bool loadHouseInfo(Map* map);
 		bool saveHouseInfo(Map* map);
 
+		// the save functions in two steps, capture has to run on the
+		// dispatcher while write may run on any thread
+		void captureMap(Map* map, MapSnapshot& snapshot);
+		bool writeMap(const MapSnapshot& snapshot);
+		void captureHouseInfo(Map* map, MapSnapshot& snapshot);
+		bool writeHouseInfo(const MapSnapshot& snapshot);
+
+		// the items of one house in the binary storage layout, for the save journal
+		void captureHouseItems(House* house, std::string& data);
+		// replaces what loadMap put into the house
+		bool loadHouseItems(Map* map, House* house, const std::string& data);
+
 	protected:
 		// Relational storage uses a row for each item/tile
 		bool loadMapRelational(Map* map);
-		bool saveMapRelational(Map* map);
+		void captureMapRelational(Map* map, MapSnapshot& snapshot);
+		bool writeMapRelational(const MapSnapshot& snapshot);
 
 		void loadMapBinary(Map* map);
-		bool saveMapBinary(Map* map);
+		void captureMapBinary(Map* map, MapSnapshot& snapshot);
 
 		void loadMapBinaryTileBased(Map* map);
-		bool saveMapBinaryTileBased(Map* map);
+		void captureMapBinaryTileBased(Map* map, MapSnapshot& snapshot);
+
+		// both binary storages share the same layout
+		bool writeMapBinary(const MapSnapshot& snapshot, const std::string& table);
 
 		void saveItem(PropWriteStream& stream, const Item* item);
 		void saveTile(PropWriteStream& stream, const Tile* tile);
 
 		bool loadContainer(PropStream& propStream, Container* container);
 		bool loadItem(PropStream& propStream, Cylinder* parent);
-		bool saveTile(Database* db, uint32_t tileId, const Tile* tile);
+		bool captureTile(uint32_t tileId, const Tile* tile, MapSnapshot::TileRow& row);
+		MapSnapshot::ItemRow captureItem(int32_t sid, int32_t pid, const Item* item);
+		bool writeTile(Database* db, const MapSnapshot::TileRow& row);
 		bool loadTile(Database& db, Tile* tile);
 };
 
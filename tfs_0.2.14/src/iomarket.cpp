@@ -23,6 +23,8 @@
 #include "iomarket.h"
 #include "iologindata.h"
 #include "configmanager.h"
+#include "databaseexecutor.h"
+#include "tasks.h"
 
 extern ConfigManager g_config;
 
@@ -30,25 +32,30 @@ MarketOfferList IOMarket::getActiveOffers(MarketAction_t action, uint16_t itemId
 {
 	MarketOfferList offerList;
 
-	DBQuery query;
-	query << "SELECT `id`, `player_id`, `amount`, `price`, `created`, `anonymous` FROM `market_offers` WHERE `sale` = " << action << " AND `itemtype` = " << itemId << ";";
-
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
 	Database* db = Database::getInstance();
+	DBStatement* stmt = db->prepareStatement("SELECT `id`, `player_id`, `amount`, `price`, `created`, `anonymous` FROM `market_offers` WHERE `sale` = ? AND `itemtype` = ?;");
+	if(!stmt)
+		return offerList;
+
+	stmt->bindInt(1, action);
+	stmt->bindInt(2, itemId);
+
 	DBResult* result;
-	if(!(result = db->storeQuery(query.str())))
+	if(!(result = stmt->storeQuery()))
 		return offerList;
 
 	const int32_t marketOfferDuration = g_config.getNumber(ConfigManager::MARKET_OFFER_DURATION);
 	do
 	{
 		MarketOffer offer;
-		offer.amount = result->getDataInt("amount");
-		offer.price = result->getDataInt("price");
-		offer.timestamp = result->getDataInt("created") + marketOfferDuration;
-		offer.counter = result->getDataInt("id") & 0xFFFF;
-		if(result->getDataInt("anonymous") == 0)
+		offer.amount = result->getDataInt(2);
+		offer.price = result->getDataInt(3);
+		offer.timestamp = result->getDataInt(4) + marketOfferDuration;
+		offer.counter = result->getDataInt(0) & 0xFFFF;
+		if(result->getDataInt(5) == 0)
 		{
-			IOLoginData::getInstance()->getNameByGuid(result->getDataInt("player_id"), offer.playerName);
+			IOLoginData::getInstance()->getNameByGuid(result->getDataInt(1), offer.playerName);
 			if(offer.playerName.empty())
 				offer.playerName = "Anonymous";
 		}
@@ -68,22 +75,27 @@ MarketOfferList IOMarket::getOwnOffers(MarketAction_t action, uint32_t playerId)
 
 	const int32_t marketOfferDuration = g_config.getNumber(ConfigManager::MARKET_OFFER_DURATION);
 
-	DBQuery query;
-	query << "SELECT `id`, `amount`, `price`, `created`, `anonymous`, `itemtype` FROM `market_offers` WHERE `player_id` = " << playerId << " AND `sale` = " << action << ";";
-
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
 	Database* db = Database::getInstance();
+	DBStatement* stmt = db->prepareStatement("SELECT `id`, `amount`, `price`, `created`, `anonymous`, `itemtype` FROM `market_offers` WHERE `player_id` = ? AND `sale` = ?;");
+	if(!stmt)
+		return offerList;
+
+	stmt->bindInt(1, playerId);
+	stmt->bindInt(2, action);
+
 	DBResult* result;
-	if(!(result = db->storeQuery(query.str())))
+	if(!(result = stmt->storeQuery()))
 		return offerList;
 
 	do
 	{
 		MarketOffer offer;
-		offer.amount = result->getDataInt("amount");
-		offer.price = result->getDataInt("price");
-		offer.timestamp = result->getDataInt("created") + marketOfferDuration;
-		offer.counter = result->getDataInt("id") & 0xFFFF;
-		offer.itemId = result->getDataInt("itemtype");
+		offer.amount = result->getDataInt(1);
+		offer.price = result->getDataInt(2);
+		offer.timestamp = result->getDataInt(3) + marketOfferDuration;
+		offer.counter = result->getDataInt(0) & 0xFFFF;
+		offer.itemId = result->getDataInt(5);
 
 		offerList.push_back(offer);
 	}
@@ -96,23 +108,28 @@ HistoryMarketOfferList IOMarket::getOwnHistory(MarketAction_t action, uint32_t p
 {
 	HistoryMarketOfferList offerList;
 
-	DBQuery query;
-	query << "SELECT `id`, `itemtype`, `amount`, `price`, `expires_at`, `state` FROM `market_history` WHERE `player_id` = " << playerId << " AND `sale` = " << action << ";";
-
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
 	Database* db = Database::getInstance();
+	DBStatement* stmt = db->prepareStatement("SELECT `id`, `itemtype`, `amount`, `price`, `expires_at`, `state` FROM `market_history` WHERE `player_id` = ? AND `sale` = ?;");
+	if(!stmt)
+		return offerList;
+
+	stmt->bindInt(1, playerId);
+	stmt->bindInt(2, action);
+
 	DBResult* result;
-	if(!(result = db->storeQuery(query.str())))
+	if(!(result = stmt->storeQuery()))
 		return offerList;
 
 	do
 	{
 		HistoryMarketOffer offer;
-		offer.itemId = result->getDataInt("itemtype");
-		offer.amount = result->getDataInt("amount");
-		offer.price = result->getDataInt("price");
-		offer.timestamp = result->getDataInt("expires_at");
+		offer.itemId = result->getDataInt(1);
+		offer.amount = result->getDataInt(2);
+		offer.price = result->getDataInt(3);
+		offer.timestamp = result->getDataInt(4);
 
-		MarketOfferState_t offerState = (MarketOfferState_t)result->getDataInt("state");
+		MarketOfferState_t offerState = (MarketOfferState_t)result->getDataInt(5);
 		if(offerState == OFFERSTATE_ACCEPTEDEX)
 			offerState = OFFERSTATE_ACCEPTED;
 
@@ -131,22 +148,27 @@ ExpiredMarketOfferList IOMarket::getExpiredOffers(MarketAction_t action)
 
 	const time_t lastExpireDate = time(NULL) - g_config.getNumber(ConfigManager::MARKET_OFFER_DURATION);
 
-	DBQuery query;
-	query << "SELECT `id`, `amount`, `price`, `itemtype`, `player_id` FROM `market_offers` WHERE `sale` = " << action << " AND `created` <= " << lastExpireDate << ";";
-
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
 	Database* db = Database::getInstance();
+	DBStatement* stmt = db->prepareStatement("SELECT `id`, `amount`, `price`, `itemtype`, `player_id` FROM `market_offers` WHERE `sale` = ? AND `created` <= ?;");
+	if(!stmt)
+		return offerList;
+
+	stmt->bindInt(1, action);
+	stmt->bindInt(2, lastExpireDate);
+
 	DBResult* result;
-	if(!(result = db->storeQuery(query.str())))
+	if(!(result = stmt->storeQuery()))
 		return offerList;
 
 	do
 	{
 		ExpiredMarketOffer offer;
-		offer.id = result->getDataInt("id");
-		offer.amount = result->getDataInt("amount");
-		offer.price = result->getDataInt("price");
-		offer.itemId = result->getDataInt("itemtype");
-		offer.playerId = result->getDataInt("player_id");
+		offer.id = result->getDataInt(0);
+		offer.amount = result->getDataInt(1);
+		offer.price = result->getDataInt(2);
+		offer.itemId = result->getDataInt(3);
+		offer.playerId = result->getDataInt(4);
 
 		offerList.push_back(offer);
 	}
@@ -158,15 +180,20 @@ ExpiredMarketOfferList IOMarket::getExpiredOffers(MarketAction_t action)
 int32_t IOMarket::getPlayerOfferCount(uint32_t playerId)
 {
 	int32_t count = -1;
+
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
 	Database* db = Database::getInstance();
-	DBResult* result;
+	DBStatement* stmt = db->prepareStatement("SELECT COUNT(*) AS `count` FROM `market_offers` WHERE `player_id` = ?;");
+	if(!stmt)
+		return count;
+
+	stmt->bindInt(1, playerId);
 
-	DBQuery query;
-	query << "SELECT COUNT(*) AS `count` FROM `market_offers` WHERE `player_id` = " << playerId << ";";
-	if(!(result = db->storeQuery(query.str())))
+	DBResult* result;
+	if(!(result = stmt->storeQuery()))
 		return count;
 
-	count = result->getDataInt("count");
+	count = result->getDataInt(0);
 	db->freeResult(result);
 	return count;
 }
@@ -174,22 +201,28 @@ int32_t IOMarket::getPlayerOfferCount(uint32_t playerId)
 MarketOfferEx IOMarket::getOfferById(uint32_t id)
 {
 	MarketOfferEx offer;
-	DBQuery query;
-	query << "SELECT `id`, `sale`, `itemtype`, `amount`, `created`, `price`, `player_id`, `anonymous` FROM `market_offers` WHERE `id` = " << id << ";";
+
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
 	Database* db = Database::getInstance();
+	DBStatement* stmt = db->prepareStatement("SELECT `id`, `sale`, `itemtype`, `amount`, `created`, `price`, `player_id`, `anonymous` FROM `market_offers` WHERE `id` = ?;");
+	if(!stmt)
+		return offer;
+
+	stmt->bindInt(1, id);
+
 	DBResult* result;
-	if((result = db->storeQuery(query.str())))
+	if((result = stmt->storeQuery()))
 	{
-		offer.type = (MarketAction_t)result->getDataInt("sale");
-		offer.amount = result->getDataInt("amount");
-		offer.counter = result->getDataInt("id") & 0xFFFF;
-		offer.timestamp = result->getDataInt("created");
-		offer.price = result->getDataInt("price");
-		offer.itemId = result->getDataInt("itemtype");
-
-		int32_t playerId = result->getDataInt("player_id");
+		offer.type = (MarketAction_t)result->getDataInt(1);
+		offer.amount = result->getDataInt(3);
+		offer.counter = result->getDataInt(0) & 0xFFFF;
+		offer.timestamp = result->getDataInt(4);
+		offer.price = result->getDataInt(5);
+		offer.itemId = result->getDataInt(2);
+
+		int32_t playerId = result->getDataInt(6);
 		offer.playerId = playerId;
-		if(result->getDataInt("anonymous") == 0)
+		if(result->getDataInt(7) == 0)
 		{
 			IOLoginData::getInstance()->getNameByGuid(playerId, offer.playerName);
 			if(offer.playerName.empty())
@@ -207,13 +240,19 @@ uint32_t IOMarket::getOfferIdByCounter(uint32_t timestamp, uint16_t counter)
 {
 	const int32_t created = timestamp - g_config.getNumber(ConfigManager::MARKET_OFFER_DURATION);
 
-	DBQuery query;
-	query << "SELECT `id` FROM `market_offers` WHERE `created` = " << created << " AND (`id` & 65535) = " << counter << " LIMIT 1;";
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
 	Database* db = Database::getInstance();
+	DBStatement* stmt = db->prepareStatement("SELECT `id` FROM `market_offers` WHERE `created` = ? AND (`id` & 65535) = ? LIMIT 1;");
+	if(!stmt)
+		return 0;
+
+	stmt->bindInt(1, created);
+	stmt->bindInt(2, counter);
+
 	DBResult* result;
-	if((result = db->storeQuery(query.str())))
+	if((result = stmt->storeQuery()))
 	{
-		uint32_t offerId = result->getDataInt("id");
+		uint32_t offerId = result->getDataInt(0);
 		db->freeResult(result);
 		return offerId;
 	}
@@ -222,92 +261,152 @@ uint32_t IOMarket::getOfferIdByCounter(uint32_t timestamp, uint16_t counter)
 
 void IOMarket::createOffer(uint32_t playerId, MarketAction_t action, uint32_t itemId, uint16_t amount, uint32_t price, bool anonymous)
 {
-	DBQuery query;
-	query << "INSERT INTO `market_offers` (`player_id`, `sale`, `itemtype`, `amount`, `price`, `created`, `anonymous`) VALUES (" << playerId << ", " << action << ", " << itemId << ", " << amount << ", " << price << ", " << time(NULL) << ", " << anonymous << ");";
-	Database::getInstance()->executeQuery(query.str());
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBStatement* stmt = Database::getInstance()->prepareStatement("INSERT INTO `market_offers` (`player_id`, `sale`, `itemtype`, `amount`, `price`, `created`, `anonymous`) VALUES (?, ?, ?, ?, ?, ?, ?);");
+	if(!stmt)
+		return;
+
+	stmt->bindInt(1, playerId);
+	stmt->bindInt(2, action);
+	stmt->bindInt(3, itemId);
+	stmt->bindInt(4, amount);
+	stmt->bindInt(5, price);
+	stmt->bindInt(6, time(NULL));
+	stmt->bindInt(7, anonymous);
+	stmt->execute();
 }
 
 void IOMarket::acceptOffer(uint32_t offerId, uint16_t amount)
 {
-	DBQuery query;
-	query << "UPDATE `market_offers` SET `amount` = `amount` - " << amount << " WHERE `id` = " << offerId << ";";
-	Database::getInstance()->executeQuery(query.str());
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBStatement* stmt = Database::getInstance()->prepareStatement("UPDATE `market_offers` SET `amount` = `amount` - ? WHERE `id` = ?;");
+	if(!stmt)
+		return;
+
+	stmt->bindInt(1, amount);
+	stmt->bindInt(2, offerId);
+	stmt->execute();
 }
 
 void IOMarket::deleteOffer(uint32_t offerId)
 {
-	DBQuery query;
-	query << "DELETE FROM `market_offers` WHERE `id` = " << offerId << ";";
-	Database::getInstance()->executeQuery(query.str());
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBStatement* stmt = Database::getInstance()->prepareStatement("DELETE FROM `market_offers` WHERE `id` = ?;");
+	if(!stmt)
+		return;
+
+	stmt->bindInt(1, offerId);
+	stmt->execute();
 }
 
 void IOMarket::appendHistory(uint32_t playerId, MarketAction_t type, uint16_t itemId, uint16_t amount, uint32_t price, time_t timestamp, MarketOfferState_t state)
 {
-	DBQuery query;
-	query << "INSERT INTO `market_history` (`player_id`, `sale`, `itemtype`, `amount`, `price`, `expires_at`, `inserted`, `state`) VALUES "
-		<< "(" << playerId << ", " << type << ", " << itemId << ", " << amount << ", " << price << ", "
-		<< timestamp << ", " << time(NULL) << ", " << state << ");";
-	Database::getInstance()->executeQuery(query.str());
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBStatement* stmt = Database::getInstance()->prepareStatement("INSERT INTO `market_history` (`player_id`, `sale`, `itemtype`, `amount`, `price`, `expires_at`, `inserted`, `state`) VALUES (?, ?, ?, ?, ?, ?, ?, ?);");
+	if(!stmt)
+		return;
+
+	stmt->bindInt(1, playerId);
+	stmt->bindInt(2, type);
+	stmt->bindInt(3, itemId);
+	stmt->bindInt(4, amount);
+	stmt->bindInt(5, price);
+	stmt->bindInt(6, timestamp);
+	stmt->bindInt(7, time(NULL));
+	stmt->bindInt(8, state);
+	stmt->execute();
 }
 
 void IOMarket::moveOfferToHistory(uint32_t offerId, MarketOfferState_t state)
 {
 	const int32_t marketOfferDuration = g_config.getNumber(ConfigManager::MARKET_OFFER_DURATION);
 
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
 	Database* db = Database::getInstance();
+	DBStatement* stmt = db->prepareStatement("SELECT `player_id`, `sale`, `itemtype`, `amount`, `price`, `created` FROM `market_offers` WHERE `id` = ?;");
+	if(!stmt)
+		return;
+
+	stmt->bindInt(1, offerId);
 
-	DBQuery query;
 	DBResult* result;
-	query << "SELECT `player_id`, `sale`, `itemtype`, `amount`, `price`, `created` FROM `market_offers` WHERE `id` = " << offerId << ";";
-	if(!(result = db->storeQuery(query.str())))
+	if(!(result = stmt->storeQuery()))
+		return;
+
+	DBStatement* deleteStmt = db->prepareStatement("DELETE FROM `market_offers` WHERE `id` = ?;");
+	if(!deleteStmt)
+	{
+		db->freeResult(result);
 		return;
+	}
 
-	query.str("");
-	query << "DELETE FROM `market_offers` WHERE `id` = " << offerId << ";";
-	if(!db->executeQuery(query.str()))
+	deleteStmt->bindInt(1, offerId);
+	if(!deleteStmt->execute())
 	{
 		db->freeResult(result);
 		return;
 	}
 
-	appendHistory(result->getDataInt("player_id"), (MarketAction_t)result->getDataInt("sale"), result->getDataInt("itemtype"), result->getDataInt("amount"), result->getDataInt("price"), result->getDataInt("created") + marketOfferDuration, state);
+	appendHistory(result->getDataInt(0), (MarketAction_t)result->getDataInt(1), result->getDataInt(2), result->getDataInt(3), result->getDataInt(4), result->getDataInt(5) + marketOfferDuration, state);
 	db->freeResult(result);
 }
 
 void IOMarket::clearOldHistory()
 {
 	const time_t lastExpireDate = time(NULL) - g_config.getNumber(ConfigManager::MARKET_OFFER_DURATION);
-	DBQuery query;
-	query << "DELETE FROM `market_history` WHERE `inserted` <= " << lastExpireDate << ";";
-	Database::getInstance()->executeQuery(query.str());
+
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
+	DBStatement* stmt = Database::getInstance()->prepareStatement("DELETE FROM `market_history` WHERE `inserted` <= ?;");
+	if(!stmt)
+		return;
+
+	stmt->bindInt(1, lastExpireDate);
+	stmt->execute();
 }
 
 void IOMarket::updateStatistics()
 {
+	DatabaseExecutor::getInstance()->addTask(DBLANE_BACKGROUND, boost::bind(&IOMarket::loadStatistics, this));
+}
+
+void IOMarket::loadStatistics()
+{
+	DBQuery query; // KEEP FOR DATABASE LOCKING!
 	Database* db = Database::getInstance();
+	DBStatement* stmt = db->prepareStatement("SELECT `sale` AS `sale`, `itemtype` AS `itemtype`, COUNT(`price`) AS `num`, MIN(`price`) AS `min`, MAX(`price`) AS `max`, SUM(`price`) AS `sum` FROM `market_history` WHERE `state` = ? GROUP BY `itemtype`, `sale`;");
+	if(!stmt)
+		return;
 
-	DBQuery query;
-	query << "SELECT `sale` AS `sale`, `itemtype` AS `itemtype`, COUNT(`price`) AS `num`, MIN(`price`) AS `min`, MAX(`price`) AS `max`, SUM(`price`) AS `sum` FROM `market_history` WHERE `state` = " << OFFERSTATE_ACCEPTED << " GROUP BY `itemtype`, `sale`;";
+	stmt->bindInt(1, OFFERSTATE_ACCEPTED);
 
 	DBResult* result;
-	if(!(result = db->storeQuery(query.str())))
+	if(!(result = stmt->storeQuery()))
 		return;
 
+	StatisticsMap_ptr purchase(new StatisticsMap), sale(new StatisticsMap);
 	do
 	{
 		MarketStatistics* statistics;
-		if(result->getDataInt("sale") == MARKETACTION_BUY)
-			statistics = &purchaseStatistics[result->getDataInt("itemtype")];
+		if(result->getDataInt(0) == MARKETACTION_BUY)
+			statistics = &(*purchase)[result->getDataInt(1)];
 		else
-			statistics = &saleStatistics[result->getDataInt("itemtype")];
+			statistics = &(*sale)[result->getDataInt(1)];
 
-		statistics->numTransactions = result->getDataInt("num");
-		statistics->lowestPrice = result->getDataInt("min");
-		statistics->totalPrice = result->getDataLong("sum");
-		statistics->highestPrice = result->getDataInt("max");
+		statistics->numTransactions = result->getDataInt(2);
+		statistics->lowestPrice = result->getDataInt(3);
+		statistics->totalPrice = result->getDataLong(5);
+		statistics->highestPrice = result->getDataInt(4);
 	}
 	while(result->next());
 	db->freeResult(result);
+
+	g_dispatcher.addTask(createTask(boost::bind(&IOMarket::setStatistics, this, purchase, sale)));
+}
+
+void IOMarket::setStatistics(StatisticsMap_ptr purchase, StatisticsMap_ptr sale)
+{
+	purchaseStatistics.swap(*purchase);
+	saleStatistics.swap(*sale);
 }
 
 MarketStatistics* IOMarket::getPurchaseStatistics(uint16_t itemId)
@@ -22,6 +22,7 @@
 #define __OTSERV_IOMARKET_H__
 
 #include <string>
+#include <boost/shared_ptr.hpp>
 #include "account.h"
 #include "player.h"
 #include "database.h"
@@ -56,14 +57,21 @@ class IOMarket
 		void moveOfferToHistory(uint32_t offerId, MarketOfferState_t state);
 		void clearOldHistory();
 
+		// reads the statistics on a database thread, they are replaced on the dispatcher
 		void updateStatistics();
 
 		MarketStatistics* getPurchaseStatistics(uint16_t itemId);
 		MarketStatistics* getSaleStatistics(uint16_t itemId);
 
 	private:
-		std::map<uint16_t, MarketStatistics> purchaseStatistics;
-		std::map<uint16_t, MarketStatistics> saleStatistics;
+		typedef std::map<uint16_t, MarketStatistics> StatisticsMap;
+		typedef boost::shared_ptr<StatisticsMap> StatisticsMap_ptr;
+
+		void loadStatistics();
+		void setStatistics(StatisticsMap_ptr purchase, StatisticsMap_ptr sale);
+
+		StatisticsMap purchaseStatistics;
+		StatisticsMap saleStatistics;
 };
 
 #endif
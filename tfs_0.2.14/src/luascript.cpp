@@ -43,6 +43,7 @@
 #include "ban.h"
 #include "mounts.h"
 #include "databasemanager.h"
+#include "databaseexecutor.h"
 
 extern Game g_game;
 extern Monsters g_monsters;
@@ -131,6 +132,17 @@ void ScriptEnvironment::resetEnv()
 }
 
 bool ScriptEnvironment::saveGameState()
+{
+	return writeGameState(m_globalStorageMap);
+}
+
+void ScriptEnvironment::captureGameState(StorageMap& storage)
+{
+	if(g_config.getBoolean(ConfigManager::SAVE_GLOBAL_STORAGE))
+		storage = m_globalStorageMap;
+}
+
+bool ScriptEnvironment::writeGameState(const StorageMap& storage)
 {
 	if(!g_config.getBoolean(ConfigManager::SAVE_GLOBAL_STORAGE))
 		return true;
@@ -143,7 +155,7 @@ bool ScriptEnvironment::saveGameState()
 
 	DBInsert stmt(db);
 	stmt.setQuery("INSERT INTO `global_storage` (`key`, `value`) VALUES ");
-	for(StorageMap::const_iterator it = m_globalStorageMap.begin(); it != m_globalStorageMap.end(); ++it)
+	for(StorageMap::const_iterator it = storage.begin(); it != storage.end(); ++it)
 	{
 		query << it->first << "," << it->second;
 		if(!stmt.addRow(query))
@@ -541,6 +553,8 @@ std::string LuaScriptInterface::getErrorDesc(ErrorCode_t code)
 
 ScriptEnvironment LuaScriptInterface::m_scriptEnv[16];
 int32_t LuaScriptInterface::m_scriptEnvIndex = -1;
+LuaScriptInterface::LuaDatabaseCallbacks LuaScriptInterface::m_databaseCallbacks;
+uint32_t LuaScriptInterface::m_lastDatabaseCallbackId = 0;
 
 LuaScriptInterface::LuaScriptInterface(std::string interfaceName)
 {
@@ -806,6 +820,7 @@ bool LuaScriptInterface::closeState()
 		}
 		m_timerEvents.clear();
 
+		clearDatabaseCallbacks();
 		lua_close(m_luaState);
 	}
 	return true;
@@ -848,6 +863,103 @@ void LuaScriptInterface::executeTimerEvent(uint32_t eventIndex)
 	}
 }
 
+uint32_t LuaScriptInterface::addDatabaseCallback(lua_State* L, LuaScriptInterface* scriptInterface, int32_t scriptId)
+{
+	//the callback has to be on top of the stack
+	LuaDatabaseCallback callback;
+	callback.scriptInterface = scriptInterface;
+	callback.scriptId = scriptId;
+	callback.function = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	m_databaseCallbacks[++m_lastDatabaseCallbackId] = callback;
+	return m_lastDatabaseCallbackId;
+}
+
+void LuaScriptInterface::clearDatabaseCallbacks()
+{
+	for(LuaDatabaseCallbacks::iterator it = m_databaseCallbacks.begin(); it != m_databaseCallbacks.end();)
+	{
+		if(it->second.scriptInterface == this)
+		{
+			if(m_luaState)
+				luaL_unref(m_luaState, LUA_REGISTRYINDEX, it->second.function);
+
+			m_databaseCallbacks.erase(it++);
+		}
+		else
+			++it;
+	}
+}
+
+void LuaScriptInterface::executeDatabaseResult(uint32_t callbackId, DBResult* result)
+{
+	LuaDatabaseCallbacks::iterator it = m_databaseCallbacks.find(callbackId);
+	if(it == m_databaseCallbacks.end())
+	{
+		if(result)
+			Database::getInstance()->freeResult(result);
+
+		return;
+	}
+
+	LuaDatabaseCallback callback = it->second;
+	m_databaseCallbacks.erase(it);
+
+	lua_State* L = callback.scriptInterface->m_luaState;
+	if(callback.scriptInterface->reserveScriptEnv())
+	{
+		ScriptEnvironment* env = getScriptEnv();
+		env->setTimerEvent();
+		env->setScriptId(callback.scriptId, callback.scriptInterface);
+
+		lua_rawgeti(L, LUA_REGISTRYINDEX, callback.function);
+		if(result)
+			lua_pushnumber(L, env->addResult(result));
+		else
+			lua_pushboolean(L, false);
+
+		callback.scriptInterface->callFunction(1);
+		callback.scriptInterface->releaseScriptEnv();
+	}
+	else
+	{
+		std::cout << "[Error] Call stack overflow. LuaScriptInterface::executeDatabaseResult" << std::endl;
+		if(result)
+			Database::getInstance()->freeResult(result);
+	}
+
+	luaL_unref(L, LUA_REGISTRYINDEX, callback.function);
+}
+
+void LuaScriptInterface::executeDatabaseCallback(uint32_t callbackId, bool success)
+{
+	LuaDatabaseCallbacks::iterator it = m_databaseCallbacks.find(callbackId);
+	if(it == m_databaseCallbacks.end())
+		return;
+
+	LuaDatabaseCallback callback = it->second;
+	m_databaseCallbacks.erase(it);
+
+	lua_State* L = callback.scriptInterface->m_luaState;
+	lua_rawgeti(L, LUA_REGISTRYINDEX, callback.function);
+	lua_pushboolean(L, success);
+	if(callback.scriptInterface->reserveScriptEnv())
+	{
+		ScriptEnvironment* env = getScriptEnv();
+		env->setTimerEvent();
+		env->setScriptId(callback.scriptId, callback.scriptInterface);
+		callback.scriptInterface->callFunction(1);
+		callback.scriptInterface->releaseScriptEnv();
+	}
+	else
+	{
+		std::cout << "[Error] Call stack overflow. LuaScriptInterface::executeDatabaseCallback" << std::endl;
+		lua_pop(L, 2);
+	}
+
+	luaL_unref(L, LUA_REGISTRYINDEX, callback.function);
+}
+
 int32_t LuaScriptInterface::luaErrorHandler(lua_State* L)
 {
 	std::string err_msg(lua_tostring(L, -1));
@@ -7895,7 +8007,7 @@ int32_t LuaScriptInterface::luaGetCreatureMaxHealth(lua_State* L)
 int32_t LuaScriptInterface::luaSaveServer(lua_State* L)
 {
 	g_dispatcher.addTask(
-		createTask(boost::bind(&Game::saveGameState, &g_game)));
+		createTask(boost::bind(&Game::saveGameState, &g_game, true)));
 	lua_pushboolean(L, true);
 
 	return 1;
@@ -8136,6 +8248,8 @@ const luaL_Reg LuaScriptInterface::luaDatabaseTable[] =
 {
 	{"query", LuaScriptInterface::luaDatabaseExecute},
 	{"storeQuery", LuaScriptInterface::luaDatabaseStoreQuery},
+	{"asyncQuery", LuaScriptInterface::luaDatabaseAsyncExecute},
+	{"asyncStoreQuery", LuaScriptInterface::luaDatabaseAsyncStoreQuery},
 	{"escapeString", LuaScriptInterface::luaDatabaseEscapeString},
 	{"escapeBlob", LuaScriptInterface::luaDatabaseEscapeBlob},
 	{"lastInsertId", LuaScriptInterface::luaDatabaseLastInsertId},
@@ -8166,6 +8280,52 @@ int32_t LuaScriptInterface::luaDatabaseStoreQuery(lua_State* L)
 	return 1;
 }
 
+int32_t LuaScriptInterface::luaDatabaseAsyncExecute(lua_State* L)
+{
+	//db.asyncQuery(query[, callback])
+	//callback(success) runs later, like an event
+	ScriptEnvironment* env = getScriptEnv();
+	LuaScriptInterface* scriptInterface = env->getScriptInterface();
+
+	boost::function<void (bool)> callback;
+	if(lua_gettop(L) > 1)
+	{
+		if(!lua_isfunction(L, -1) || !scriptInterface)
+		{
+			reportErrorFunc("callback parameter should be a function.");
+			lua_pop(L, lua_gettop(L));
+			lua_pushboolean(L, false);
+			return 1;
+		}
+
+		callback = boost::bind(&LuaScriptInterface::executeDatabaseCallback, addDatabaseCallback(L, scriptInterface, env->getScriptId()), _1);
+	}
+
+	DatabaseExecutor::getInstance()->executeQuery(DBLANE_BACKGROUND, popString(L), callback);
+	lua_pushboolean(L, true);
+	return 1;
+}
+
+int32_t LuaScriptInterface::luaDatabaseAsyncStoreQuery(lua_State* L)
+{
+	//db.asyncStoreQuery(query, callback)
+	//callback(resultId or false) runs later, like an event; the result is freed after it returns
+	ScriptEnvironment* env = getScriptEnv();
+	LuaScriptInterface* scriptInterface = env->getScriptInterface();
+	if(!lua_isfunction(L, -1) || !scriptInterface)
+	{
+		reportErrorFunc("callback parameter should be a function.");
+		lua_pop(L, lua_gettop(L));
+		lua_pushboolean(L, false);
+		return 1;
+	}
+
+	uint32_t callbackId = addDatabaseCallback(L, scriptInterface, env->getScriptId());
+	DatabaseExecutor::getInstance()->storeQuery(DBLANE_BACKGROUND, popString(L), boost::bind(&LuaScriptInterface::executeDatabaseResult, callbackId, _1));
+	lua_pushboolean(L, true);
+	return 1;
+}
+
 int32_t LuaScriptInterface::luaDatabaseEscapeString(lua_State* L)
 {
 	DBQuery query;
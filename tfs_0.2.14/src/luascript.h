@@ -91,8 +91,13 @@ class ScriptEnvironment
 		void resetEnv();
 		void resetCallback() {m_callbackId = 0;}
 
+		typedef std::map<uint32_t, int32_t> StorageMap;
+
 		static bool saveGameState();
 		static bool loadGameState();
+		// saveGameState in two steps, capture on the dispatcher and write from any thread
+		static void captureGameState(StorageMap& storage);
+		static bool writeGameState(const StorageMap& storage);
 
 		void setScriptId(int32_t scriptId, LuaScriptInterface* scriptInterface)
 			{m_scriptId = scriptId; m_interface = scriptInterface;}
@@ -151,7 +156,6 @@ class ScriptEnvironment
 	private:
 		typedef std::map<uint64_t, Thing*> ThingMap;
 		typedef std::vector<const LuaVariant*> VariantVector;
-		typedef std::map<uint32_t, int32_t> StorageMap;
 		typedef std::map<uint32_t, AreaCombat*> AreaMap;
 		typedef std::map<uint32_t, Combat*> CombatMap;
 		typedef std::map<uint32_t, Condition*> ConditionMap;
@@ -654,9 +658,11 @@ class LuaScriptInterface
 		static int32_t luaBitULeftShift(lua_State* L);
 		static int32_t luaBitURightShift(lua_State* L);
 
-		static const luaL_Reg luaDatabaseTable[10];
+		static const luaL_Reg luaDatabaseTable[12];
 		static int32_t luaDatabaseExecute(lua_State* L);
 		static int32_t luaDatabaseStoreQuery(lua_State* L);
+		static int32_t luaDatabaseAsyncExecute(lua_State* L);
+		static int32_t luaDatabaseAsyncStoreQuery(lua_State* L);
 		static int32_t luaDatabaseEscapeString(lua_State* L);
 		static int32_t luaDatabaseEscapeBlob(lua_State* L);
 		static int32_t luaDatabaseLastInsertId(lua_State* L);
@@ -706,6 +712,24 @@ class LuaScriptInterface
 
 		void executeTimerEvent(uint32_t eventIndex);
 
+		//callbacks of db.asyncQuery and db.asyncStoreQuery, by id so a reloaded
+		//or destroyed interface simply drops the answer
+		struct LuaDatabaseCallback
+		{
+			LuaScriptInterface* scriptInterface;
+			int32_t scriptId;
+			int32_t function;
+		};
+
+		typedef std::map<uint32_t, LuaDatabaseCallback> LuaDatabaseCallbacks;
+		static LuaDatabaseCallbacks m_databaseCallbacks;
+		static uint32_t m_lastDatabaseCallbackId;
+
+		static uint32_t addDatabaseCallback(lua_State* L, LuaScriptInterface* scriptInterface, int32_t scriptId);
+		void clearDatabaseCallbacks();
+		static void executeDatabaseResult(uint32_t callbackId, DBResult* result);
+		static void executeDatabaseCallback(uint32_t callbackId, bool success);
+
 		std::string m_interfaceName;
 };
 
@@ -27,6 +27,7 @@
 
 #include <boost/config.hpp>
 #include <boost/bind.hpp>
+#include <boost/thread/tss.hpp>
 
 #include "iomap.h"
 
@@ -43,6 +44,7 @@
 #include "creature.h"
 
 #include "player.h"
+#include "monster.h"
 #include "configmanager.h"
 #include "game.h"
 
@@ -54,11 +56,46 @@ Map::Map()
 {
 	mapWidth = 0;
 	mapHeight = 0;
+
+	spectatorCacheHits = 0;
+	spectatorCacheMisses = 0;
+	spectatorCacheInvalidations = 0;
+
+	flowFieldClock = 0;
+	flowFieldHits = 0;
+	flowFieldMisses = 0;
+
+	transientTileCount = 0;
+	reclaimedTileCount = 0;
+
+	for(uint32_t i = 0; i < SECTOR_DIRECTORY_SIZE * SECTOR_DIRECTORY_SIZE; ++i)
+		sectorDirectory[i] = NULL;
+
+	sectorCount = 0;
+	sectorBlockCount = 0;
 }
 
 Map::~Map()
 {
-	//
+	clearSpectatorCache();
+	recycleSpectators();
+	for(std::vector<SpectatorVec*>::iterator it = spectatorPool.begin(); it != spectatorPool.end(); ++it)
+		delete *it;
+
+	for(std::vector<FlowField*>::iterator it = flowFields.begin(); it != flowFields.end(); ++it)
+		delete *it;
+
+	for(uint32_t i = 0; i < SECTOR_DIRECTORY_SIZE * SECTOR_DIRECTORY_SIZE; ++i)
+	{
+		QTreeLeafNode** block = sectorDirectory[i];
+		if(!block)
+			continue;
+
+		for(uint32_t j = 0; j < SECTOR_BLOCK_SIZE * SECTOR_BLOCK_SIZE; ++j)
+			delete block[j];
+
+		delete[] block;
+	}
 }
 
 bool Map::loadMap(const std::string& identifier)
@@ -84,11 +121,24 @@ bool Map::loadMap(const std::string& identifier)
 }
 
 bool Map::saveMap()
+{
+	MapSnapshot snapshot;
+	captureMap(snapshot);
+	return writeMap(snapshot);
+}
+
+void Map::captureMap(MapSnapshot& snapshot)
+{
+	IOMapSerialize.captureHouseInfo(this, snapshot);
+	IOMapSerialize.captureMap(this, snapshot);
+}
+
+bool Map::writeMap(const MapSnapshot& snapshot)
 {
 	bool saved = false;
 	for(uint32_t tries = 0; tries < 3; tries++)
 	{
-		if(IOMapSerialize.saveHouseInfo(this))
+		if(IOMapSerialize.writeHouseInfo(snapshot))
 		{
 			saved = true;
 			break;
@@ -101,7 +151,7 @@ bool Map::saveMap()
 	saved = false;
 	for(uint32_t tries = 0; tries < 3; tries++)
 	{
-		if(IOMapSerialize.saveMap(this))
+		if(IOMapSerialize.writeMap(snapshot))
 		{
 			saved = true;
 			break;
@@ -110,26 +160,6 @@ bool Map::saveMap()
 	return saved;
 }
 
-Tile* Map::getTile(int32_t x, int32_t y, int32_t z)
-{
-	if(x < 0 || x >= 0xFFFF || y < 0 || y >= 0xFFFF || z < 0 || z >= MAP_MAX_LAYERS)
-		return NULL;
-
-	QTreeLeafNode* leaf = QTreeNode::getLeafStatic(&root, x, y);
-	if(leaf)
-	{
-		Floor* floor = leaf->getFloor(z);
-		if(floor)
-			return floor->tiles[x & FLOOR_MASK][y & FLOOR_MASK];
-	}
-	return NULL;
-}
-
-Tile* Map::getTile(const Position& pos)
-{
-	return getTile(pos.x, pos.y, pos.z);
-}
-
 void Map::setTile(int32_t x, int32_t y, int32_t z, Tile* newTile)
 {
 	if(x < 0 || x >= 0xFFFF || y < 0 || y >= 0xFFFF || z < 0 || z >= MAP_MAX_LAYERS)
@@ -138,27 +168,31 @@ void Map::setTile(int32_t x, int32_t y, int32_t z, Tile* newTile)
 		return;
 	}
 
-	QTreeLeafNode::newLeaf = false;
-	QTreeLeafNode* leaf = root.createLeaf(x, y, 15);
-	if(QTreeLeafNode::newLeaf)
+	QTreeLeafNode* leaf = getLeaf(x, y);
+	if(!leaf)
 	{
+		leaf = createLeaf(x, y);
+
+		//cached queries could not register in a leaf that did not exist yet
+		clearSpectatorCache();
+
 		//update north
-		QTreeLeafNode* northLeaf = root.getLeaf(x, y - FLOOR_SIZE);
+		QTreeLeafNode* northLeaf = getLeaf(x, y - FLOOR_SIZE);
 		if(northLeaf)
 			northLeaf->m_leafS = leaf;
 
 		//update west leaf
-		QTreeLeafNode* westLeaf = root.getLeaf(x - FLOOR_SIZE, y);
+		QTreeLeafNode* westLeaf = getLeaf(x - FLOOR_SIZE, y);
 		if(westLeaf)
 			westLeaf->m_leafE = leaf;
 
 		//update south
-		QTreeLeafNode* southLeaf = root.getLeaf(x, y + FLOOR_SIZE);
+		QTreeLeafNode* southLeaf = getLeaf(x, y + FLOOR_SIZE);
 		if(southLeaf)
 			leaf->m_leafS = southLeaf;
 
 		//update east
-		QTreeLeafNode* eastLeaf = root.getLeaf(x + FLOOR_SIZE, y);
+		QTreeLeafNode* eastLeaf = getLeaf(x + FLOOR_SIZE, y);
 		if(eastLeaf)
 			leaf->m_leafE = eastLeaf;
 	}
@@ -300,8 +334,15 @@ bool Map::removeCreature(Creature* creature)
 void Map::getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, bool checkforduplicate,
 	int32_t minRangeX, int32_t maxRangeX,
 	int32_t minRangeY, int32_t maxRangeY,
-	int32_t minRangeZ, int32_t maxRangeZ)
+	int32_t minRangeZ, int32_t maxRangeZ, int32_t cacheIndex/* = -1*/)
 {
+	SpectatorCacheRef ref;
+	if(cacheIndex != -1)
+	{
+		ref.index = cacheIndex;
+		ref.generation = spectatorEntries[cacheIndex].generation;
+	}
+
 	int32_t minoffset = centerPos.z - maxRangeZ;
 	int32_t x1 = std::min((int32_t)0xFFFF, std::max((int32_t)0, (centerPos.x + minRangeX + minoffset)));
 	int32_t y1 = std::min((int32_t)0xFFFF, std::max((int32_t)0, (centerPos.y + minRangeY + minoffset)));
@@ -329,6 +370,24 @@ void Map::getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, b
 		{
 			if(leafE)
 			{
+				if(cacheIndex != -1)
+				{
+					// drop handles of queries that are gone before the vector grows
+					SpectatorCacheRefs& refs = leafE->spectator_refs;
+					if(refs.size() >= 16 && refs.size() == refs.capacity())
+					{
+						SpectatorCacheRefs::iterator last = refs.begin();
+						for(SpectatorCacheRefs::iterator rit = refs.begin(); rit != refs.end(); ++rit)
+						{
+							const SpectatorCacheEntry& entry = spectatorEntries[rit->index];
+							if(entry.list && entry.generation == rit->generation)
+								*last++ = *rit;
+						}
+						refs.erase(last, refs.end());
+					}
+					refs.push_back(ref);
+				}
+
 				CreatureVector& node_list = leafE->creature_list;
 				CreatureVector::const_iterator node_iter = node_list.begin();
 				CreatureVector::const_iterator node_end = node_list.end();
@@ -383,10 +442,9 @@ void Map::getSpectators(SpectatorVec& list, const Position& centerPos,
 	bool cacheResult = false;
 	if(minRangeX == 0 && maxRangeX == 0 && minRangeY == 0 && maxRangeY == 0 && multifloor == true && checkforduplicate == false)
 	{
-		SpectatorCache::iterator it = spectatorCache.find(centerPos);
-		if(it != spectatorCache.end())
+		if(SpectatorVec* cached = findSpectatorCache(centerPos))
 		{
-			list = *it->second;
+			list = *cached;
 			foundCache = true;
 		}
 		else
@@ -436,13 +494,23 @@ void Map::getSpectators(SpectatorVec& list, const Position& centerPos,
 			maxRangeZ = centerPos.z;
 		}
 
-		getSpectatorsInternal(list, centerPos, true,
-			minRangeX, maxRangeX,
-			minRangeY, maxRangeY,
-			minRangeZ, maxRangeZ);
-
 		if(cacheResult)
-			spectatorCache[centerPos].reset(new SpectatorVec(list));
+		{
+			int32_t cacheIndex = createSpectatorCache(centerPos);
+			SpectatorVec& cached = *spectatorEntries[cacheIndex].list;
+			getSpectatorsInternal(cached, centerPos, false,
+				minRangeX, maxRangeX,
+				minRangeY, maxRangeY,
+				minRangeZ, maxRangeZ, cacheIndex);
+			list = cached;
+		}
+		else
+		{
+			getSpectatorsInternal(list, centerPos, true,
+				minRangeX, maxRangeX,
+				minRangeY, maxRangeY,
+				minRangeZ, maxRangeZ);
+		}
 	}
 }
 
@@ -450,19 +518,16 @@ const SpectatorVec& Map::getSpectators(const Position& centerPos)
 {
 	if(centerPos.z >= MAP_MAX_LAYERS)
 	{
-		boost::shared_ptr<SpectatorVec> p(new SpectatorVec());
-		SpectatorVec& list = *p;
-		return list;
+		static const SpectatorVec emptyList;
+		return emptyList;
 	}
 
-	SpectatorCache::iterator it = spectatorCache.find(centerPos);
-	if(it != spectatorCache.end())
-		return *it->second;
+	if(SpectatorVec* cached = findSpectatorCache(centerPos))
+		return *cached;
 	else
 	{
-		boost::shared_ptr<SpectatorVec> p(new SpectatorVec());
-		spectatorCache[centerPos] = p;
-		SpectatorVec& list = *p;
+		int32_t cacheIndex = createSpectatorCache(centerPos);
+		SpectatorVec& list = *spectatorEntries[cacheIndex].list;
 
 		int32_t minRangeX = -maxViewportX;
 		int32_t maxRangeX = maxViewportX;
@@ -500,17 +565,111 @@ const SpectatorVec& Map::getSpectators(const Position& centerPos)
 		getSpectatorsInternal(list, centerPos, false,
 			minRangeX, maxRangeX,
 			minRangeY, maxRangeY,
-			minRangeZ, maxRangeZ);
+			minRangeZ, maxRangeZ, cacheIndex);
 
 		return list;
 	}
 }
 
+SpectatorVec* Map::findSpectatorCache(const Position& centerPos)
+{
+	SpectatorCache::iterator it = spectatorCache.find(getSpectatorCacheKey(centerPos));
+	if(it == spectatorCache.end())
+	{
+		++spectatorCacheMisses;
+		return NULL;
+	}
+
+	++spectatorCacheHits;
+	return spectatorEntries[it->second].list;
+}
+
+int32_t Map::createSpectatorCache(const Position& centerPos)
+{
+	if(spectatorCache.size() >= SPECTATOR_CACHE_SIZE)
+		clearSpectatorCache();
+
+	uint32_t index;
+	if(!freeSpectatorEntries.empty())
+	{
+		index = freeSpectatorEntries.back();
+		freeSpectatorEntries.pop_back();
+	}
+	else
+	{
+		index = spectatorEntries.size();
+		SpectatorCacheEntry entry;
+		entry.list = NULL;
+		entry.generation = 0;
+		spectatorEntries.push_back(entry);
+	}
+
+	SpectatorCacheEntry& entry = spectatorEntries[index];
+	entry.key = getSpectatorCacheKey(centerPos);
+	if(!spectatorPool.empty())
+	{
+		entry.list = spectatorPool.back();
+		spectatorPool.pop_back();
+	}
+	else
+		entry.list = new SpectatorVec();
+
+	spectatorCache[entry.key] = index;
+	return index;
+}
+
+void Map::retireSpectatorCache(uint32_t index)
+{
+	SpectatorCacheEntry& entry = spectatorEntries[index];
+	spectatorCache.erase(entry.key);
+	retiredSpectators.push_back(entry.list);
+
+	entry.list = NULL;
+	++entry.generation;
+	freeSpectatorEntries.push_back(index);
+}
+
+void Map::invalidateSpectators(QTreeLeafNode* leaf)
+{
+	SpectatorCacheRefs& refs = leaf->spectator_refs;
+	for(SpectatorCacheRefs::const_iterator it = refs.begin(); it != refs.end(); ++it)
+	{
+		const SpectatorCacheEntry& entry = spectatorEntries[it->index];
+		if(entry.list && entry.generation == it->generation)
+		{
+			retireSpectatorCache(it->index);
+			++spectatorCacheInvalidations;
+		}
+	}
+	refs.clear();
+}
+
 void Map::clearSpectatorCache()
 {
+	// stale handles left in the leaves are recognized by their generation
+	for(SpectatorCache::iterator it = spectatorCache.begin(); it != spectatorCache.end(); ++it)
+	{
+		SpectatorCacheEntry& entry = spectatorEntries[it->second];
+		retiredSpectators.push_back(entry.list);
+		entry.list = NULL;
+		++entry.generation;
+		freeSpectatorEntries.push_back(it->second);
+	}
+
 	spectatorCache.clear();
 }
 
+void Map::recycleSpectators()
+{
+	for(std::vector<SpectatorVec*>::iterator it = retiredSpectators.begin(); it != retiredSpectators.end(); ++it)
+	{
+		(*it)->clear();
+		spectatorPool.push_back(*it);
+	}
+
+	retiredSpectators.clear();
+}
+
 bool Map::canThrowObjectTo(const Position& fromPos, const Position& toPos, bool checkLineOfSight /*= true*/,
 	int32_t rangex /*= Map::maxClientViewportX*/, int32_t rangey /*= Map::maxClientViewportY*/)
 {
@@ -706,16 +865,15 @@ bool Map::getPathTo(const Creature* creature, const Position& destPos,
 	if(startPos.z != endPos.z)
 		return false;
 
-	AStarNodes nodes;
-	AStarNode* startNode = nodes.createOpenNode();
-
-	startNode->x = startPos.x;
-	startNode->y = startPos.y;
+	AStarNodes& nodes = AStarNodes::getInstance();
+	nodes.reset(g_config.getNumber(ConfigManager::PATHFINDING_MAX_NODES));
 
+	AStarNode* startNode = nodes.createNode(startPos.x, startPos.y);
 	startNode->g = 0;
 	startNode->h = nodes.getEstimatedDistance(startPos.x, startPos.y, endPos.x, endPos.y);
 	startNode->f = startNode->g + startNode->h;
 	startNode->parent = NULL;
+	nodes.openNode(startNode);
 
 	Position pos;
 	pos.z = startPos.z;
@@ -783,29 +941,26 @@ bool Map::getPathTo(const Creature* creature, const Position& destPos,
 							//The node on the closed/open list is cheaper than this one
 							continue;
 						}
-
-						nodes.openNode(neighbourNode);
 					}
 					else
 					{
 						//Does not exist in the open/closed list, create a new node
-						neighbourNode = nodes.createOpenNode();
+						neighbourNode = nodes.createNode(pos.x, pos.y);
 						if(!neighbourNode)
 						{
 							//seems we ran out of nodes
 							listDir.clear();
 							return false;
 						}
+
+						neighbourNode->h = nodes.getEstimatedDistance(pos.x, pos.y, endPos.x, endPos.y);
 					}
 
 					//This node is the best node so far with this state
-					neighbourNode->x = pos.x;
-					neighbourNode->y = pos.y;
 					neighbourNode->parent = n;
 					neighbourNode->g = newg;
-					neighbourNode->h = nodes.getEstimatedDistance(neighbourNode->x, neighbourNode->y,
-						endPos.x, endPos.y);
 					neighbourNode->f = neighbourNode->g + neighbourNode->h;
+					nodes.openNode(neighbourNode);
 				}
 			}
 
@@ -859,14 +1014,13 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
 	Position startPos = creature->getPosition();
 	Position endPos;
 
-	AStarNodes nodes;
-	AStarNode* startNode = nodes.createOpenNode();
-
-	startNode->x = startPos.x;
-	startNode->y = startPos.y;
+	AStarNodes& nodes = AStarNodes::getInstance();
+	nodes.reset(g_config.getNumber(ConfigManager::PATHFINDING_MAX_NODES));
 
+	AStarNode* startNode = nodes.createNode(startPos.x, startPos.y);
 	startNode->f = 0;
 	startNode->parent = NULL;
+	nodes.openNode(startNode);
 
 	Position pos;
 	pos.z = startPos.z;
@@ -949,12 +1103,11 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
 						//The node on the closed/open list is cheaper than this one
 						continue;
 					}
-					nodes.openNode(neighbourNode);
 				}
 				else
 				{
 					//Does not exist in the open/closed list, create a new node
-					neighbourNode = nodes.createOpenNode();
+					neighbourNode = nodes.createNode(pos.x, pos.y);
 					if(!neighbourNode)
 					{
 						if(found)
@@ -970,10 +1123,9 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
 				}
 
 				//This node is the best node so far with this state
-				neighbourNode->x = pos.x;
-				neighbourNode->y = pos.y;
 				neighbourNode->parent = n;
 				neighbourNode->f = newf;
+				nodes.openNode(neighbourNode);
 			}
 		}
 		nodes.closeNode(n);
@@ -1020,114 +1172,481 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
 	return true;
 }
 
-//*********** AStarNodes *************
+//*********** Flow fields *************
 
-AStarNodes::AStarNodes()
+enum FlowFieldState_t
 {
-	curNode = 0;
-	openNodes.reset();
+	FLOWFIELD_UNKNOWN = 0,
+	FLOWFIELD_OPEN,
+	FLOWFIELD_SETTLED,
+	FLOWFIELD_BLOCKED
+};
+
+#define FLOWFIELD_UNREACHED 0x7FFFFFFF
+#define FLOWFIELD_GOAL 0xFF
+
+//opposite steps are i ^ 2, the field stores the step a follower takes from a cell
+static const int32_t flowFieldSteps[8][2] =
+{
+	{-1, 0},
+	{0, 1},
+	{1, 0},
+	{0, -1},
+
+	//diagonal
+	{-1, -1},
+	{1, -1},
+	{1, 1},
+	{-1, 1},
+};
+
+static const Direction flowFieldDirections[8] =
+{
+	WEST,
+	SOUTH,
+	EAST,
+	NORTH,
+	NORTHWEST,
+	NORTHEAST,
+	SOUTHEAST,
+	SOUTHWEST
+};
+
+uint32_t Map::getWalkProfile(const Creature* creature)
+{
+	//everything Tile::__queryAdd and AStarNodes::getFieldWalkCost look at for a monster
+	//apart from creatures, followers with the same profile see the same walkable tiles and costs
+	const Monster* monster = creature->getMonster();
+	if(!monster)
+		return 0;
+
+	uint32_t profile = 1;
+	if(monster->canPushItems())
+		profile |= 1 << 2;
+
+	for(int32_t i = 0; i < COMBAT_COUNT - 1; ++i)
+	{
+		CombatType_t combatType = (CombatType_t)(1 << i);
+		if(monster->isImmune(combatType))
+			profile |= 1 << (5 + i * 2);
+
+		if(monster->hasCondition(Combat::DamageToConditionType(combatType)))
+			profile |= 1 << (6 + i * 2);
+	}
+	return profile;
 }
 
-AStarNode* AStarNodes::createOpenNode()
+bool Map::getPathToCreature(const Creature* creature, const Creature* target,
+	std::list<Direction>& dirList, const FindPathParams& fpp)
 {
-	if(curNode >= MAX_NODES)
-		return NULL;
+	const Position& startPos = creature->getPosition();
+	const Position& targetPos = target->getPosition();
+
+	//only a plain chase is shared, every follower is then looking for the same tiles
+	uint32_t profile = getWalkProfile(creature);
+	int32_t dx = std::abs(startPos.x - targetPos.x);
+	int32_t dy = std::abs(startPos.y - targetPos.y);
+	if(!profile || !fpp.fullPathSearch || !fpp.clearSight || !fpp.allowDiagonal || fpp.keepDistance ||
+		fpp.minTargetDist != 1 || fpp.maxTargetDist != 1 || startPos.z != targetPos.z ||
+		dx >= FLOWFIELD_RADIUS || dy >= FLOWFIELD_RADIUS ||
+		(fpp.maxSearchDist != -1 && (dx > fpp.maxSearchDist + 1 || dy > fpp.maxSearchDist + 1)))
+	{
+		return getPathMatching(creature, dirList, FrozenPathingConditionCall(targetPos), fpp);
+	}
+
+	dirList.clear();
+	if(std::max(dx, dy) == 1 && isSightClear(startPos, targetPos, true))
+		return true;
+
+	FlowField* field = getFlowField(creature, target, profile);
 
-	uint32_t ret_node = curNode;
-	curNode++;
-	openNodes[ret_node] = 1;
-	return &nodes[ret_node];
+	int32_t startX = startPos.x - field->originX;
+	int32_t startY = startPos.y - field->originY;
+
+	int32_t bestCost, bestStep;
+	settleFlowField(field, creature, startY * FLOWFIELD_SIZE + startX, bestCost, bestStep);
+	if(bestStep == -1)
+		return false;
+
+	dirList.push_back(flowFieldDirections[bestStep]);
+
+	int32_t x = startX + flowFieldSteps[bestStep][0];
+	int32_t y = startY + flowFieldSteps[bestStep][1];
+	uint8_t step;
+	while((step = field->next[y * FLOWFIELD_SIZE + x]) != FLOWFIELD_GOAL)
+	{
+		dirList.push_back(flowFieldDirections[step]);
+		x += flowFieldSteps[step][0];
+		y += flowFieldSteps[step][1];
+	}
+	return true;
 }
 
-AStarNode* AStarNodes::getBestNode()
+Map::FlowField* Map::getFlowField(const Creature* creature, const Creature* target, uint32_t profile)
 {
-	if(curNode == 0)
-		return NULL;
+	++flowFieldClock;
+
+	FlowField* field = NULL;
+	FlowField* oldest = NULL;
+	for(std::vector<FlowField*>::iterator it = flowFields.begin(); it != flowFields.end(); ++it)
+	{
+		if((*it)->targetId == target->getID() && (*it)->profile == profile)
+		{
+			field = *it;
+			break;
+		}
 
-	int best_node_f = 100000;
-	uint32_t best_node = 0;
-	bool found = false;
+		if(!oldest || (*it)->lastUse < oldest->lastUse)
+			oldest = *it;
+	}
 
-	for(uint32_t i = 0; i < curNode; i++)
+	if(field)
 	{
-		if(nodes[i].f < best_node_f && openNodes[i] == 1)
+		bool valid = (field->targetPos == target->getPosition() &&
+			field->occupiedGoals == getOccupiedGoals(field->targetPos));
+		for(std::vector<std::pair<QTreeLeafNode*, uint32_t> >::iterator it = field->leaves.begin(); valid && it != field->leaves.end(); ++it)
+		{
+			if(it->first->getVersion() != it->second)
+				valid = false;
+		}
+
+		field->lastUse = flowFieldClock;
+		if(valid)
 		{
-			found = true;
-			best_node_f = nodes[i].f;
-			best_node = i;
+			++flowFieldHits;
+			return field;
 		}
 	}
+	else if(flowFields.size() < FLOWFIELD_CACHE_SIZE)
+	{
+		field = new FlowField;
+		flowFields.push_back(field);
+	}
+	else
+		field = oldest;
 
-	if(found)
-		return &nodes[best_node];
+	++flowFieldMisses;
+	resetFlowField(field, creature, target, profile);
+	field->lastUse = flowFieldClock;
+	return field;
+}
 
-	return NULL;
+uint8_t Map::getOccupiedGoals(const Position& targetPos)
+{
+	uint8_t occupied = 0;
+	for(int32_t i = 0; i < 8; ++i)
+	{
+		const Tile* tile = getTile(targetPos.x + flowFieldSteps[i][0], targetPos.y + flowFieldSteps[i][1], targetPos.z);
+		if(tile && tile->getCreatureCount() > 0)
+			occupied |= 1 << i;
+	}
+	return occupied;
 }
 
-void AStarNodes::closeNode(AStarNode* node)
+void Map::resetFlowField(FlowField* field, const Creature* creature, const Creature* target, uint32_t profile)
 {
-	uint32_t pos = GET_NODE_INDEX(node);
-	if(pos >= MAX_NODES)
+	const Position& targetPos = target->getPosition();
+
+	field->targetId = target->getID();
+	field->profile = profile;
+	field->targetPos = targetPos;
+	field->occupiedGoals = getOccupiedGoals(targetPos);
+	field->originX = targetPos.x - FLOWFIELD_RADIUS;
+	field->originY = targetPos.y - FLOWFIELD_RADIUS;
+
+	memset(field->state, FLOWFIELD_UNKNOWN, sizeof(field->state));
+	field->openCells.clear();
+
+	field->leaves.clear();
+	int32_t endX = field->originX + FLOWFIELD_SIZE - 1, endY = field->originY + FLOWFIELD_SIZE - 1;
+	for(int32_t ny = (field->originY & ~FLOOR_MASK); ny <= endY; ny += FLOOR_SIZE)
 	{
-		assert(pos >= MAX_NODES);
-		std::cout << "AStarNodes. trying to close node out of range" << std::endl;
-		return;
+		for(int32_t nx = (field->originX & ~FLOOR_MASK); nx <= endX; nx += FLOOR_SIZE)
+		{
+			if(nx < 0 || ny < 0)
+				continue;
+
+			if(QTreeLeafNode* leaf = getLeaf(nx, ny))
+				field->leaves.push_back(std::make_pair(leaf, leaf->getVersion()));
+		}
 	}
 
-	openNodes[pos] = 0;
+	//the goals are the free walkable tiles next to the target with a clear sight to it,
+	//a tile another creature already stands on is only a way past it
+	for(int32_t i = 0; i < 8; ++i)
+	{
+		Position pos(targetPos.x + flowFieldSteps[i][0], targetPos.y + flowFieldSteps[i][1], targetPos.z);
+		int32_t cell = (FLOWFIELD_RADIUS + flowFieldSteps[i][1]) * FLOWFIELD_SIZE + FLOWFIELD_RADIUS + flowFieldSteps[i][0];
+
+		const Tile* tile = getTile(pos);
+		if(!tile || tile->__queryAdd(0, creature, 1, FLAG_PATHFINDING | FLAG_IGNOREFIELDDAMAGE | FLAG_IGNOREBLOCKCREATURE) != RET_NOERROR)
+		{
+			field->state[cell] = FLOWFIELD_BLOCKED;
+			continue;
+		}
+
+		field->state[cell] = FLOWFIELD_OPEN;
+		if((field->occupiedGoals & (1 << i)) || !isSightClear(pos, targetPos, true))
+		{
+			field->dist[cell] = FLOWFIELD_UNREACHED;
+			continue;
+		}
+
+		field->dist[cell] = 0;
+		field->next[cell] = FLOWFIELD_GOAL;
+		field->openCells.push_back(std::make_pair(0, cell));
+	}
+	std::make_heap(field->openCells.begin(), field->openCells.end(), std::greater<std::pair<int32_t, uint32_t> >());
 }
 
-void AStarNodes::openNode(AStarNode* node)
+void Map::settleFlowField(FlowField* field, const Creature* creature, int32_t startCell,
+	int32_t& bestCost, int32_t& bestStep)
 {
-	uint32_t pos = GET_NODE_INDEX(node);
-	if(pos >= MAX_NODES)
+	int32_t startX = startCell % FLOWFIELD_SIZE, startY = startCell / FLOWFIELD_SIZE;
+
+	bestCost = FLOWFIELD_UNREACHED;
+	bestStep = -1;
+
+	//the creatures around the follower decide which of its next steps are open right now
+	int32_t stepCost[8];
+	for(int32_t i = 0; i < 8; ++i)
 	{
-		assert(pos >= MAX_NODES);
-		std::cout << "AStarNodes. trying to open node out of range" << std::endl;
-		return;
+		stepCost[i] = -1;
+		const Tile* tile = getTile(field->originX + startX + flowFieldSteps[i][0],
+			field->originY + startY + flowFieldSteps[i][1], field->targetPos.z);
+		if(tile && tile->__queryAdd(0, creature, 1, FLAG_PATHFINDING | FLAG_IGNOREFIELDDAMAGE) == RET_NOERROR)
+			stepCost[i] = (i < 4 ? MAP_NORMALWALKCOST : MAP_DIAGONALWALKCOST) + AStarNodes::getTileWalkCost(creature, tile);
+	}
+
+	//neighbours settled for an earlier follower already have their final distance
+	for(int32_t i = 0; i < 8; ++i)
+	{
+		int32_t x = startX + flowFieldSteps[i][0], y = startY + flowFieldSteps[i][1];
+		int32_t cell = y * FLOWFIELD_SIZE + x;
+		if(field->state[cell] != FLOWFIELD_SETTLED || stepCost[i] == -1)
+			continue;
+
+		int32_t total = field->dist[cell] + stepCost[i];
+		if(total < bestCost)
+		{
+			bestCost = total;
+			bestStep = i;
+		}
 	}
 
-	openNodes[pos] = 1;
+	//keep going with the search until nothing cheaper can reach the follower
+	std::greater<std::pair<int32_t, uint32_t> > compare;
+	while(!field->openCells.empty() && field->openCells.front().first < bestCost)
+	{
+		std::pair<int32_t, uint32_t> open = field->openCells.front();
+		std::pop_heap(field->openCells.begin(), field->openCells.end(), compare);
+		field->openCells.pop_back();
+
+		uint32_t cell = open.second;
+		if(field->state[cell] == FLOWFIELD_SETTLED || field->dist[cell] != open.first)
+			continue;
+
+		int32_t x = cell % FLOWFIELD_SIZE, y = cell / FLOWFIELD_SIZE;
+		const Tile* tile = getTile(field->originX + x, field->originY + y, field->targetPos.z);
+
+		//a creature in the way costs what it does for getPathMatching, whoever
+		//follows; only what is around the follower is checked again later
+		field->state[cell] = FLOWFIELD_SETTLED;
+		field->cost[cell] = AStarNodes::getFieldWalkCost(creature, tile);
+		if(tile->getCreatureCount() > 0)
+			field->cost[cell] += MAP_NORMALWALKCOST * 3;
+
+		int32_t stepX = x - startX, stepY = y - startY;
+		if(std::max(std::abs(stepX), std::abs(stepY)) == 1)
+		{
+			for(int32_t i = 0; i < 8; ++i)
+			{
+				if(flowFieldSteps[i][0] != stepX || flowFieldSteps[i][1] != stepY || stepCost[i] == -1)
+					continue;
+
+				int32_t total = open.first + stepCost[i];
+				if(total < bestCost)
+				{
+					bestCost = total;
+					bestStep = i;
+				}
+			}
+		}
+
+		for(int32_t i = 0; i < 8; ++i)
+		{
+			int32_t nx = x + flowFieldSteps[i][0], ny = y + flowFieldSteps[i][1];
+			if(nx < 0 || ny < 0 || nx >= FLOWFIELD_SIZE || ny >= FLOWFIELD_SIZE)
+				continue;
+
+			uint32_t neighbour = ny * FLOWFIELD_SIZE + nx;
+			uint8_t& state = field->state[neighbour];
+			if(state == FLOWFIELD_SETTLED || state == FLOWFIELD_BLOCKED)
+				continue;
+
+			if(state == FLOWFIELD_UNKNOWN)
+			{
+				//creatures come and go too often to block cells of a shared field,
+				//the follower checks them for its next step only
+				const Tile* neighbourTile = getTile(field->originX + nx, field->originY + ny, field->targetPos.z);
+				if(!neighbourTile || neighbourTile->__queryAdd(0, creature, 1, FLAG_PATHFINDING | FLAG_IGNOREFIELDDAMAGE | FLAG_IGNOREBLOCKCREATURE) != RET_NOERROR)
+				{
+					state = FLOWFIELD_BLOCKED;
+					continue;
+				}
+
+				state = FLOWFIELD_OPEN;
+				field->dist[neighbour] = FLOWFIELD_UNREACHED;
+			}
+
+			int32_t newDist = open.first + field->cost[cell] + (i < 4 ? MAP_NORMALWALKCOST : MAP_DIAGONALWALKCOST);
+			if(newDist < field->dist[neighbour])
+			{
+				field->dist[neighbour] = newDist;
+				field->next[neighbour] = i ^ 2;
+				field->openCells.push_back(std::make_pair(newDist, neighbour));
+				std::push_heap(field->openCells.begin(), field->openCells.end(), compare);
+			}
+		}
+	}
 }
 
-uint32_t AStarNodes::countClosedNodes()
+//*********** AStarNodes *************
+
+AStarNodes::AStarNodes()
+{
+	tableMask = 0;
+	stamp = 0;
+	curNode = 0;
+	maxNodes = 0;
+	openNodes = 0;
+	closedNodes = 0;
+}
+
+AStarNodes& AStarNodes::getInstance()
+{
+	static boost::thread_specific_ptr<AStarNodes> instance;
+	if(!instance.get())
+		instance.reset(new AStarNodes);
+
+	return *instance;
+}
+
+void AStarNodes::reset(uint32_t _maxNodes)
 {
-	uint32_t counter = 0;
-	for(uint32_t i = 0; i < curNode; i++)
+	if(_maxNodes < 64)
+		_maxNodes = 64;
+
+	if(_maxNodes > nodes.size())
 	{
-		if(openNodes[i] == 0)
-			counter++;
+		nodes.resize(_maxNodes);
+		openHeap.reserve(_maxNodes * 2);
+
+		//keep the load factor of the index under one half
+		uint32_t tableSize = 1;
+		while(tableSize < _maxNodes * 2)
+			tableSize <<= 1;
+
+		TableEntry entry = {0, 0, 0};
+		nodeTable.assign(tableSize, entry);
+		tableMask = tableSize - 1;
+		stamp = 0;
+	}
+
+	//bumping the stamp invalidates the whole index without touching it
+	if(++stamp == 0)
+	{
+		for(std::vector<TableEntry>::iterator it = nodeTable.begin(); it != nodeTable.end(); ++it)
+			it->stamp = 0;
+
+		stamp = 1;
 	}
-	return counter;
+
+	maxNodes = _maxNodes;
+	curNode = 0;
+	openNodes = 0;
+	closedNodes = 0;
+	openHeap.clear();
 }
 
-uint32_t AStarNodes::countOpenNodes()
+AStarNode* AStarNodes::createNode(int32_t x, int32_t y)
 {
-	uint32_t counter = 0;
-	for(uint32_t i = 0; i < curNode; i++)
+	if(curNode >= maxNodes)
+		return NULL;
+
+	uint32_t key = getKey(x, y);
+	uint32_t i = (key * 2654435761U) & tableMask;
+	while(nodeTable[i].stamp == stamp)
+		i = (i + 1) & tableMask;
+
+	nodeTable[i].key = key;
+	nodeTable[i].stamp = stamp;
+	nodeTable[i].index = curNode;
+
+	AStarNode* node = &nodes[curNode++];
+	node->x = x;
+	node->y = y;
+	node->parent = NULL;
+	node->f = node->g = node->h = 0;
+	node->state = NODE_NEW;
+	return node;
+}
+
+AStarNode* AStarNodes::getBestNode()
+{
+	while(!openHeap.empty())
 	{
-		if(openNodes[i] == 1)
-			counter++;
+		HeapEntry entry = openHeap.front();
+		std::pop_heap(openHeap.begin(), openHeap.end(), HeapCompare());
+		openHeap.pop_back();
+
+		//nodes are pushed again whenever they get cheaper, skip the outdated entries
+		AStarNode* node = &nodes[entry.index];
+		if(node->state == NODE_OPEN && node->f == entry.f)
+			return node;
 	}
-	return counter;
+	return NULL;
 }
 
-bool AStarNodes::isInList(int32_t x, int32_t y)
+void AStarNodes::closeNode(AStarNode* node)
 {
-	for(uint32_t i = 0; i < curNode; i++)
+	if(node->state != NODE_OPEN)
+		return;
+
+	node->state = NODE_CLOSED;
+	--openNodes;
+	++closedNodes;
+}
+
+void AStarNodes::openNode(AStarNode* node)
+{
+	if(node->state == NODE_CLOSED)
+		--closedNodes;
+
+	if(node->state != NODE_OPEN)
 	{
-		if(nodes[i].x == x && nodes[i].y == y)
-			return true;
+		node->state = NODE_OPEN;
+		++openNodes;
 	}
-	return false;
+
+	HeapEntry entry;
+	entry.f = node->f;
+	entry.index = node - &nodes[0];
+
+	openHeap.push_back(entry);
+	std::push_heap(openHeap.begin(), openHeap.end(), HeapCompare());
 }
 
 AStarNode* AStarNodes::getNodeInList(int32_t x, int32_t y)
 {
-	for(uint32_t i = 0; i < curNode; i++)
+	uint32_t key = getKey(x, y);
+	uint32_t i = (key * 2654435761U) & tableMask;
+	while(nodeTable[i].stamp == stamp)
 	{
-		if(nodes[i].x == x && nodes[i].y == y)
-			return &nodes[i];
+		if(nodeTable[i].key == key)
+			return &nodes[nodeTable[i].index];
+
+		i = (i + 1) & tableMask;
 	}
 	return NULL;
 }
@@ -1156,13 +1675,18 @@ int32_t AStarNodes::getTileWalkCost(const Creature* creature, const Tile* tile)
 		cost += MAP_NORMALWALKCOST * 3;
 	}
 
+	return cost + getFieldWalkCost(creature, tile);
+}
+
+int32_t AStarNodes::getFieldWalkCost(const Creature* creature, const Tile* tile)
+{
 	if(const MagicField* field = tile->getFieldItem())
 	{
 		CombatType_t combatType = field->getCombatType();
 		if(!creature->isImmune(combatType) && !creature->hasCondition(Combat::DamageToConditionType(combatType)))
-			cost += MAP_NORMALWALKCOST * 18;
+			return MAP_NORMALWALKCOST * 18;
 	}
-	return cost;
+	return 0;
 }
 
 int32_t AStarNodes::getEstimatedDistance(int32_t x, int32_t y, int32_t xGoal, int32_t yGoal)
@@ -1183,93 +1707,38 @@ Floor::Floor()
 	}
 }
 
-//**************** QTreeNode **********************
-QTreeNode::QTreeNode()
-{
-	m_isLeaf = false;
-	m_child[0] = NULL;
-	m_child[1] = NULL;
-	m_child[2] = NULL;
-	m_child[3] = NULL;
-}
-
-QTreeNode::~QTreeNode()
-{
-	delete m_child[0];
-	delete m_child[1];
-	delete m_child[2];
-	delete m_child[3];
-}
-
-QTreeLeafNode* QTreeNode::getLeaf(uint32_t x, uint32_t y)
+//**************** Sectors **********************
+QTreeLeafNode* Map::createLeaf(uint32_t x, uint32_t y)
 {
-	if(!isLeaf())
+	QTreeLeafNode**& block = sectorDirectory[((y >> (FLOOR_BITS + SECTOR_BLOCK_BITS)) << SECTOR_DIRECTORY_BITS) | (x >> (FLOOR_BITS + SECTOR_BLOCK_BITS))];
+	if(!block)
 	{
-		uint32_t index = ((x & 0x8000) >> 15) | ((y & 0x8000) >> 14);
-		if(m_child[index])
-			return m_child[index]->getLeaf(x*2, y*2);
-		else
-			return NULL;
-	}
-	else
-		return static_cast<QTreeLeafNode*>(this);
-}
+		block = new QTreeLeafNode*[SECTOR_BLOCK_SIZE * SECTOR_BLOCK_SIZE];
+		for(uint32_t i = 0; i < SECTOR_BLOCK_SIZE * SECTOR_BLOCK_SIZE; ++i)
+			block[i] = NULL;
 
-QTreeLeafNode* QTreeNode::getLeafStatic(QTreeNode* root, uint32_t x, uint32_t y)
-{
-	QTreeNode* currentNode = root;
-	uint32_t currentX = x, currentY = y;
-	while(currentNode)
-	{
-		if(!currentNode->isLeaf())
-		{
-			uint32_t index = ((currentX & 0x8000) >> 15) | ((currentY & 0x8000) >> 14);
-			if(currentNode->m_child[index])
-			{
-				currentNode = currentNode->m_child[index];
-				currentX = currentX*2;
-				currentY = currentY*2;
-			}
-			else
-				return NULL;
-		}
-		else
-			return static_cast<QTreeLeafNode*>(currentNode);
+		++sectorBlockCount;
 	}
-	return NULL;
-}
 
-QTreeLeafNode* QTreeNode::createLeaf(uint32_t x, uint32_t y, uint32_t level)
-{
-	if(!isLeaf())
+	QTreeLeafNode*& leaf = block[(((y >> FLOOR_BITS) & SECTOR_BLOCK_MASK) << SECTOR_BLOCK_BITS) | ((x >> FLOOR_BITS) & SECTOR_BLOCK_MASK)];
+	if(!leaf)
 	{
-		uint32_t index = ((x & 0x8000) >> 15) | ((y & 0x8000) >> 14);
-		if(!m_child[index])
-		{
-			if(level != FLOOR_BITS)
-				m_child[index] = new QTreeNode();
-			else
-			{
-				m_child[index] = new QTreeLeafNode();
-				QTreeLeafNode::newLeaf = true;
-			}
-		}
-		return m_child[index]->createLeaf(x*2, y*2, level - 1);
+		leaf = new QTreeLeafNode();
+		++sectorCount;
 	}
-	return static_cast<QTreeLeafNode*>(this);
-}
 
+	return leaf;
+}
 
 //************ LeafNode ************************
-bool QTreeLeafNode::newLeaf = false;
 QTreeLeafNode::QTreeLeafNode()
 {
 	for(uint32_t i = 0; i < MAP_MAX_LAYERS; ++i)
 		m_array[i] = NULL;
 
-	m_isLeaf = true;
 	m_leafS = NULL;
 	m_leafE = NULL;
+	m_version = 0;
 }
 
 QTreeLeafNode::~QTreeLeafNode()
@@ -1323,11 +1792,104 @@ uint32_t Map::clean()
 		}
 	}
 
+	uint32_t reclaimed = reclaimTiles();
 	if(g_game.getGameState() == GAME_STATE_MAINTAIN)
 		g_game.setGameState(GAME_STATE_NORMAL);
 
 	std::cout << "> CLEAN: Removed " << count << " item" << (count != 1 ? "s" : "")
-		<< " from " << tiles << " tile" << (tiles != 1 ? "s" : "") << " in "
+		<< " from " << tiles << " tile" << (tiles != 1 ? "s" : "") << " and "
+		<< reclaimed << " empty tile" << (reclaimed != 1 ? "s" : "") << " in "
 		<< (OTSYS_TIME() - start) / (1000.) << " seconds." << std::endl;
 	return count;
 }
+
+Tile* Map::getTransientTile(int32_t x, int32_t y, int32_t z)
+{
+	++transientTileCount;
+	return new StaticTile(x, y, z);
+}
+
+void Map::releaseTransientTile(Tile* tile)
+{
+	//transient tiles are never linked to a sector
+	assert(!tile->qt_node && tile->isEmpty());
+	delete static_cast<StaticTile*>(tile);
+}
+
+uint32_t Map::reclaimTiles()
+{
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < SECTOR_DIRECTORY_SIZE * SECTOR_DIRECTORY_SIZE; ++i)
+	{
+		QTreeLeafNode** block = sectorDirectory[i];
+		if(!block)
+			continue;
+
+		for(uint32_t j = 0; j < SECTOR_BLOCK_SIZE * SECTOR_BLOCK_SIZE; ++j)
+		{
+			QTreeLeafNode* leaf = block[j];
+			if(!leaf)
+				continue;
+
+			for(uint32_t z = 0; z < MAP_MAX_LAYERS; ++z)
+			{
+				Floor* floor = leaf->getFloor(z);
+				if(!floor)
+					continue;
+
+				for(uint32_t x = 0; x < FLOOR_SIZE; ++x)
+				{
+					for(uint32_t y = 0; y < FLOOR_SIZE; ++y)
+					{
+						Tile* tile = floor->tiles[x][y];
+						if(!tile || !tile->isEmpty())
+							continue;
+
+						//empty tiles are never dynamic, the flag would not be clear
+						floor->tiles[x][y] = NULL;
+						delete static_cast<StaticTile*>(tile);
+						++count;
+					}
+				}
+			}
+		}
+	}
+
+	reclaimedTileCount += count;
+	return count;
+}
+
+uint32_t Map::countEmptyTiles() const
+{
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < SECTOR_DIRECTORY_SIZE * SECTOR_DIRECTORY_SIZE; ++i)
+	{
+		QTreeLeafNode** block = sectorDirectory[i];
+		if(!block)
+			continue;
+
+		for(uint32_t j = 0; j < SECTOR_BLOCK_SIZE * SECTOR_BLOCK_SIZE; ++j)
+		{
+			QTreeLeafNode* leaf = block[j];
+			if(!leaf)
+				continue;
+
+			for(uint32_t z = 0; z < MAP_MAX_LAYERS; ++z)
+			{
+				Floor* floor = leaf->getFloor(z);
+				if(!floor)
+					continue;
+
+				for(uint32_t x = 0; x < FLOOR_SIZE; ++x)
+				{
+					for(uint32_t y = 0; y < FLOOR_SIZE; ++y)
+					{
+						if(floor->tiles[x][y] && floor->tiles[x][y]->isEmpty())
+							++count;
+					}
+				}
+			}
+		}
+	}
+	return count;
+}
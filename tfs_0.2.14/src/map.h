@@ -40,6 +40,7 @@ class Creature;
 class Player;
 class Game;
 struct FindPathParams;
+struct MapSnapshot;
 
 #define MAP_MAX_LAYERS 16
  
@@ -51,11 +52,9 @@ struct AStarNode
 	int32_t x, y;
 	AStarNode* parent;
 	int32_t f, g, h;
+	uint8_t state;
 };
- 
-#define MAX_NODES 512
-#define GET_NODE_INDEX(a) (a - &nodes[0])
- 
+
 #define MAP_NORMALWALKCOST 10
 #define MAP_DIAGONALWALKCOST 25
 
@@ -64,74 +63,120 @@ class AStarNodes
 	public:
 		AStarNodes();
 		~AStarNodes(){}
- 
-		AStarNode* createOpenNode();
+
+		//the node arena is kept per thread and reused by every search
+		static AStarNodes& getInstance();
+		void reset(uint32_t _maxNodes);
+
+		AStarNode* createNode(int32_t x, int32_t y);
 		AStarNode* getBestNode();
 		void closeNode(AStarNode* node);
 		void openNode(AStarNode* node);
-		uint32_t countClosedNodes();
-		uint32_t countOpenNodes();
-		bool isInList(int32_t x, int32_t y);
+		uint32_t countClosedNodes() const {return closedNodes;}
+		uint32_t countOpenNodes() const {return openNodes;}
 		AStarNode* getNodeInList(int32_t x, int32_t y);
 
 		int32_t getMapWalkCost(const Creature* creature, AStarNode* node,
 			const Tile* neighbourTile, const Position& neighbourPos);
 		static int32_t getTileWalkCost(const Creature* creature, const Tile* tile);
+		// the part of the walk cost that does not depend on the creatures on the tile
+		static int32_t getFieldWalkCost(const Creature* creature, const Tile* tile);
 		int32_t getEstimatedDistance(int32_t x, int32_t y, int32_t xGoal, int32_t yGoal);
- 
+
 	private:
-		AStarNode nodes[MAX_NODES];
-		std::bitset<MAX_NODES> openNodes;
-		uint32_t curNode;
+		enum NodeState_t
+		{
+			NODE_NEW = 0,
+			NODE_OPEN,
+			NODE_CLOSED
+		};
+
+		struct HeapEntry
+		{
+			int32_t f;
+			uint32_t index;
+		};
+
+		struct HeapCompare
+		{
+			bool operator()(const HeapEntry& a, const HeapEntry& b) const
+			{
+				//min-heap on f, ties go to the oldest node like the old linear scan did
+				return a.f > b.f || (a.f == b.f && a.index > b.index);
+			}
+		};
+
+		struct TableEntry
+		{
+			uint32_t key;
+			uint32_t stamp;
+			uint32_t index;
+		};
+
+		static uint32_t getKey(int32_t x, int32_t y) {return ((uint32_t)(x & 0xFFFF) << 16) | (uint32_t)(y & 0xFFFF);}
+
+		std::vector<AStarNode> nodes;
+		std::vector<HeapEntry> openHeap;
+		std::vector<TableEntry> nodeTable;
+		uint32_t tableMask, stamp;
+		uint32_t curNode, maxNodes;
+		uint32_t openNodes, closedNodes;
 };
- 
+
 template<class T> class lessPointer : public std::binary_function<T*, T*, bool>
 {
 	public:
 		bool operator()(T*& t1, T*& t2) { return *t1 < *t2; }
 };
  
-typedef std::list<Creature*> SpectatorVec;
+typedef std::vector<Creature*> SpectatorVec;
 typedef std::list<Player*> PlayerList;
-typedef std::map<Position, boost::shared_ptr<SpectatorVec> > SpectatorCache;
  
 #define FLOOR_BITS 3
 #define FLOOR_SIZE (1 << FLOOR_BITS)
 #define FLOOR_MASK (FLOOR_SIZE - 1)
 
+// cached spectator queries are never shared by more than this many positions,
+// reaching it simply starts over with an empty cache
+#define SPECTATOR_CACHE_SIZE 16384
+
+// handle a leaf keeps for every cached query that scanned it
+struct SpectatorCacheRef
+{
+	uint32_t index;
+	uint32_t generation;
+};
+
+typedef std::vector<SpectatorCacheRef> SpectatorCacheRefs;
+
 struct Floor
 {
 	Floor();
 	Tile* tiles[FLOOR_SIZE][FLOOR_SIZE];
 };
 
-class FrozenPathingConditionCall;
-class QTreeLeafNode;
+// The map is split into sectors of FLOOR_SIZE x FLOOR_SIZE tiles. A sector is
+// found through a two level directory: blocks of SECTOR_BLOCK_SIZE x
+// SECTOR_BLOCK_SIZE sectors are only allocated where the map has tiles.
+#define SECTOR_BLOCK_BITS 6
+#define SECTOR_BLOCK_SIZE (1 << SECTOR_BLOCK_BITS)
+#define SECTOR_BLOCK_MASK (SECTOR_BLOCK_SIZE - 1)
+#define SECTOR_DIRECTORY_BITS (16 - FLOOR_BITS - SECTOR_BLOCK_BITS)
+#define SECTOR_DIRECTORY_SIZE (1 << SECTOR_DIRECTORY_BITS)
 
-class QTreeNode
-{
-	public:
-		QTreeNode();
-		virtual ~QTreeNode();
- 
-		bool isLeaf() const {return m_isLeaf;}
-		QTreeLeafNode* getLeaf(uint32_t x, uint32_t y);
-		static QTreeLeafNode* getLeafStatic(QTreeNode* root, uint32_t x, uint32_t y);
-		QTreeLeafNode* createLeaf(uint32_t x, uint32_t y, uint32_t level);
- 
-	protected:
-		bool m_isLeaf;
-		QTreeNode* m_child[4];
- 
-		friend class Map;
-};
+class FrozenPathingConditionCall;
 
+#define FLOWFIELD_RADIUS 20
+#define FLOWFIELD_SIZE (FLOWFIELD_RADIUS * 2 + 1)
+#define FLOWFIELD_CELLS (FLOWFIELD_SIZE * FLOWFIELD_SIZE)
+#define FLOWFIELD_CACHE_SIZE 32
 
-class QTreeLeafNode : public QTreeNode
+// A map sector, the name is kept from the quadtree it used to be a leaf of
+class QTreeLeafNode
 {
 	public:
 		QTreeLeafNode();
-		virtual ~QTreeLeafNode();
+		~QTreeLeafNode();
  
 		Floor* createFloor(uint32_t z);
 		Floor* getFloor(uint16_t z){return m_array[z];}
@@ -142,15 +187,20 @@ class QTreeLeafNode : public QTreeNode
 		void addCreature(Creature* c);
 		void removeCreature(Creature* c);
 
+		// bumped whenever the ground or an item that blocks or redirects a
+		// walk changes on one of its tiles, creatures moving do not count
+		void touch() {++m_version;}
+		uint32_t getVersion() const {return m_version;}
+
 	protected:
-		static bool newLeaf;
 		QTreeLeafNode* m_leafS;
 		QTreeLeafNode* m_leafE;
+		uint32_t m_version;
 		Floor* m_array[MAP_MAX_LAYERS];
 		CreatureVector creature_list;
+		SpectatorCacheRefs spectator_refs;
  
 		friend class Map;
-		friend class QTreeNode;
 };
 
 /**
@@ -182,16 +232,73 @@ class Map
 		  */
 		bool saveMap();
 
+		/**
+		  * Copy the house tiles and house info that saveMap writes.
+		  * Has to be called on the dispatcher thread.
+		  */
+		void captureMap(MapSnapshot& snapshot);
+
+		/**
+		  * Write a snapshot taken by captureMap, from any thread.
+		  * \returns true if the map was saved successfully
+		  */
+		bool writeMap(const MapSnapshot& snapshot);
+
 		/**
 		  * Get a single tile.
 		  * \returns A pointer to that tile.
 		  */
-		Tile* getTile(int32_t x, int32_t y, int32_t z);
-		Tile* getTile(const Position& pos);
+		Tile* getTile(int32_t x, int32_t y, int32_t z)
+		{
+			if(x < 0 || x >= 0xFFFF || y < 0 || y >= 0xFFFF || z < 0 || z >= MAP_MAX_LAYERS)
+				return NULL;
+
+			QTreeLeafNode* leaf = getLeaf(x, y);
+			if(leaf)
+			{
+				Floor* floor = leaf->getFloor(z);
+				if(floor)
+					return floor->tiles[x & FLOOR_MASK][y & FLOOR_MASK];
+			}
+			return NULL;
+		}
+
+		Tile* getTile(const Position& pos) {return getTile(pos.x, pos.y, pos.z);}
 
 		uint32_t clean();
 
-		QTreeLeafNode* getLeaf(uint16_t x, uint16_t y){ return root.getLeaf(x, y);}
+		/**
+		  * Get a tile for a position the map has no tile at, used by area
+		  * effects over void squares. The tile is not added to the map and
+		  * has to be given back through releaseTransientTile.
+		  */
+		Tile* getTransientTile(int32_t x, int32_t y, int32_t z);
+		void releaseTransientTile(Tile* tile);
+
+		/**
+		  * Remove the tiles that hold no ground, things or flags.
+		  * \returns the amount of tiles removed
+		  */
+		uint32_t reclaimTiles();
+		uint32_t countEmptyTiles() const;
+
+		uint64_t getTransientTileCount() const {return transientTileCount;}
+		uint64_t getReclaimedTileCount() const {return reclaimedTileCount;}
+
+		QTreeLeafNode* getLeaf(uint32_t x, uint32_t y)
+		{
+			if(x > 0xFFFF || y > 0xFFFF)
+				return NULL;
+
+			QTreeLeafNode** block = sectorDirectory[((y >> (FLOOR_BITS + SECTOR_BLOCK_BITS)) << SECTOR_DIRECTORY_BITS) | (x >> (FLOOR_BITS + SECTOR_BLOCK_BITS))];
+			if(!block)
+				return NULL;
+
+			return block[(((y >> FLOOR_BITS) & SECTOR_BLOCK_MASK) << SECTOR_BLOCK_BITS) | ((x >> FLOOR_BITS) & SECTOR_BLOCK_MASK)];
+		}
+
+		uint32_t getSectorCount() const {return sectorCount;}
+		uint32_t getSectorBlockCount() const {return sectorBlockCount;}
 
 		/**
 		  * Set a single tile.
@@ -257,17 +364,102 @@ class Map
 		bool getPathMatching(const Creature* creature, std::list<Direction>& dirList,
 			const FrozenPathingConditionCall& pathCondition, const FindPathParams& fpp);
 
+		/**
+		  * Get the path to a creature being followed. Searches that every
+		  * follower of the target would repeat are answered from a distance
+		  * map shared by all of them, anything else uses getPathMatching.
+		  * \returns returns true if a path was found
+		  */
+		bool getPathToCreature(const Creature* creature, const Creature* target,
+			std::list<Direction>& dirList, const FindPathParams& fpp);
+
+		uint64_t getFlowFieldHits() const {return flowFieldHits;}
+		uint64_t getFlowFieldMisses() const {return flowFieldMisses;}
+		uint32_t getFlowFieldCount() const {return flowFields.size();}
+
+		uint64_t getSpectatorCacheHits() const {return spectatorCacheHits;}
+		uint64_t getSpectatorCacheMisses() const {return spectatorCacheMisses;}
+		uint64_t getSpectatorCacheInvalidations() const {return spectatorCacheInvalidations;}
+		uint32_t getSpectatorCacheSize() const {return spectatorCache.size();}
+
 	protected:
 		uint32_t mapWidth, mapHeight;
 		std::string spawnfile;
 		std::string housefile;
+
+		struct SpectatorCacheEntry
+		{
+			uint64_t key;
+			SpectatorVec* list;
+			uint32_t generation;
+		};
+
+		typedef OTSERV_HASH_MAP<uint64_t, uint32_t> SpectatorCache;
 		SpectatorCache spectatorCache;
+		std::vector<SpectatorCacheEntry> spectatorEntries;
+		std::vector<uint32_t> freeSpectatorEntries;
+
+		// lists of invalidated queries stay alive until the running task is done,
+		// afterwards they are reused for new queries
+		std::vector<SpectatorVec*> retiredSpectators;
+		std::vector<SpectatorVec*> spectatorPool;
 
-		// Actually scans the map for spectators
+		uint64_t spectatorCacheHits;
+		uint64_t spectatorCacheMisses;
+		uint64_t spectatorCacheInvalidations;
+
+		static uint64_t getSpectatorCacheKey(const Position& pos)
+		{
+			return ((uint64_t)pos.x << 24) | ((uint64_t)pos.y << 8) | (uint64_t)pos.z;
+		}
+
+		// Distance map towards the tiles next to a followed creature, it is
+		// filled lazily and stays valid while the target does not move, none
+		// of the sectors it covers change and the same tiles next to the
+		// target are taken by other creatures
+		struct FlowField
+		{
+			uint32_t targetId;
+			uint32_t profile;
+			Position targetPos;
+			uint8_t occupiedGoals;
+			int32_t originX, originY;
+			uint32_t lastUse;
+
+			int32_t dist[FLOWFIELD_CELLS];
+			int16_t cost[FLOWFIELD_CELLS];
+			uint8_t state[FLOWFIELD_CELLS];
+			uint8_t next[FLOWFIELD_CELLS];
+
+			std::vector<std::pair<int32_t, uint32_t> > openCells;
+			std::vector<std::pair<QTreeLeafNode*, uint32_t> > leaves;
+		};
+
+		std::vector<FlowField*> flowFields;
+		uint32_t flowFieldClock;
+		uint64_t flowFieldHits;
+		uint64_t flowFieldMisses;
+
+		uint64_t transientTileCount;
+		uint64_t reclaimedTileCount;
+
+		static uint32_t getWalkProfile(const Creature* creature);
+		uint8_t getOccupiedGoals(const Position& targetPos);
+		FlowField* getFlowField(const Creature* creature, const Creature* target, uint32_t profile);
+		void resetFlowField(FlowField* field, const Creature* creature, const Creature* target, uint32_t profile);
+		void settleFlowField(FlowField* field, const Creature* creature, int32_t startCell,
+			int32_t& bestCost, int32_t& bestStep);
+
+		SpectatorVec* findSpectatorCache(const Position& centerPos);
+		int32_t createSpectatorCache(const Position& centerPos);
+		void retireSpectatorCache(uint32_t index);
+
+		// Actually scans the map for spectators, a cacheIndex registers the
+		// query in every leaf it scanned
 		void getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, bool checkforduplicate,
 			int32_t minRangeX, int32_t maxRangeX,
 			int32_t minRangeY, int32_t maxRangeY,
-			int32_t minRangeZ, int32_t maxRangeZ);
+			int32_t minRangeZ, int32_t maxRangeZ, int32_t cacheIndex = -1);
 
 		// Use this when a custom spectator vector is needed, this support many
 		// more parameters than the heavily cached version below.
@@ -275,13 +467,20 @@ class Map
 			int32_t minRangeX = 0, int32_t maxRangeX = 0,
 			int32_t minRangeY = 0, int32_t maxRangeY = 0);
 		// The returned SpectatorVec is a temporary and should not be kept around
-		// Take special heed in that the vector will be destroyed if any function
-		// that calls clearSpectatorCache is called.
+		// Take special heed in that the vector will be reused once the running
+		// dispatcher task is done.
 		const SpectatorVec& getSpectators(const Position& centerPos);
 
+		// drops the cached queries that scanned this leaf
+		void invalidateSpectators(QTreeLeafNode* leaf);
 		void clearSpectatorCache();
+		void recycleSpectators();
+
+		QTreeLeafNode* createLeaf(uint32_t x, uint32_t y);
 
-		QTreeNode root;
+		QTreeLeafNode** sectorDirectory[SECTOR_DIRECTORY_SIZE * SECTOR_DIRECTORY_SIZE];
+		uint32_t sectorCount;
+		uint32_t sectorBlockCount;
 
 		struct RefreshBlock_t
 		{
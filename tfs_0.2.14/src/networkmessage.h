@@ -167,6 +167,7 @@ class NetworkMessage
 		bool isOverrun() const { return m_overrun; }
 
 		char* getBuffer() { return (char*)&m_MsgBuf[0]; }
+		const char* getBuffer() const { return (const char*)&m_MsgBuf[0]; }
 		char* getBodyBuffer() { m_ReadPos = 2; return (char*)&m_MsgBuf[header_length]; }
 
 #ifdef __TRACK_NETWORK__
@@ -198,6 +199,4 @@ class NetworkMessage
 		uint8_t m_MsgBuf[NETWORKMESSAGE_MAXSIZE];
 };
 
-typedef boost::shared_ptr<NetworkMessage> NetworkMessage_ptr;
-
 #endif // #ifndef __NETWORK_MESSAGE_H__
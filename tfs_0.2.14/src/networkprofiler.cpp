@@ -0,0 +1,151 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <boost/bind.hpp>
+
+#include "networkprofiler.h"
+#include "configmanager.h"
+#include "scheduler.h"
+#include "tools.h"
+
+extern ConfigManager g_config;
+
+NetworkProfiler::NetworkProfiler()
+{
+	memset(m_received, 0, sizeof(m_received));
+	memset(m_sent, 0, sizeof(m_sent));
+	m_startTime = time(NULL);
+}
+
+void NetworkProfiler::addReceived(uint8_t opcode, uint32_t bytes, int64_t handlerTime)
+{
+	boost::mutex::scoped_lock lockClass(m_lock);
+	OpcodeStats& stats = m_received[opcode];
+	++stats.packets;
+	stats.bytes += bytes;
+	stats.handlerTime += handlerTime;
+}
+
+void NetworkProfiler::addHandlerTime(uint8_t opcode, int64_t handlerTime)
+{
+	boost::mutex::scoped_lock lockClass(m_lock);
+	m_received[opcode].handlerTime += handlerTime;
+}
+
+void NetworkProfiler::addSent(OutputMessage_ptr msg)
+{
+	uint32_t start = msg->getProfiledPos();
+	uint32_t end = msg->getReadPos();
+	if(end <= start)
+		return;
+
+	msg->setProfiledPos(end);
+	uint8_t opcode = (uint8_t)msg->getBuffer()[start];
+
+	boost::mutex::scoped_lock lockClass(m_lock);
+	OpcodeStats& stats = m_sent[opcode];
+	++stats.packets;
+	stats.bytes += end - start;
+}
+
+void NetworkProfiler::runTask(uint8_t opcode, const boost::function<void (void)>& f)
+{
+	boost::posix_time::ptime start = now();
+	f();
+	getInstance()->addHandlerTime(opcode, (now() - start).total_microseconds());
+}
+
+static bool compareBytes(const std::pair<uint64_t, int32_t>& a, const std::pair<uint64_t, int32_t>& b)
+{
+	return a.first > b.first;
+}
+
+std::string NetworkProfiler::getReport()
+{
+	OpcodeStats received[256], sent[256];
+	m_lock.lock();
+	memcpy(received, m_received, sizeof(received));
+	memcpy(sent, m_sent, sizeof(sent));
+	m_lock.unlock();
+
+	std::ostringstream os;
+	os << "Network statistics from " << formatDate(m_startTime) << " to " << formatDate(time(NULL)) << "\n";
+	for(int32_t direction = 0; direction < 2; ++direction)
+	{
+		const OpcodeStats* stats = (direction == 0 ? received : sent);
+		os << (direction == 0 ? "Received" : "Sent") << ":\n";
+		os << "opcode     packets        bytes";
+		if(direction == 0)
+			os << "   handler ms";
+
+		os << "\n";
+
+		//heaviest first
+		std::vector<std::pair<uint64_t, int32_t> > order;
+		for(int32_t i = 0; i < 256; ++i)
+		{
+			if(stats[i].packets > 0)
+				order.push_back(std::make_pair(stats[i].bytes, i));
+		}
+
+		std::sort(order.begin(), order.end(), compareBytes);
+		for(std::vector<std::pair<uint64_t, int32_t> >::iterator it = order.begin(); it != order.end(); ++it)
+		{
+			const OpcodeStats& opcode = stats[it->second];
+			os << "0x" << std::hex << std::setw(2) << std::setfill('0') << it->second << std::dec << std::setfill(' ')
+				<< std::setw(12) << opcode.packets << std::setw(13) << opcode.bytes;
+			if(direction == 0)
+				os << std::setw(13) << opcode.handlerTime / 1000;
+
+			os << "\n";
+		}
+	}
+	return os.str();
+}
+
+void NetworkProfiler::dump()
+{
+	std::ofstream file("data/logs/networkstats.log", std::ios::app);
+	if(file.is_open())
+		file << getReport() << std::endl;
+}
+
+void NetworkProfiler::reset()
+{
+	boost::mutex::scoped_lock lockClass(m_lock);
+	memset(m_received, 0, sizeof(m_received));
+	memset(m_sent, 0, sizeof(m_sent));
+	m_startTime = time(NULL);
+}
+
+void NetworkProfiler::autoDump()
+{
+	int32_t dumpEachMinutes = g_config.getNumber(ConfigManager::NETWORK_STATS_DUMP_EACH_MINUTES);
+	if(dumpEachMinutes <= 0)
+		return;
+
+	dump();
+	g_scheduler.addEvent(createSchedulerTask(dumpEachMinutes * 1000 * 60, boost::bind(&NetworkProfiler::autoDump, this)));
+}
@@ -0,0 +1,80 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Traffic and handler time per game protocol opcode
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_NETWORKPROFILER_H__
+#define __OTSERV_NETWORKPROFILER_H__
+
+#include "definitions.h"
+#include <string>
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "outputmessage.h"
+
+// Counters are updated by the network threads and the dispatcher, so they
+// sit behind one lock that is only held for a few additions.
+class NetworkProfiler
+{
+	public:
+		~NetworkProfiler() {}
+
+		static NetworkProfiler* getInstance()
+		{
+			static NetworkProfiler instance;
+			return &instance;
+		}
+
+		static boost::posix_time::ptime now() {return boost::posix_time::microsec_clock::universal_time();}
+
+		void addReceived(uint8_t opcode, uint32_t bytes, int64_t handlerTime);
+		void addHandlerTime(uint8_t opcode, int64_t handlerTime);
+		// counts what was written to the message since it was last counted as
+		// one packet of the opcode it starts with, so it is called before every
+		// opcode the game protocol writes
+		void addSent(OutputMessage_ptr msg);
+
+		// runs a dispatcher task on behalf of an inbound opcode
+		static void runTask(uint8_t opcode, const boost::function<void (void)>& f);
+
+		std::string getReport();
+		void dump();
+		void reset();
+
+		// writes the report every networkStatsDumpEachMinutes
+		void autoDump();
+
+	protected:
+		NetworkProfiler();
+
+		struct OpcodeStats
+		{
+			uint64_t packets;
+			uint64_t bytes;
+			int64_t handlerTime; // microseconds
+		};
+
+		OpcodeStats m_received[256];
+		OpcodeStats m_sent[256];
+		time_t m_startTime;
+		boost::mutex m_lock;
+};
+
+#endif
@@ -79,6 +79,10 @@
 #include "admin.h"
 #include "globalevent.h"
 #include "mounts.h"
+#include "networkprofiler.h"
+#include "workerpool.h"
+#include "databaseexecutor.h"
+#include "savejournal.h"
 
 #ifdef __OTSERV_ALLOCATOR__
 #include "allocator.h"
@@ -96,6 +100,7 @@
 
 Dispatcher g_dispatcher;
 Scheduler g_scheduler;
+WorkerPool g_loginPool;
 
 IPList serverIPs;
 
@@ -224,6 +229,9 @@ int main(int argc, char *argv[])
 		servicer.run();
 		g_scheduler.join();
 		g_dispatcher.join();
+		g_loginPool.join();
+		DatabaseExecutor::getInstance()->join();
+		SaveJournal::getInstance()->join();
 	}
 	else
 	{
@@ -507,9 +515,22 @@ void mainLoader(ServiceManager* services)
 	if(!g_game.loadMap(g_config.getString(ConfigManager::MAP_NAME)))
 		startupErrorMessage("");
 
+	if(g_config.getBoolean(ConfigManager::SAVE_JOURNAL))
+	{
+		//what a crash left behind goes on top of the database before anyone logs in
+		if(!SaveJournal::getInstance()->replay(g_game.getMap()))
+			startupErrorMessage("Unable to replay the save journal.");
+
+		SaveJournal::getInstance()->start();
+	}
+
 	std::cout << ">> Initializing gamestate" << std::endl;
 	g_game.setGameState(GAME_STATE_INIT);
 
+	g_loginPool.start(g_config.getNumber(ConfigManager::LOGIN_THREADS), &Database::bindThreadConnection);
+	DatabaseExecutor::getInstance()->start(g_config.getNumber(ConfigManager::DATABASE_PRIORITY_CONNECTIONS),
+		g_config.getNumber(ConfigManager::DATABASE_BACKGROUND_CONNECTIONS));
+
 	// Tibia protocols
 	services->add<ProtocolGame>(g_config.getNumber(ConfigManager::GAME_PORT));
 	services->add<ProtocolLogin>(g_config.getNumber(ConfigManager::LOGIN_PORT));
@@ -528,6 +549,10 @@ void mainLoader(ServiceManager* services)
 	if(autoSaveEachMinutes > 0)
 		g_scheduler.addEvent(createSchedulerTask(autoSaveEachMinutes * 1000 * 60, boost::bind(&Game::autoSave, &g_game)));
 
+	int32_t networkStatsDumpEachMinutes = g_config.getNumber(ConfigManager::NETWORK_STATS_DUMP_EACH_MINUTES);
+	if(networkStatsDumpEachMinutes > 0)
+		g_scheduler.addEvent(createSchedulerTask(networkStatsDumpEachMinutes * 1000 * 60, boost::bind(&NetworkProfiler::autoDump, NetworkProfiler::getInstance())));
+
 	if(g_config.getBoolean(ConfigManager::SERVERSAVE_ENABLED))
 	{
 		int32_t serverSaveHour = g_config.getNumber(ConfigManager::SERVERSAVE_H);
@@ -1008,7 +1033,7 @@ LRESULT CALLBACK WindowProcedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM
 					if(g_game.getGameState() != GAME_STATE_STARTUP)
 					{
 						g_dispatcher.addTask(
-							createTask(boost::bind(&Game::saveGameState, &g_game)));
+							createTask(boost::bind(&Game::saveGameState, &g_game, true)));
 						MessageBoxA(NULL, "The players online have been saved.", "Save players", MB_OK);
 					}
 				}
@@ -22,30 +22,46 @@
 #include "outputmessage.h"
 #include "protocol.h"
 #include "scheduler.h"
+#include "configmanager.h"
 
 extern Dispatcher g_dispatcher;
+extern ConfigManager g_config;
 
-#ifdef __ENABLE_SERVER_DIAGNOSTIC__
-uint32_t OutputMessagePool::OutputMessagePoolCount = OUTPUT_POOL_SIZE;
-#endif
-
-OutputMessage::OutputMessage()
+OutputMessage::OutputMessage() : m_refCount(0)
 {
+	m_nextFree = NULL;
 	freeMessage();
 }
 
+void intrusive_ptr_add_ref(OutputMessage* msg)
+{
+	++msg->m_refCount;
+}
+
+void intrusive_ptr_release(OutputMessage* msg)
+{
+	if(--msg->m_refCount == 0)
+		OutputMessagePool::getInstance()->releaseMessage(msg);
+}
+
 //*********** OutputMessagePool ****************//
 
 OutputMessagePool::OutputMessagePool()
 {
+	m_freeMessages = NULL;
+	m_freeCount = m_messageCount = m_peakInFlight = 0;
+	m_requestCount = m_reuseCount = 0;
 	for(uint32_t i = 0; i < OUTPUT_POOL_SIZE; ++i)
 	{
 		OutputMessage* msg = new OutputMessage();
-		m_outputMessages.push_back(msg);
+		msg->m_nextFree = m_freeMessages;
+		m_freeMessages = msg;
 #ifdef __TRACK_NETWORK__
 		m_allOutputMessages.push_back(msg);
 #endif
 	}
+
+	m_freeCount = m_messageCount = OUTPUT_POOL_SIZE;
 	m_frameTime = OTSYS_TIME();
 }
 
@@ -58,11 +74,12 @@ void OutputMessagePool::startExecutionFrame()
 
 OutputMessagePool::~OutputMessagePool()
 {
-	InternalOutputMessageList::iterator it;
-	for(it = m_outputMessages.begin(); it != m_outputMessages.end(); ++it)
-		delete *it;
-
-	m_outputMessages.clear();
+	while(m_freeMessages)
+	{
+		OutputMessage* msg = m_freeMessages;
+		m_freeMessages = msg->m_nextFree;
+		delete msg;
+	}
 }
 
 void OutputMessagePool::send(OutputMessage_ptr msg)
@@ -104,26 +121,8 @@ void OutputMessagePool::send(OutputMessage_ptr msg)
 void OutputMessagePool::sendAll()
 {
 	boost::recursive_mutex::scoped_lock lockClass(m_outputPoolLock);
-	OutputMessageMessageList::iterator it;
-
-	for(it = m_toAddQueue.begin(); it != m_toAddQueue.end();)
-	{
-		//drop messages that are older than 10 seconds
-		if(OTSYS_TIME() - (*it)->getFrame() > 10 * 1000)
-		{
-			(*it)->getProtocol()->onSendMessage(*it);
-			it = m_toAddQueue.erase(it);
-			continue;
-		}
-
-		(*it)->setState(OutputMessage::STATE_ALLOCATED);
-		m_autoSendOutputMessages.push_back(*it);
-		++it;
-	}
-
-	m_toAddQueue.clear();
-
-	for(it = m_autoSendOutputMessages.begin(); it != m_autoSendOutputMessages.end();)
+	OutputMessageMessageList::iterator it, last = m_autoSendOutputMessages.begin();
+	for(it = m_autoSendOutputMessages.begin(); it != m_autoSendOutputMessages.end(); ++it)
 	{
 		OutputMessage_ptr omsg = *it;
 		#ifdef __NO_PLAYER_SENDBUFFER__
@@ -153,11 +152,17 @@ void OutputMessagePool::sendAll()
 				std::cout << "Error: [OutputMessagePool::send] NULL connection." << std::endl;
 				#endif
 			}
-			it = m_autoSendOutputMessages.erase(it);
 		}
 		else
-			++it;
+		{
+			//keep the ones still buffering, in order
+			if(last != it)
+				*last = omsg;
+
+			++last;
+		}
 	}
+	m_autoSendOutputMessages.erase(last, m_autoSendOutputMessages.end());
 }
 
 void OutputMessagePool::releaseMessage(OutputMessage* msg)
@@ -168,6 +173,8 @@ void OutputMessagePool::releaseMessage(OutputMessage* msg)
 
 void OutputMessagePool::internalReleaseMessage(OutputMessage* msg)
 {
+	//references are taken under the lock by network threads as well
+	boost::recursive_mutex::scoped_lock lockClass(m_outputPoolLock);
 	if(msg->getProtocol())
 	{
 		msg->getProtocol()->unRef();
@@ -192,14 +199,27 @@ void OutputMessagePool::internalReleaseMessage(OutputMessage* msg)
 
 #ifdef __TRACK_NETWORK__
 	msg->clearTrack();
+#else
+	int32_t maxFree = g_config.getNumber(ConfigManager::MAX_FREE_OUTPUT_MESSAGES);
+	if(m_freeCount >= maxFree && m_messageCount > OUTPUT_POOL_SIZE)
+	{
+		--m_messageCount;
+		delete msg;
+		return;
+	}
 #endif
 
-	m_outputPoolLock.lock();
-	m_outputMessages.push_back(msg);
-	m_outputPoolLock.unlock();
+	msg->m_nextFree = m_freeMessages;
+	m_freeMessages = msg;
+	++m_freeCount;
 }
 
 OutputMessage_ptr OutputMessagePool::getOutputMessage(Protocol* protocol, bool autosend /*= true*/)
+{
+	return getOutputMessage(protocol, protocol->getConnection(), autosend);
+}
+
+OutputMessage_ptr OutputMessagePool::getOutputMessage(Protocol* protocol, Connection_ptr connection, bool autosend)
 {
 	#ifdef __DEBUG_NET_DETAIL__
 	std::cout << "request output message - auto = " << autosend << std::endl;
@@ -210,37 +230,42 @@ OutputMessage_ptr OutputMessagePool::getOutputMessage(Protocol* protocol, bool a
 
 	boost::recursive_mutex::scoped_lock lockClass(m_outputPoolLock);
 
-	if(protocol->getConnection() == NULL)
+	if(connection == NULL)
 		return OutputMessage_ptr();
 
-	if(m_outputMessages.empty())
+	OutputMessage* msg = m_freeMessages;
+	if(msg)
 	{
-		OutputMessage* msg = new OutputMessage();
-		m_outputMessages.push_back(msg);
-
-#ifdef __ENABLE_SERVER_DIAGNOSTIC__
-		OutputMessagePoolCount++;
-#endif
+		m_freeMessages = msg->m_nextFree;
+		msg->m_nextFree = NULL;
+		--m_freeCount;
+		++m_reuseCount;
+	}
+	else
+	{
+		msg = new OutputMessage();
+		++m_messageCount;
 
 #ifdef __TRACK_NETWORK__
 		m_allOutputMessages.push_back(msg);
 #endif
 	}
 
-	OutputMessage_ptr outputmessage;
-	outputmessage.reset(m_outputMessages.back(),
-		boost::bind(&OutputMessagePool::releaseMessage, this, _1));
+	++m_requestCount;
+	if(m_messageCount - m_freeCount > m_peakInFlight)
+		m_peakInFlight = m_messageCount - m_freeCount;
 
-	m_outputMessages.pop_back();
+	OutputMessage_ptr outputmessage(msg);
 
-	configureOutputMessage(outputmessage, protocol, autosend);
+	configureOutputMessage(outputmessage, protocol, connection, autosend);
 	return outputmessage;
 }
 
-void OutputMessagePool::configureOutputMessage(OutputMessage_ptr msg, Protocol* protocol, bool autosend)
+void OutputMessagePool::configureOutputMessage(OutputMessage_ptr msg, Protocol* protocol, Connection_ptr connection, bool autosend)
 {
 	TRACK_MESSAGE(msg);
 	msg->Reset();
+	msg->setProfiledPos(msg->getReadPos());
 	if(autosend)
 	{
 		msg->setState(OutputMessage::STATE_ALLOCATED);
@@ -249,7 +274,6 @@ void OutputMessagePool::configureOutputMessage(OutputMessage_ptr msg, Protocol*
 	else
 		msg->setState(OutputMessage::STATE_ALLOCATED_NO_AUTOSEND);
 
-	Connection_ptr connection = protocol->getConnection();
 	assert(connection != NULL);
 
 	msg->setProtocol(protocol);
@@ -264,10 +288,3 @@ void OutputMessagePool::configureOutputMessage(OutputMessage_ptr msg, Protocol*
 #endif
 	msg->setFrame(m_frameTime);
 }
-
-void OutputMessagePool::addToAutoSend(OutputMessage_ptr msg)
-{
-	m_outputPoolLock.lock();
-	m_toAddQueue.push_back(msg);
-	m_outputPoolLock.unlock();
-}
@@ -25,6 +25,8 @@
 #include "connection.h"
 #include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/detail/atomic_count.hpp>
 #include <boost/bind.hpp>
 #include "tools.h"
 #include <list>
@@ -70,6 +72,10 @@ class OutputMessage : public NetworkMessage, boost::noncopyable
 		Connection_ptr getConnection() { return m_connection;}
 		uint64_t getFrame() const { return m_frame;}
 
+		//start of the bytes the network profiler has not counted yet
+		uint32_t getProfiledPos() const { return m_profiledPos;}
+		void setProfiledPos(uint32_t pos) { m_profiledPos = pos;}
+
 		//void setOutputBufferStart(uint32_t pos) {m_outputBufferStart = pos;}
 		//uint32_t getOutputBufferStart() const {return m_outputBufferStart;}
 
@@ -133,6 +139,8 @@ class OutputMessage : public NetworkMessage, boost::noncopyable
 		}
 
 		friend class OutputMessagePool;
+		friend void intrusive_ptr_add_ref(OutputMessage* msg);
+		friend void intrusive_ptr_release(OutputMessage* msg);
 
 		void setProtocol(Protocol* protocol){ m_protocol = protocol;}
 		void setConnection(Connection_ptr connection){ m_connection = connection;}
@@ -147,11 +155,16 @@ class OutputMessage : public NetworkMessage, boost::noncopyable
 
 		uint32_t m_outputBufferStart;
 		uint64_t m_frame;
+		uint32_t m_profiledPos;
 
 		OutputMessageState m_state;
+
+		//shared by the dispatcher and the network threads
+		boost::detail::atomic_count m_refCount;
+		OutputMessage* m_nextFree;
 };
 
-typedef boost::shared_ptr<OutputMessage> OutputMessage_ptr;
+typedef boost::intrusive_ptr<OutputMessage> OutputMessage_ptr;
 
 class OutputMessagePool
 {
@@ -167,37 +180,41 @@ class OutputMessagePool
 			return &instance;
 		}
 
-#ifdef __ENABLE_SERVER_DIAGNOSTIC__
-		static uint32_t OutputMessagePoolCount;
-#endif
-
 		void send(OutputMessage_ptr msg);
 		void sendAll();
 		void stop() {m_isOpen = false;}
 		OutputMessage_ptr getOutputMessage(Protocol* protocol, bool autosend = true);
+		OutputMessage_ptr getOutputMessage(Protocol* protocol, Connection_ptr connection, bool autosend);
 		void startExecutionFrame();
 
-#ifdef __ENABLE_SERVER_DIAGNOSTIC__
-		size_t getTotalMessageCount() const {return OutputMessagePoolCount;}
-#else
-		size_t getTotalMessageCount() const {return m_allOutputMessages.size();}
-#endif
-		size_t getAvailableMessageCount() const {return m_outputMessages.size();}
+		size_t getTotalMessageCount() const {return m_messageCount;}
+		size_t getAvailableMessageCount() const {return m_freeCount;}
 		size_t getAutoMessageCount() const {return m_autoSendOutputMessages.size();}
-		void addToAutoSend(OutputMessage_ptr msg);
+		uint64_t getRequestCount() const {return m_requestCount;}
+		uint64_t getReuseCount() const {return m_reuseCount;}
+		int32_t getInFlightCount() const {return m_messageCount - m_freeCount;}
+		int32_t getPeakInFlightCount() const {return m_peakInFlight;}
 
 	protected:
-		void configureOutputMessage(OutputMessage_ptr msg, Protocol* protocol, bool autosend);
+		void configureOutputMessage(OutputMessage_ptr msg, Protocol* protocol, Connection_ptr connection, bool autosend);
+		friend void intrusive_ptr_release(OutputMessage* msg);
 		void releaseMessage(OutputMessage* msg);
 		void internalReleaseMessage(OutputMessage* msg);
 
 		typedef std::list<OutputMessage*> InternalOutputMessageList;
-		typedef std::list<OutputMessage_ptr> OutputMessageMessageList;
+		typedef std::vector<OutputMessage_ptr> OutputMessageMessageList;
+
+		//free messages are chained through OutputMessage::m_nextFree, anything past
+		//the configured maximum is deleted instead of kept
+		OutputMessage* m_freeMessages;
+		int32_t m_freeCount;
+		int32_t m_messageCount;
+		int32_t m_peakInFlight;
+		uint64_t m_requestCount;
+		uint64_t m_reuseCount;
 
-		InternalOutputMessageList m_outputMessages;
 		InternalOutputMessageList m_allOutputMessages;
 		OutputMessageMessageList m_autoSendOutputMessages;
-		OutputMessageMessageList m_toAddQueue;
 		boost::recursive_mutex m_outputPoolLock;
 		uint64_t m_frameTime;
 		bool m_isOpen;
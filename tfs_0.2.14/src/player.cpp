@@ -42,6 +42,7 @@
 #include "beds.h"
 #include "mounts.h"
 #include "quests.h"
+#include "savejournal.h"
 #ifndef _CONSOLE
 #include "gui.h"
 #endif
@@ -72,6 +73,13 @@ Creature()
 		client->setPlayer(this);
 
 	depotChange = false;
+	for(int32_t i = PLAYERSAVE_FIRST; i <= PLAYERSAVE_LAST; ++i)
+	{
+		savedDigests[i] = 0;
+		pendingSections[i] = false;
+	}
+
+	savedGeneration = capturedGeneration = 0;
 	accountNumber = 0;
 	name = _name;
 	setVocation(0);
@@ -871,6 +879,12 @@ void Player::dropLoot(Container* corpse)
 		__internalAddThing(SLOT_BACKPACK, Item::CreateItem(ITEM_BAG));
 }
 
+void Player::setBankBalance(uint64_t balance)
+{
+	bankBalance = balance;
+	SaveJournal::getInstance()->addBalance(this);
+}
+
 void Player::addStorageValue(const uint32_t key, const int32_t value, const bool isLogin/* = false*/)
 {
 	if(IS_IN_KEYRANGE(key, RESERVED_RANGE))
@@ -906,6 +920,9 @@ void Player::addStorageValue(const uint32_t key, const int32_t value, const bool
 		if(!isLogin && Quests::getInstance()->isQuestStorage(key, value))
 			sendTextMessage(MSG_EVENT_ADVANCE, "Your questlog has been updated.");
 	}
+
+	if(!isLogin)
+		SaveJournal::getInstance()->addStorage(this, key, value);
 }
 
 bool Player::getStorageValue(const uint32_t key, int32_t& value) const
@@ -1069,6 +1086,7 @@ bool Player::addDepot(Depot* depot, uint32_t depotId)
 
 	depots[depotId] = depot;
 	depot->setDepotId(depotId);
+	depot->setOwnerId(getGUID());
 	depot->setMaxDepotLimit(maxDepotLimit);
 	return true;
 }
@@ -2116,6 +2134,7 @@ void Player::addExperience(uint64_t exp, bool useMult/* = false*/, bool sendText
 	else
 		levelPercent = 0;
 
+	SaveJournal::getInstance()->addExperience(this);
 	sendStats();
 }
 
@@ -3338,6 +3357,10 @@ void Player::postAddNotification(Thing* thing, const Cylinder* oldParent, int32_
 		updateInventoryWeight();
 		updateItemsLight();
 		sendStats();
+
+		//containers we carry pass on what happens inside them
+		if(thing->getItem())
+			SaveJournal::getInstance()->onPlayerItemsChanged(this);
 	}
 
 	if(const Item* item = thing->getItem())
@@ -3390,6 +3413,9 @@ void Player::postRemoveNotification(Thing* thing, const Cylinder* newParent, int
 		updateInventoryWeight();
 		updateItemsLight();
 		sendStats();
+
+		if(thing->getItem())
+			SaveJournal::getInstance()->onPlayerItemsChanged(this);
 	}
 
 	if(const Item* item = thing->getItem())
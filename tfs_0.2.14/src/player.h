@@ -129,6 +129,21 @@ typedef std::list<uint32_t> InvitedToGuildsList;
 typedef std::list<uint32_t> GuildWarList;
 typedef std::list<Party*> PartyList;
 
+//parts of a player that are written on their own, see IOLoginData::capturePlayer
+enum PlayerSaveSection_t
+{
+	PLAYERSAVE_FIRST = 0,
+	PLAYERSAVE_STATS = PLAYERSAVE_FIRST,
+	PLAYERSAVE_SKILLS,
+	PLAYERSAVE_SPELLS,
+	PLAYERSAVE_ITEMS,
+	PLAYERSAVE_DEPOT,
+	PLAYERSAVE_STORAGE,
+	PLAYERSAVE_GUILDINVITES,
+	PLAYERSAVE_VIPLIST,
+	PLAYERSAVE_LAST = PLAYERSAVE_VIPLIST
+};
+
 #define PLAYER_MAX_SPEED 1500
 #define PLAYER_MIN_SPEED 10
 
@@ -189,7 +204,7 @@ class Player : public Creature, public Cylinder
 		int32_t getOfflineTrainingTime() { return offlineTrainingTime; }
 
 		uint64_t getBankBalance() const {return bankBalance;}
-		void setBankBalance(uint64_t balance) {bankBalance = balance;}
+		void setBankBalance(uint64_t balance);
 
 		uint32_t getGuildId() const {return guildId;}
 		void setGuildId(uint32_t newGuildId) {guildId = newGuildId;}
@@ -524,8 +539,8 @@ class Player : public Creature, public Cylinder
 		void sendCreatureDisappear(const Creature* creature, uint32_t stackpos, bool isLogout)
 			{if(client) client->sendRemoveCreature(creature, creature->getPosition(), stackpos, isLogout);}
 		void sendCreatureMove(const Creature* creature, const Tile* newTile, const Position& newPos,
-		const Tile* oldTile, const Position& oldPos, uint32_t oldStackPos, bool teleport)
-			{if(client) client->sendMoveCreature(creature, newTile, newPos, newTile->getClientIndexOfThing(this, creature), oldTile, oldPos, oldStackPos, teleport);}
+		const Tile* oldTile, const Position& oldPos, uint32_t oldStackPos, bool teleport, const NetworkMessage* stepPacket = NULL)
+			{if(client) client->sendMoveCreature(creature, newTile, newPos, oldTile, oldPos, oldStackPos, teleport, stepPacket);}
 
 		void sendCreatureTurn(const Creature* creature)
 			{if(client) client->sendCreatureTurn(creature, creature->getTile()->getClientIndexOfThing(this, creature));}
@@ -622,8 +637,12 @@ class Player : public Creature, public Cylinder
 			{if(client) client->sendChangeSpeed(creature, newSpeed);}
 		void sendCreatureHealth(const Creature* creature) const
 			{if(client) client->sendCreatureHealth(creature);}
+		void sendCreatureHealth(const NetworkMessage& packet) const
+			{if(client) client->sendCreatureHealth(packet);}
 		void sendDistanceShoot(const Position& from, const Position& to, unsigned char type) const
 			{if(client) client->sendDistanceShoot(from, to, type);}
+		void sendDistanceShoot(const NetworkMessage& packet, const Position& from, const Position& to) const
+			{if(client) client->sendDistanceShoot(packet, from, to);}
 		void sendHouseWindow(House* house, uint32_t listId) const;
 		void sendCreatePrivateChannel(uint16_t channelId, const std::string& channelName)
 			{if(client) client->sendCreatePrivateChannel(channelId, channelName);}
@@ -632,6 +651,8 @@ class Player : public Creature, public Cylinder
 		void sendIcons() const;
 		void sendMagicEffect(const Position& pos, uint8_t type) const
 			{if(client) client->sendMagicEffect(pos, type);}
+		void sendMagicEffect(const NetworkMessage& packet, const Position& pos) const
+			{if(client) client->sendMagicEffect(packet, pos);}
 		void sendPing();
 		void sendPingBack() const
 			{if(client) client->sendPingBack();}
@@ -904,6 +925,15 @@ class Player : public Creature, public Cylinder
 		StorageMap storageMap;
 		LightInfo itemsLight;
 
+		//what the database is known to hold, a zero digest means unknown
+		size_t savedDigests[PLAYERSAVE_LAST + 1];
+		StorageMap savedStorageMap;
+		uint64_t savedGeneration;
+		//sections and storage keys written by saves that have not been acknowledged yet
+		bool pendingSections[PLAYERSAVE_LAST + 1];
+		std::set<uint32_t> pendingStorageKeys;
+		uint64_t capturedGeneration;
+
 		OutfitList m_playerOutfits;
 
 		//read/write storage data
@@ -959,6 +989,7 @@ class Player : public Creature, public Cylinder
 	friend class Map;
 	friend class Actions;
 	friend class IOLoginData;
+	friend class SaveJournal;
 	friend class ProtocolGame;
 };
 
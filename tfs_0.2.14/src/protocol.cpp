@@ -31,31 +31,133 @@
 #include "outputmessage.h"
 #include "rsa.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 extern RSA g_RSA;
 
-void Protocol::onSendMessage(OutputMessage_ptr msg)
+#define XTEA_ROUNDS 32
+
+//the round keys only depend on the key, so they are worked out once per message
+static void XTEA_roundKeys(const uint32_t* k, uint32_t* keys)
 {
-	#ifdef __DEBUG_NET_DETAIL__
-	std::cout << "Protocol::onSendMessage" << std::endl;
-	#endif
+	uint32_t sum = 0;
+	for(int32_t i = 0; i < XTEA_ROUNDS; ++i)
+	{
+		keys[i * 2] = sum + k[sum & 3];
+		sum -= 0x61C88647;
+		keys[i * 2 + 1] = sum + k[sum >> 11 & 3];
+	}
+}
+
+#ifdef __SSE2__
+// four blocks at a time, v0 and v1 words of each block split into their own registers
+static inline void XTEA_load(const uint32_t* buffer, __m128i& v0, __m128i& v1)
+{
+	__m128i a = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)buffer), _MM_SHUFFLE(3, 1, 2, 0));
+	__m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(buffer + 4)), _MM_SHUFFLE(3, 1, 2, 0));
+	v0 = _mm_unpacklo_epi64(a, b);
+	v1 = _mm_unpackhi_epi64(a, b);
+}
 
-	if(!m_rawMessages)
+static inline void XTEA_store(uint32_t* buffer, __m128i v0, __m128i v1)
+{
+	_mm_storeu_si128((__m128i*)buffer, _mm_unpacklo_epi32(v0, v1));
+	_mm_storeu_si128((__m128i*)(buffer + 4), _mm_unpackhi_epi32(v0, v1));
+}
+
+static inline __m128i XTEA_mix(__m128i v)
+{
+	return _mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(v, 4), _mm_srli_epi32(v, 5)), v);
+}
+#endif
+
+static void XTEA_encryptBlocks(uint32_t* buffer, size_t blocks, const uint32_t* keys)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	for(; i + 4 <= blocks; i += 4)
+	{
+		__m128i v0, v1;
+		XTEA_load(buffer + i * 2, v0, v1);
+		for(int32_t r = 0; r < XTEA_ROUNDS * 2; r += 2)
+		{
+			v0 = _mm_add_epi32(v0, _mm_xor_si128(XTEA_mix(v1), _mm_set1_epi32(keys[r])));
+			v1 = _mm_add_epi32(v1, _mm_xor_si128(XTEA_mix(v0), _mm_set1_epi32(keys[r + 1])));
+		}
+		XTEA_store(buffer + i * 2, v0, v1);
+	}
+#endif
+	for(; i < blocks; ++i)
 	{
-		msg->writeMessageLength();
-		if(m_encryptionEnabled)
+		uint32_t v0 = buffer[i * 2], v1 = buffer[i * 2 + 1];
+		for(int32_t r = 0; r < XTEA_ROUNDS * 2; r += 2)
 		{
-			#ifdef __DEBUG_NET_DETAIL__
-			std::cout << "Protocol::onSendMessage - encrypt" << std::endl;
-			#endif
-			XTEA_encrypt(*msg);
-			msg->addCryptoHeader(m_checksumEnabled);
+			v0 += ((v1 << 4 ^ v1 >> 5) + v1) ^ keys[r];
+			v1 += ((v0 << 4 ^ v0 >> 5) + v0) ^ keys[r + 1];
 		}
+		buffer[i * 2] = v0;
+		buffer[i * 2 + 1] = v1;
 	}
+}
+
+static void XTEA_decryptBlocks(uint32_t* buffer, size_t blocks, const uint32_t* keys)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	for(; i + 4 <= blocks; i += 4)
+	{
+		__m128i v0, v1;
+		XTEA_load(buffer + i * 2, v0, v1);
+		for(int32_t r = XTEA_ROUNDS * 2; r > 0; r -= 2)
+		{
+			v1 = _mm_sub_epi32(v1, _mm_xor_si128(XTEA_mix(v0), _mm_set1_epi32(keys[r - 1])));
+			v0 = _mm_sub_epi32(v0, _mm_xor_si128(XTEA_mix(v1), _mm_set1_epi32(keys[r - 2])));
+		}
+		XTEA_store(buffer + i * 2, v0, v1);
+	}
+#endif
+	for(; i < blocks; ++i)
+	{
+		uint32_t v0 = buffer[i * 2], v1 = buffer[i * 2 + 1];
+		for(int32_t r = XTEA_ROUNDS * 2; r > 0; r -= 2)
+		{
+			v1 -= ((v0 << 4 ^ v0 >> 5) + v0) ^ keys[r - 1];
+			v0 -= ((v1 << 4 ^ v1 >> 5) + v1) ^ keys[r - 2];
+		}
+		buffer[i * 2] = v0;
+		buffer[i * 2 + 1] = v1;
+	}
+}
+
+void Protocol::onSendMessage(OutputMessage_ptr msg)
+{
+	#ifdef __DEBUG_NET_DETAIL__
+	std::cout << "Protocol::onSendMessage" << std::endl;
+	#endif
 
 	if(msg == m_outputBuffer)
 		m_outputBuffer.reset();
 }
 
+void Protocol::wrapMessage(OutputMessage_ptr msg)
+{
+	//network thread, right before the message is written
+	if(m_rawMessages)
+		return;
+
+	msg->writeMessageLength();
+	if(m_encryptionEnabled)
+	{
+		#ifdef __DEBUG_NET_DETAIL__
+		std::cout << "Protocol::wrapMessage - encrypt" << std::endl;
+		#endif
+		XTEA_encrypt(*msg);
+		msg->addCryptoHeader(m_checksumEnabled);
+	}
+}
+
 void Protocol::onRecvMessage(NetworkMessage& msg)
 {
 	#ifdef __DEBUG_NET_DETAIL__
@@ -76,7 +178,7 @@ OutputMessage_ptr Protocol::getOutputBuffer()
 {
 	if(m_outputBuffer && m_outputBuffer->getMessageLength() < NETWORKMESSAGE_MAXSIZE - 4096)
 		return m_outputBuffer;
-	else if(m_connection)
+	else if(getConnection())
 	{
 		m_outputBuffer = OutputMessagePool::getInstance()->getOutputMessage(this);
 		return m_outputBuffer;
@@ -108,12 +210,6 @@ void Protocol::deleteProtocolTask()
 
 void Protocol::XTEA_encrypt(OutputMessage& msg)
 {
-	uint32_t k[4];
-	k[0] = m_key[0];
-	k[1] = m_key[1];
-	k[2] = m_key[2];
-	k[3] = m_key[3];
-
 	int32_t messageLength = msg.getMessageLength();
 
 	//add bytes until reach 8 multiple
@@ -125,24 +221,9 @@ void Protocol::XTEA_encrypt(OutputMessage& msg)
 		messageLength += n;
 	}
 
-	int32_t read_pos = 0;
-	uint32_t* buffer = (uint32_t*)msg.getOutputBuffer();
-	while(read_pos < messageLength / 4)
-	{
-		uint32_t v0 = buffer[read_pos], v1 = buffer[read_pos + 1];
-		uint32_t delta = 0x61C88647;
-		uint32_t sum = 0;
-
-		for(int32_t i = 0; i < 32; i++)
-		{
-			v0 += ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + k[sum & 3]);
-			sum -= delta;
-			v1 += ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + k[sum >> 11 & 3]);
-		}
-		buffer[read_pos] = v0;
-		buffer[read_pos + 1] = v1;
-		read_pos += 2;
-	}
+	uint32_t keys[XTEA_ROUNDS * 2];
+	XTEA_roundKeys(m_key, keys);
+	XTEA_encryptBlocks((uint32_t*)msg.getOutputBuffer(), messageLength / 8, keys);
 }
 
 bool Protocol::XTEA_decrypt(NetworkMessage& msg)
@@ -155,33 +236,9 @@ bool Protocol::XTEA_decrypt(NetworkMessage& msg)
 		return false;
 	}
 
-	//
-	uint32_t k[4];
-	k[0] = m_key[0];
-	k[1] = m_key[1];
-	k[2] = m_key[2];
-	k[3] = m_key[3];
-
-	uint32_t* buffer = (uint32_t*)(msg.getBuffer() + msg.getReadPos());
-	int read_pos = 0;
-	int32_t messageLength = msg.getMessageLength() - 6;
-	while(read_pos < messageLength / 4)
-	{
-		uint32_t v0 = buffer[read_pos], v1 = buffer[read_pos + 1];
-		uint32_t delta = 0x61C88647;
-		uint32_t sum = 0xC6EF3720;
-
-		for(int32_t i = 0; i < 32; i++)
-		{
-			v1 -= ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + k[sum >> 11 & 3]);
-			sum += delta;
-			v0 -= ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + k[sum & 3]);
-		}
-		buffer[read_pos] = v0;
-		buffer[read_pos + 1] = v1;
-		read_pos += 2;
-	}
-	//
+	uint32_t keys[XTEA_ROUNDS * 2];
+	XTEA_roundKeys(m_key, keys);
+	XTEA_decryptBlocks((uint32_t*)(msg.getBuffer() + msg.getReadPos()), (msg.getMessageLength() - 6) / 8, keys);
 
 	int tmp = msg.GetU16();
 	if(tmp > msg.getMessageLength() - 8)
@@ -223,8 +280,8 @@ bool Protocol::RSA_decrypt(RSA* rsa, NetworkMessage& msg)
 
 uint32_t Protocol::getIP() const
 {
-	if(getConnection())
-		return getConnection()->getIP();
+	if(Connection_ptr connection = getConnection())
+		return connection->getIP();
 
 	return 0;
 }
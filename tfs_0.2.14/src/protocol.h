@@ -23,18 +23,22 @@
 
 #include <boost/utility.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/detail/atomic_count.hpp>
 
 class NetworkMessage;
 class OutputMessage;
 class Connection;
-typedef boost::shared_ptr<OutputMessage> OutputMessage_ptr;
+typedef boost::intrusive_ptr<OutputMessage> OutputMessage_ptr;
+void intrusive_ptr_add_ref(OutputMessage* msg);
+void intrusive_ptr_release(OutputMessage* msg);
 typedef boost::shared_ptr<Connection> Connection_ptr;
 class RSA;
 
 class Protocol : boost::noncopyable
 {
 	public:
-		Protocol(Connection_ptr connection)
+		Protocol(Connection_ptr connection) : m_refCount(0)
 		{
 			m_connection = connection;
 			m_encryptionEnabled = false;
@@ -44,7 +48,6 @@ class Protocol : boost::noncopyable
 			m_key[1] = 0;
 			m_key[2] = 0;
 			m_key[3] = 0;
-			m_refCount = 0;
 		}
 
 		virtual ~Protocol() {}
@@ -53,14 +56,17 @@ class Protocol : boost::noncopyable
 
 		virtual void parsePacket(NetworkMessage& msg){}
 
-		void onSendMessage(OutputMessage_ptr msg);
+		virtual void onSendMessage(OutputMessage_ptr msg);
+		void wrapMessage(OutputMessage_ptr msg);
 		void onRecvMessage(NetworkMessage& msg);
 		virtual void onRecvFirstMessage(NetworkMessage& msg) = 0;
 		virtual void onConnect() {}
 
-		Connection_ptr getConnection() { return m_connection;}
-		const Connection_ptr getConnection() const { return m_connection;}
-		void setConnection(Connection_ptr connection) { m_connection = connection;}
+		//the connection is cleared by the dispatcher while login workers may
+		//still read it, so it is only ever copied in or out atomically
+		Connection_ptr getConnection() { return boost::atomic_load(&m_connection);}
+		const Connection_ptr getConnection() const { return boost::atomic_load(&m_connection);}
+		void setConnection(Connection_ptr connection) { boost::atomic_store(&m_connection, connection);}
 
 		uint32_t getIP() const;
 
@@ -95,7 +101,8 @@ class Protocol : boost::noncopyable
 		bool m_checksumEnabled;
 		bool m_rawMessages;
 		uint32_t m_key[4];
-		uint32_t m_refCount;
+		//also held by login workers, not only the dispatcher
+		boost::detail::atomic_count m_refCount;
 };
 
 #endif
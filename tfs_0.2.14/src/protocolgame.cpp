@@ -23,6 +23,8 @@
 
 #include "networkmessage.h"
 #include "outputmessage.h"
+#include "networkprofiler.h"
+#include "workerpool.h"
 
 #include "items.h"
 
@@ -57,20 +59,31 @@ extern ConfigManager g_config;
 extern Actions actions;
 extern Ban g_bans;
 extern CreatureEvents* g_creatureEvents;
+extern WorkerPool g_loginPool;
 Chat g_chat;
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
 uint32_t ProtocolGame::protocolGameCount = 0;
 #endif
 
+#define TILE_DESCRIPTION_CACHE_SIZE 65536
+
+uint64_t ProtocolGame::tileDescriptionHits = 0;
+uint64_t ProtocolGame::tileDescriptionMisses = 0;
+ProtocolGame::TileDescriptionMap ProtocolGame::tileDescriptions;
+NetworkMessage ProtocolGame::tileDescriptionBuffer;
+NetworkMessage ProtocolGame::broadcastPacket;
+
 // Helping templates to add dispatcher tasks
 template<class FunctionType>
 void ProtocolGame::addGameTaskInternal(bool droppable, uint32_t delay, const FunctionType& func)
 {
+	//the time the game spends on the task is profiled under the packet that queued it
+	boost::function<void (void)> task = boost::bind(&NetworkProfiler::runTask, m_recvOpcode, boost::function<void (void)>(func));
 	if(droppable)
-		g_dispatcher.addTask(createTask(delay, func));
+		g_dispatcher.addTask(createTask(delay, task));
 	else
-		g_dispatcher.addTask(createTask(func));
+		g_dispatcher.addTask(createTask(task));
 }
 
 ProtocolGame::ProtocolGame(Connection_ptr connection) :
@@ -79,6 +92,7 @@ ProtocolGame::ProtocolGame(Connection_ptr connection) :
 	player = NULL;
 	m_debugAssertSent = false;
 	m_acceptPackets = false;
+	m_recvOpcode = 0;
 	eventConnect = 0;
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
 	protocolGameCount++;
@@ -385,13 +399,44 @@ bool ProtocolGame::parseFirstPacket(NetworkMessage& msg)
 
 	uint16_t clientos = msg.GetU16();
 	uint16_t version = msg.GetU16();
+	if(msg.getMessageLength() - msg.getReadPos() != 128)
+	{
+		getConnection()->closeConnection();
+		return false;
+	}
+
+	//decryption and the account checks run on a login worker, the player
+	//is loaded and placed by the dispatcher afterwards
+	addRef();
+	g_loginPool.addJob(boost::bind(&ProtocolGame::runLogin, this, clientos, version,
+		std::string(msg.getBuffer() + msg.getReadPos(), 128)));
+	return true;
+}
 
+void ProtocolGame::runLogin(uint16_t clientos, uint16_t version, const std::string& block)
+{
+	//login worker, the dispatcher may clear the connection meanwhile so
+	//everything below works on this one copy
+	if(Connection_ptr connection = getConnection())
+		checkLogin(connection, clientos, version, block);
+
+	unRef();
+}
+
+bool ProtocolGame::checkLogin(Connection_ptr connection, uint16_t clientos, uint16_t version, const std::string& block)
+{
+	NetworkMessage msg;
+	memcpy(msg.getBuffer(), block.data(), block.size());
+	msg.setMessageLength(block.size());
+	msg.setReadPos(0);
 	if(!RSA_decrypt(msg))
 	{
-		getConnection()->closeConnection();
+		connection->closeConnection();
 		return false;
 	}
 
+	uint32_t clientip = connection->getIP();
+
 	uint32_t key[4];
 	key[0] = msg.GetU32();
 	key[1] = msg.GetU32();
@@ -414,7 +459,7 @@ bool ProtocolGame::parseFirstPacket(NetworkMessage& msg)
 
 	if(version < CLIENT_VERSION_MIN || version > CLIENT_VERSION_MAX)
 	{
-		disconnectClient(0x14, "Only clients with protocol " CLIENT_VERSION_STR " allowed!");
+		disconnectClient(connection, 0x14, "Only clients with protocol " CLIENT_VERSION_STR " allowed!");
 		return false;
 	}
 
@@ -427,38 +472,38 @@ bool ProtocolGame::parseFirstPacket(NetworkMessage& msg)
 		}
 		else
 		{
-			disconnectClient(0x14, "You must enter your account name.");
+			disconnectClient(connection, 0x14, "You must enter your account name.");
 			return false;
 		}
 	}
 
 	if(g_game.getGameState() == GAME_STATE_STARTUP || g_game.getServerSaveMessage(0))
 	{
-		disconnectClient(0x14, "Gameworld is starting up. Please wait.");
+		disconnectClient(connection, 0x14, "Gameworld is starting up. Please wait.");
 		return false;
 	}
 
 	if(g_game.getGameState() == GAME_STATE_MAINTAIN)
 	{
-		disconnectClient(0x14, "Gameworld is under maintenance. Please re-connect in a while.");
+		disconnectClient(connection, 0x14, "Gameworld is under maintenance. Please re-connect in a while.");
 		return false;
 	}
 
-	if(g_bans.isIpDisabled(getIP()))
+	if(g_bans.isIpDisabled(clientip))
 	{
-		disconnectClient(0x14, "Too many connections attempts from this IP. Try again later.");
+		disconnectClient(connection, 0x14, "Too many connections attempts from this IP. Try again later.");
 		return false;
 	}
 
-	if(IOBan::getInstance()->isIpBanished(getIP()))
+	if(IOBan::getInstance()->isIpBanished(clientip))
 	{
-		disconnectClient(0x14, "Your IP is banished!");
+		disconnectClient(connection, 0x14, "Your IP is banished!");
 		return false;
 	}
 
 	if(!IOLoginData::getInstance()->playerExists(name))
 	{
-		disconnectClient(0x14, "Player not found.");
+		disconnectClient(connection, 0x14, "Player not found.");
 		return false;
 	}
 
@@ -472,13 +517,12 @@ bool ProtocolGame::parseFirstPacket(NetworkMessage& msg)
 
 	if(!gotPassword || !passwordTest(password, acc_pass))
 	{
-		g_bans.addLoginAttempt(getIP(), false);
-		disconnectClient(0x14, "Account name or password is not correct.");
-		getConnection()->closeConnection();
+		g_bans.addLoginAttempt(clientip, false);
+		disconnectClient(connection, 0x14, "Account name or password is not correct.");
 		return false;
 	}
 
-	g_bans.addLoginAttempt(getIP(), true);
+	g_bans.addLoginAttempt(clientip, true);
 
 	g_dispatcher.addTask(
 		createTask(boost::bind(&ProtocolGame::login, this, name, accnumber, password, clientos, isSetGM, openChannels)));
@@ -522,7 +566,15 @@ void ProtocolGame::onConnect()
 
 void ProtocolGame::disconnectClient(uint8_t error, const char* message)
 {
-	OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, false);
+	disconnectClient(getConnection(), error, message);
+}
+
+void ProtocolGame::disconnectClient(Connection_ptr connection, uint8_t error, const char* message)
+{
+	if(!connection)
+		return;
+
+	OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, connection, false);
 	if(output)
 	{
 		TRACK_MESSAGE(output);
@@ -530,13 +582,13 @@ void ProtocolGame::disconnectClient(uint8_t error, const char* message)
 		output->AddString(message);
 		OutputMessagePool::getInstance()->send(output);
 	}
-	disconnect();
+	connection->closeConnection();
 }
 
 void ProtocolGame::disconnect()
 {
-	if(getConnection())
-		getConnection()->closeConnection();
+	if(Connection_ptr connection = getConnection())
+		connection->closeConnection();
 }
 
 void ProtocolGame::parsePacket(NetworkMessage &msg)
@@ -545,6 +597,15 @@ void ProtocolGame::parsePacket(NetworkMessage &msg)
 		return;
 
 	uint8_t recvbyte = msg.GetByte();
+	m_recvOpcode = recvbyte;
+
+	boost::posix_time::ptime start = NetworkProfiler::now();
+	parseOpcode(msg, recvbyte);
+	NetworkProfiler::getInstance()->addReceived(recvbyte, msg.getMessageLength(), (NetworkProfiler::now() - start).total_microseconds());
+}
+
+void ProtocolGame::parseOpcode(NetworkMessage& msg, uint8_t recvbyte)
+{
 	//a dead player can not performs actions
 	if((player->isRemoved() || player->getHealth() <= 0) && recvbyte != 0x14)
 		return;
@@ -861,30 +922,95 @@ void ProtocolGame::parsePacket(NetworkMessage &msg)
 		disconnect();
 }
 
-void ProtocolGame::GetTileDescription(const Tile* tile, NetworkMessage_ptr msg)
+NetworkMessage_ptr ProtocolGame::getOutputBuffer()
 {
-	msg->AddU16(0x00); //environmental effects
+	NetworkMessage_ptr msg = Protocol::getOutputBuffer();
+	if(msg)
+		NetworkProfiler::getInstance()->addSent(msg); // whatever the previous send wrote
+	return msg;
+}
 
-	int32_t count = 0;
-	if(tile->ground)
+void ProtocolGame::AddOpcode(NetworkMessage_ptr msg, uint8_t opcode)
+{
+	NetworkProfiler::getInstance()->addSent(msg); // the bytes of the previous opcode
+	msg->AddByte(opcode);
+}
+
+void ProtocolGame::onSendMessage(OutputMessage_ptr msg)
+{
+	NetworkProfiler::getInstance()->addSent(msg);
+	Protocol::onSendMessage(msg);
+}
+
+NetworkMessage& ProtocolGame::getBroadcastPacket()
+{
+	broadcastPacket.setReadPos(0);
+	broadcastPacket.setMessageLength(0);
+	return broadcastPacket;
+}
+
+const ProtocolGame::TileDescription& ProtocolGame::getTileDescription(const Tile* tile)
+{
+	//dispatcher thread
+	TileDescriptionMap::iterator cit = tileDescriptions.find(tile);
+	if(cit != tileDescriptions.end() && cit->second.version == tile->getVersion())
 	{
-		msg->AddItem(tile->ground);
-		count++;
+		++tileDescriptionHits;
+		return cit->second;
 	}
 
-	const TileItemVector* items = tile->getItemList();
-	const CreatureVector* creatures = tile->getCreatures();
+	++tileDescriptionMisses;
+	if(cit == tileDescriptions.end())
+	{
+		if(tileDescriptions.size() >= TILE_DESCRIPTION_CACHE_SIZE)
+			tileDescriptions.clear();
+
+		cit = tileDescriptions.insert(std::make_pair(tile, TileDescription())).first;
+	}
+
+	TileDescription& description = cit->second;
+	description.version = tile->getVersion();
+	description.topItems = description.downItems = 0;
+	description.offsets[0] = 0;
 
-	ItemVector::const_iterator it;
-	if(items)
+	NetworkMessage& buffer = tileDescriptionBuffer;
+	buffer.setReadPos(0);
+	buffer.setMessageLength(0);
+	if(tile->ground)
 	{
-		for(it = items->getBeginTopItem(); ((it != items->getEndTopItem()) && (count < 10)); ++it)
+		buffer.AddItem(tile->ground);
+		description.offsets[++description.topItems] = buffer.getReadPos();
+	}
+
+	if(const TileItemVector* items = tile->getItemList())
+	{
+		ItemVector::const_iterator it;
+		for(it = items->getBeginTopItem(); it != items->getEndTopItem() && description.topItems < TILE_DESCRIPTION_ITEMS; ++it)
 		{
-			msg->AddItem(*it);
-			count++;
+			buffer.AddItem(*it);
+			description.offsets[++description.topItems] = buffer.getReadPos();
+		}
+
+		for(it = items->getBeginDownItem(); it != items->getEndDownItem() && description.downItems < TILE_DESCRIPTION_ITEMS; ++it)
+		{
+			buffer.AddItem(*it);
+			description.offsets[description.topItems + ++description.downItems] = buffer.getReadPos();
 		}
 	}
 
+	memcpy(description.data, buffer.getBuffer(), buffer.getReadPos());
+	return description;
+}
+
+void ProtocolGame::GetTileDescription(const Tile* tile, NetworkMessage_ptr msg)
+{
+	msg->AddU16(0x00); //environmental effects
+
+	const TileDescription& description = getTileDescription(tile);
+	int32_t count = description.topItems;
+	msg->AddBytes((const char*)description.data, description.offsets[count]);
+
+	const CreatureVector* creatures = tile->getCreatures();
 	if(creatures)
 	{
 		CreatureVector::const_reverse_iterator cit;
@@ -901,13 +1027,11 @@ void ProtocolGame::GetTileDescription(const Tile* tile, NetworkMessage_ptr msg)
 		}
 	}
 
-	if(items)
+	int32_t downItems = std::min<int32_t>(description.downItems, 10 - count);
+	if(downItems > 0)
 	{
-		for(it = items->getBeginDownItem(); ((it != items->getEndDownItem()) && (count < 10)); ++it)
-		{
-			msg->AddItem(*it);
-			count++;
-		}
+		const uint8_t* begin = description.offsets + description.topItems;
+		msg->AddBytes((const char*)description.data + *begin, begin[downItems] - *begin);
 	}
 }
 
@@ -978,46 +1102,49 @@ void ProtocolGame::GetFloorDescription(NetworkMessage_ptr msg, int32_t x, int32_
 
 void ProtocolGame::checkCreatureAsKnown(uint32_t id, bool &known, uint32_t &removedKnown)
 {
-	// loop through the known creature list and check if the given creature is in
-	std::list<uint32_t>::iterator i;
-	for(i = knownCreatureList.begin(); i != knownCreatureList.end(); ++i)
+	KnownCreatureMap::iterator it = knownCreatureMap.find(id);
+	if(it != knownCreatureMap.end())
 	{
-		if((*i) == id)
-		{
-			// know... make the creature even more known...
-			knownCreatureList.erase(i);
-			knownCreatureList.push_back(id);
-
-			known = true;
-			return;
-		}
+		// know... make the creature even more known...
+		knownCreatureList.splice(knownCreatureList.end(), knownCreatureList, it->second);
+		known = true;
+		return;
 	}
 
 	// ok, he is unknown...
 	known = false;
 
 	// ... but not in future
-	knownCreatureList.push_back(id);
+	knownCreatureMap[id] = knownCreatureList.insert(knownCreatureList.end(), id);
 
 	// too many known creatures?
-	if(knownCreatureList.size() > 1300)
+	if(knownCreatureMap.size() > 1300)
 	{
-		// lets try to remove one from the end of the list
-		for(int32_t n = 0; n < 1300; n++)
+		// the list is kept in order of last use, so the victim is the first
+		// entry that is not on our screen; only the creatures around us can be,
+		// so those are the only ones we have to skip
+		std::vector<uint32_t> inSight;
+		if(player)
 		{
-			removedKnown = knownCreatureList.front();
+			const SpectatorVec& list = g_game.getSpectators(player->getPosition());
+			inSight.reserve(list.size());
+			for(SpectatorVec::const_iterator sit = list.begin(); sit != list.end(); ++sit)
+				inSight.push_back((*sit)->getID());
+
+			std::sort(inSight.begin(), inSight.end());
+		}
 
-			Creature* c = g_game.getCreatureByID(removedKnown);
-			if((!c) || (!canSee(c)))
+		for(size_t n = 0; n < inSight.size(); ++n)
+		{
+			if(!std::binary_search(inSight.begin(), inSight.end(), knownCreatureList.front()))
 				break;
 
 			// this creature we can't remove, still in sight, so back to the end
-			knownCreatureList.pop_front();
-			knownCreatureList.push_back(removedKnown);
+			knownCreatureList.splice(knownCreatureList.end(), knownCreatureList, knownCreatureList.begin());
 		}
 
-		// hopefully we found someone to remove :S, we got only 250 tries
-		// if not... lets kick some players with debug errors :)
+		removedKnown = knownCreatureList.front();
+		knownCreatureMap.erase(knownCreatureList.front());
 		knownCreatureList.pop_front();
 	}
 	else
@@ -1601,7 +1728,7 @@ void ProtocolGame::sendOpenPrivateChannel(const std::string& receiver)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xAD);
+	AddOpcode(msg, 0xAD);
 	msg->AddString(receiver);
 }
 
@@ -1612,7 +1739,7 @@ void ProtocolGame::sendChannelEvent(uint16_t channelId, const std::string& playe
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xF3);
+	AddOpcode(msg, 0xF3);
 	msg->AddU16(channelId);
 	msg->AddString(playerName);
 	msg->AddByte(channelEvent);
@@ -1628,7 +1755,7 @@ void ProtocolGame::sendCreatureOutfit(const Creature* creature, const Outfit_t&
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x8E);
+	AddOpcode(msg, 0x8E);
 	msg->AddU32(creature->getID());
 	if(creature->isInGhostMode())
 		AddCreatureInvisible(msg, creature);
@@ -1646,7 +1773,7 @@ void ProtocolGame::sendCreatureInvisible(const Creature* creature)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x8E);
+	AddOpcode(msg, 0x8E);
 	msg->AddU32(creature->getID());
 	AddCreatureInvisible(msg, creature);
 }
@@ -1684,7 +1811,7 @@ void ProtocolGame::sendCreatureShield(const Creature* creature)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x91);
+	AddOpcode(msg, 0x91);
 	msg->AddU32(creature->getID());
 	msg->AddByte(player->getPartyShield(creature->getPlayer()));
 }
@@ -1702,7 +1829,7 @@ void ProtocolGame::sendCreatureSkull(const Creature* creature)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x90);
+	AddOpcode(msg, 0x90);
 	msg->AddU32(creature->getID());
 	msg->AddByte(player->getSkullClient(creature->getPlayer()));
 }
@@ -1717,7 +1844,7 @@ void ProtocolGame::sendCreatureSquare(const Creature* creature, SquareColor_t co
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x86);
+	AddOpcode(msg, 0x86);
 	msg->AddU32(creature->getID());
 	msg->AddByte((uint8_t)color);
 }
@@ -1729,7 +1856,7 @@ void ProtocolGame::sendTutorial(uint8_t tutorialId)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xDC);
+	AddOpcode(msg, 0xDC);
 	msg->AddByte(tutorialId);
 }
 
@@ -1740,7 +1867,7 @@ void ProtocolGame::sendAddMarker(const Position& pos, uint8_t markType, const st
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xDD);
+	AddOpcode(msg, 0xDD);
 	msg->AddPosition(pos);
 	msg->AddByte(markType);
 	msg->AddString(desc);
@@ -1753,7 +1880,7 @@ void ProtocolGame::sendReLoginWindow()
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x28);
+	AddOpcode(msg, 0x28);
 	msg->AddByte(0xFF);
 }
 
@@ -1774,7 +1901,7 @@ void ProtocolGame::sendBasicData()
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x9F);
+	AddOpcode(msg, 0x9F);
 
 	msg->AddByte(player->isPremium() ? 0x01 : 0x00);
 	msg->AddByte(player->getVocation()->getClientId());
@@ -1807,7 +1934,7 @@ void ProtocolGame::sendClosePrivate(uint16_t channelId)
 	if(channelId == CHANNEL_GUILD || channelId == CHANNEL_PARTY)
 		g_chat.removeUserFromChannel(player, channelId);
 
-	msg->AddByte(0xB3);
+	AddOpcode(msg, 0xB3);
 	msg->AddU16(channelId);
 }
 
@@ -1818,7 +1945,7 @@ void ProtocolGame::sendCreatePrivateChannel(uint16_t channelId, const std::strin
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xB2);
+	AddOpcode(msg, 0xB2);
 	msg->AddU16(channelId);
 	msg->AddString(channelName);
 
@@ -1837,7 +1964,7 @@ void ProtocolGame::sendChannelsDialog()
 	TRACK_MESSAGE(msg);
 	ChannelList list;
 	list = g_chat.getChannelList(player);
-	msg->AddByte(0xAB);
+	AddOpcode(msg, 0xAB);
 	msg->AddByte(list.size()); //how many
 	while(list.size())
 	{
@@ -1855,7 +1982,7 @@ void ProtocolGame::sendChannel(uint16_t channelId, const std::string& channelNam
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xAC);
+	AddOpcode(msg, 0xAC);
 	msg->AddU16(channelId);
 	msg->AddString(channelName);
 
@@ -1898,7 +2025,7 @@ void ProtocolGame::sendIcons(int32_t icons)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xA2);
+	AddOpcode(msg, 0xA2);
 	msg->AddU16(icons);
 }
 
@@ -1909,7 +2036,7 @@ void ProtocolGame::sendContainer(uint32_t cid, const Container* container, bool
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x6E);
+	AddOpcode(msg, 0x6E);
 	msg->AddByte(cid);
 
 	msg->AddItem(container);
@@ -1930,7 +2057,7 @@ void ProtocolGame::sendShop(Npc* npc, const ShopInfoList& itemList)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x7A);
+	AddOpcode(msg, 0x7A);
 	msg->AddString(npc->getName());
 	msg->AddU16(std::min((size_t)0xFFFF, itemList.size()));
 
@@ -1946,7 +2073,7 @@ void ProtocolGame::sendCloseShop()
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x7C);
+	AddOpcode(msg, 0x7C);
 }
 
 void ProtocolGame::sendSaleItemList(const std::list<ShopInfo>& shop)
@@ -1956,7 +2083,7 @@ void ProtocolGame::sendSaleItemList(const std::list<ShopInfo>& shop)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x7B);
+	AddOpcode(msg, 0x7B);
 	msg->AddU32(g_game.getMoney(player));
 
 	std::map<uint32_t, uint32_t> saleMap;
@@ -2035,7 +2162,7 @@ void ProtocolGame::sendMarketEnter(uint32_t depotId)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xF6);
+	AddOpcode(msg, 0xF6);
 	msg->AddU32(std::min((uint64_t)0xFFFFFFFF, player->getBankBalance()));
 	msg->AddByte(std::min((int32_t)0xFF, IOMarket::getInstance()->getPlayerOfferCount(player->getGUID())));
 
@@ -2098,7 +2225,7 @@ void ProtocolGame::sendMarketLeave()
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xF7);
+	AddOpcode(msg, 0xF7);
 }
 
 void ProtocolGame::sendMarketBrowseItem(uint16_t itemId, const MarketOfferList& buyOffers, const MarketOfferList& sellOffers)
@@ -2108,7 +2235,7 @@ void ProtocolGame::sendMarketBrowseItem(uint16_t itemId, const MarketOfferList&
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xF9);
+	AddOpcode(msg, 0xF9);
 	msg->AddItemId(itemId);
 
 	msg->AddU32(buyOffers.size());
@@ -2139,7 +2266,7 @@ void ProtocolGame::sendMarketAcceptOffer(MarketOfferEx offer)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xF9);
+	AddOpcode(msg, 0xF9);
 	msg->AddItemId(offer.itemId);
 
 	if(offer.type == MARKETACTION_BUY)
@@ -2171,7 +2298,7 @@ void ProtocolGame::sendMarketBrowseOwnOffers(const MarketOfferList& buyOffers, c
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xF9);
+	AddOpcode(msg, 0xF9);
 	msg->AddU16(MARKETREQUEST_OWN_OFFERS);
 
 	msg->AddU32(buyOffers.size());
@@ -2202,7 +2329,7 @@ void ProtocolGame::sendMarketCancelOffer(MarketOfferEx offer)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xF9);
+	AddOpcode(msg, 0xF9);
 	msg->AddU16(MARKETREQUEST_OWN_OFFERS);
 
 	if(offer.type == MARKETACTION_BUY)
@@ -2234,7 +2361,7 @@ void ProtocolGame::sendMarketBrowseOwnHistory(const HistoryMarketOfferList& buyO
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xF9);
+	AddOpcode(msg, 0xF9);
 	msg->AddU16(MARKETREQUEST_OWN_HISTORY);
 
 	std::map<uint32_t, uint16_t> counterMap;
@@ -2271,7 +2398,7 @@ void ProtocolGame::sendMarketDetail(uint16_t itemId)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xF8);
+	AddOpcode(msg, 0xF8);
 	msg->AddItemId(itemId);
 
 	const ItemType& it = Item::items[itemId];
@@ -2475,7 +2602,7 @@ void ProtocolGame::sendQuestLog()
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xF0);
+	AddOpcode(msg, 0xF0);
 	msg->AddU16(Quests::getInstance()->getQuestsCount(player));
 	for(QuestsList::const_iterator it = Quests::getInstance()->getFirstQuest(),
 		end = Quests::getInstance()->getLastQuest(); it != end; ++it)
@@ -2497,7 +2624,7 @@ void ProtocolGame::sendQuestLine(const Quest* quest)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xF1);
+	AddOpcode(msg, 0xF1);
 	msg->AddU16(quest->getID());
 	msg->AddByte(quest->getMissionsCount(player));
 	for(MissionsList::const_iterator it = quest->getFirstMission(), end = quest->getLastMission();
@@ -2520,9 +2647,9 @@ void ProtocolGame::sendTradeItemRequest(const Player* player, const Item* item,
 
 	TRACK_MESSAGE(msg);
 	if(ack)
-		msg->AddByte(0x7D);
+		AddOpcode(msg, 0x7D);
 	else
-		msg->AddByte(0x7E);
+		AddOpcode(msg, 0x7E);
 
 	msg->AddString(player->getName());
 
@@ -2570,7 +2697,7 @@ void ProtocolGame::sendCloseTrade()
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x7F);
+	AddOpcode(msg, 0x7F);
 }
 
 void ProtocolGame::sendCloseContainer(uint32_t cid)
@@ -2580,7 +2707,7 @@ void ProtocolGame::sendCloseContainer(uint32_t cid)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x6F);
+	AddOpcode(msg, 0x6F);
 	msg->AddByte(cid);
 }
 
@@ -2594,7 +2721,7 @@ void ProtocolGame::sendCreatureTurn(const Creature* creature, uint32_t stackPos)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x6B);
+	AddOpcode(msg, 0x6B);
 	msg->AddPosition(creature->getPosition());
 	msg->AddByte(stackPos);
 	msg->AddU16(0x63); /*99*/
@@ -2640,7 +2767,7 @@ void ProtocolGame::sendCancelTarget()
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xA3);
+	AddOpcode(msg, 0xA3);
 	msg->AddU32(0x00);
 }
 
@@ -2651,7 +2778,7 @@ void ProtocolGame::sendChangeSpeed(const Creature* creature, uint32_t speed)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x8F);
+	AddOpcode(msg, 0x8F);
 	msg->AddU32(creature->getID());
 	msg->AddU16(speed);
 }
@@ -2663,7 +2790,7 @@ void ProtocolGame::sendCancelWalk()
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xB5);
+	AddOpcode(msg, 0xB5);
 	msg->AddByte(player->getDirection());
 }
 
@@ -2684,7 +2811,7 @@ void ProtocolGame::sendPing()
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x1D);
+	AddOpcode(msg, 0x1D);
 }
 
 void ProtocolGame::sendPingBack()
@@ -2694,7 +2821,7 @@ void ProtocolGame::sendPingBack()
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x1E);
+	AddOpcode(msg, 0x1E);
 }
 
 void ProtocolGame::sendDistanceShoot(const Position& from, const Position& to, uint8_t type)
@@ -2710,7 +2837,20 @@ void ProtocolGame::sendDistanceShoot(const Position& from, const Position& to, u
 		return;
 
 	TRACK_MESSAGE(msg);
-	AddDistanceShoot(msg, from, to, type);
+	AddDistanceShoot(*msg, from, to, type);
+}
+
+void ProtocolGame::sendDistanceShoot(const NetworkMessage& packet, const Position& from, const Position& to)
+{
+	if(!canSee(from) && !canSee(to))
+		return;
+
+	NetworkMessage_ptr msg = getOutputBuffer();
+	if(!msg)
+		return;
+
+	TRACK_MESSAGE(msg);
+	AddBroadcast(msg, packet);
 }
 
 void ProtocolGame::sendMagicEffect(const Position& pos, uint8_t type)
@@ -2726,7 +2866,20 @@ void ProtocolGame::sendMagicEffect(const Position& pos, uint8_t type)
 		return;
 
 	TRACK_MESSAGE(msg);
-	AddMagicEffect(msg, pos, type);
+	AddMagicEffect(*msg, pos, type);
+}
+
+void ProtocolGame::sendMagicEffect(const NetworkMessage& packet, const Position& pos)
+{
+	if(!canSee(pos))
+		return;
+
+	NetworkMessage_ptr msg = getOutputBuffer();
+	if(!msg)
+		return;
+
+	TRACK_MESSAGE(msg);
+	AddBroadcast(msg, packet);
 }
 
 void ProtocolGame::sendCreatureHealth(const Creature* creature)
@@ -2736,7 +2889,17 @@ void ProtocolGame::sendCreatureHealth(const Creature* creature)
 		return;
 
 	TRACK_MESSAGE(msg);
-	AddCreatureHealth(msg, creature);
+	AddCreatureHealth(*msg, creature);
+}
+
+void ProtocolGame::sendCreatureHealth(const NetworkMessage& packet)
+{
+	NetworkMessage_ptr msg = getOutputBuffer();
+	if(!msg)
+		return;
+
+	TRACK_MESSAGE(msg);
+	AddBroadcast(msg, packet);
 }
 
 void ProtocolGame::sendFYIBox(const std::string& message)
@@ -2746,7 +2909,7 @@ void ProtocolGame::sendFYIBox(const std::string& message)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x15);
+	AddOpcode(msg, 0x15);
 	msg->AddString(message);
 }
 
@@ -2800,7 +2963,7 @@ void ProtocolGame::sendUpdateTile(const Tile* tile, const Position& pos)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x69);
+	AddOpcode(msg, 0x69);
 	msg->AddPosition(pos);
 	if(tile)
 	{
@@ -2829,12 +2992,15 @@ void ProtocolGame::sendAddCreature(const Creature* creature, const Position& pos
 	{
 		AddTileCreature(msg, pos, stackpos, creature);
 		if(isLogin)
-			AddMagicEffect(msg, pos, NM_ME_TELEPORT);
+		{
+			NetworkProfiler::getInstance()->addSent(msg);
+			AddMagicEffect(*msg, pos, NM_ME_TELEPORT);
+		}
 
 		return;
 	}
 
-	msg->AddByte(0x0A);
+	AddOpcode(msg, 0x0A);
 	msg->AddU32(player->getID());
 
 	msg->AddU16(0x32);
@@ -2848,7 +3014,10 @@ void ProtocolGame::sendAddCreature(const Creature* creature, const Position& pos
 	AddMapDescription(msg, pos);
 
 	if(isLogin)
-		AddMagicEffect(msg, pos, NM_ME_TELEPORT);
+	{
+		NetworkProfiler::getInstance()->addSent(msg);
+		AddMagicEffect(*msg, pos, NM_ME_TELEPORT);
+	}
 
 	AddInventoryItem(msg, SLOT_HEAD, player->getInventoryItem(SLOT_HEAD));
 	AddInventoryItem(msg, SLOT_NECKLACE, player->getInventoryItem(SLOT_NECKLACE));
@@ -2937,7 +3106,8 @@ void ProtocolGame::sendRemoveCreature(const Creature* creature, const Position&
 }
 
 void ProtocolGame::sendMoveCreature(const Creature* creature, const Tile* newTile, const Position& newPos,
-	uint32_t newStackPos, const Tile* oldTile, const Position& oldPos, uint32_t oldStackPos, bool teleport)
+	const Tile* oldTile, const Position& oldPos, uint32_t oldStackPos, bool teleport,
+	const NetworkMessage* stepPacket/* = NULL*/)
 {
 	if(creature == player)
 	{
@@ -2957,7 +3127,7 @@ void ProtocolGame::sendMoveCreature(const Creature* creature, const Tile* newTil
 				RemoveTileItem(msg, oldPos, oldStackPos);
 			else
 			{
-				msg->AddByte(0x6D);
+				AddOpcode(msg, 0x6D);
 				msg->AddPosition(oldPos);
 				msg->AddByte(oldStackPos);
 				msg->AddPosition(newPos);
@@ -2970,23 +3140,23 @@ void ProtocolGame::sendMoveCreature(const Creature* creature, const Tile* newTil
 
 			if(oldPos.y > newPos.y) // north, for old x
 			{
-				msg->AddByte(0x65);
+				AddOpcode(msg, 0x65);
 				GetMapDescription(oldPos.x - 8, newPos.y - 6, newPos.z, 18, 1, msg);
 			}
 			else if(oldPos.y < newPos.y) // south, for old x
 			{
-				msg->AddByte(0x67);
+				AddOpcode(msg, 0x67);
 				GetMapDescription(oldPos.x - 8, newPos.y + 7, newPos.z, 18, 1, msg);
 			}
 
 			if(oldPos.x < newPos.x) // east, [with new y]
 			{
-				msg->AddByte(0x66);
+				AddOpcode(msg, 0x66);
 				GetMapDescription(newPos.x + 9, newPos.y - 6, newPos.z, 1, 14, msg);
 			}
 			else if(oldPos.x > newPos.x) // west, [with new y]
 			{
-				msg->AddByte(0x68);
+				AddOpcode(msg, 0x68);
 				GetMapDescription(newPos.x - 8, newPos.y - 6, newPos.z, 1, 14, msg);
 			}
 		}
@@ -2996,7 +3166,7 @@ void ProtocolGame::sendMoveCreature(const Creature* creature, const Tile* newTil
 		if(teleport || (oldPos.z == 7 && newPos.z >= 8) || oldStackPos >= 10)
 		{
 			sendRemoveCreature(creature, oldPos, oldStackPos, false);
-			sendAddCreature(creature, newPos, newStackPos, false);
+			sendAddCreature(creature, newPos, newTile->getClientIndexOfThing(player, creature), false);
 		}
 		else
 		{
@@ -3005,16 +3175,25 @@ void ProtocolGame::sendMoveCreature(const Creature* creature, const Tile* newTil
 				return;
 
 			TRACK_MESSAGE(msg);
-			msg->AddByte(0x6D);
-			msg->AddPosition(oldPos);
-			msg->AddByte(oldStackPos);
-			msg->AddPosition(creature->getPosition());
+			if(stepPacket)
+			{
+				// only the old stackpos differs between viewers
+				AddBroadcast(msg, *stepPacket);
+				msg->getBuffer()[msg->getReadPos() - 6] = oldStackPos;
+			}
+			else
+			{
+				AddOpcode(msg, 0x6D);
+				msg->AddPosition(oldPos);
+				msg->AddByte(oldStackPos);
+				msg->AddPosition(creature->getPosition());
+			}
 		}
 	}
 	else if(canSee(oldPos))
 		sendRemoveCreature(creature, oldPos, oldStackPos, false);
 	else if(canSee(creature->getPosition()))
-		sendAddCreature(creature, newPos, newStackPos, false);
+		sendAddCreature(creature, newPos, newTile->getClientIndexOfThing(player, creature), false);
 }
 
 //inventory
@@ -3086,7 +3265,7 @@ void ProtocolGame::sendTextWindow(uint32_t windowTextId, Item* item, uint16_t ma
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x96);
+	AddOpcode(msg, 0x96);
 	msg->AddU32(windowTextId);
 	msg->AddItem(item);
 	if(canWrite)
@@ -3120,7 +3299,7 @@ void ProtocolGame::sendTextWindow(uint32_t windowTextId, uint32_t itemId, const
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x96);
+	AddOpcode(msg, 0x96);
 	msg->AddU32(windowTextId);
 	msg->AddItem(itemId, 1);
 
@@ -3139,7 +3318,7 @@ void ProtocolGame::sendHouseWindow(uint32_t windowTextId, House* _house,
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0x97);
+	AddOpcode(msg, 0x97);
 	msg->AddByte(0x00);
 	msg->AddU32(windowTextId);
 	msg->AddString(text);
@@ -3154,7 +3333,7 @@ void ProtocolGame::sendOutfitWindow()
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xC8);
+	AddOpcode(msg, 0xC8);
 
 	Outfit_t currentOutfit = player->getDefaultOutfit();
 	Mount* currentMount = Mounts::getInstance()->getMountByID(player->getCurrentMount());
@@ -3243,7 +3422,7 @@ void ProtocolGame::sendVIPLogIn(uint32_t guid)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xD3);
+	AddOpcode(msg, 0xD3);
 	msg->AddU32(guid);
 }
 
@@ -3254,7 +3433,7 @@ void ProtocolGame::sendVIPLogOut(uint32_t guid)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xD4);
+	AddOpcode(msg, 0xD4);
 	msg->AddU32(guid);
 }
 
@@ -3265,7 +3444,7 @@ void ProtocolGame::sendVIP(uint32_t guid, const std::string& name, bool isOnline
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xD2);
+	AddOpcode(msg, 0xD2);
 	msg->AddU32(guid);
 	msg->AddString(name);
 	msg->AddByte(isOnline ? 0x01 : 0x00);
@@ -3281,7 +3460,7 @@ void ProtocolGame::sendSpellCooldown(uint8_t spellId, uint32_t time)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xA4);
+	AddOpcode(msg, 0xA4);
 	msg->AddByte(spellId);
 	msg->AddU32(time);
 }
@@ -3293,7 +3472,7 @@ void ProtocolGame::sendSpellGroupCooldown(SpellGroup_t groupId, uint32_t time)
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xA5);
+	AddOpcode(msg, 0xA5);
 	msg->AddByte(groupId);
 	msg->AddU32(time);
 }
@@ -3307,7 +3486,7 @@ void ProtocolGame::sendDamageMessage(MessageClasses mclass, const std::string& m
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xB4);
+	AddOpcode(msg, 0xB4);
 	msg->AddByte(mclass);
 	msg->AddPosition(pos);
 	msg->AddU32(primaryDamage);
@@ -3324,7 +3503,7 @@ void ProtocolGame::sendHealMessage(MessageClasses mclass, const std::string& mes
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xB4);
+	AddOpcode(msg, 0xB4);
 	msg->AddByte(mclass);
 	msg->AddPosition(pos);
 	msg->AddU32(heal);
@@ -3339,7 +3518,7 @@ void ProtocolGame::sendExperienceMessage(MessageClasses mclass, const std::strin
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xB4);
+	AddOpcode(msg, 0xB4);
 	msg->AddByte(mclass);
 	msg->AddPosition(pos);
 	msg->AddU32(exp);
@@ -3350,21 +3529,21 @@ void ProtocolGame::sendExperienceMessage(MessageClasses mclass, const std::strin
 ////////////// Add common messages
 void ProtocolGame::AddMapDescription(NetworkMessage_ptr msg, const Position& pos)
 {
-	msg->AddByte(0x64);
+	AddOpcode(msg, 0x64);
 	msg->AddPosition(player->getPosition());
 	GetMapDescription(pos.x - 8, pos.y - 6, pos.z, 18, 14, msg);
 }
 
 void ProtocolGame::AddTextMessage(NetworkMessage_ptr msg, MessageClasses mclass, const std::string& message)
 {
-	msg->AddByte(0xB4);
+	AddOpcode(msg, 0xB4);
 	msg->AddByte(mclass);
 	msg->AddString(message);
 }
 
 void ProtocolGame::AddTextMessageEx(NetworkMessage_ptr msg, MessageClasses mclass, const std::string& message, const Position& pos, uint32_t value, TextColor_t color)
 {
-	msg->AddByte(0xB4);
+	AddOpcode(msg, 0xB4);
 	msg->AddByte(mclass);
 	msg->AddPosition(pos);
 	msg->AddU32(value);
@@ -3372,20 +3551,37 @@ void ProtocolGame::AddTextMessageEx(NetworkMessage_ptr msg, MessageClasses mclas
 	msg->AddString(message);
 }
 
-void ProtocolGame::AddMagicEffect(NetworkMessage_ptr msg,const Position& pos, uint8_t type)
+bool ProtocolGame::AddMagicEffect(NetworkMessage& msg, const Position& pos, uint8_t type)
 {
-	msg->AddByte(0x83);
-	msg->AddPosition(pos);
-	msg->AddByte(type + 1);
+	if(type > NM_ME_LAST)
+		return false;
+
+	msg.AddByte(0x83);
+	msg.AddPosition(pos);
+	msg.AddByte(type + 1);
+	return true;
 }
 
-void ProtocolGame::AddDistanceShoot(NetworkMessage_ptr msg, const Position& from, const Position& to,
+bool ProtocolGame::AddDistanceShoot(NetworkMessage& msg, const Position& from, const Position& to,
 	uint8_t type)
 {
-	msg->AddByte(0x85);
-	msg->AddPosition(from);
-	msg->AddPosition(to);
-	msg->AddByte(type + 1);
+	if(type > NM_SHOOT_LAST || type == NM_SHOOT_UNK1 || type == NM_SHOOT_UNK2 || type == NM_SHOOT_UNK3)
+		return false;
+
+	msg.AddByte(0x85);
+	msg.AddPosition(from);
+	msg.AddPosition(to);
+	msg.AddByte(type + 1);
+	return true;
+}
+
+void ProtocolGame::AddCreatureStep(NetworkMessage& msg, const Position& oldPos, const Position& newPos)
+{
+	// the old stackpos is patched in per viewer by sendMoveCreature
+	msg.AddByte(0x6D);
+	msg.AddPosition(oldPos);
+	msg.AddByte(0x00);
+	msg.AddPosition(newPos);
 }
 
 void ProtocolGame::AddCreature(NetworkMessage_ptr msg, const Creature* creature, bool known, uint32_t remove)
@@ -3434,7 +3630,7 @@ void ProtocolGame::AddCreature(NetworkMessage_ptr msg, const Creature* creature,
 
 void ProtocolGame::AddPlayerStats(NetworkMessage_ptr msg)
 {
-	msg->AddByte(0xA0);
+	AddOpcode(msg, 0xA0);
 
 	msg->AddU16(player->getHealth());
 	msg->AddU16(player->getPlayerInfo(PLAYERINFO_MAXHEALTH));
@@ -3468,7 +3664,7 @@ void ProtocolGame::AddPlayerStats(NetworkMessage_ptr msg)
 
 void ProtocolGame::AddPlayerSkills(NetworkMessage_ptr msg)
 {
-	msg->AddByte(0xA1);
+	AddOpcode(msg, 0xA1);
 
 	msg->AddByte(player->getSkill(SKILL_FIST, SKILL_LEVEL));
 	msg->AddByte(player->getBaseSkill(SKILL_FIST));
@@ -3505,7 +3701,7 @@ void ProtocolGame::AddCreatureSpeak(NetworkMessage_ptr msg, const Creature* crea
 	if(!creature)
 		return;
 
-	msg->AddByte(0xAA);
+	AddOpcode(msg, 0xAA);
 
 	static uint32_t statementId = 0;
 	msg->AddU32(++statementId); // statement id
@@ -3559,14 +3755,14 @@ void ProtocolGame::AddCreatureSpeak(NetworkMessage_ptr msg, const Creature* crea
 	msg->AddString(text);
 }
 
-void ProtocolGame::AddCreatureHealth(NetworkMessage_ptr msg,const Creature* creature)
+void ProtocolGame::AddCreatureHealth(NetworkMessage& msg, const Creature* creature)
 {
-	msg->AddByte(0x8C);
-	msg->AddU32(creature->getID());
+	msg.AddByte(0x8C);
+	msg.AddU32(creature->getID());
 	if(creature->isHealthHidden())
-		msg->AddByte(0x00);
+		msg.AddByte(0x00);
 	else
-		msg->AddByte((int32_t)std::ceil(((float)creature->getHealth()) * 100 / std::max(creature->getMaxHealth(), (int32_t)1)));
+		msg.AddByte((int32_t)std::ceil(((float)creature->getHealth()) * 100 / std::max(creature->getMaxHealth(), (int32_t)1)));
 }
 
 void ProtocolGame::AddCreatureInvisible(NetworkMessage_ptr msg, const Creature* creature)
@@ -3601,7 +3797,7 @@ void ProtocolGame::AddCreatureOutfit(NetworkMessage_ptr msg, const Creature* cre
 
 void ProtocolGame::AddWorldLight(NetworkMessage_ptr msg, const LightInfo& lightInfo)
 {
-	msg->AddByte(0x82);
+	AddOpcode(msg, 0x82);
 	msg->AddByte((player->isAccessPlayer() ? 0xFF : lightInfo.level));
 	msg->AddByte(lightInfo.color);
 }
@@ -3610,19 +3806,25 @@ void ProtocolGame::AddCreatureLight(NetworkMessage_ptr msg, const Creature* crea
 {
 	LightInfo lightInfo;
 	creature->getCreatureLight(lightInfo);
-	msg->AddByte(0x8D);
+	AddOpcode(msg, 0x8D);
 	msg->AddU32(creature->getID());
 	msg->AddByte((player->isAccessPlayer() ? 0xFF : lightInfo.level));
 	msg->AddByte(lightInfo.color);
 }
 
+void ProtocolGame::AddBroadcast(NetworkMessage_ptr msg, const NetworkMessage& packet)
+{
+	NetworkProfiler::getInstance()->addSent(msg);
+	msg->AddBytes(packet.getBuffer(), packet.getMessageLength());
+}
+
 //tile
 void ProtocolGame::AddTileItem(NetworkMessage_ptr msg, const Position& pos, uint32_t stackpos, const Item* item)
 {
 	if(stackpos >= 10)
 		return;
 
-	msg->AddByte(0x6A);
+	AddOpcode(msg, 0x6A);
 	msg->AddPosition(pos);
 	msg->AddByte(stackpos);
 	msg->AddItem(item);
@@ -3634,7 +3836,7 @@ void ProtocolGame::AddTileCreature(NetworkMessage_ptr msg, const Position& pos,
 	if(stackpos >= 10)
 		return;
 
-	msg->AddByte(0x6A);
+	AddOpcode(msg, 0x6A);
 	msg->AddPosition(pos);
 	msg->AddByte(stackpos);
 
@@ -3649,7 +3851,7 @@ void ProtocolGame::UpdateTileItem(NetworkMessage_ptr msg, const Position& pos, u
 	if(stackpos >= 10)
 		return;
 
-	msg->AddByte(0x6B);
+	AddOpcode(msg, 0x6B);
 	msg->AddPosition(pos);
 	msg->AddByte(stackpos);
 	msg->AddItem(item);
@@ -3660,7 +3862,7 @@ void ProtocolGame::RemoveTileItem(NetworkMessage_ptr msg, const Position& pos, u
 	if(stackpos >= 10)
 		return;
 
-	msg->AddByte(0x6C);
+	AddOpcode(msg, 0x6C);
 	msg->AddPosition(pos);
 	msg->AddByte(stackpos);
 }
@@ -3672,7 +3874,7 @@ void ProtocolGame::MoveUpCreature(NetworkMessage_ptr msg, const Creature* creatu
 		return;
 
 	//floor change up
-	msg->AddByte(0xBE);
+	AddOpcode(msg, 0xBE);
 
 	//going to surface
 	if(newPos.z == 7)
@@ -3706,11 +3908,11 @@ void ProtocolGame::MoveUpCreature(NetworkMessage_ptr msg, const Creature* creatu
 
 	//moving up a floor up makes us out of sync
 	//west
-	msg->AddByte(0x68);
+	AddOpcode(msg, 0x68);
 	GetMapDescription(oldPos.x - 8, oldPos.y + 1 - 6, newPos.z, 1, 14, msg);
 
 	//north
-	msg->AddByte(0x65);
+	AddOpcode(msg, 0x65);
 	GetMapDescription(oldPos.x - 8, oldPos.y - 6, newPos.z, 18, 1, msg);
 }
 
@@ -3721,7 +3923,7 @@ void ProtocolGame::MoveDownCreature(NetworkMessage_ptr msg, const Creature* crea
 		return;
 
 	//floor change down
-	msg->AddByte(0xBF);
+	AddOpcode(msg, 0xBF);
 
 	//going from surface to underground
 	if(newPos.z == 8)
@@ -3753,11 +3955,11 @@ void ProtocolGame::MoveDownCreature(NetworkMessage_ptr msg, const Creature* crea
 
 	//moving down a floor makes us out of sync
 	//east
-	msg->AddByte(0x66);
+	AddOpcode(msg, 0x66);
 	GetMapDescription(oldPos.x + 9, oldPos.y - 1 - 6, newPos.z, 1, 14, msg);
 
 	//south
-	msg->AddByte(0x67);
+	AddOpcode(msg, 0x67);
 	GetMapDescription(oldPos.x - 8, oldPos.y + 7, newPos.z, 18, 1, msg);
 }
 
@@ -3766,12 +3968,12 @@ void ProtocolGame::AddInventoryItem(NetworkMessage_ptr msg, slots_t slot, const
 {
 	if(!item)
 	{
-		msg->AddByte(0x79);
+		AddOpcode(msg, 0x79);
 		msg->AddByte(slot);
 		return;
 	}
 
-	msg->AddByte(0x78);
+	AddOpcode(msg, 0x78);
 	msg->AddByte(slot);
 	msg->AddItem(item);
 }
@@ -3780,33 +3982,33 @@ void ProtocolGame::UpdateInventoryItem(NetworkMessage_ptr msg, slots_t slot, con
 {
 	if(!item)
 	{
-		msg->AddByte(0x79);
+		AddOpcode(msg, 0x79);
 		msg->AddByte(slot);
 		return;
 	}
 
-	msg->AddByte(0x78);
+	AddOpcode(msg, 0x78);
 	msg->AddByte(slot);
 	msg->AddItem(item);
 }
 
 void ProtocolGame::RemoveInventoryItem(NetworkMessage_ptr msg, slots_t slot)
 {
-	msg->AddByte(0x79);
+	AddOpcode(msg, 0x79);
 	msg->AddByte(slot);
 }
 
 //containers
 void ProtocolGame::AddContainerItem(NetworkMessage_ptr msg, uint8_t cid, const Item* item)
 {
-	msg->AddByte(0x70);
+	AddOpcode(msg, 0x70);
 	msg->AddByte(cid);
 	msg->AddItem(item);
 }
 
 void ProtocolGame::UpdateContainerItem(NetworkMessage_ptr msg, uint8_t cid, uint8_t slot, const Item* item)
 {
-	msg->AddByte(0x71);
+	AddOpcode(msg, 0x71);
 	msg->AddByte(cid);
 	msg->AddByte(slot);
 	msg->AddItem(item);
@@ -3814,7 +4016,7 @@ void ProtocolGame::UpdateContainerItem(NetworkMessage_ptr msg, uint8_t cid, uint
 
 void ProtocolGame::RemoveContainerItem(NetworkMessage_ptr msg, uint8_t cid, uint8_t slot)
 {
-	msg->AddByte(0x72);
+	AddOpcode(msg, 0x72);
 	msg->AddByte(cid);
 	msg->AddByte(slot);
 }
@@ -3826,7 +4028,7 @@ void ProtocolGame::sendChannelMessage(std::string author, std::string text, Spea
 		return;
 
 	TRACK_MESSAGE(msg);
-	msg->AddByte(0xAA);
+	AddOpcode(msg, 0xAA);
 	msg->AddU32(0x00);
 	msg->AddString(author);
 	msg->AddU16(0x00);
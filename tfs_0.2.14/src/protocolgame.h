@@ -35,7 +35,8 @@ enum connectResult_t
 };
 
 class NetworkMessage;
-typedef boost::shared_ptr<NetworkMessage> NetworkMessage_ptr;
+//the game protocol only builds messages handed out by the output pool
+typedef OutputMessage_ptr NetworkMessage_ptr;
 class Player;
 class Game;
 class House;
@@ -56,6 +57,18 @@ class ProtocolGame : public Protocol
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
 		static uint32_t protocolGameCount;
 #endif
+		static uint64_t tileDescriptionHits;
+		static uint64_t tileDescriptionMisses;
+		static size_t getTileDescriptionCount() {return tileDescriptions.size();}
+
+		// packets that read the same for every spectator are serialized once
+		// into the broadcast packet and appended to each viewer's output
+		static NetworkMessage& getBroadcastPacket();
+		static bool AddMagicEffect(NetworkMessage& msg, const Position& pos, uint8_t type);
+		static bool AddDistanceShoot(NetworkMessage& msg, const Position& from, const Position& to, uint8_t type);
+		static void AddCreatureHealth(NetworkMessage& msg, const Creature* creature);
+		static void AddCreatureStep(NetworkMessage& msg, const Position& oldPos, const Position& newPos);
+
 		ProtocolGame(Connection_ptr connection);
 		virtual ~ProtocolGame();
 
@@ -67,11 +80,35 @@ class ProtocolGame : public Protocol
 		void setPlayer(Player* p);
 
 	private:
-		std::list<uint32_t> knownCreatureList;
+		// known creatures from least to most recently described, indexed by id
+		typedef std::list<uint32_t> KnownCreatureList;
+		typedef OTSERV_HASH_MAP<uint32_t, KnownCreatureList::iterator> KnownCreatureMap;
+		KnownCreatureList knownCreatureList;
+		KnownCreatureMap knownCreatureMap;
+
+		// serialized ground and items of a tile, shared by every viewer; the
+		// creatures in between are still added per player
+		enum {TILE_DESCRIPTION_ITEMS = 10};
+		struct TileDescription
+		{
+			uint32_t version;
+			uint8_t topItems; // ground included
+			uint8_t downItems;
+			uint8_t offsets[TILE_DESCRIPTION_ITEMS * 2 + 1];
+			uint8_t data[TILE_DESCRIPTION_ITEMS * 2 * 4];
+		};
+
+		typedef OTSERV_HASH_MAP<const Tile*, TileDescription> TileDescriptionMap;
+		static TileDescriptionMap tileDescriptions;
+		static NetworkMessage tileDescriptionBuffer;
+		static NetworkMessage broadcastPacket;
+
+		static const TileDescription& getTileDescription(const Tile* tile);
 
 		bool connect(uint32_t playerId, std::list<uint8_t> openChannels);
 		void disconnect();
 		void disconnectClient(uint8_t error, const char* message);
+		void disconnectClient(Connection_ptr connection, uint8_t error, const char* message);
 
 		virtual void releaseProtocol();
 		virtual void deleteProtocolTask();
@@ -84,9 +121,18 @@ class ProtocolGame : public Protocol
 
 		// we have all the parse methods
 		virtual void parsePacket(NetworkMessage& msg);
+		void parseOpcode(NetworkMessage& msg, uint8_t recvbyte);
+
+		// outbound traffic is profiled per opcode, every opcode written to a
+		// message closes the count of the one before it
+		NetworkMessage_ptr getOutputBuffer();
+		void AddOpcode(NetworkMessage_ptr msg, uint8_t opcode);
+		virtual void onSendMessage(OutputMessage_ptr msg);
 		virtual void onRecvFirstMessage(NetworkMessage& msg);
 		virtual void onConnect();
 		bool parseFirstPacket(NetworkMessage& msg);
+		void runLogin(uint16_t clientos, uint16_t version, const std::string& block);
+		bool checkLogin(Connection_ptr connection, uint16_t clientos, uint16_t version, const std::string& block);
 
 		//Parse methods
 		void parseLogout(NetworkMessage& msg);
@@ -184,6 +230,9 @@ class ProtocolGame : public Protocol
 		void sendDistanceShoot(const Position& from, const Position& to, uint8_t type);
 		void sendMagicEffect(const Position& pos, uint8_t type);
 		void sendCreatureHealth(const Creature* creature);
+		void sendDistanceShoot(const NetworkMessage& packet, const Position& from, const Position& to);
+		void sendMagicEffect(const NetworkMessage& packet, const Position& pos);
+		void sendCreatureHealth(const NetworkMessage& packet);
 		void sendSkills();
 		void sendPing();
 		void sendPingBack();
@@ -250,8 +299,9 @@ class ProtocolGame : public Protocol
 
 		void sendAddCreature(const Creature* creature, const Position& pos, uint32_t stackpos, bool isLogin);
 		void sendRemoveCreature(const Creature* creature, const Position& pos, uint32_t stackpos, bool isLogout);
-		void sendMoveCreature(const Creature* creature, const Tile* newTile, const Position& newPos, uint32_t newStackPos,
-			const Tile* oldTile, const Position& oldPos, uint32_t oldStackPos, bool teleport);
+		void sendMoveCreature(const Creature* creature, const Tile* newTile, const Position& newPos,
+			const Tile* oldTile, const Position& oldPos, uint32_t oldStackPos, bool teleport,
+			const NetworkMessage* stepPacket = NULL);
 
 		//containers
 		void sendAddContainerItem(uint8_t cid, const Item* item);
@@ -289,18 +339,16 @@ class ProtocolGame : public Protocol
 		void AddMapDescription(NetworkMessage_ptr msg, const Position& pos);
 		void AddTextMessage(NetworkMessage_ptr msg,MessageClasses mclass, const std::string& message);
 		void AddTextMessageEx(NetworkMessage_ptr msg,MessageClasses mclass, const std::string& message, const Position& pos, uint32_t value, TextColor_t color);
-		void AddMagicEffect(NetworkMessage_ptr msg, const Position& pos, uint8_t type);
-		void AddDistanceShoot(NetworkMessage_ptr msg, const Position& from, const Position& to, uint8_t type);
 		void AddCreature(NetworkMessage_ptr msg, const Creature* creature, bool known, uint32_t remove);
 		void AddPlayerStats(NetworkMessage_ptr msg);
 		void AddCreatureSpeak(NetworkMessage_ptr msg, const Creature* creature, SpeakClasses type,
 			std::string text, uint16_t channelId, Position* pos = NULL);
-		void AddCreatureHealth(NetworkMessage_ptr msg, const Creature* creature);
 		void AddCreatureOutfit(NetworkMessage_ptr msg, const Creature* creature, const Outfit_t& outfit);
 		void AddCreatureInvisible(NetworkMessage_ptr msg, const Creature* creature);
 		void AddPlayerSkills(NetworkMessage_ptr msg);
 		void AddWorldLight(NetworkMessage_ptr msg, const LightInfo& lightInfo);
 		void AddCreatureLight(NetworkMessage_ptr msg, const Creature* creature);
+		void AddBroadcast(NetworkMessage_ptr msg, const NetworkMessage& packet);
 
 		//tiles
 		void AddTileItem(NetworkMessage_ptr msg, const Position& pos, uint32_t stackpos, const Item* item);
@@ -341,6 +389,7 @@ class ProtocolGame : public Protocol
 
 		bool m_debugAssertSent;
 		bool m_acceptPackets;
+		uint8_t m_recvOpcode;
 };
 
 #endif
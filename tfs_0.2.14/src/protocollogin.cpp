@@ -30,13 +30,16 @@
 #include "iologindata.h"
 #include "ban.h"
 #include <iomanip>
+#include <boost/bind.hpp>
 #include "game.h"
 #include "gui.h"
+#include "workerpool.h"
 
 extern ConfigManager g_config;
 extern IPList serverIPs;
 extern Ban g_bans;
 extern Game g_game;
+extern WorkerPool g_loginPool;
 
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
 uint32_t ProtocolLogin::protocolLoginCount = 0;
@@ -52,7 +55,15 @@ void ProtocolLogin::deleteProtocolTask()
 
 void ProtocolLogin::disconnectClient(uint8_t error, const char* message)
 {
-	OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, false);
+	disconnectClient(getConnection(), error, message);
+}
+
+void ProtocolLogin::disconnectClient(Connection_ptr connection, uint8_t error, const char* message)
+{
+	if(!connection)
+		return;
+
+	OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, connection, false);
 	if(output)
 	{
 		TRACK_MESSAGE(output);
@@ -60,7 +71,7 @@ void ProtocolLogin::disconnectClient(uint8_t error, const char* message)
 		output->AddString(message);
 		OutputMessagePool::getInstance()->send(output);
 	}
-	getConnection()->closeConnection();
+	connection->closeConnection();
 }
 
 bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
@@ -87,12 +98,41 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 		return false;
 	}
 
-	if(!RSA_decrypt(msg))
+	if(msg.getMessageLength() - msg.getReadPos() != 128)
 	{
 		getConnection()->closeConnection();
 		return false;
 	}
 
+	//decryption and the account lookup run on a login worker
+	addRef();
+	g_loginPool.addJob(boost::bind(&ProtocolLogin::runLogin, this, clientip, version,
+		std::string(msg.getBuffer() + msg.getReadPos(), 128)));
+	return true;
+}
+
+void ProtocolLogin::runLogin(uint32_t clientip, uint16_t version, const std::string& block)
+{
+	//login worker, the dispatcher may clear the connection meanwhile so
+	//everything below works on this one copy
+	if(Connection_ptr connection = getConnection())
+		checkLogin(connection, clientip, version, block);
+
+	unRef();
+}
+
+bool ProtocolLogin::checkLogin(Connection_ptr connection, uint32_t clientip, uint16_t version, const std::string& block)
+{
+	NetworkMessage msg;
+	memcpy(msg.getBuffer(), block.data(), block.size());
+	msg.setMessageLength(block.size());
+	msg.setReadPos(0);
+	if(!RSA_decrypt(msg))
+	{
+		connection->closeConnection();
+		return false;
+	}
+
 	uint32_t key[4];
 	key[0] = msg.GetU32();
 	key[1] = msg.GetU32();
@@ -113,38 +153,38 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 		}
 		else
 		{
-			disconnectClient(0x0A, "Invalid Account Name.");
+			disconnectClient(connection, 0x0A, "Invalid Account Name.");
 			return false;
 		}
 	}
 
 	if(version < CLIENT_VERSION_MIN || version > CLIENT_VERSION_MAX)
 	{
-		disconnectClient(0x0A, "Only clients with protocol " CLIENT_VERSION_STR " allowed!");
+		disconnectClient(connection, 0x0A, "Only clients with protocol " CLIENT_VERSION_STR " allowed!");
 		return false;
 	}
 
 	if(g_game.getGameState() == GAME_STATE_STARTUP)
 	{
-		disconnectClient(0x0A, "Gameworld is starting up. Please wait.");
+		disconnectClient(connection, 0x0A, "Gameworld is starting up. Please wait.");
 		return false;
 	}
 
 	if(g_game.getGameState() == GAME_STATE_MAINTAIN)
 	{
-		disconnectClient(0x0A, "Gameworld is under maintenance. Please re-connect in a while.");
+		disconnectClient(connection, 0x0A, "Gameworld is under maintenance. Please re-connect in a while.");
 		return false;
 	}
 
 	if(g_bans.isIpDisabled(clientip))
 	{
-		disconnectClient(0x0A, "Too many connections attempts from this IP. Try again later.");
+		disconnectClient(connection, 0x0A, "Too many connections attempts from this IP. Try again later.");
 		return false;
 	}
 
 	if(IOBan::getInstance()->isIpBanished(clientip))
 	{
-		disconnectClient(0x0A, "Your IP is banished!");
+		disconnectClient(connection, 0x0A, "Your IP is banished!");
 		return false;
 	}
 
@@ -162,13 +202,13 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 	if(account.id == 0 || !passwordTest(password, account.password))
 	{
 		g_bans.addLoginAttempt(clientip, false);
-		disconnectClient(0x0A, "Account name or password is not correct.");
+		disconnectClient(connection, 0x0A, "Account name or password is not correct.");
 		return false;
 	}
 
 	g_bans.addLoginAttempt(clientip, true);
 
-	OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, false);
+	OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, connection, false);
 	if(output)
 	{
 		TRACK_MESSAGE(output);
@@ -222,7 +262,7 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 
 		OutputMessagePool::getInstance()->send(output);
 	}
-	getConnection()->closeConnection();
+	connection->closeConnection();
 	return true;
 }
 
@@ -57,8 +57,11 @@ class ProtocolLogin : public Protocol
 
 	protected:
 		void disconnectClient(uint8_t error, const char* message);
+		void disconnectClient(Connection_ptr connection, uint8_t error, const char* message);
 
 		bool parseFirstPacket(NetworkMessage& msg);
+		void runLogin(uint32_t clientip, uint16_t version, const std::string& block);
+		bool checkLogin(Connection_ptr connection, uint32_t clientip, uint16_t version, const std::string& block);
 
 		#ifdef __DEBUG_NET_DETAIL__
 		virtual void deleteProtocolTask();
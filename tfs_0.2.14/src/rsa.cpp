@@ -25,7 +25,6 @@
 
 RSA::RSA()
 {
-	OTSYS_THREAD_LOCKVARINIT(rsaLock);
 	m_keySet = false;
 	mpz_init2(m_p, 1024);
 	mpz_init2(m_q, 1024);
@@ -62,9 +61,27 @@ bool RSA::setKey(const std::string& file)
 	return true;
 }
 
+RSA::Scratch::Scratch()
+{
+	mpz_init2(c, 1024);
+	mpz_init2(v1, 1024);
+	mpz_init2(v2, 1024);
+	mpz_init2(u2, 1024);
+	mpz_init2(tmp, 1024);
+}
+
+RSA::Scratch::~Scratch()
+{
+	mpz_clear(c);
+	mpz_clear(v1);
+	mpz_clear(v2);
+	mpz_clear(u2);
+	mpz_clear(tmp);
+}
+
 void RSA::setKey(const char* p, const char* q, const char* d)
 {
-	OTSYS_THREAD_LOCK_CLASS lockClass(rsaLock);
+	boost::unique_lock<boost::shared_mutex> lockClass(m_keyLock);
 
 	mpz_set_str(m_p, p, 10);
 	mpz_set_str(m_q, q, 10);
@@ -88,14 +105,20 @@ void RSA::setKey(const char* p, const char* q, const char* d)
 
 void RSA::decrypt(char* msg, int32_t size)
 {
-	OTSYS_THREAD_LOCK_CLASS lockClass(rsaLock);
+	boost::shared_lock<boost::shared_mutex> lockClass(m_keyLock);
 
-	mpz_t c,v1,v2,u2,tmp;
-	mpz_init2(c, 1024);
-	mpz_init2(v1, 1024);
-	mpz_init2(v2, 1024);
-	mpz_init2(u2, 1024);
-	mpz_init2(tmp, 1024);
+	Scratch* scratch = m_scratch.get();
+	if(!scratch)
+	{
+		scratch = new Scratch();
+		m_scratch.reset(scratch);
+	}
+
+	mpz_t& c = scratch->c;
+	mpz_t& v1 = scratch->v1;
+	mpz_t& v2 = scratch->v2;
+	mpz_t& u2 = scratch->u2;
+	mpz_t& tmp = scratch->tmp;
 
 	mpz_import(c, 128, 1, 1, 0, 0, msg);
 
@@ -118,12 +141,6 @@ void RSA::decrypt(char* msg, int32_t size)
 	size_t count = (mpz_sizeinbase(c, 2) + 7)/8;
 	memset(msg, 0, 128 - count);
 	mpz_export(&msg[128 - count], NULL, 1, 1, 0, 0, c);
-
-	mpz_clear(c);
-	mpz_clear(v1);
-	mpz_clear(v2);
-	mpz_clear(u2);
-	mpz_clear(tmp);
 }
 
 int32_t RSA::getKeySize()
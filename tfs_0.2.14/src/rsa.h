@@ -22,6 +22,7 @@
 #define __OTSERV_RSA_H__
 
 #include "otsystem.h"
+#include <boost/thread.hpp>
 
 #include "gmp.h"
 
@@ -40,10 +41,20 @@ class RSA
 	protected:
 		bool m_keySet;
 
-		OTSYS_THREAD_LOCKVAR rsaLock;
+		//the key is only written by setKey, any number of threads may decrypt at once
+		boost::shared_mutex m_keyLock;
 
 		//use only GMP
 		mpz_t m_p, m_q, m_u, m_d, m_dp, m_dq, m_mod;
+
+		//decrypt temporaries, allocated once per thread instead of once per login
+		struct Scratch
+		{
+			Scratch();
+			~Scratch();
+			mpz_t c, v1, v2, u2, tmp;
+		};
+		boost::thread_specific_ptr<Scratch> m_scratch;
 };
 
 #endif
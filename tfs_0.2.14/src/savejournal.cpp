@@ -0,0 +1,598 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/crc.hpp>
+
+#include "savejournal.h"
+#include "iologindata.h"
+#include "iomapserialize.h"
+#include "house.h"
+#include "player.h"
+#include "configmanager.h"
+#include "scheduler.h"
+
+extern ConfigManager g_config;
+extern IOMapSerialize IOMapSerialize;
+
+typedef std::map<uint32_t, PlayerSnapshot> JournaledPlayers;
+
+static uint32_t checksum(const std::string& data)
+{
+	boost::crc_32_type crc;
+	crc.process_bytes(data.c_str(), data.length());
+	return crc.checksum();
+}
+
+static std::string makeRecord(JournalRecord_t type, const std::string& body)
+{
+	PropWriteStream record;
+	record.ADD_UCHAR(type);
+	record.ADD_ULONG(checksum(body));
+	record.ADD_LSTRING(body);
+
+	uint32_t size;
+	const char* data = record.getStream(size);
+	return std::string(data, size);
+}
+
+static std::string makeRecord(JournalRecord_t type, const PropWriteStream& payload)
+{
+	uint32_t size;
+	const char* data = payload.getStream(size);
+	return makeRecord(type, std::string(data, size));
+}
+
+static bool readFile(const std::string& fileName, std::string& data)
+{
+	FILE* file = fopen(fileName.c_str(), "rb");
+	if(!file)
+		return false;
+
+	char buffer[8192];
+	size_t size;
+	while((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		data.append(buffer, size);
+
+	fclose(file);
+	return true;
+}
+
+// a record is its type, the checksum of its payload and the payload; false
+// at the end and at a record a crash cut short
+static bool readRecord(PropStream& stream, uint8_t& type, std::string& payload)
+{
+	uint32_t crc;
+	return stream.GET_UCHAR(type) && stream.GET_ULONG(crc) && stream.GET_LSTRING(payload) && checksum(payload) == crc;
+}
+
+static PlayerSnapshot& getJournaledPlayer(JournaledPlayers& players, uint32_t guid)
+{
+	JournaledPlayers::iterator it = players.find(guid);
+	if(it != players.end())
+		return it->second;
+
+	PlayerSnapshot& snapshot = players[guid];
+	snapshot.generation = 0;
+	snapshot.guid = guid;
+	snapshot.fullStorage = false;
+	for(int32_t i = PLAYERSAVE_FIRST; i <= PLAYERSAVE_LAST; ++i)
+		snapshot.dirty[i] = false;
+
+	return snapshot;
+}
+
+static void setColumn(PlayerSnapshot& snapshot, const char* name, int64_t value)
+{
+	for(PlayerSnapshot::ColumnList::iterator it = snapshot.columns.begin(); it != snapshot.columns.end(); ++it)
+	{
+		if(!strcmp(it->first, name))
+		{
+			it->second = value;
+			return;
+		}
+	}
+	snapshot.columns.push_back(std::make_pair(name, value));
+}
+
+static void replayRecord(uint8_t type, PropStream& record, JournaledPlayers& players, std::map<uint32_t, std::string>& houses)
+{
+	uint32_t guid = 0;
+	switch(type)
+	{
+		case JOURNAL_PLAYERSAVED:
+		{
+			//the database holds everything before this
+			if(record.GET_ULONG(guid))
+				players.erase(guid);
+
+			break;
+		}
+
+		case JOURNAL_STORAGE:
+		{
+			uint32_t key, value;
+			if(!record.GET_ULONG(guid) || !record.GET_ULONG(key) || !record.GET_ULONG(value))
+				break;
+
+			PlayerSnapshot& snapshot = getJournaledPlayer(players, guid);
+			snapshot.dirty[PLAYERSAVE_STORAGE] = true;
+
+			std::vector<uint32_t>& removed = snapshot.removedStorage;
+			removed.erase(std::remove(removed.begin(), removed.end(), key), removed.end());
+			if((int32_t)value == -1)
+			{
+				snapshot.changedStorage.erase(key);
+				removed.push_back(key);
+			}
+			else
+				snapshot.changedStorage[key] = (int32_t)value;
+
+			break;
+		}
+
+		case JOURNAL_EXPERIENCE:
+		{
+			uint64_t experience;
+			uint32_t level, healthMax, manaMax, capacity;
+			if(!record.GET_ULONG(guid) || !record.GET_VALUE(experience) || !record.GET_ULONG(level)
+				|| !record.GET_ULONG(healthMax) || !record.GET_ULONG(manaMax) || !record.GET_ULONG(capacity))
+				break;
+
+			PlayerSnapshot& snapshot = getJournaledPlayer(players, guid);
+			setColumn(snapshot, "experience", experience);
+			setColumn(snapshot, "level", level);
+			setColumn(snapshot, "healthmax", (int32_t)healthMax);
+			setColumn(snapshot, "manamax", (int32_t)manaMax);
+			setColumn(snapshot, "cap", capacity);
+			break;
+		}
+
+		case JOURNAL_BALANCE:
+		{
+			uint64_t balance;
+			if(record.GET_ULONG(guid) && record.GET_VALUE(balance))
+				setColumn(getJournaledPlayer(players, guid), "balance", balance);
+
+			break;
+		}
+
+		case JOURNAL_PLAYERITEMS:
+		{
+			uint8_t section;
+			uint32_t count;
+			if(!record.GET_ULONG(guid) || !record.GET_UCHAR(section) || !record.GET_ULONG(count))
+				break;
+
+			PlayerSnapshot::ItemRowList rows;
+			PlayerSnapshot::ItemRow row;
+			uint32_t pid, sid, subType;
+			while(count-- && record.GET_ULONG(pid) && record.GET_ULONG(sid) && record.GET_USHORT(row.type)
+				&& record.GET_ULONG(subType) && record.GET_LSTRING(row.attributes))
+			{
+				row.pid = pid;
+				row.sid = sid;
+				row.count = subType;
+				rows.push_back(row);
+			}
+
+			PlayerSnapshot& snapshot = getJournaledPlayer(players, guid);
+			if(section == PLAYERSAVE_DEPOT)
+			{
+				snapshot.dirty[PLAYERSAVE_DEPOT] = true;
+				snapshot.depotItems.swap(rows);
+			}
+			else
+			{
+				snapshot.dirty[PLAYERSAVE_ITEMS] = true;
+				snapshot.items.swap(rows);
+			}
+			break;
+		}
+
+		case JOURNAL_HOUSEITEMS:
+		{
+			uint32_t houseId;
+			std::string items;
+			if(record.GET_ULONG(houseId) && record.GET_LSTRING(items))
+				houses[houseId].swap(items);
+
+			break;
+		}
+
+		case JOURNAL_PLAYERCHANGES:
+		{
+			//the checksum covered all of them, so each one reads back whole
+			std::string inner;
+			while(record.size() && readRecord(record, type, inner))
+			{
+				PropStream innerRecord;
+				innerRecord.init(inner.c_str(), inner.length());
+				replayRecord(type, innerRecord, players, houses);
+			}
+			break;
+		}
+
+		default:
+			break;
+	}
+}
+
+bool SaveJournal::replay(Map* map)
+{
+	m_fileName = g_config.getString(ConfigManager::SAVE_JOURNAL_FILE);
+
+	std::string data;
+	if(!readFile(m_fileName, data) || data.empty())
+		return true;
+
+	JournaledPlayers players;
+	std::map<uint32_t, std::string> houses;
+	uint32_t records = 0;
+
+	PropStream stream;
+	stream.init(data.c_str(), data.length());
+	while(stream.size())
+	{
+		uint8_t type;
+		std::string payload;
+		if(!readRecord(stream, type, payload))
+		{
+			std::cout << "Warning: [SaveJournal::replay] Ignoring an incomplete record at the end of " << m_fileName << "." << std::endl;
+			break;
+		}
+
+		++records;
+		PropStream record;
+		record.init(payload.c_str(), payload.length());
+		replayRecord(type, record, players, houses);
+	}
+
+	for(JournaledPlayers::iterator it = players.begin(); it != players.end(); ++it)
+	{
+		if(!IOLoginData::getInstance()->writeJournal(it->second))
+		{
+			std::cout << "> ERROR: Failed to write the journaled changes of player " << it->first << "." << std::endl;
+			return false;
+		}
+	}
+
+	if(!houses.empty())
+	{
+		for(std::map<uint32_t, std::string>::iterator it = houses.begin(); it != houses.end(); ++it)
+		{
+			House* house = Houses::getInstance().getHouse(it->first);
+			if(house && !IOMapSerialize.loadHouseItems(map, house, it->second))
+			{
+				std::cout << "> ERROR: Failed to load the journaled items of house " << it->first << "." << std::endl;
+				return false;
+			}
+		}
+
+		if(!map->saveMap())
+		{
+			std::cout << "> ERROR: Failed to save the journaled house items." << std::endl;
+			return false;
+		}
+	}
+
+	std::cout << ">> Replayed " << records << " journal records: " << players.size() << " players, " << houses.size() << " houses" << std::endl;
+
+	//everything is in the database now
+	if(FILE* file = fopen(m_fileName.c_str(), "wb"))
+		fclose(file);
+
+	return true;
+}
+
+void SaveJournal::start()
+{
+	m_fileName = g_config.getString(ConfigManager::SAVE_JOURNAL_FILE);
+	if(!(m_file = fopen(m_fileName.c_str(), "ab")))
+	{
+		std::cout << "> ERROR: Failed to open the save journal " << m_fileName << "." << std::endl;
+		return;
+	}
+
+	//records have to be written in the order they were made, so there is one writer
+	m_writer.start(1);
+	m_running = true;
+
+	int32_t interval = g_config.getNumber(ConfigManager::SAVE_JOURNAL_INTERVAL);
+	if(interval > 0)
+		g_scheduler.addEvent(createSchedulerTask(interval * 1000, boost::bind(&SaveJournal::checkItems, this)));
+}
+
+void SaveJournal::shutdown()
+{
+	if(!m_running)
+		return;
+
+	m_running = false;
+	m_writer.addJob(boost::bind(&SaveJournal::close, this));
+	m_writer.shutdown();
+}
+
+void SaveJournal::join()
+{
+	m_writer.join();
+}
+
+void SaveJournal::addStorage(const Player* player, uint32_t key, int32_t value)
+{
+	if(m_running)
+		m_changedPlayers[player->getGUID()].storage[key] = value;
+}
+
+void SaveJournal::addExperience(const Player* player)
+{
+	if(m_running)
+		m_changedPlayers[player->getGUID()].experience = true;
+}
+
+void SaveJournal::addBalance(const Player* player)
+{
+	if(m_running)
+		m_changedPlayers[player->getGUID()].balance = true;
+}
+
+void SaveJournal::onPlayerItemsChanged(const Player* player)
+{
+	if(m_running)
+		m_changedPlayers[player->getGUID()].items = true;
+}
+
+void SaveJournal::onDepotChanged(uint32_t guid)
+{
+	if(m_running)
+		m_changedPlayers[guid].depot = true;
+}
+
+void SaveJournal::flush(Player* player)
+{
+	if(!m_running)
+		return;
+
+	PlayerChangesMap::iterator it = m_changedPlayers.find(player->getGUID());
+	if(it == m_changedPlayers.end())
+		return;
+
+	//the item lists go first, so the values below replay on top of them
+	const PlayerChanges& changes = it->second;
+	std::string records;
+	if(changes.items)
+		captureItems(records, player, PLAYERSAVE_ITEMS);
+
+	if(changes.depot)
+		captureItems(records, player, PLAYERSAVE_DEPOT);
+
+	for(std::map<uint32_t, int32_t>::const_iterator sit = changes.storage.begin(); sit != changes.storage.end(); ++sit)
+	{
+		PropWriteStream payload;
+		payload.ADD_ULONG(player->getGUID());
+		payload.ADD_ULONG(sit->first);
+		payload.ADD_ULONG(sit->second);
+		records += makeRecord(JOURNAL_STORAGE, payload);
+	}
+
+	if(changes.experience)
+	{
+		PropWriteStream payload;
+		payload.ADD_ULONG(player->getGUID());
+		payload.ADD_VALUE(player->experience);
+		payload.ADD_ULONG(player->level);
+		payload.ADD_ULONG(player->healthMax);
+		payload.ADD_ULONG(player->manaMax);
+		payload.ADD_ULONG((uint32_t)player->getCapacity());
+		records += makeRecord(JOURNAL_EXPERIENCE, payload);
+	}
+
+	if(changes.balance)
+	{
+		PropWriteStream payload;
+		payload.ADD_ULONG(player->getGUID());
+		payload.ADD_VALUE(player->bankBalance);
+		records += makeRecord(JOURNAL_BALANCE, payload);
+	}
+
+	m_changedPlayers.erase(it);
+	if(!records.empty())
+		append(JOURNAL_PLAYERCHANGES, records);
+}
+
+void SaveJournal::captureItems(std::string& records, Player* player, int32_t section)
+{
+	PlayerSnapshot::ItemRowList rows;
+	size_t digest = IOLoginData::getInstance()->capturePlayerItems(player, (PlayerSaveSection_t)section, rows);
+
+	//a list that was moved around and put back as it was is not journaled again
+	ItemDigests& digests = m_itemDigests[player->getGUID()];
+	bool& seen = (section == PLAYERSAVE_DEPOT ? digests.depotSeen : digests.itemsSeen);
+	size_t& journaled = (section == PLAYERSAVE_DEPOT ? digests.depot : digests.items);
+	if(seen && digest == journaled)
+		return;
+
+	seen = true;
+	journaled = digest;
+
+	PropWriteStream payload;
+	payload.ADD_ULONG(player->getGUID());
+	payload.ADD_UCHAR(section);
+	payload.ADD_ULONG(rows.size());
+	for(PlayerSnapshot::ItemRowList::const_iterator it = rows.begin(); it != rows.end(); ++it)
+	{
+		payload.ADD_ULONG(it->pid);
+		payload.ADD_ULONG(it->sid);
+		payload.ADD_USHORT(it->type);
+		payload.ADD_ULONG(it->count);
+		payload.ADD_LSTRING(it->attributes);
+	}
+	records += makeRecord(JOURNAL_PLAYERITEMS, payload);
+}
+
+void SaveJournal::onPlayerSaved(const Player* player)
+{
+	if(!m_running)
+		return;
+
+	PropWriteStream payload;
+	payload.ADD_ULONG(player->getGUID());
+	append(JOURNAL_PLAYERSAVED, payload);
+
+	//the save holds the item lists now, a later change is journaled whole
+	m_itemDigests.erase(player->getGUID());
+}
+
+void SaveJournal::onHouseChanged(const House* house)
+{
+	if(m_running)
+		m_changedHouses.insert(house->getHouseId());
+}
+
+void SaveJournal::mark(uint64_t saveGeneration)
+{
+	if(!m_running)
+		return;
+
+	PropWriteStream payload;
+	payload.ADD_VALUE(saveGeneration);
+	append(JOURNAL_MARK, payload);
+}
+
+void SaveJournal::compact(uint64_t saveGeneration)
+{
+	if(m_running)
+		m_writer.addJob(boost::bind(&SaveJournal::rewrite, this, saveGeneration));
+}
+
+void SaveJournal::checkItems()
+{
+	if(!m_running)
+		return;
+
+	for(AutoList<Player>::listiterator it = Player::listPlayer.list.begin(); it != Player::listPlayer.list.end() && !m_changedPlayers.empty(); ++it)
+	{
+		if(!it->second->isRemoved())
+			flush(it->second);
+	}
+
+	//what is left belongs to players that went offline, their logout save has it
+	m_changedPlayers.clear();
+
+	for(std::set<uint32_t>::const_iterator it = m_changedHouses.begin(); it != m_changedHouses.end(); ++it)
+	{
+		House* house = Houses::getInstance().getHouse(*it);
+		if(!house)
+			continue;
+
+		std::string items;
+		IOMapSerialize.captureHouseItems(house, items);
+
+		PropWriteStream payload;
+		payload.ADD_ULONG(*it);
+		payload.ADD_LSTRING(items);
+		append(JOURNAL_HOUSEITEMS, payload);
+	}
+	m_changedHouses.clear();
+
+	g_scheduler.addEvent(createSchedulerTask(g_config.getNumber(ConfigManager::SAVE_JOURNAL_INTERVAL) * 1000,
+		boost::bind(&SaveJournal::checkItems, this)));
+}
+
+void SaveJournal::append(JournalRecord_t type, const PropWriteStream& payload)
+{
+	m_writer.addJob(boost::bind(&SaveJournal::write, this, makeRecord(type, payload)));
+}
+
+void SaveJournal::append(JournalRecord_t type, const std::string& body)
+{
+	m_writer.addJob(boost::bind(&SaveJournal::write, this, makeRecord(type, body)));
+}
+
+void SaveJournal::write(const std::string& data)
+{
+	if(!m_file)
+		return;
+
+	fwrite(data.c_str(), 1, data.length(), m_file);
+	//records that are already queued go out with the next flush
+	if(m_writer.getPendingJobCount() == 0)
+		fflush(m_file);
+}
+
+void SaveJournal::rewrite(uint64_t saveGeneration)
+{
+	if(!m_file)
+		return;
+
+	fclose(m_file);
+	m_file = NULL;
+
+	std::string data;
+	readFile(m_fileName, data);
+
+	//keep what follows the last mark of that save
+	size_t keep = std::string::npos;
+	PropStream stream;
+	stream.init(data.c_str(), data.length());
+
+	uint8_t type;
+	std::string payload;
+	while(stream.size() && readRecord(stream, type, payload))
+	{
+		uint64_t generation;
+		PropStream record;
+		record.init(payload.c_str(), payload.length());
+		if(type == JOURNAL_MARK && record.GET_VALUE(generation) && generation == saveGeneration)
+			keep = data.length() - stream.size();
+	}
+
+	if(keep != std::string::npos)
+	{
+		std::string tmpName = m_fileName + ".tmp";
+		if(FILE* file = fopen(tmpName.c_str(), "wb"))
+		{
+			bool written = (fwrite(data.c_str() + keep, 1, data.length() - keep, file) == data.length() - keep);
+			if(fclose(file) == 0 && written)
+			{
+				//rename does not replace an existing file everywhere
+				if(rename(tmpName.c_str(), m_fileName.c_str()) != 0)
+				{
+					remove(m_fileName.c_str());
+					rename(tmpName.c_str(), m_fileName.c_str());
+				}
+			}
+		}
+	}
+
+	if(!(m_file = fopen(m_fileName.c_str(), "ab")))
+		std::cout << "> ERROR: Failed to reopen the save journal " << m_fileName << "." << std::endl;
+}
+
+void SaveJournal::close()
+{
+	if(!m_file)
+		return;
+
+	fclose(m_file);
+	m_file = NULL;
+}
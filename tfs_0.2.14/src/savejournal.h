@@ -0,0 +1,140 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Append-only log of player and house changes between saves
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_SAVEJOURNAL_H__
+#define __OTSERV_SAVEJOURNAL_H__
+
+#include "definitions.h"
+#include <string>
+#include <map>
+#include <set>
+#include <stdio.h>
+
+#include "workerpool.h"
+#include "fileloader.h"
+
+class Player;
+class House;
+class Map;
+
+enum JournalRecord_t
+{
+	JOURNAL_MARK = 1, // a full save was captured
+	JOURNAL_PLAYERSAVED = 2, // a player was written on its own
+	JOURNAL_STORAGE = 3,
+	JOURNAL_EXPERIENCE = 4,
+	JOURNAL_BALANCE = 5,
+	JOURNAL_PLAYERITEMS = 6,
+	JOURNAL_HOUSEITEMS = 7,
+	JOURNAL_PLAYERCHANGES = 8 // the records above of one player, replayed all or none
+};
+
+// Records are built on the dispatcher and appended in order by one writer
+// thread. Each holds a value or a whole item list rather than a difference,
+// so a record that is replayed on top of a save which already has it does
+// no harm. Everything before the mark of a full save is dropped once that
+// save is written.
+//
+// What changes about a player is held back and journaled as one record
+// with its item lists, so a crash never replays a new bank balance or
+// storage value over the items that were traded for it.
+class SaveJournal
+{
+	public:
+		~SaveJournal() {}
+
+		static SaveJournal* getInstance()
+		{
+			static SaveJournal instance;
+			return &instance;
+		}
+
+		// writes what a crash left in the journal to the database and the
+		// houses of the loaded map, before start
+		bool replay(Map* map);
+		void start();
+		// writes what is queued, then lets the writer exit
+		void shutdown();
+		void join();
+
+		bool isRunning() const {return m_running;}
+
+		// a value of -1 erases the key, like Player::addStorageValue
+		void addStorage(const Player* player, uint32_t key, int32_t value);
+		void addExperience(const Player* player);
+		void addBalance(const Player* player);
+		void onPlayerItemsChanged(const Player* player);
+		void onDepotChanged(uint32_t guid);
+		void onHouseChanged(const House* house);
+
+		// journals what is held back for the player, before it is saved
+		void flush(Player* player);
+		void onPlayerSaved(const Player* player);
+
+		void mark(uint64_t saveGeneration);
+		void compact(uint64_t saveGeneration);
+
+		// journals the players and houses that changed, every saveJournalInterval seconds
+		void checkItems();
+
+		long getPendingRecordCount() const {return m_writer.getPendingJobCount();}
+
+	protected:
+		SaveJournal() : m_file(NULL), m_running(false) {}
+
+		void append(JournalRecord_t type, const PropWriteStream& payload);
+		void append(JournalRecord_t type, const std::string& body);
+		void captureItems(std::string& records, Player* player, int32_t section);
+		void write(const std::string& data);
+		void rewrite(uint64_t saveGeneration);
+		void close();
+
+		std::string m_fileName;
+		FILE* m_file;
+		bool m_running;
+		WorkerPool m_writer;
+
+		// item list digests of what was journaled last, per player
+		struct ItemDigests
+		{
+			ItemDigests() : itemsSeen(false), depotSeen(false), items(0), depot(0) {}
+
+			bool itemsSeen, depotSeen;
+			size_t items, depot;
+		};
+
+		typedef std::map<uint32_t, ItemDigests> DigestMap;
+		DigestMap m_itemDigests;
+
+		// what changed about a player since it was last journaled
+		struct PlayerChanges
+		{
+			PlayerChanges() : items(false), depot(false), experience(false), balance(false) {}
+
+			bool items, depot, experience, balance;
+			std::map<uint32_t, int32_t> storage;
+		};
+
+		typedef std::map<uint32_t, PlayerChanges> PlayerChangesMap;
+		PlayerChangesMap m_changedPlayers;
+		std::set<uint32_t> m_changedHouses;
+};
+
+#endif
@@ -25,14 +25,105 @@
 #include "exception.h"
 #endif
 
+#define SCHEDULER_ROOT_MASK (SCHEDULER_ROOT_SIZE - 1)
+#define SCHEDULER_LEVEL_MASK (SCHEDULER_LEVEL_SIZE - 1)
+#define SCHEDULER_NO_TICK 0xFFFFFFFFFFFFFFFFULL
+
+inline uint32_t levelShift(int32_t level)
+{
+	return SCHEDULER_ROOT_BITS + (level - 1) * SCHEDULER_LEVEL_BITS;
+}
+
+inline int32_t levelSlot(int32_t level, uint32_t index)
+{
+	return SCHEDULER_ROOT_SIZE + (level - 1) * SCHEDULER_LEVEL_SIZE + index;
+}
+
+inline int32_t findRootBit(const uint64_t* bits, uint32_t from)
+{
+	for(uint32_t word = from >> 6; word < SCHEDULER_ROOT_SIZE / 64; ++word)
+	{
+		uint64_t value = bits[word];
+		if(word == (from >> 6))
+			value &= ~0ULL << (from & 63);
+
+		if(!value)
+			continue;
+
+		#ifdef __GNUC__
+		return (word << 6) + __builtin_ctzll(value);
+		#else
+		uint32_t bit = 0;
+		while(!(value & 1))
+		{
+			value >>= 1;
+			++bit;
+		}
+		return (word << 6) + bit;
+		#endif
+	}
+	return -1;
+}
+
+static boost::mutex taskPoolLock;
+static std::vector<void*> taskPool;
+
+void* SchedulerTask::operator new(size_t size)
+{
+	if(size == sizeof(SchedulerTask))
+	{
+		boost::mutex::scoped_lock lockClass(taskPoolLock);
+		if(!taskPool.empty())
+		{
+			void* p = taskPool.back();
+			taskPool.pop_back();
+			return p;
+		}
+	}
+
+	return ::operator new(size);
+}
+
+void SchedulerTask::operator delete(void* p, size_t size)
+{
+	if(!p)
+		return;
+
+	if(size == sizeof(SchedulerTask))
+	{
+		boost::mutex::scoped_lock lockClass(taskPoolLock);
+		if(taskPool.size() < SCHEDULER_TASK_POOL)
+		{
+			taskPool.push_back(p);
+			return;
+		}
+	}
+
+	::operator delete(p);
+}
+
 Scheduler::Scheduler()
 {
 	m_lastEventId = 0;
+	m_eventCount = 0;
 	m_threadState = STATE_TERMINATED;
+	m_currentTick = 0;
+	m_wakeTick = SCHEDULER_NO_TICK;
+
+	EventEntry entry;
+	entry.task = NULL;
+	entry.tick = 0;
+	entry.prev = entry.next = entry.slot = -1;
+
+	m_pool.resize(SCHEDULER_INITIAL_POOL, entry);
+	m_poolMask = SCHEDULER_INITIAL_POOL - 1;
+	clearWheel();
 }
 
 void Scheduler::start()
 {
+	m_startTime = boost::get_system_time();
+	m_currentTick = 0;
 	m_threadState = STATE_RUNNING;
 	m_thread = boost::thread(boost::bind(&Scheduler::schedulerThread, (void*)this));
 }
@@ -46,19 +137,11 @@ void Scheduler::schedulerThread(void* p)
 	schedulerExceptionHandler.InstallHandler();
 	#endif
 
-	// NOTE: second argument defer_lock is to prevent from immediate locking
-	boost::unique_lock<boost::mutex> eventLockUnique(scheduler->m_eventLock, boost::defer_lock);
-
+	boost::unique_lock<boost::mutex> eventLockUnique(scheduler->m_eventLock);
 	while(scheduler->m_threadState != STATE_TERMINATED)
 	{
-		SchedulerTask* task = NULL;
-		bool runTask = false;
-		bool ret = true;
-
-		// check if there are events waiting...
-		eventLockUnique.lock();
-
-		if(scheduler->m_eventList.empty())
+		scheduler->m_wakeTick = scheduler->getNextTick();
+		if(scheduler->m_wakeTick == SCHEDULER_NO_TICK)
 		{
 			#ifdef __DEBUG_SCHEDULER__
 			std::cout << "Scheduler: No events" << std::endl;
@@ -68,53 +151,36 @@ void Scheduler::schedulerThread(void* p)
 		else
 		{
 			#ifdef __DEBUG_SCHEDULER__
-			std::cout << "Scheduler: Waiting for event" << std::endl;
+			std::cout << "Scheduler: Waiting for tick " << scheduler->m_wakeTick << std::endl;
 			#endif
-			ret = scheduler->m_eventSignal.timed_wait(eventLockUnique, scheduler->m_eventList.top()->getCycle());
+			scheduler->m_eventSignal.timed_wait(eventLockUnique, scheduler->getTime(scheduler->m_wakeTick));
 		}
 
-		#ifdef __DEBUG_SCHEDULER__
-		std::cout << "Scheduler: Signaled" << std::endl;
-		#endif
-
 		// the mutex is locked again now...
-		if(!ret && (scheduler->m_threadState != STATE_TERMINATED))
-		{
-			// ok we had a timeout, so there has to be an event we have to execute...
-			task = scheduler->m_eventList.top();
-			scheduler->m_eventList.pop();
+		if(scheduler->m_threadState == STATE_TERMINATED)
+			break;
 
-			// check if the event was stopped
-			EventIdSet::iterator it = scheduler->m_eventIds.find(task->getEventId());
-			if(it != scheduler->m_eventIds.end())
-			{
-				// was not stopped so we should run it
-				runTask = true;
-				scheduler->m_eventIds.erase(it);
-			}
-		}
+		scheduler->advance(scheduler->getTick(boost::get_system_time(), false));
+		if(scheduler->m_dueTasks.empty())
+			continue;
 
+		// we are not waiting, so there is no need to signal us until we are
+		scheduler->m_wakeTick = 0;
 		eventLockUnique.unlock();
 
-		// add task to dispatcher
-		if(task)
+		// add tasks to dispatcher
+		for(std::vector<SchedulerTask*>::iterator it = scheduler->m_dueTasks.begin(); it != scheduler->m_dueTasks.end(); ++it)
 		{
-			// if it was not stopped
-			if(runTask)
-			{
-				// Expiration has another meaning for dispatcher tasks, reset it
-				task->setDontExpire();
-				#ifdef __DEBUG_SCHEDULER__
-				std::cout << "Scheduler: Executing event " << task->getEventId() << std::endl;
-				#endif
-				g_dispatcher.addTask(task);
-			}
-			else
-			{
-				// was stopped, have to be deleted here
-				delete task;
-			}
+			// Expiration has another meaning for dispatcher tasks, reset it
+			(*it)->setDontExpire();
+			#ifdef __DEBUG_SCHEDULER__
+			std::cout << "Scheduler: Executing event " << (*it)->getEventId() << std::endl;
+			#endif
+			g_dispatcher.addTask(*it);
 		}
+
+		scheduler->m_dueTasks.clear();
+		eventLockUnique.lock();
 	}
 
 	#if defined __EXCEPTION_TRACER__
@@ -128,25 +194,25 @@ uint32_t Scheduler::addEvent(SchedulerTask* task)
 	m_eventLock.lock();
 	if(Scheduler::m_threadState == Scheduler::STATE_RUNNING)
 	{
-		// check if the event has a valid id
-		if(task->getEventId() == 0)
-		{
-			// if not generate one
-			if(m_lastEventId >= 0xFFFFFFFF)
-				m_lastEventId = 0;
+		// keep the pool at most half full so id probing stays short
+		if((m_eventCount + 1) * 2 > m_pool.size())
+			growPool();
 
-			++m_lastEventId;
-			task->setEventId(m_lastEventId);
-		}
-		// insert the eventid in the list of active events
-		m_eventIds.insert(task->getEventId());
+		// an empty wheel can jump straight to the present
+		if(!m_eventCount)
+			m_currentTick = std::max(m_currentTick, getTick(boost::get_system_time(), false));
+
+		task->setEventId(generateEventId());
 
-		// add the event to the queue
-		m_eventList.push(task);
+		int32_t index = task->getEventId() & m_poolMask;
+		EventEntry& entry = m_pool[index];
+		entry.task = task;
+		entry.tick = std::max(getTick(task->getCycle()), m_currentTick);
+		linkEntry(index);
+		++m_eventCount;
 
-		// if the list was empty or this event is the top in the list
-		// we have to signal it
-		do_signal = (task == m_eventList.top());
+		// if the scheduler thread sleeps past this event we have to signal it
+		do_signal = (entry.tick < m_wakeTick);
 
 		#ifdef __DEBUG_SCHEDULER__
 		std::cout << "Scheduler: Added event " << task->getEventId() << std::endl;
@@ -180,25 +246,29 @@ bool Scheduler::stopEvent(uint32_t eventid)
 	std::cout << "Scheduler: Stopping event " << eventid << std::endl;
 	#endif
 
-	//boost::mutex::scoped_lock lockClass(m_eventLock);
 	m_eventLock.lock();
 
-	// search the event id..
-	EventIdSet::iterator it = m_eventIds.find(eventid);
-	if(it == m_eventIds.end())
+	// the event id tells us its pool entry
+	int32_t index = eventid & m_poolMask;
+	SchedulerTask* task = m_pool[index].task;
+	if(!task || task->getEventId() != eventid)
 	{
 		m_eventLock.unlock();
 		return false;
 	}
 
-	m_eventIds.erase(it);
+	unlinkEntry(index);
+	m_pool[index].task = NULL;
+	--m_eventCount;
 	m_eventLock.unlock();
+
+	// the task may hold references that must not be released under our lock
+	delete task;
 	return true;
 }
 
 void Scheduler::stop()
 {
-	//boost::mutex::scoped_lock lockClass(m_eventLock);
 	m_eventLock.lock();
 	#ifdef __DEBUG_SCHEDULER__
 	std::cout << "Stopping Scheduler" << std::endl;
@@ -209,23 +279,234 @@ void Scheduler::stop()
 
 void Scheduler::shutdown()
 {
-	//boost::mutex::scoped_lock lockClass(m_eventLock);
 	#ifdef __DEBUG_SCHEDULER__
 	std::cout << "Shutdown Scheduler" << std::endl;
 	#endif
 
+	std::vector<SchedulerTask*> tasks;
+
 	m_eventLock.lock();
 	m_threadState = Scheduler::STATE_TERMINATED;
 
-	//this list should already be empty
-	while(!m_eventList.empty())
-		m_eventList.pop();
+	//the wheel should already be empty
+	for(std::vector<EventEntry>::iterator it = m_pool.begin(); it != m_pool.end(); ++it)
+	{
+		if(it->task)
+		{
+			tasks.push_back(it->task);
+			it->task = NULL;
+		}
+	}
 
-	m_eventIds.clear();
+	clearWheel();
+	m_eventCount = 0;
 	m_eventLock.unlock();
+	m_eventSignal.notify_one();
+
+	for(std::vector<SchedulerTask*>::iterator it = tasks.begin(); it != tasks.end(); ++it)
+		delete *it;
 }
 
 void Scheduler::join()
 {
 	m_thread.join();
 }
+
+uint64_t Scheduler::getTick(const boost::system_time& time, bool roundUp/* = true*/) const
+{
+	if(time <= m_startTime)
+		return 0;
+
+	// events round up and the clock rounds down, so nothing fires before its time
+	int64_t elapsed = (time - m_startTime).total_microseconds();
+	if(roundUp)
+		elapsed += 999;
+
+	return elapsed / 1000;
+}
+
+boost::system_time Scheduler::getTime(uint64_t tick) const
+{
+	return m_startTime + boost::posix_time::milliseconds((int64_t)tick);
+}
+
+uint32_t Scheduler::generateEventId()
+{
+	// ids keep growing like before, we only skip those whose entry is taken
+	do
+	{
+		if(m_lastEventId >= 0xFFFFFFFF)
+			m_lastEventId = 0;
+
+		++m_lastEventId;
+	}
+	while(m_pool[m_lastEventId & m_poolMask].task);
+	return m_lastEventId;
+}
+
+void Scheduler::growPool()
+{
+	std::vector<EventEntry> oldPool;
+	oldPool.swap(m_pool);
+
+	EventEntry entry;
+	entry.task = NULL;
+	entry.tick = 0;
+	entry.prev = entry.next = entry.slot = -1;
+
+	// live ids differ in their low bits, so they can not collide with a larger mask either
+	m_pool.resize(oldPool.size() * 2, entry);
+	m_poolMask = m_pool.size() - 1;
+	clearWheel();
+
+	for(std::vector<EventEntry>::iterator it = oldPool.begin(); it != oldPool.end(); ++it)
+	{
+		if(!it->task)
+			continue;
+
+		int32_t index = it->task->getEventId() & m_poolMask;
+		m_pool[index].task = it->task;
+		m_pool[index].tick = it->tick;
+		linkEntry(index);
+	}
+}
+
+void Scheduler::clearWheel()
+{
+	for(int32_t i = 0; i < SCHEDULER_SLOTS; ++i)
+		m_slotHead[i] = m_slotTail[i] = -1;
+
+	for(int32_t i = 0; i < SCHEDULER_ROOT_SIZE / 64; ++i)
+		m_rootBits[i] = 0;
+}
+
+void Scheduler::linkEntry(int32_t index)
+{
+	EventEntry& entry = m_pool[index];
+	uint64_t tick = std::max(entry.tick, m_currentTick);
+	uint64_t delta = tick - m_currentTick;
+
+	int32_t slot;
+	if(delta < SCHEDULER_ROOT_SIZE)
+	{
+		slot = tick & SCHEDULER_ROOT_MASK;
+		m_rootBits[slot >> 6] |= 1ULL << (slot & 63);
+	}
+	else
+	{
+		int32_t level = 1;
+		while(level < SCHEDULER_WHEEL_LEVELS - 1 && delta >= (1ULL << levelShift(level + 1)))
+			++level;
+
+		// anything beyond the last level waits in its farthest slot and cascades from there
+		uint64_t limit = 1ULL << (levelShift(level) + SCHEDULER_LEVEL_BITS);
+		if(delta >= limit)
+			tick = m_currentTick + limit - 1;
+
+		slot = levelSlot(level, (tick >> levelShift(level)) & SCHEDULER_LEVEL_MASK);
+	}
+
+	entry.slot = slot;
+	entry.next = -1;
+	entry.prev = m_slotTail[slot];
+	if(entry.prev != -1)
+		m_pool[entry.prev].next = index;
+	else
+		m_slotHead[slot] = index;
+
+	m_slotTail[slot] = index;
+}
+
+void Scheduler::unlinkEntry(int32_t index)
+{
+	EventEntry& entry = m_pool[index];
+	if(entry.prev != -1)
+		m_pool[entry.prev].next = entry.next;
+	else
+		m_slotHead[entry.slot] = entry.next;
+
+	if(entry.next != -1)
+		m_pool[entry.next].prev = entry.prev;
+	else
+		m_slotTail[entry.slot] = entry.prev;
+
+	if(entry.slot < SCHEDULER_ROOT_SIZE && m_slotHead[entry.slot] == -1)
+		m_rootBits[entry.slot >> 6] &= ~(1ULL << (entry.slot & 63));
+
+	entry.prev = entry.next = entry.slot = -1;
+}
+
+void Scheduler::cascade(int32_t level)
+{
+	int32_t slot = levelSlot(level, (m_currentTick >> levelShift(level)) & SCHEDULER_LEVEL_MASK);
+	int32_t index = m_slotHead[slot];
+	m_slotHead[slot] = m_slotTail[slot] = -1;
+
+	// move every entry of this slot down to the level it belongs to now
+	while(index != -1)
+	{
+		int32_t next = m_pool[index].next;
+		linkEntry(index);
+		index = next;
+	}
+}
+
+void Scheduler::advance(uint64_t now)
+{
+	while(m_currentTick <= now)
+	{
+		uint32_t rootIndex = m_currentTick & SCHEDULER_ROOT_MASK;
+		if(rootIndex == 0)
+		{
+			for(int32_t level = 1; level < SCHEDULER_WHEEL_LEVELS; ++level)
+			{
+				cascade(level);
+				if((m_currentTick >> levelShift(level)) & SCHEDULER_LEVEL_MASK)
+					break;
+			}
+		}
+
+		int32_t index = m_slotHead[rootIndex];
+		while(index != -1)
+		{
+			EventEntry& entry = m_pool[index];
+			m_dueTasks.push_back(entry.task);
+			entry.task = NULL;
+			entry.slot = -1;
+			--m_eventCount;
+			index = entry.next;
+		}
+
+		m_slotHead[rootIndex] = m_slotTail[rootIndex] = -1;
+		m_rootBits[rootIndex >> 6] &= ~(1ULL << (rootIndex & 63));
+
+		// skip the empty slots up to the next event or the next cascade
+		uint64_t nextTick = m_currentTick - rootIndex + SCHEDULER_ROOT_SIZE;
+		if(rootIndex + 1 < SCHEDULER_ROOT_SIZE)
+		{
+			int32_t bit = findRootBit(m_rootBits, rootIndex + 1);
+			if(bit != -1)
+				nextTick = m_currentTick - rootIndex + bit;
+		}
+
+		m_currentTick = std::min(nextTick, now + 1);
+	}
+}
+
+uint64_t Scheduler::getNextTick() const
+{
+	if(!m_eventCount)
+		return SCHEDULER_NO_TICK;
+
+	// the next rotation has not been cascaded yet
+	uint32_t rootIndex = m_currentTick & SCHEDULER_ROOT_MASK;
+	if(rootIndex == 0)
+		return m_currentTick;
+
+	int32_t bit = findRootBit(m_rootBits, rootIndex);
+	if(bit != -1)
+		return m_currentTick - rootIndex + bit;
+
+	// nothing left in this rotation, wake up to cascade the next one
+	return m_currentTick - rootIndex + SCHEDULER_ROOT_SIZE;
+}
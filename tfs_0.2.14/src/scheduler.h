@@ -25,26 +25,37 @@
 #include "tasks.h"
 #include <boost/bind.hpp>
 #include <vector>
-#include <queue>
-#include <set>
 
 #define SCHEDULER_MINTICKS 50
 
+// The scheduler keeps its events in a hierarchical timing wheel with a
+// resolution of one millisecond. The first level covers the next 256 ticks,
+// every further level covers 64 slots of the level below it, so five levels
+// span the whole uint32_t delay range.
+#define SCHEDULER_WHEEL_LEVELS 5
+#define SCHEDULER_ROOT_BITS 8
+#define SCHEDULER_LEVEL_BITS 6
+#define SCHEDULER_ROOT_SIZE (1 << SCHEDULER_ROOT_BITS)
+#define SCHEDULER_LEVEL_SIZE (1 << SCHEDULER_LEVEL_BITS)
+#define SCHEDULER_SLOTS (SCHEDULER_ROOT_SIZE + (SCHEDULER_WHEEL_LEVELS - 1) * SCHEDULER_LEVEL_SIZE)
+#define SCHEDULER_INITIAL_POOL 4096
+#define SCHEDULER_TASK_POOL 4096
+
 class SchedulerTask : public Task
 {
 	public:
 		~SchedulerTask() {}
 
+		// events come and go far too often to get each one from the heap,
+		// freed tasks are kept for the next ones
+		static void* operator new(size_t size);
+		static void operator delete(void* p, size_t size);
+
 		void setEventId(uint32_t eventid) {m_eventid = eventid;}
 		uint32_t getEventId() const {return m_eventid;}
 
 		boost::system_time getCycle() const {return m_expiration;}
 
-		bool operator<(const SchedulerTask& other) const
-		{
-			return getCycle() > other.getCycle();
-		}
-
 	protected:
 		SchedulerTask(uint32_t delay, const boost::function<void (void)>& f) : Task(delay, f)
 		{
@@ -64,15 +75,6 @@ inline SchedulerTask* createSchedulerTask(uint32_t delay, const boost::function<
 	return new SchedulerTask(delay, f);
 }
 
-class lessSchedTask : public std::binary_function<SchedulerTask*&, SchedulerTask*&, bool>
-{
-	public:
-		bool operator()(SchedulerTask*& t1, SchedulerTask*& t2)
-		{
-			return (*t1) < (*t2);
-		}
-};
-
 class Scheduler
 {
 	public:
@@ -97,15 +99,50 @@ class Scheduler
 	protected:
 		static void schedulerThread(void* p);
 
+		// Pooled wheel entry, an event lives in slot (eventId & m_poolMask)
+		// so both lookup and removal are constant time
+		struct EventEntry
+		{
+			SchedulerTask* task;
+			uint64_t tick;
+			int32_t prev, next;
+			int32_t slot;
+		};
+
+		uint64_t getTick(const boost::system_time& time, bool roundUp = true) const;
+		boost::system_time getTime(uint64_t tick) const;
+
+		uint32_t generateEventId();
+		void growPool();
+		void clearWheel();
+
+		void linkEntry(int32_t index);
+		void unlinkEntry(int32_t index);
+		void cascade(int32_t level);
+		void advance(uint64_t now);
+		uint64_t getNextTick() const;
+
 		boost::thread m_thread;
 		boost::mutex m_eventLock;
 		boost::condition_variable m_eventSignal;
 
 		uint32_t m_lastEventId;
-		std::priority_queue<SchedulerTask*, std::vector<SchedulerTask*>, lessSchedTask > m_eventList;
-		typedef std::set<uint32_t> EventIdSet;
-		EventIdSet m_eventIds;
+		uint32_t m_eventCount;
 		SchedulerState m_threadState;
+
+		boost::system_time m_startTime;
+		uint64_t m_currentTick;
+		uint64_t m_wakeTick;
+
+		std::vector<EventEntry> m_pool;
+		uint32_t m_poolMask;
+
+		int32_t m_slotHead[SCHEDULER_SLOTS];
+		int32_t m_slotTail[SCHEDULER_SLOTS];
+		uint64_t m_rootBits[SCHEDULER_ROOT_SIZE / 64];
+
+		// filled by advance() and handed to the dispatcher by the scheduler thread
+		std::vector<SchedulerTask*> m_dueTasks;
 };
 
 extern Scheduler g_scheduler;
@@ -30,7 +30,7 @@ extern ConfigManager g_config;
 extern Ban g_bans;
 
 ServiceManager::ServiceManager()
-	: m_io_service(), death_timer(m_io_service), running(false)
+	: m_io_service(), death_timer(m_io_service), m_threadCount(1), running(false)
 {
 	//
 }
@@ -56,11 +56,30 @@ void ServiceManager::die()
 	m_io_service.stop();
 }
 
+void ServiceManager::runIOService()
+{
+	m_io_service.run();
+}
+
 void ServiceManager::run()
 {
 	assert(!running);
 	running = true;
-	m_io_service.run();
+
+	//every connection runs its handlers through its own strand, so any
+	//of these threads may pick them up without two running at once
+	int32_t threads = g_config.getNumber(ConfigManager::NETWORK_THREADS);
+	if(threads <= 0)
+		threads = std::max<int32_t>(1, boost::thread::hardware_concurrency());
+
+	m_threadCount = threads;
+
+	boost::thread_group workers;
+	for(int32_t i = 1; i < threads; ++i)
+		workers.create_thread(boost::bind(&ServiceManager::runIOService, this));
+
+	runIOService();
+	workers.join_all();
 }
 
 void ServiceManager::stop()
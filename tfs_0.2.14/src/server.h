@@ -105,6 +105,8 @@ class ServiceManager : boost::noncopyable
 		void run();
 		void stop();
 
+		uint32_t getThreadCount() const {return m_threadCount;}
+
 		bool okay();
 
 		template <typename ProtocolType>
@@ -115,11 +117,13 @@ class ServiceManager : boost::noncopyable
 
 	protected:
 		void die();
+		void runIOService();
 
 		std::map<uint16_t, ServicePort_ptr> m_acceptors;
 
 		boost::asio::io_service m_io_service;
 		boost::asio::deadline_timer death_timer;
+		uint32_t m_threadCount;
 		bool running;
 };
 
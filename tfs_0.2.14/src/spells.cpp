@@ -116,6 +116,7 @@ void Spells::clear()
 		delete it2->second;
 
 	instants.clear();
+	instantWords.clear();
 }
 
 LuaScriptInterface& Spells::getScriptInterface()
@@ -154,6 +155,12 @@ bool Spells::registerEvent(Event* event, xmlNodePtr p)
 		}
 
 		instants[instant->getWords()] = instant;
+
+		//words only differing in case share a slot, keep the one the old scan over instants preferred
+		InstantSpell*& slot = instantWords[instant->getWords()];
+		if(!slot || instant->getWords() < slot->getWords())
+			slot = instant;
+
 		return true;
 	}
 	else if(rune)
@@ -203,20 +210,7 @@ RuneSpell* Spells::getRuneSpellByName(const std::string& name)
 
 InstantSpell* Spells::getInstantSpell(const std::string& words)
 {
-	InstantSpell* result = NULL;
-	for(InstantsMap::iterator it = instants.begin(); it != instants.end(); ++it)
-	{
-		InstantSpell* instantSpell = it->second;
-
-		const std::string& instantSpellWords = instantSpell->getWords();
-		size_t spellLen = instantSpellWords.length();
-		if(strncasecmp(instantSpellWords.c_str(), words.c_str(), spellLen) == 0)
-		{
-			if(!result || spellLen > result->getWords().length())
-				result = instantSpell;
-		}
-	}
-
+	InstantSpell* result = instantWords.findLongestPrefix(words);
 	if(result)
 	{
 		const std::string& resultWords = result->getWords();
@@ -783,30 +777,25 @@ bool Spell::playerInstantSpellCheck(Player* player, const Position& toPos)
 		else
 		{
 			Tile* tile = g_game.getTile(toPos.x, toPos.y, toPos.z);
+			Tile* transientTile = NULL;
 			if(!tile)
-			{
-				tile = new StaticTile(toPos.x, toPos.y, toPos.z);
-				g_game.setTile(tile);
-			}
+				tile = transientTile = g_game.getMap()->getTransientTile(toPos.x, toPos.y, toPos.z);
 
-			ReturnValue ret;
-			if((ret = Combat::canDoCombat(player, tile, isAggressive)) != RET_NOERROR)
+			ReturnValue ret = Combat::canDoCombat(player, tile, isAggressive);
+			if(ret == RET_NOERROR)
 			{
-				player->sendCancelMessage(ret);
-				g_game.addMagicEffect(player->getPosition(), NM_ME_POFF);
-				return false;
+				if(blockingCreature && tile->getTopVisibleCreature(player) != NULL)
+					ret = RET_NOTENOUGHROOM;
+				else if(blockingSolid && tile->hasProperty(BLOCKSOLID))
+					ret = RET_NOTENOUGHROOM;
 			}
 
-			if(blockingCreature && tile->getTopVisibleCreature(player) != NULL)
-			{
-				player->sendCancelMessage(RET_NOTENOUGHROOM);
-				g_game.addMagicEffect(player->getPosition(), NM_ME_POFF);
-				return false;
-			}
+			if(transientTile)
+				g_game.getMap()->releaseTransientTile(transientTile);
 
-			if(blockingSolid && tile->hasProperty(BLOCKSOLID))
+			if(ret != RET_NOERROR)
 			{
-				player->sendCancelMessage(RET_NOTENOUGHROOM);
+				player->sendCancelMessage(ret);
 				g_game.addMagicEffect(player->getPosition(), NM_ME_POFF);
 				return false;
 			}
@@ -27,6 +27,7 @@
 #include "actions.h"
 #include "talkaction.h"
 #include "baseevents.h"
+#include "wordtrie.h"
 
 class InstantSpell;
 class ConjureSpell;
@@ -65,6 +66,7 @@ class Spells : public BaseEvents
 
 		RunesMap runes;
 		InstantsMap instants;
+		WordTrie<InstantSpell> instantWords;
 
 		friend class CombatSpell;
 		LuaScriptInterface m_scriptInterface;
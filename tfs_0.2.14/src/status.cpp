@@ -56,10 +56,12 @@ enum RequestedInfo_t
 };
 
 std::map<uint32_t, int64_t> ProtocolStatus::ipConnectMap;
+boost::mutex ProtocolStatus::ipConnectLock;
 
 void ProtocolStatus::onRecvFirstMessage(NetworkMessage& msg)
 {
 	uint32_t ip = getIP();
+	bool limited = false;
 	if(ip != 0x0100007F)
 	{
 		std::string ipStr = convertIPToString(ip);
@@ -71,18 +73,28 @@ void ProtocolStatus::onRecvFirstMessage(NetworkMessage& msg)
 				return;
 			}
 
-			std::map<uint32_t, int64_t>::const_iterator it = ipConnectMap.find(ip);
-			if(it != ipConnectMap.end())
+			limited = true;
+		}
+	}
+
+	//status requests come in on every network thread
+	ipConnectLock.lock();
+	if(limited)
+	{
+		std::map<uint32_t, int64_t>::const_iterator it = ipConnectMap.find(ip);
+		if(it != ipConnectMap.end())
+		{
+			if(OTSYS_TIME() < (it->second + g_config.getNumber(ConfigManager::STATUSQUERY_TIMEOUT)))
 			{
-				if(OTSYS_TIME() < (it->second + g_config.getNumber(ConfigManager::STATUSQUERY_TIMEOUT)))
-				{
-					getConnection()->closeConnection();
-					return;
-				}
+				ipConnectLock.unlock();
+				getConnection()->closeConnection();
+				return;
 			}
 		}
 	}
+
 	ipConnectMap[ip] = OTSYS_TIME();
+	ipConnectLock.unlock();
 
 	switch(msg.GetByte())
 	{
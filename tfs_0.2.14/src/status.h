@@ -22,6 +22,7 @@
 #define __OTSERV_STATUS_H
 
 #include <string>
+#include <boost/thread.hpp>
 #include "definitions.h"
 #include "networkmessage.h"
 #include "protocol.h"
@@ -57,6 +58,7 @@ class ProtocolStatus : public Protocol
 
 	protected:
 		static std::map<uint32_t, int64_t> ipConnectMap;
+		static boost::mutex ipConnectLock;
 
 		#ifdef __DEBUG_NET_DETAIL__
 		virtual void deleteProtocolTask();
@@ -51,6 +51,7 @@ void TalkActions::clear()
 		it = wordsMap.begin();
 	}
 
+	wordsIndex.clear();
 	m_scriptInterface.reInitState();
 }
 
@@ -79,6 +80,7 @@ bool TalkActions::registerEvent(Event* event, xmlNodePtr p)
 		return false;
 
 	wordsMap.push_back(std::make_pair(talkAction->getWords(), talkAction));
+	wordsIndex.insert(std::make_pair(talkAction->getWords(), talkAction));
 	return true;
 }
 
@@ -104,20 +106,15 @@ TalkActionResult_t TalkActions::playerSaySpell(Player* player, SpeakClasses type
 	trim_left(str_words, " ");
 	trim_right(str_words, " ");
 
-	TalkActionList::iterator it;
-	for(it = wordsMap.begin(); it != wordsMap.end(); ++it)
-	{
-		if(it->first == str_words)
-		{
-			TalkAction* talkAction = it->second;
-			int32_t ret = talkAction->executeSay(player, str_words, str_param);
-			if(ret == 1)
-				return TALKACTION_CONTINUE;
-			else
-				return TALKACTION_BREAK;
-		}
-	}
-	return TALKACTION_CONTINUE;
+	TalkActionWords::iterator it = wordsIndex.find(str_words);
+	if(it == wordsIndex.end())
+		return TALKACTION_CONTINUE;
+
+	int32_t ret = it->second->executeSay(player, str_words, str_param);
+	if(ret == 1)
+		return TALKACTION_CONTINUE;
+
+	return TALKACTION_BREAK;
 }
 
 TalkAction::TalkAction(LuaScriptInterface* _interface) :
@@ -23,6 +23,7 @@
 #define __TALKACTION_H__
 
 #include <list>
+#include <map>
 #include <string>
 #include "luascript.h"
 #include "baseevents.h"
@@ -55,6 +56,10 @@ class TalkActions : public BaseEvents
 		typedef std::list< std::pair<std::string, TalkAction* > > TalkActionList;
 		TalkActionList wordsMap;
 
+		// first talkaction registered for each words, used for the lookups
+		typedef std::map<std::string, TalkAction*> TalkActionWords;
+		TalkActionWords wordsIndex;
+
 		LuaScriptInterface m_scriptInterface;
 };
 
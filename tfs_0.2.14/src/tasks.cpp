@@ -30,8 +30,27 @@ extern Game g_game;
 
 Dispatcher::Dispatcher()
 {
-	m_taskList.clear();
+	for(uint32_t i = 0; i < DISPATCHER_QUEUE_SIZE; ++i)
+	{
+		m_ring[i].sequence = i;
+		m_ring[i].task = NULL;
+	}
+
+	m_enqueuePos = 0;
+	m_dequeuePos = 0;
+	m_batchPos = 0;
+	m_hasOverflow = false;
+	m_hasPriority = false;
+	m_sleeping = false;
 	m_threadState = STATE_TERMINATED;
+
+	m_pendingTasks = 0;
+	m_peakTasks = 0;
+	m_executedTasks = 0;
+	m_expiredTasks = 0;
+	m_overflowTasks = 0;
+	m_totalLatency = 0;
+	m_maxLatency = 0;
 }
 
 void Dispatcher::start()
@@ -53,61 +72,58 @@ void Dispatcher::dispatcherThread(void* p)
 	std::cout << "Starting Dispatcher" << std::endl;
 	#endif
 
-	OutputMessagePool* outputPool;
-
 	// NOTE: second argument defer_lock is to prevent from immediate locking
 	boost::unique_lock<boost::mutex> taskLockUnique(dispatcher->m_taskLock, boost::defer_lock);
 
 	while(dispatcher->m_threadState != STATE_TERMINATED)
 	{
-		Task* task = NULL;
+		if(!dispatcher->takeBatch(dispatcher->m_batch))
+		{
+			// announce that we are going to sleep, then look once more so
+			// that a producer can not slip a task in unnoticed
+			taskLockUnique.lock();
+			dispatcher->m_sleeping = true;
+			boost::atomic_thread_fence(boost::memory_order_seq_cst);
+			if(dispatcher->m_threadState != STATE_TERMINATED && !dispatcher->m_hasOverflow && !dispatcher->m_hasPriority
+				&& dispatcher->m_ring[dispatcher->m_dequeuePos & (DISPATCHER_QUEUE_SIZE - 1)].sequence.load(boost::memory_order_acquire) != dispatcher->m_dequeuePos + 1)
+			{
+				#ifdef __DEBUG_SCHEDULER__
+				std::cout << "Dispatcher: Waiting for task" << std::endl;
+				#endif
+				dispatcher->m_taskSignal.wait(taskLockUnique);
+			}
 
-		// check if there are tasks waiting
-		taskLockUnique.lock();
+			dispatcher->m_sleeping = false;
+			taskLockUnique.unlock();
 
-		if(dispatcher->m_taskList.empty())
-		{
-			//if the list is empty wait for signal
 			#ifdef __DEBUG_SCHEDULER__
-			std::cout << "Dispatcher: Waiting for task" << std::endl;
+			std::cout << "Dispatcher: Signalled" << std::endl;
 			#endif
-			dispatcher->m_taskSignal.wait(taskLockUnique);
-		}
-
-		#ifdef __DEBUG_SCHEDULER__
-		std::cout << "Dispatcher: Signalled" << std::endl;
-		#endif
-
-		if(!dispatcher->m_taskList.empty() && (dispatcher->m_threadState != STATE_TERMINATED))
-		{
-			// take the first task
-			task = dispatcher->m_taskList.front();
-			dispatcher->m_taskList.pop_front();
+			continue;
 		}
 
-		taskLockUnique.unlock();
-
-		// finally execute the task...
-		if(task)
+		// finally execute the batch...
+		dispatcher->m_batchPos = 0;
+		while(dispatcher->m_batchPos < dispatcher->m_batch.size())
 		{
-			if(!task->hasExpired())
+			// tasks added with push_front jump ahead of everything else
+			if(dispatcher->m_hasPriority)
 			{
-				OutputMessagePool::getInstance()->startExecutionFrame();
-				(*task)();
-
-				outputPool = OutputMessagePool::getInstance();
-				if(outputPool)
-					outputPool->sendAll();
+				std::list<Task*> priorityList;
+				taskLockUnique.lock();
+				priorityList.swap(dispatcher->m_priorityList);
+				dispatcher->m_hasPriority = false;
+				taskLockUnique.unlock();
 
-				g_game.clearSpectatorCache();
+				for(std::list<Task*>::iterator pit = priorityList.begin(); pit != priorityList.end(); ++pit)
+					dispatcher->executeTask(*pit);
 			}
 
-			delete task;
-
-			#ifdef __DEBUG_SCHEDULER__
-			std::cout << "Dispatcher: Executing task" << std::endl;
-			#endif
+			// a task of this batch may shut us down, flush then runs the rest of it
+			dispatcher->executeTask(dispatcher->m_batch[dispatcher->m_batchPos++]);
 		}
+
+		dispatcher->m_batch.clear();
 	}
 
 	#if defined __EXCEPTION_TRACER__
@@ -115,53 +131,178 @@ void Dispatcher::dispatcherThread(void* p)
 	#endif
 }
 
-void Dispatcher::addTask(Task* task, bool push_front /*= false*/)
+bool Dispatcher::takeBatch(std::vector<Task*>& batch)
+{
+	if(m_hasPriority)
+	{
+		boost::mutex::scoped_lock lockClass(m_taskLock);
+		batch.insert(batch.end(), m_priorityList.begin(), m_priorityList.end());
+		m_priorityList.clear();
+		m_hasPriority = false;
+	}
+
+	// the ring holds the oldest tasks, overflow only starts once it is full
+	while(batch.size() < DISPATCHER_BATCH_SIZE)
+	{
+		TaskCell& cell = m_ring[m_dequeuePos & (DISPATCHER_QUEUE_SIZE - 1)];
+		if(cell.sequence.load(boost::memory_order_acquire) != m_dequeuePos + 1)
+			break;
+
+		batch.push_back(cell.task);
+		cell.task = NULL;
+		cell.sequence.store(m_dequeuePos + DISPATCHER_QUEUE_SIZE, boost::memory_order_release);
+		++m_dequeuePos;
+	}
+
+	if(batch.size() < DISPATCHER_BATCH_SIZE && m_hasOverflow)
+	{
+		boost::mutex::scoped_lock lockClass(m_taskLock);
+		batch.insert(batch.end(), m_taskList.begin(), m_taskList.end());
+		m_taskList.clear();
+		m_hasOverflow = false;
+	}
+
+	return !batch.empty();
+}
+
+void Dispatcher::executeTask(Task* task)
 {
-	bool do_signal = false;
+	--m_pendingTasks;
+	boost::system_time now = boost::get_system_time();
+	if(!task->hasExpired())
+	{
+		uint64_t latency = (now - task->getEnqueueTime()).total_microseconds();
+		m_totalLatency.fetch_add(latency, boost::memory_order_relaxed);
+		if(latency > m_maxLatency.load(boost::memory_order_relaxed))
+			m_maxLatency.store(latency, boost::memory_order_relaxed);
 
-	m_taskLock.lock();
-	if(m_threadState == STATE_RUNNING)
+		++m_executedTasks;
+		OutputMessagePool::getInstance()->startExecutionFrame();
+		(*task)();
+
+		OutputMessagePool* outputPool = OutputMessagePool::getInstance();
+		if(outputPool)
+			outputPool->sendAll();
+
+		g_game.recycleSpectatorCache();
+	}
+	else
+		++m_expiredTasks;
+
+	delete task;
+
+	#ifdef __DEBUG_SCHEDULER__
+	std::cout << "Dispatcher: Executing task" << std::endl;
+	#endif
+}
+
+uint64_t Dispatcher::getAverageLatency() const
+{
+	uint64_t executed = m_executedTasks;
+	if(!executed)
+		return 0;
+
+	return m_totalLatency / executed;
+}
+
+bool Dispatcher::pushRing(Task* task)
+{
+	uint32_t pos = m_enqueuePos.load(boost::memory_order_relaxed);
+	while(true)
 	{
-		do_signal = m_taskList.empty();
-		if(push_front)
-			m_taskList.push_front(task);
+		TaskCell& cell = m_ring[pos & (DISPATCHER_QUEUE_SIZE - 1)];
+		int32_t diff = (int32_t)(cell.sequence.load(boost::memory_order_acquire) - pos);
+		if(diff == 0)
+		{
+			if(m_enqueuePos.compare_exchange_weak(pos, pos + 1, boost::memory_order_relaxed))
+			{
+				cell.task = task;
+				cell.sequence.store(pos + 1, boost::memory_order_release);
+				return true;
+			}
+		}
+		else if(diff < 0)
+			return false; // full
 		else
-			m_taskList.push_back(task);
+			pos = m_enqueuePos.load(boost::memory_order_relaxed);
+	}
+}
 
-		#ifdef __DEBUG_SCHEDULER__
-		std::cout << "Dispatcher: Added task" << std::endl;
-		#endif
+void Dispatcher::pushLocked(Task* task, bool push_front)
+{
+	boost::mutex::scoped_lock lockClass(m_taskLock);
+	if(push_front)
+	{
+		m_priorityList.push_front(task);
+		m_hasPriority = true;
 	}
 	else
+	{
+		// once we overflowed everything goes here until the dispatcher caught up,
+		// so tasks of one producer keep their order
+		m_taskList.push_back(task);
+		m_hasOverflow = true;
+		++m_overflowTasks;
+	}
+}
+
+void Dispatcher::notify()
+{
+	boost::atomic_thread_fence(boost::memory_order_seq_cst);
+	if(!m_sleeping)
+		return;
+
+	m_taskLock.lock();
+	m_taskLock.unlock();
+	m_taskSignal.notify_one();
+}
+
+void Dispatcher::addTask(Task* task, bool push_front /*= false*/)
+{
+	if(m_threadState != STATE_RUNNING)
 	{
 		#ifdef __DEBUG_SCHEDULER__
 		std::cout << "Error: [Dispatcher::addTask] Dispatcher thread is terminated." << std::endl;
 		#endif
 		delete task;
-		task = NULL;
+		return;
 	}
 
-	m_taskLock.unlock();
+	task->setEnqueueTime(boost::get_system_time());
+	uint32_t pending = ++m_pendingTasks;
+	if(pending > m_peakTasks.load(boost::memory_order_relaxed))
+		m_peakTasks.store(pending, boost::memory_order_relaxed);
+
+	if(push_front || m_hasOverflow || !pushRing(task))
+		pushLocked(task, push_front);
 
-	// send a signal if the list was empty
-	if(do_signal)
-		m_taskSignal.notify_one();
+	#ifdef __DEBUG_SCHEDULER__
+	std::cout << "Dispatcher: Added task" << std::endl;
+	#endif
+	notify();
 }
 
 void Dispatcher::flush()
 {
-	Task* task = NULL;
-	while(!m_taskList.empty())
+	// we are called by a task of the current batch, what follows it runs
+	// first so that everything keeps its order
+	while(m_batchPos < m_batch.size())
 	{
-		task = m_taskList.front();
-		m_taskList.pop_front();
-		(*task)();
-		delete task;
-		OutputMessagePool* outputPool = OutputMessagePool::getInstance();
-		if(outputPool)
-			outputPool->sendAll();
+		Task* task = m_batch[m_batchPos++];
+		task->setDontExpire();
+		executeTask(task);
+	}
+
+	std::vector<Task*> batch;
+	while(takeBatch(batch))
+	{
+		for(std::vector<Task*>::iterator it = batch.begin(); it != batch.end(); ++it)
+		{
+			(*it)->setDontExpire();
+			executeTask(*it);
+		}
 
-		g_game.clearSpectatorCache();
+		batch.clear();
 	}
 	#ifdef __DEBUG_SCHEDULER__
 	std::cout << "Flushing Dispatcher" << std::endl;
@@ -170,9 +311,7 @@ void Dispatcher::flush()
 
 void Dispatcher::stop()
 {
-	m_taskLock.lock();
 	m_threadState = STATE_CLOSING;
-	m_taskLock.unlock();
 	#ifdef __DEBUG_SCHEDULER__
 	std::cout << "Stopping Dispatcher" << std::endl;
 	#endif
@@ -180,10 +319,8 @@ void Dispatcher::stop()
 
 void Dispatcher::shutdown()
 {
-	m_taskLock.lock();
 	m_threadState = STATE_TERMINATED;
 	flush();
-	m_taskLock.unlock();
 	#ifdef __DEBUG_SCHEDULER__
 	std::cout << "Shutdown Dispatcher" << std::endl;
 	#endif
@@ -24,8 +24,14 @@
 
 #include <boost/function.hpp>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <list>
+#include <vector>
 
 const int DISPATCHER_TASK_EXPIRATION = 2000;
+// must be a power of two
+const uint32_t DISPATCHER_QUEUE_SIZE = 4096;
+const uint32_t DISPATCHER_BATCH_SIZE = 256;
 
 class Task
 {
@@ -38,7 +44,8 @@ class Task
 		Task(const boost::function<void (void)>& f)
 			: m_expiration(boost::date_time::not_a_date_time), m_f(f) {}
 
-		~Task() {}
+		// virtual, so scheduler tasks go back to their own free list
+		virtual ~Task() {}
 
 		void operator()()
 		{
@@ -58,11 +65,15 @@ class Task
 			return m_expiration < boost::get_system_time();
 		}
 
+		void setEnqueueTime(const boost::system_time& time) {m_enqueueTime = time;}
+		const boost::system_time& getEnqueueTime() const {return m_enqueueTime;}
+
 	protected:
 		// Expiration has another meaning for scheduler tasks,
 		// then it is the time the task should be added to the
 		// dispatcher
 		boost::system_time m_expiration;
+		boost::system_time m_enqueueTime;
 		boost::function<void (void)> m_f;
 };
 
@@ -96,17 +107,62 @@ class Dispatcher
 		void shutdown();
 		void join();
 
+		uint32_t getPendingTaskCount() const {return m_pendingTasks;}
+		uint32_t getPeakTaskCount() const {return m_peakTasks;}
+		uint64_t getExecutedTaskCount() const {return m_executedTasks;}
+		uint64_t getExpiredTaskCount() const {return m_expiredTasks;}
+		uint64_t getOverflowTaskCount() const {return m_overflowTasks;}
+		// enqueue to execute latency in microseconds
+		uint64_t getAverageLatency() const;
+		uint64_t getMaxLatency() const {return m_maxLatency;}
+
 	protected:
 		static void dispatcherThread(void* p);
 
+		// bounded multi-producer/single-consumer ring, every cell carries a
+		// sequence number that tells producers and the consumer whose turn it is
+		struct TaskCell
+		{
+			boost::atomic<uint32_t> sequence;
+			Task* task;
+		};
+
+		bool pushRing(Task* task);
+		void pushLocked(Task* task, bool push_front);
+		void notify();
+
+		bool takeBatch(std::vector<Task*>& batch);
+		void executeTask(Task* task);
 		void flush();
 
 		boost::thread m_thread;
 		boost::mutex m_taskLock;
 		boost::condition_variable m_taskSignal;
 
+		TaskCell m_ring[DISPATCHER_QUEUE_SIZE];
+		boost::atomic<uint32_t> m_enqueuePos;
+		uint32_t m_dequeuePos;
+
+		// overflow and push_front tasks, guarded by m_taskLock
 		std::list<Task*> m_taskList;
-		DispatcherState m_threadState;
+		std::list<Task*> m_priorityList;
+		boost::atomic<bool> m_hasOverflow;
+		boost::atomic<bool> m_hasPriority;
+		boost::atomic<bool> m_sleeping;
+
+		// only touched by the dispatcher thread
+		std::vector<Task*> m_batch;
+		size_t m_batchPos;
+
+		boost::atomic<DispatcherState> m_threadState;
+
+		boost::atomic<uint32_t> m_pendingTasks;
+		boost::atomic<uint32_t> m_peakTasks;
+		boost::atomic<uint64_t> m_executedTasks;
+		boost::atomic<uint64_t> m_expiredTasks;
+		boost::atomic<uint64_t> m_overflowTasks;
+		boost::atomic<uint64_t> m_totalLatency;
+		boost::atomic<uint64_t> m_maxLatency;
 };
 
 extern Dispatcher g_dispatcher;
@@ -39,6 +39,7 @@
 extern Game g_game;
 extern MoveEvents* g_moveEvents;
 
+uint32_t Tile::versionCounter = 0;
 StaticTile real_null_tile(0xFFFF, 0xFFFF, 0xFFFF);
 Tile& Tile::null_tile = real_null_tile;
 
@@ -500,7 +501,10 @@ void Tile::moveCreature(Creature* creature, Cylinder* toCylinder, bool forceTele
 			creature->setDirection(WEST);
 	}
 
-	//send to client
+	//send to client, spectators share the step packet
+	NetworkMessage& stepPacket = ProtocolGame::getBroadcastPacket();
+	ProtocolGame::AddCreatureStep(stepPacket, oldPos, newPos);
+
 	uint32_t i = 0;
 	for(it = list.begin(); it != list.end(); ++it)
 	{
@@ -508,7 +512,7 @@ void Tile::moveCreature(Creature* creature, Cylinder* toCylinder, bool forceTele
 		{
 			//Use the correct stackpos
 			if(!creature->isInGhostMode() || tmpPlayer->isAccessPlayer())
-				tmpPlayer->sendCreatureMove(creature, newTile, newPos, this, oldPos, oldStackPosVector[i], teleport);
+				tmpPlayer->sendCreatureMove(creature, newTile, newPos, this, oldPos, oldStackPosVector[i], teleport, &stepPacket);
 
 			++i;
 		}
@@ -552,7 +556,7 @@ ReturnValue Tile::__queryAdd(int32_t index, const Thing* thing, uint32_t count,
 
 			if(monster->canPushCreatures() && !monster->isSummon())
 			{
-				if(creatures)
+				if(creatures && !hasBitSet(FLAG_IGNOREBLOCKCREATURE, flags))
 				{
 					Creature* creature;
 					for(uint32_t i = 0; i < creatures->size(); ++i)
@@ -570,7 +574,7 @@ ReturnValue Tile::__queryAdd(int32_t index, const Thing* thing, uint32_t count,
 					}
 				}
 			}
-			else if(creatures && !creatures->empty())
+			else if(creatures && !creatures->empty() && !hasBitSet(FLAG_IGNOREBLOCKCREATURE, flags))
 			{
 				for(CreatureVector::const_iterator cit = creatures->begin(); cit != creatures->end(); ++cit)
 				{
@@ -915,7 +919,7 @@ void Tile::__addThing(int32_t index, Thing* thing)
 	Creature* creature = thing->getCreature();
 	if(creature)
 	{
-		g_game.clearSpectatorCache();
+		g_game.invalidateSpectatorCache(this);
 		creature->setParent(this);
 		CreatureVector* creatures = makeCreatures();
 		creatures->insert(creatures->begin(), creature);
@@ -945,6 +949,9 @@ void Tile::__addThing(int32_t index, Thing* thing)
 			{
 				ground = item;
 				++thingCount;
+				if(qt_node)
+					qt_node->touch();
+
 				onAddTileItem(item);
 			}
 			else
@@ -1206,7 +1213,7 @@ void Tile::__removeThing(Thing* thing, uint32_t count)
 				return;
 			}
 
-			g_game.clearSpectatorCache();
+			g_game.invalidateSpectatorCache(this);
 			creatures->erase(it);
 			--thingCount;
 			return;
@@ -1257,6 +1264,9 @@ void Tile::__removeThing(Thing* thing, uint32_t count)
 			ground->setParent(NULL);
 			ground = NULL;
 			--thingCount;
+			if(qt_node)
+				qt_node->touch();
+
 			onRemoveTileItem(list, oldStackPosVector, item);
 			return;
 		}
@@ -1610,7 +1620,7 @@ void Tile::__internalAddThing(uint32_t index, Thing* thing)
 	Creature* creature = thing->getCreature();
 	if(creature)
 	{
-		g_game.clearSpectatorCache();
+		g_game.invalidateSpectatorCache(this);
 		CreatureVector* creatures = makeCreatures();
 		creatures->insert(creatures->begin(), creature);
 		++thingCount;
@@ -1665,8 +1675,26 @@ void Tile::__internalAddThing(uint32_t index, Thing* thing)
 	}
 }
 
+static bool affectsPathing(const Item* item)
+{
+	//what Tile::__queryAdd, the walk costs and the sight to a followed creature look at,
+	//creatures are checked when they step
+	return item->isGroundTile() || item->hasProperty(BLOCKSOLID) || item->hasProperty(BLOCKPATH) ||
+		item->hasProperty(BLOCKPROJECTILE) ||
+		item->hasProperty(IMMOVABLEBLOCKSOLID) || item->hasProperty(IMMOVABLEBLOCKPATH) ||
+		item->hasProperty(IMMOVABLENOFIELDBLOCKPATH) || item->hasProperty(NOFIELDBLOCKPATH) ||
+		item->getTeleport() || item->getMagicField() || item->floorChangeDown() ||
+		item->floorChangeNorth() || item->floorChangeSouth() || item->floorChangeEast() ||
+		item->floorChangeWest() || item->floorChangeSouthAlt() || item->floorChangeEastAlt();
+}
+
 void Tile::updateTileFlags(Item* item, bool removing)
 {
+	//every item change on the tile passes through here
+	m_version = ++versionCounter;
+	if(qt_node && affectsPathing(item))
+		qt_node->touch();
+
 	if(!removing)
 	{
 		//!removing is adding an item to the tile
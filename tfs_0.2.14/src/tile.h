@@ -38,9 +38,8 @@ class QTreeLeafNode;
 class BedItem;
 
 typedef std::vector<Creature*> CreatureVector;
-typedef std::list<Creature*> SpectatorVec;
+typedef std::vector<Creature*> SpectatorVec;
 typedef std::list<Player*> PlayerList;
-typedef std::map<Position, boost::shared_ptr<SpectatorVec> > SpectatorCache;
 typedef std::vector<Item*> ItemVector;
 
 enum tileflags_t
@@ -267,6 +266,12 @@ class Tile : public Cylinder
 
 		virtual bool isRemoved() const {return false;}
 
+		// a tile without ground, things or flags, nothing on the map needs it
+		bool isEmpty() const {return !ground && !thingCount && !m_flags;}
+
+		// changes whenever an item on the tile does, unique across all tiles
+		uint32_t getVersion() const {return m_version;}
+
 	private:
 		void onAddTileItem(Item* item);
 		void onUpdateTileItem(Item* oldItem, const ItemType& oldType, Item* newItem, const ItemType& newType);
@@ -287,6 +292,9 @@ class Tile : public Cylinder
 		uint32_t thingCount;
 		Position tilePos;
 		uint32_t m_flags;
+		uint32_t m_version;
+
+		static uint32_t versionCounter;
 };
 
 // Used for walkable tiles, where there is high likeliness of
@@ -335,7 +343,8 @@ inline Tile::Tile(uint16_t x, uint16_t y, uint16_t z) :
 	ground(NULL),
 	thingCount(0),
 	tilePos(x, y, z),
-	m_flags(0)
+	m_flags(0),
+	m_version(++versionCounter)
 {
 }
 
@@ -402,6 +411,8 @@ inline StaticTile::StaticTile(uint16_t x, uint16_t y, uint16_t z) :
 
 inline StaticTile::~StaticTile()
 {
+	delete items;
+	delete creatures;
 }
 
 inline DynamicTile::DynamicTile(uint16_t x, uint16_t y, uint16_t z) :
@@ -0,0 +1,102 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Case insensitive prefix tree for spell words
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_WORDTRIE_H__
+#define __OTSERV_WORDTRIE_H__
+
+#include <string>
+#include <vector>
+#include <ctype.h>
+
+#include "definitions.h"
+
+// Finds the longest key that starts a text, ignoring case, with a single
+// walk over the text no matter how many keys there are.
+template<class T> class WordTrie
+{
+	public:
+		WordTrie() {clear();}
+
+		void clear()
+		{
+			nodes.clear();
+			nodes.push_back(Node(0));
+		}
+
+		// Keys that only differ in case share the same slot
+		T*& operator[](const std::string& key)
+		{
+			uint32_t index = 0;
+			for(std::string::const_iterator it = key.begin(); it != key.end(); ++it)
+			{
+				char c = tolower((uint8_t)*it);
+				uint32_t child = findChild(index, c);
+				if(!child)
+				{
+					child = nodes.size();
+					nodes.push_back(Node(c));
+					nodes[child].sibling = nodes[index].child;
+					nodes[index].child = child;
+				}
+				index = child;
+			}
+			return nodes[index].value;
+		}
+
+		T* findLongestPrefix(const std::string& text) const
+		{
+			T* result = nodes[0].value;
+			uint32_t index = 0;
+			for(std::string::const_iterator it = text.begin(); it != text.end(); ++it)
+			{
+				if(!(index = findChild(index, tolower((uint8_t)*it))))
+					break;
+
+				if(nodes[index].value)
+					result = nodes[index].value;
+			}
+			return result;
+		}
+
+	protected:
+		struct Node
+		{
+			Node(char _c) : c(_c), child(0), sibling(0), value(NULL) {}
+
+			char c;
+			uint32_t child;
+			uint32_t sibling;
+			T* value;
+		};
+
+		uint32_t findChild(uint32_t index, char c) const
+		{
+			for(uint32_t child = nodes[index].child; child; child = nodes[child].sibling)
+			{
+				if(nodes[child].c == c)
+					return child;
+			}
+			return 0;
+		}
+
+		std::vector<Node> nodes;
+};
+
+#endif
@@ -0,0 +1,66 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+//
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+#include "otpch.h"
+
+#include <boost/bind.hpp>
+
+#include "workerpool.h"
+
+void WorkerPool::start(int32_t threads, const boost::function<void (void)>& init/* = boost::function<void (void)>()*/)
+{
+	if(threads <= 0)
+		threads = std::max<int32_t>(1, boost::thread::hardware_concurrency());
+
+	m_threadCount = threads;
+	m_init = init;
+	m_work.reset(new boost::asio::io_service::work(m_service));
+	for(int32_t i = 0; i < threads; ++i)
+		m_threads.create_thread(boost::bind(&WorkerPool::run, this));
+}
+
+void WorkerPool::run()
+{
+	if(m_init)
+		m_init();
+
+	m_service.run();
+}
+
+void WorkerPool::shutdown()
+{
+	m_work.reset();
+}
+
+void WorkerPool::join()
+{
+	m_threads.join_all();
+}
+
+void WorkerPool::addJob(const boost::function<void (void)>& f)
+{
+	++m_pendingJobs;
+	m_service.post(boost::bind(&WorkerPool::runJob, this, f));
+}
+
+void WorkerPool::runJob(const boost::function<void (void)>& f)
+{
+	--m_pendingJobs;
+	f();
+}
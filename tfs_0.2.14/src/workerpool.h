@@ -0,0 +1,62 @@
+//////////////////////////////////////////////////////////////////////
+// OpenTibia - an opensource roleplaying game
+//////////////////////////////////////////////////////////////////////
+// Threads that run blocking jobs away from the dispatcher
+//////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef __OTSERV_WORKERPOOL_H__
+#define __OTSERV_WORKERPOOL_H__
+
+#include "definitions.h"
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/detail/atomic_count.hpp>
+
+// Jobs are taken by whichever thread is free, in no particular order; a
+// job that has to touch the game hands its result to the dispatcher.
+class WorkerPool
+{
+	public:
+		WorkerPool() : m_pendingJobs(0), m_threadCount(0) {}
+		~WorkerPool() {}
+
+		// threads <= 0 starts one per core, each runs init before its first job
+		void start(int32_t threads, const boost::function<void (void)>& init = boost::function<void (void)>());
+		// runs what is queued, then lets the threads exit
+		void shutdown();
+		void join();
+
+		void addJob(const boost::function<void (void)>& f);
+
+		int32_t getThreadCount() const {return m_threadCount;}
+		long getPendingJobCount() const {return m_pendingJobs;}
+
+	protected:
+		void run();
+		void runJob(const boost::function<void (void)>& f);
+
+		boost::function<void (void)> m_init;
+		boost::asio::io_service m_service;
+		boost::scoped_ptr<boost::asio::io_service::work> m_work;
+		boost::thread_group m_threads;
+		boost::detail::atomic_count m_pendingJobs;
+		int32_t m_threadCount;
+};
+
+#endif